@@ -193,6 +193,14 @@ struct rl_msg_layout rl_ker_numtables[] = {
         {
             .copylen = sizeof(struct rl_kmsg_ipcp_sched_pfifo),
         },
+    [RLITE_KER_MEMTRACK_STATS_REQ] =
+        {
+            .copylen = sizeof(struct rl_msg_base),
+        },
+    [RLITE_KER_MEMTRACK_STATS_RESP] =
+        {
+            .copylen = sizeof(struct rl_kmsg_memtrack_stats_resp),
+        },
     [RLITE_KER_MSG_MAX] =
         {
             .copylen = 0,
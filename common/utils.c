@@ -45,6 +45,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <limits.h>
 
 #define COMMON_ALLOC(_sz, _unused) rl_alloc(_sz, RL_MT_UTILS)
 #define COMMON_FREE(_p) rl_free(_p, RL_MT_UTILS)
@@ -299,6 +300,63 @@ rl_msg_serlen(struct rl_msg_layout *numtables, size_t num_entries,
 }
 COMMON_EXPORT(rl_msg_serlen);
 
+/* Compute the length of a serialized message, given its first serbuf_len
+ * bytes. Returns the length of the whole message (possibly larger than
+ * serbuf_len, and saturated to INT_MAX), 0 if more bytes are needed to
+ * compute it, or -1 if the message type is invalid. */
+int
+rl_msg_serbuf_len(struct rl_msg_layout *numtables, size_t num_entries,
+                  const void *serbuf, unsigned int serbuf_len)
+{
+    const struct rl_msg_base *bmsg = RLITE_MB(serbuf);
+    unsigned long long ofs;
+    unsigned int nfields;
+    uint32_t len32, num32;
+    uint16_t len16;
+    unsigned int i;
+
+    if (serbuf_len < sizeof(bmsg->hdr)) {
+        return 0;
+    }
+
+    if (bmsg->hdr.msg_type >= num_entries) {
+        PE("Invalid numtables access [msg_type=%u]\n", bmsg->hdr.msg_type);
+        return -1;
+    }
+
+    /* Each name is serialized as four strings. */
+    ofs     = numtables[bmsg->hdr.msg_type].copylen;
+    nfields = 4 * numtables[bmsg->hdr.msg_type].names +
+              numtables[bmsg->hdr.msg_type].strings;
+    for (i = 0; i < nfields; i++) {
+        if (ofs + sizeof(len16) > serbuf_len) {
+            return 0;
+        }
+        memcpy(&len16, serbuf + ofs, sizeof(len16));
+        ofs += sizeof(len16) + len16;
+    }
+
+    for (i = 0; i < numtables[bmsg->hdr.msg_type].buffers; i++) {
+        if (ofs + sizeof(len32) > serbuf_len) {
+            return 0;
+        }
+        memcpy(&len32, serbuf + ofs, sizeof(len32));
+        ofs += sizeof(len32) + len32;
+    }
+
+    for (i = 0; i < numtables[bmsg->hdr.msg_type].arrays; i++) {
+        if (ofs + 2 * sizeof(len32) > serbuf_len) {
+            return 0;
+        }
+        memcpy(&len32, serbuf + ofs, sizeof(len32));
+        memcpy(&num32, serbuf + ofs + sizeof(len32), sizeof(num32));
+        ofs += 2 * sizeof(len32) + (unsigned long long)len32 * num32;
+    }
+
+    return ofs > INT_MAX ? INT_MAX : (int)ofs;
+}
+COMMON_EXPORT(rl_msg_serbuf_len);
+
 /* Serialize msg into serbuf. */
 unsigned int
 serialize_rlite_msg(struct rl_msg_layout *numtables, size_t num_entries,
@@ -207,6 +207,40 @@ int rina_flow_alloc(const char *dif_name, const char *local_appl,
  */
 int rina_flow_alloc_wait(int wfd);
 
+/*
+ * Issue a flow allocation request like rina_flow_alloc() with RINA_F_NOWAIT,
+ * but using the control file descriptor @fd (previously obtained with
+ * rina_open()), rather than opening a new control file descriptor for each
+ * request. Many requests can be pending on @fd at the same time, so that
+ * applications that need to set up a large number of flows can pipeline
+ * the requests, paying a single write() per flow on the control path.
+ * The @fd should be dedicated to asynchronous flow allocations, as it is
+ * also used to report completions (see rina_flow_alloc_complete()).
+ *
+ * On success, it returns a positive request identifier, that will be
+ * reported back by rina_flow_alloc_complete() when the request completes.
+ * On error -1 is returned, with the errno code properly set.
+ */
+int rina_flow_alloc_async(int fd, const char *dif_name, const char *local_appl,
+                          const char *remote_appl,
+                          const struct rina_flow_spec *flowspec);
+
+/*
+ * Collect the completion of a flow allocation request previously issued on
+ * the control file descriptor @fd by means of rina_flow_alloc_async().
+ * Completions are reported in the order they happen, which is not
+ * necessarily the order of the requests. The @fd can be used with poll(),
+ * select() and similar to wait for completions to be ready.
+ *
+ * On success, the identifier of the completed request is returned, and the
+ * flow I/O file descriptor is stored in @flowfd. If the flow allocation was
+ * rejected or failed, -1 is stored in @flowfd, but the request identifier
+ * is still returned. On error -1 is returned, with the errno code properly
+ * set; in particular, if @fd is non-blocking and no completions are
+ * ready, errno is set to EAGAIN.
+ */
+int rina_flow_alloc_complete(int fd, int *flowfd);
+
 /*
  * Fills in the provided @spec with an unrelable best-effort QoS.
  */
@@ -151,7 +151,22 @@ struct rl_msg_ipcp {
 /* The control device wants to be notified about creation, removal or
  * update of IPCPs. */
 #define RL_F_IPCPS (1 << 0)
-#define RL_F_ALL RL_F_IPCPS
+/* A read() on the control device returns as many pending messages as
+ * they fit in the user buffer, each one as a record made of a
+ * struct rl_msg_rec_hdr followed by the serialized message. */
+#define RL_F_BATCH (1 << 1)
+#define RL_F_ALL (RL_F_IPCPS | RL_F_BATCH)
+
+struct rl_msg_rec_hdr {
+    uint32_t len; /* length of the serialized message */
+    uint32_t pad;
+};
+
+/* Records are padded to a multiple of RL_MSG_REC_ALIGN bytes. */
+#define RL_MSG_REC_ALIGN 8
+#define RL_MSG_REC_SIZE(_len)                                                  \
+    (sizeof(struct rl_msg_rec_hdr) +                                           \
+     (((_len) + RL_MSG_REC_ALIGN - 1) & ~(RL_MSG_REC_ALIGN - 1)))
 
 /* Bind the flow identified by port_id to
  * this rl_io device. */
@@ -170,6 +185,9 @@ struct rl_ioctl_info {
 #define RLITE_IOCTL_FLOW_BIND _IOW(0xAF, 0x00, struct rl_ioctl_info)
 #define RLITE_IOCTL_CHFLAGS _IOW(0xAF, 0x01, uint64_t)
 #define RLITE_IOCTL_MSS_GET _IOW(0xAF, 0x02, uint32_t *)
+/* Microseconds a blocking read() busy-polls the receive queue before
+ * going to sleep (0 to disable). */
+#define RLITE_IOCTL_BUSY_POLL _IOW(0xAF, 0x03, uint32_t)
 
 #define RLITE_MGMT_HDR_T_OUT_LOCAL_PORT 1
 #define RLITE_MGMT_HDR_T_OUT_DST_ADDR 2
@@ -272,6 +290,16 @@ rina_flow_spec_best_effort(struct rina_flow_spec *spec)
            !spec->max_jitter && !spec->in_order_delivery;
 }
 
+/* Log2 histogram of latencies, collected by the kernel datapath when the
+ * latency_stats parameter of the rlite module is set. Bucket 0 counts
+ * latencies below 1 us, while bucket i > 0 counts latencies in
+ * [2^(i-1), 2^i) us. The last bucket also counts larger latencies. */
+#define RL_LAT_BUCKETS 24
+
+struct rl_lat_hist {
+    uint64_t buckets[RL_LAT_BUCKETS];
+};
+
 struct rl_flow_stats {
     /* Statistics for an rl_io device. */
     uint64_t tx_pkt;
@@ -280,6 +308,15 @@ struct rl_flow_stats {
     uint64_t rx_byte;
     uint64_t rx_overrun_pkt;
     uint64_t rx_overrun_byte;
+    /* Wakeups of the reader. Compared to rx_pkt, this tells how well
+     * wakeups are being coalesced. */
+    uint64_t rx_wakeups;
+
+    /* From write() to the release of the PDU by DTP (traffic shaping and
+     * closed window queue). */
+    struct rl_lat_hist tx_lat;
+    /* Time spent in the userspace receive queue, until read(). */
+    struct rl_lat_hist rx_lat;
 };
 
 /* RMT statistics. All counters must be 64 bits wide. */
@@ -293,6 +330,10 @@ struct rl_rmt_stats {
     uint64_t ttl_drop;
     uint64_t noflow_drop;
     uint64_t other_drop;
+    /* PDUs transmitted with the compact PCI, and the header bytes saved
+     * w.r.t. the full PCI. */
+    uint64_t pci_compact_pkt;
+    uint64_t pci_saved_byte;
 };
 
 /* IPCP statistics. All counters must be 64 bits wide. */
@@ -309,8 +350,28 @@ struct rl_ipcp_stats {
     uint64_t rtx_byte;
 
     struct rl_rmt_stats rmt;
+
+    /* From write() (or from the reception of a PDU to be forwarded) to the
+     * handoff to the lower flow. */
+    struct rl_lat_hist tx_lat;
+    /* Time spent in the PDU scheduler queues. */
+    struct rl_lat_hist rmtq_lat;
+    /* Time spent in the userspace receive queues, until read(). */
+    struct rl_lat_hist rx_lat;
 } __attribute__((aligned(64)));
 
+/* Memory usage of a memtrack category, reported by the kernel and by the
+ * uipcps daemon. */
+#define RL_MEMTRACK_NAMSIZ 16
+#define RL_MEMTRACK_MAX_TYPES 24
+
+struct rl_memtrack_stats {
+    char name[RL_MEMTRACK_NAMSIZ];
+    uint64_t count;     /* live objects */
+    uint64_t bytes;     /* live bytes */
+    uint64_t bytes_hwm; /* high-water mark of live bytes */
+};
+
 /* DTP state exported to userspace. */
 struct rl_flow_dtp {
     /* Sender state. */
@@ -350,10 +411,8 @@ struct rl_flow_dtp {
 #define RL_VERB_DBG 4
 #define RL_VERB_VERY 5
 
-/* Memtrack machinery, enabled in debug mode. */
-#ifdef RL_DEBUG
-#define RL_MEMTRACK
-#endif
+/* The memtrack machinery (RL_MEMTRACK) is enabled by the build system,
+ * unless configure is run with --no-memtrack. */
 
 #ifdef __cplusplus
 }
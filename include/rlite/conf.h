@@ -87,6 +87,10 @@ int rl_conf_ipcp_get_stats(rl_ipcp_id_t ipcp_id, struct rl_ipcp_stats *stats);
 int rl_conf_memtrack_dump(void);
 #endif
 
+/* Get the memory usage of the kernel, for each memtrack category. Returns
+ * the number of entries written to @stats, or -1 on error. */
+int rl_conf_memtrack_stats(struct rl_memtrack_stats *stats, unsigned int max);
+
 #ifdef __cplusplus
 }
 #endif
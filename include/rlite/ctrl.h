@@ -39,6 +39,32 @@ int rl_write_msg(int rfd, const struct rl_msg_base *msg, int quiet);
 
 struct rl_msg_base *rl_read_next_msg(int rfd, int quiet);
 
+/* Batched reader for control devices in RL_F_BATCH mode: a single read()
+ * returns many messages, which are then deserialized one at a time into
+ * a message buffer reused across calls. */
+#define RL_MSG_BATCH_SIZE (1 << 14)
+
+struct rl_msg_batch {
+    char *buf;
+    unsigned int len; /* bytes returned by the last read */
+    unsigned int ofs; /* next record to deserialize */
+    struct rl_msg_base *msg;
+    unsigned int msg_size;
+    int msg_valid;
+};
+
+int rl_msg_batch_init(struct rl_msg_batch *b);
+
+void rl_msg_batch_fini(struct rl_msg_batch *b);
+
+/* Read the next batch of messages from rfd. Returns the number of bytes
+ * read, or -1 on error (e.g. EAGAIN on non-blocking devices). */
+int rl_msg_batch_read(int rfd, struct rl_msg_batch *b);
+
+/* Returns the next message of the current batch, or NULL if there are
+ * no more. The message is only valid until the next call. */
+struct rl_msg_base *rl_msg_batch_next(struct rl_msg_batch *b);
+
 int rl_fa_req_fill(struct rl_kmsg_fa_req *req, uint32_t event_id,
                    const char *dif_name, const char *local_appl,
                    const char *remote_appl,
@@ -67,6 +67,8 @@ enum {
     RLITE_KER_IPCP_CONFIG_GET_RESP,  /* 35 */
     RLITE_KER_IPCP_SCHED_WRR,        /* 36 */
     RLITE_KER_IPCP_SCHED_PFIFO,      /* 37 */
+    RLITE_KER_MEMTRACK_STATS_REQ,    /* 38 */
+    RLITE_KER_MEMTRACK_STATS_RESP,   /* 39 */
 
     RLITE_KER_MSG_MAX,
 };
@@ -446,6 +448,16 @@ struct rl_kmsg_ipcp_stats_resp {
     struct rl_ipcp_stats stats;
 };
 
+/* application <-- kernel message to report the memory usage of the
+ * kernel modules (response to RLITE_KER_MEMTRACK_STATS_REQ). */
+struct rl_kmsg_memtrack_stats_resp {
+    struct rl_msg_hdr hdr;
+
+    uint32_t num; /* number of valid entries in stats[] */
+    uint32_t pad1;
+    struct rl_memtrack_stats stats[RL_MEMTRACK_MAX_TYPES];
+};
+
 /* application --> kernel message to configure a WRR PDU scheduler. */
 struct rl_kmsg_ipcp_sched_wrr {
     struct rl_msg_ipcp ipcp_hdr;
@@ -28,6 +28,7 @@
 #include <string>
 #include <list>
 #include <map>
+#include <set>
 #include <fstream>
 #include <iostream>
 #include <memory>
@@ -38,6 +39,7 @@ namespace raft {
 using Term      = uint32_t;
 using LogIndex  = uint32_t;
 using ReplicaId = std::string;
+using ReadId    = uint64_t;
 
 /* Base class for all the Raft messages. */
 struct RaftMessage {
@@ -84,6 +86,11 @@ struct RaftAppendEntries : public RaftMessage {
     /* Log entries to store (empty for heartbeat). There may be
      * more than one for efficiency. */
     std::list<std::pair<Term, std::unique_ptr<char[]>>> entries;
+
+    /* If not zero, the leader is confirming its leadership to serve
+     * reads, and the follower must acknowledge the message even if it
+     * is an heartbeat. */
+    uint64_t read_seq = 0;
 };
 
 struct RaftAppendEntriesResp : public RaftMessage {
@@ -104,6 +111,14 @@ struct RaftAppendEntriesResp : public RaftMessage {
      * and prev_log_term as specified in the request. If false
      * the leader should retry with an older log entry. */
     bool success;
+
+    /* The read_seq of the corresponding RaftAppendEntries, if the
+     * follower recognized the sender as its leader. */
+    uint64_t read_seq = 0;
+
+    /* True if this acknowledges an heartbeat (only to confirm
+     * leadership), so that log_index and success are meaningless. */
+    bool heartbeat = false;
 };
 
 enum class RaftTimerType {
@@ -148,6 +163,12 @@ struct RaftSMOutput {
     std::list<std::pair<ReplicaId, std::unique_ptr<RaftMessage>>>
         output_messages;
     std::list<RaftTimerCmd> timer_commands;
+
+    /* Reads (see RaftSM::read_request()) that can now be served from
+     * the local replica of the state machine, and reads that cannot be
+     * served anymore because we lost leadership. */
+    std::list<ReadId> reads_ready;
+    std::list<ReadId> reads_failed;
 };
 
 enum class RaftState {
@@ -246,6 +267,41 @@ class RaftSM {
     /* How many votes we collected as a candidate. */
     unsigned int votes_collected = 0;
 
+    /* Last time we heard from the current leader. */
+    std::chrono::system_clock::time_point last_leader_contact;
+
+    /* =================================================================
+     * Volatile state for leaders, to serve linearizable reads without
+     * writing to the log (ReadIndex and leader lease).
+     */
+
+    struct PendingRead {
+        ReadId id;
+        /* The read can be served when this log entry has been applied... */
+        LogIndex index;
+        /* ...and leadership has been confirmed by a round of heartbeats
+         * started after the read was requested. */
+        uint64_t seq;
+    };
+    std::list<PendingRead> pending_reads;
+
+    /* Index of the no-op entry appended when we became leader. Reads
+     * cannot be served before this entry is committed, as our
+     * commit_index may be behind the one of the previous leader. */
+    LogIndex noop_index = 0;
+
+    /* Sequence number of the last round of heartbeats started to confirm
+     * leadership, and of the last confirmed one. */
+    uint64_t read_seq_next      = 0;
+    uint64_t read_seq_confirmed = 0;
+    bool read_round_active      = false;
+    std::set<ReplicaId> read_round_acks;
+    std::chrono::system_clock::time_point read_round_start_time;
+
+    /* Until this time we are sure that no other leader can be elected,
+     * so we can serve reads without confirming leadership. */
+    std::chrono::system_clock::time_point lease_expiry;
+
     /* Name of the log file. */
     const std::string logfilename;
 
@@ -267,6 +323,10 @@ class RaftSM {
     static constexpr unsigned long kLogEntriesOfs     = 128;
     static constexpr size_t kLogVotedForSize = kLogEntriesOfs - kLogVotedForOfs;
 
+    /* Flag set in the term of no-op entries, both in the log and in the
+     * RaftAppendEntries messages. No-op entries are not applied. */
+    static constexpr Term kNoopTermFlag = 0x80000000U;
+
     /* Argument for RaftSM::prepare_append_entries() that specifies
      * its behaviour (send all the unacked log entries or only the
      * ones that have not been sent yet). */
@@ -276,9 +336,10 @@ class RaftSM {
     };
 
     /* Getter/setters for replica persistent state. */
-    int log_u32_write(unsigned long pos, uint32_t val);
+    int log_u32_write(unsigned long pos, uint32_t val, bool sync = true);
     int log_u32_read(unsigned long pos, uint32_t *val);
-    int log_buf_write(unsigned long pos, const char *buf, size_t len);
+    int log_buf_write(unsigned long pos, const char *buf, size_t len,
+                      bool sync = true);
     int log_buf_read(unsigned long pos, char *buf, size_t len);
     int magic_check();
     int log_open(bool first_boot);
@@ -318,10 +379,19 @@ class RaftSM {
     unsigned int quorum() const;
     int prepare_append_entries(LogReplicateStrategy strategy,
                                RaftSMOutput *out);
-    int log_entry_get_term(LogIndex index, Term *term);
+    int append_entries_to(const ReplicaId &id, LogReplicateStrategy strategy,
+                          bool *sent, RaftSMOutput *out);
+    int log_entry_get_term(LogIndex index, Term *term, bool *noop = nullptr);
     int log_entry_get_command(LogIndex index, char *const serbuf);
-    int append_log_entry(const Term term, const char *serbuf);
+    int append_log_entry(const Term term, const char *serbuf,
+                         bool sync = true);
     int apply_committed_entries();
+    int batch_sync();
+    int read_round_start(RaftSMOutput *out);
+    int read_round_complete(RaftSMOutput *out);
+    int read_ack(const ReplicaId &follower, uint64_t seq, RaftSMOutput *out);
+    void reads_serve(RaftSMOutput *out);
+    void reads_fail(RaftSMOutput *out);
 
     std::chrono::milliseconds ElectionTimeoutMin =
         std::chrono::milliseconds(int(kElectionTimeoutMinMsecs));
@@ -331,6 +401,17 @@ class RaftSM {
         std::chrono::milliseconds(int(kHeartBeatTimeoutMsecs));
     std::chrono::milliseconds RtxTimeout =
         std::chrono::milliseconds(int(kRtxTimeoutMsecs));
+    std::chrono::milliseconds LeaseTimeout = std::chrono::milliseconds(0);
+
+    /* Maximum number of bytes of log entries in a RaftAppendEntries
+     * message, and maximum number of log entries sent to a follower and
+     * not acked yet (zero means no limit). */
+    size_t MaxAppendEntriesBytes   = kMaxLogChunkBytes;
+    unsigned int ReplicationWindow = kReplicationWindow;
+
+    /* Number of log entries appended by submit_batched() and not yet
+     * synced to disk and sent to the followers. */
+    unsigned int batched_entries = 0;
 
     unsigned int verbosity = kVerboseVery;
 
@@ -338,8 +419,35 @@ class RaftSM {
     struct Stats {
         /* Number of discarded log entries, due to partial replication. */
         unsigned int discarded = 0;
+
+        /* Number of reads served under lease or after confirming
+         * leadership, number of rounds of heartbeats needed to confirm
+         * leadership, and number of reads failed because of a leadership
+         * change. */
+        unsigned int reads_lease  = 0;
+        unsigned int reads_index  = 0;
+        unsigned int read_rounds  = 0;
+        unsigned int reads_failed = 0;
+
+        /* Number of batches of submitted log entries, and number of
+         * entries in those batches. */
+        unsigned int batches         = 0;
+        unsigned int batched_entries = 0;
+
+        /* Number of RaftAppendEntries messages carrying log entries, and
+         * number of times a follower could not be sent some entries
+         * because its replication window was full. */
+        unsigned int ae_msgs     = 0;
+        unsigned int window_full = 0;
     } stats;
 
+protected:
+    /* Time source, which can be overridden (e.g. for simulations). */
+    virtual std::chrono::system_clock::time_point clock_now() const
+    {
+        return std::chrono::system_clock::now();
+    }
+
 public:
     RaftSM(const std::string &smname, const ReplicaId &myname,
            std::string logname, size_t cmd_size, std::ostream &ioe,
@@ -377,6 +485,34 @@ public:
     int submit(const char *const serbuf, LogIndex *log_index_p,
                RaftSMOutput *out);
 
+    /* Like submit(), but the new log entry is not synced to disk and not
+     * sent to the followers until submit_flush() is called, so that many
+     * entries can be replicated with a single disk sync and a single
+     * RaftAppendEntries message per follower. */
+    int submit_batched(const char *const serbuf, LogIndex *log_index_p);
+    int submit_flush(RaftSMOutput *out);
+
+    /* Number of entries submitted with submit_batched() and not
+     * flushed yet. */
+    unsigned int submit_pending() const { return batched_entries; }
+
+    /* Called by the user on the leader when it wants to perform a
+     * linearizable read of the replicated state machine, identified by
+     * 'id'. The read is reported in RaftSMOutput::reads_ready when it can
+     * be served from the local replica, or in RaftSMOutput::reads_failed
+     * if we lose leadership in the meanwhile. No log entries are written.
+     * Concurrent reads share the same round of heartbeats, and no round
+     * is needed at all while the leader lease (if enabled) is valid. */
+    int read_request(ReadId id, RaftSMOutput *out);
+
+    /* True if we are the leader and we hold a valid lease. */
+    bool lease_valid() const;
+
+    /* True if the local replica of the state machine can be read with a
+     * bounded staleness: we are the leader, or we heard from the leader
+     * no more than 'max_staleness' ago. */
+    bool read_local_ok(std::chrono::milliseconds max_staleness) const;
+
     /* Called by the Raft state machine when a log entry needs to
      * be applied to the replicated state machine. */
     virtual int apply(LogIndex index, Term term, const char *const serbuf) = 0;
@@ -408,6 +544,11 @@ public:
         return 0;
     }
 
+    std::chrono::milliseconds get_election_timeout_min() const
+    {
+        return ElectionTimeoutMin;
+    }
+
     std::chrono::milliseconds get_election_timeout_max() const
     {
         return ElectionTimeoutMax;
@@ -434,15 +575,41 @@ public:
         verbosity = level; /* no need to check */
     }
 
-    /* At most 1000 bytes of log chunk per each RaftAppendEntries
-     * message. */
-    static constexpr size_t kMaxLogChunkBytes = 1000;
+    /* By default, at most 1000 bytes of log chunk per each
+     * RaftAppendEntries message, and at most 128 unacked entries per
+     * follower. */
+    static constexpr size_t kMaxLogChunkBytes        = 1000;
+    static constexpr unsigned int kReplicationWindow = 128;
+
+    void set_max_append_entries_bytes(size_t bytes)
+    {
+        MaxAppendEntriesBytes = bytes;
+    }
+
+    void set_replication_window(unsigned int entries)
+    {
+        ReplicationWindow = entries;
+    }
 
     void set_retransmission_timeout(std::chrono::milliseconds t)
     {
         RtxTimeout = t;
     }
 
+    /* Enable the leader lease (a zero 't' disables it). The lease must be
+     * shorter than the minimum election timeout, as followers refuse to
+     * vote for a new leader for that long after hearing from the current
+     * one. A margin for clock drift should also be accounted for. */
+    int set_lease_timeout(std::chrono::milliseconds t)
+    {
+        if (t >= ElectionTimeoutMin) {
+            return -1;
+        }
+        LeaseTimeout = t;
+
+        return 0;
+    }
+
     static constexpr int kElectionTimeoutMinMsecs = 200;
     static constexpr int kHeartBeatTimeoutMsecs   = 100;
     static constexpr int kRtxTimeoutMsecs         = 2000;
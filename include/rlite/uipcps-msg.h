@@ -58,6 +58,9 @@ enum {
     RLITE_U_IPCP_ROUTE_DEL,              /* 24 */
     RLITE_U_IPCP_STATS_SHOW_REQ,         /* 25 */
     RLITE_U_IPCP_STATS_SHOW_RESP,        /* 26 */
+    RLITE_U_SERVER_STATS_DUMP,           /* 27 */
+    RLITE_U_MEMTRACK_STATS_REQ,          /* 28 */
+    RLITE_U_MEMTRACK_STATS_RESP,         /* 29 */
 
     RLITE_U_MSG_MAX,
 };
@@ -199,4 +202,14 @@ struct rl_cmsg_ipcp_route_mod {
 #define rl_cmsg_ipcp_stats_req rl_cmsg_ipcp_rib_show_req
 #define rl_cmsg_ipcp_stats_resp rl_cmsg_ipcp_rib_show_resp
 
+/* rlite-ctl <-- uipcps message to report memory usage. */
+struct rl_cmsg_memtrack_stats_resp {
+    struct rl_msg_hdr hdr;
+
+    uint8_t result;
+    uint8_t pad1[3];
+    uint32_t num; /* number of valid entries in stats[] */
+    struct rl_memtrack_stats stats[RL_MEMTRACK_MAX_TYPES];
+};
+
 #endif /* __RLITE_U_MSG_H__ */
@@ -68,6 +68,8 @@ int deserialize_rlite_msg(struct rl_msg_layout *numtables, size_t num_entries,
                           void *msgbuf, unsigned int msgbuf_len);
 unsigned int rl_msg_serlen(struct rl_msg_layout *numtables, size_t num_entries,
                            const struct rl_msg_base *msg);
+int rl_msg_serbuf_len(struct rl_msg_layout *numtables, size_t num_entries,
+                      const void *serbuf, unsigned int serbuf_len);
 unsigned int rl_numtables_max_size(struct rl_msg_layout *numtables,
                                    unsigned int n);
 void rina_name_free(struct rina_name *name);
@@ -176,6 +178,8 @@ char *rl_strdup(const char *s, rl_memtrack_t ty);
 void rl_free(void *obj, rl_memtrack_t ty);
 void rl_mt_adjust(int val, rl_memtrack_t ty);
 void rl_memtrack_dump_stats(void);
+unsigned int rl_memtrack_get_stats(struct rl_memtrack_stats *stats,
+                                   unsigned int max);
 #else /* ! RL_MEMTRACK */
 #define rl_alloc(_sz, _ty) malloc(_sz)
 #define rl_strdup(_s, _ty) strdup(_s)
@@ -183,6 +187,10 @@ void rl_memtrack_dump_stats(void);
 #define rl_mt_adjust(_1, _2)
 #endif /* ! RL_MEMTRACK */
 
+/* Hash functions for the hash tables of user-space components. */
+unsigned int rl_str_hash(const char *str);
+unsigned int rl_u32_hash(uint32_t x);
+
 #endif /* !__KERNEL__ */
 
 #ifdef __cplusplus
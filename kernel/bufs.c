@@ -59,6 +59,8 @@ rl_buf_alloc(size_t size, size_t hdroom, size_t tailroom, gfp_t gfp)
     rb_list_init(&rb->node);
 
 #else  /* RL_SKB */
+    BUILD_BUG_ON(sizeof(union rl_buf_ctx) + sizeof(uint64_t) >
+                 sizeof(rb->cb));
     rb = alloc_skb(hdroom + size + tailroom, gfp);
 
     if (unlikely(!rb)) {
@@ -70,6 +72,7 @@ rl_buf_alloc(size_t size, size_t hdroom, size_t tailroom, gfp_t gfp)
 #endif /* RL_SKB */
 
     RL_BUF_RMT(rb).lower_flow = NULL;
+    RL_BUF_TSTAMP(rb)         = 0;
 
     return rb;
 }
@@ -110,6 +113,46 @@ rl_buf_clone(struct rl_buf *rb, gfp_t gfp)
 }
 EXPORT_SYMBOL(rl_buf_clone);
 
+/* Make sure that the data of @rb is not shared with clones and that there
+ * are at least @hdroom bytes of headroom, so that the headers can be
+ * rewritten in place. The data is copied only if needed. */
+int
+rl_buf_cow_head(struct rl_buf *rb, size_t hdroom, gfp_t gfp)
+{
+#ifndef RL_SKB
+    size_t cur_hdroom = (uint8_t *)rb->pci - &rb->raw->buf[0];
+    struct rl_rawbuf *raw;
+    size_t tailroom;
+
+    if (likely(atomic_read(&rb->raw->refcnt) == 1 && cur_hdroom >= hdroom)) {
+        return 0;
+    }
+
+    tailroom = rb->raw->size - cur_hdroom - rb->len;
+    hdroom   = max(hdroom, cur_hdroom);
+    raw      = rl_alloc(sizeof(*raw) + hdroom + rb->len + tailroom, gfp,
+                   RL_MT_BUFDATA);
+    if (unlikely(!raw)) {
+        RPV(1, "Out of memory\n");
+        return -ENOMEM;
+    }
+
+    raw->size = hdroom + rb->len + tailroom;
+    atomic_set(&raw->refcnt, 1);
+    memcpy(raw->buf + hdroom, rb->pci, rb->len);
+    if (atomic_dec_and_test(&rb->raw->refcnt)) {
+        rl_free(rb->raw, RL_MT_BUFDATA);
+    }
+    rb->raw = raw;
+    rb->pci = (struct rina_pci *)(raw->buf + hdroom);
+
+    return 0;
+#else  /* RL_SKB */
+    return skb_cow_head(rb, hdroom);
+#endif /* RL_SKB */
+}
+EXPORT_SYMBOL(rl_buf_cow_head);
+
 void
 __rl_buf_free(struct rl_buf *rb)
 {
@@ -24,6 +24,9 @@
 #include "rlite/version.h"
 #include "rlite-kernel.h"
 
+#define CREATE_TRACE_POINTS
+#include "rlite-trace.h"
+
 #include <linux/module.h>
 #include <linux/file.h>
 #include <linux/aio.h>
@@ -46,6 +49,17 @@ int verbosity = RL_VERB_DBG;
 EXPORT_SYMBOL(verbosity);
 module_param(verbosity, int, 0644);
 
+/* Collect latency histograms in the datapath. */
+bool rl_latency_stats = false;
+EXPORT_SYMBOL(rl_latency_stats);
+module_param_named(latency_stats, rl_latency_stats, bool, 0644);
+
+EXPORT_TRACEPOINT_SYMBOL(rlite_pdu_tx);
+EXPORT_TRACEPOINT_SYMBOL(rlite_pdu_rx);
+EXPORT_TRACEPOINT_SYMBOL(rlite_pdu_fwd);
+EXPORT_TRACEPOINT_SYMBOL(rlite_pdu_drop);
+EXPORT_TRACEPOINT_SYMBOL(rlite_pdu_rtx);
+
 struct rl_ctrl;
 struct rl_dm;
 
@@ -62,11 +76,21 @@ struct rl_ctrl {
     /* Pointer to the parent data model. */
     struct rl_dm *dm;
 
-    /* Upqueue-related data structures. */
-    struct list_head upqueue;
+    /* Upqueue-related data structures. The upqueue is a ring of
+     * variable-size records (struct rl_msg_rec_hdr followed by the
+     * serialized message), allocated on the first write() or on the
+     * first message appended (see rl_upqueue_alloc()).
+     * Once allocated, the ring is only freed on release.
+     * Producers serialize directly into the ring under upqueue_lock;
+     * readers are serialized by upqueue_rlock and copy out of the ring
+     * without holding the spinlock, since producers never touch the
+     * area between upq_head and upq_tail. */
+    char *upqueue;
 #define RL_UPQUEUE_SIZE_MAX (1 << 14)
-    unsigned int upqueue_size;
+    unsigned int upq_head; /* free running */
+    unsigned int upq_tail; /* free running */
     spinlock_t upqueue_lock;
+    struct mutex upqueue_rlock;
     wait_queue_head_t upqueue_wqh;
 
     struct list_head flows_fetch_q;
@@ -76,13 +100,9 @@ struct rl_ctrl {
     unsigned flags;
 };
 
-/* A message to be delivered to an userspace application through an
- * rlite control device. */
-struct upqueue_entry {
-    void *sermsg;
-    size_t serlen;
-    struct list_head node;
-};
+/* Record length used to mark the unused tail of the ring, when a
+ * record does not fit before the end. */
+#define RL_UPQ_WRAP 0xffffffffU
 
 struct registered_appl {
     /* Name of the registered application. */
@@ -109,11 +129,11 @@ struct registered_appl {
 };
 
 #define IPCP_ID_BITMAP_SIZE 256
-#define PORT_ID_BITMAP_SIZE 65536
+/* The all-ones port id is reserved (RL_PORT_ID_NONE), and it is also
+ * used as invalid cep id. */
+#define PORT_ID_BITMAP_SIZE 65535
 #define CEP_ID_BITMAP_SIZE PORT_ID_BITMAP_SIZE
 #define IPCP_HASHTABLE_BITS 6
-#define PORT_ID_HASHTABLE_BITS 10
-#define CEP_ID_HASHTABLE_BITS 10
 
 /* Global data structures, shared by all the rl_dm instances. In other works
  * this is common to all the network namespaces. */
@@ -138,20 +158,21 @@ struct rl_dm {
     /* Hash table to store information about each IPC process. */
     DECLARE_HASHTABLE(ipcp_table, IPCP_HASHTABLE_BITS);
 
-    /* Bitmap to manage port ids. */
-    DECLARE_BITMAP(port_id_bitmap, PORT_ID_BITMAP_SIZE);
+    /* Allocators for port ids and connection endpoint ids. */
+    struct rl_idalloc port_ids;
+    struct rl_idalloc cep_ids;
 
-    /* Hash tables to store information about each flow. */
-    DECLARE_HASHTABLE(flow_table, PORT_ID_HASHTABLE_BITS);
-    DECLARE_HASHTABLE(flow_table_by_cep, CEP_ID_HASHTABLE_BITS);
+    /* Hash tables to look up flows by port id and by cep id, and list
+     * of all the flows. */
+    struct rl_flowtab flow_table;
+    struct rl_flowtab flow_table_by_cep;
+    struct list_head flows;
     uint32_t uid_cnt;
 
-    /* Bitmap to manage connection endpoint ids. */
-    DECLARE_BITMAP(cep_id_bitmap, CEP_ID_BITMAP_SIZE);
-
     struct list_head difs;
 
-    /* Lock for flows table. */
+    /* Lock for flows tables. Lookups on the datapath do not take it,
+     * and rely on RCU instead. */
     rwlock_t flows_lock;
 
     /* Lock for IPCPs table. */
@@ -290,48 +311,73 @@ rl_ipcp_factory_unregister(const char *dif_type)
 }
 EXPORT_SYMBOL(rl_ipcp_factory_unregister);
 
-static inline unsigned int
-upqentry_size(struct upqueue_entry *entry)
+static inline struct rl_msg_rec_hdr *
+upq_rec(struct rl_ctrl *rc, unsigned int idx)
 {
-    return entry->serlen + sizeof(*entry);
+    return (struct rl_msg_rec_hdr *)(rc->upqueue +
+                                     (idx & (RL_UPQUEUE_SIZE_MAX - 1)));
+}
+
+/* Allocate the upqueue ring, if not done yet. Many control devices are
+ * short-lived (e.g. the ones used to allocate a flow), and they only
+ * receive a few messages, so that it is worth to avoid the allocation
+ * when the device is opened. */
+static int
+rl_upqueue_alloc(struct rl_ctrl *rc, gfp_t gfp)
+{
+    char *upqueue;
+
+    if (likely(READ_ONCE(rc->upqueue))) {
+        return 0;
+    }
+
+    upqueue = rl_alloc(RL_UPQUEUE_SIZE_MAX, gfp, RL_MT_UPQ);
+    if (!upqueue) {
+        return -ENOMEM;
+    }
+
+    spin_lock(&rc->upqueue_lock);
+    if (!rc->upqueue) {
+        rc->upqueue = upqueue;
+        upqueue     = NULL;
+    }
+    spin_unlock(&rc->upqueue_lock);
+
+    if (upqueue) {
+        /* Someone else was faster. */
+        rl_free(upqueue, RL_MT_UPQ);
+    }
+
+    return 0;
 }
 
 int
 rl_upqueue_append(struct rl_ctrl *rc, const struct rl_msg_base *rmsg,
                   bool maysleep)
 {
-    gfp_t gfp        = maysleep ? GFP_KERNEL : GFP_ATOMIC;
     unsigned long to = msecs_to_jiffies(5);
     DECLARE_WAITQUEUE(wait, current);
-    struct upqueue_entry *entry;
+    struct rl_msg_rec_hdr *rec;
+    unsigned int reclen;
     unsigned long exp;
     unsigned int serlen;
-    void *serbuf;
     int ret = 0;
 
     if (rc == NULL) {
         return 0; /* Nothing to do. */
     }
 
-    entry = rl_alloc(sizeof(*entry), gfp | __GFP_ZERO, RL_MT_UPQ);
-    if (!entry) {
-        RPV(1, "Out of memory\n");
-        return -ENOMEM;
+    serlen = rl_msg_serlen(rl_ker_numtables, RLITE_KER_MSG_MAX, rmsg);
+    reclen = RL_MSG_REC_SIZE(serlen);
+    if (unlikely(reclen > RL_UPQUEUE_SIZE_MAX / 2)) {
+        RPV(1, "Message too long for the upqueue [%u]\n", serlen);
+        return -EMSGSIZE;
     }
 
-    /* Serialize the response into serbuf and then put it into the upqueue. */
-    serlen = rl_msg_serlen(rl_ker_numtables, RLITE_KER_MSG_MAX, rmsg);
-    serbuf = rl_alloc(serlen, gfp | __GFP_ZERO, RL_MT_UPQ);
-    if (!serbuf) {
-        rl_free(entry, RL_MT_UPQ);
-        RPV(1, "Out of memory\n");
+    if (unlikely(rl_upqueue_alloc(rc, maysleep ? GFP_KERNEL : GFP_ATOMIC))) {
+        RPD(1, "Cannot allocate the upqueue, dropping\n");
         return -ENOMEM;
     }
-    serlen =
-        serialize_rlite_msg(rl_ker_numtables, RLITE_KER_MSG_MAX, serbuf, rmsg);
-
-    entry->sermsg = serbuf;
-    entry->serlen = serlen;
 
     if (maysleep) {
         add_wait_queue(&rc->upqueue_wqh, &wait);
@@ -340,14 +386,19 @@ rl_upqueue_append(struct rl_ctrl *rc, const struct rl_msg_base *rmsg,
     exp = jiffies + to;
 
     for (;;) {
+        unsigned int ofs, contig, needed;
+
         spin_lock(&rc->upqueue_lock);
-        if (rc->upqueue_size + upqentry_size(entry) > RL_UPQUEUE_SIZE_MAX) {
+        ofs    = rc->upq_tail & (RL_UPQUEUE_SIZE_MAX - 1);
+        contig = RL_UPQUEUE_SIZE_MAX - ofs;
+        /* If the record does not fit before the end of the ring, we also
+         * need to waste the tail. */
+        needed = reclen <= contig ? reclen : contig + reclen;
+        if (rc->upq_tail - rc->upq_head + needed > RL_UPQUEUE_SIZE_MAX) {
             /* No free space in the queue. */
             spin_unlock(&rc->upqueue_lock);
             if (!maysleep || !time_before(jiffies, exp)) {
                 RPD(1, "upqueue overrun, dropping [cansleep=%d]\n", maysleep);
-                rl_free(serbuf, RL_MT_UPQ);
-                rl_free(entry, RL_MT_UPQ);
                 ret = -ENOSPC;
                 break;
             }
@@ -356,8 +407,19 @@ rl_upqueue_append(struct rl_ctrl *rc, const struct rl_msg_base *rmsg,
             schedule_timeout(to);
             continue;
         }
-        list_add_tail(&entry->node, &rc->upqueue);
-        rc->upqueue_size += upqentry_size(entry);
+        if (needed != reclen) {
+            upq_rec(rc, rc->upq_tail)->len = RL_UPQ_WRAP;
+            rc->upq_tail += contig;
+        }
+        /* Serialize the message directly into the ring. */
+        rec = upq_rec(rc, rc->upq_tail);
+        rec->len =
+            serialize_rlite_msg(rl_ker_numtables, RLITE_KER_MSG_MAX, rec + 1,
+                                rmsg);
+        rec->pad = 0;
+        memset((char *)(rec + 1) + rec->len, 0,
+               reclen - sizeof(*rec) - rec->len);
+        rc->upq_tail += reclen;
         spin_unlock(&rc->upqueue_lock);
         break;
     }
@@ -606,6 +668,8 @@ ipcp_add_entry(struct rl_dm *dm, struct rl_kmsg_ipcp_create *req,
         spin_lock_init(&entry->regapp_lock);
         init_waitqueue_head(&entry->uipcp_wqh);
         mutex_init(&entry->lock);
+        atomic_set(&entry->flows_gen, 0);
+        rl_rx_cache_init(&entry->rx_cache);
         hash_add(dm->ipcp_table, &entry->node, entry->id);
         init_waitqueue_head(&entry->tx_wqh);
         entry->dm = rl_dm_getref(dm);
@@ -667,6 +731,7 @@ ipcp_add(struct rl_dm *dm, struct rl_kmsg_ipcp_create *req,
 
     entry->ops = factory->ops;
     entry->flags |= factory->use_cep_ids ? RL_K_IPCP_USE_CEP_IDS : 0;
+    entry->flags |= factory->fragmentation ? RL_K_IPCP_FRAGMENTATION : 0;
     *ipcp_id = entry->id;
 
 out:
@@ -940,23 +1005,221 @@ application_del_by_rc(struct rl_ctrl *rc)
     }
 }
 
-/* To be called under FLOCK or FRLOCK. */
+int
+rl_idalloc_init(struct rl_idalloc *ida, unsigned long size)
+{
+    ida->bitmap = rl_alloc(BITS_TO_LONGS(size) * sizeof(unsigned long),
+                           GFP_KERNEL | __GFP_ZERO, RL_MT_MISC);
+    if (!ida->bitmap) {
+        return -ENOMEM;
+    }
+    ida->size   = size;
+    ida->cursor = 0;
+    ida->used   = 0;
+    spin_lock_init(&ida->lock);
+
+    return 0;
+}
+EXPORT_SYMBOL(rl_idalloc_init);
+
+void
+rl_idalloc_fini(struct rl_idalloc *ida)
+{
+    if (ida->used) {
+        PE("%lu ids still in use\n", ida->used);
+    }
+    rl_free(ida->bitmap, RL_MT_MISC);
+    ida->bitmap = NULL;
+}
+EXPORT_SYMBOL(rl_idalloc_fini);
+
+/* Returns the allocated id, or -ENOSPC. The search starts from the id
+ * following the last one allocated, and wraps around. */
+long
+rl_idalloc_get(struct rl_idalloc *ida)
+{
+    unsigned long id;
+
+    spin_lock_bh(&ida->lock);
+    id = find_next_zero_bit(ida->bitmap, ida->size, ida->cursor);
+    if (id >= ida->size) {
+        id = find_next_zero_bit(ida->bitmap, ida->cursor, 0);
+        if (id >= ida->cursor) {
+            spin_unlock_bh(&ida->lock);
+            return -ENOSPC;
+        }
+    }
+    __set_bit(id, ida->bitmap);
+    ida->cursor = id + 1 < ida->size ? id + 1 : 0;
+    ida->used++;
+    spin_unlock_bh(&ida->lock);
+
+    return id;
+}
+EXPORT_SYMBOL(rl_idalloc_get);
+
+void
+rl_idalloc_put(struct rl_idalloc *ida, unsigned long id)
+{
+    spin_lock_bh(&ida->lock);
+    if (WARN_ON(id >= ida->size || !test_bit(id, ida->bitmap))) {
+        spin_unlock_bh(&ida->lock);
+        return;
+    }
+    __clear_bit(id, ida->bitmap);
+    ida->used--;
+    spin_unlock_bh(&ida->lock);
+}
+EXPORT_SYMBOL(rl_idalloc_put);
+
+#ifdef RL_HAVE_RHASHTABLE
+static const struct rhashtable_params flowtab_port_params = {
+    .key_len             = sizeof(rl_port_t),
+    .key_offset          = offsetof(struct flow_entry, local_port),
+    .head_offset         = offsetof(struct flow_entry, node),
+    .automatic_shrinking = true,
+};
+
+static const struct rhashtable_params flowtab_cep_params = {
+    .key_len             = sizeof(rlm_cepid_t),
+    .key_offset          = offsetof(struct flow_entry, local_cep),
+    .head_offset         = offsetof(struct flow_entry, node_cep),
+    .automatic_shrinking = true,
+};
+#endif /* RL_HAVE_RHASHTABLE */
+
+int
+rl_flowtab_init(struct rl_flowtab *tab, bool by_cep)
+{
+    tab->by_cep = by_cep;
+#ifdef RL_HAVE_RHASHTABLE
+    return rhashtable_init(&tab->ht, by_cep ? &flowtab_cep_params
+                                            : &flowtab_port_params);
+#else  /* !RL_HAVE_RHASHTABLE */
+    hash_init(tab->ht);
+    return 0;
+#endif /* !RL_HAVE_RHASHTABLE */
+}
+EXPORT_SYMBOL(rl_flowtab_init);
+
+/* The table must be empty. */
+void
+rl_flowtab_fini(struct rl_flowtab *tab)
+{
+#ifdef RL_HAVE_RHASHTABLE
+    rhashtable_destroy(&tab->ht);
+#else  /* !RL_HAVE_RHASHTABLE */
+    BUG_ON(!hash_empty(tab->ht));
+#endif /* !RL_HAVE_RHASHTABLE */
+}
+EXPORT_SYMBOL(rl_flowtab_fini);
+
+int
+rl_flowtab_insert(struct rl_flowtab *tab, struct flow_entry *flow)
+{
+#ifdef RL_HAVE_RHASHTABLE
+    if (tab->by_cep) {
+        return rhashtable_insert_fast(&tab->ht, &flow->node_cep,
+                                      flowtab_cep_params);
+    }
+    return rhashtable_insert_fast(&tab->ht, &flow->node, flowtab_port_params);
+#else  /* !RL_HAVE_RHASHTABLE */
+    if (tab->by_cep) {
+        hash_add_rcu(tab->ht, &flow->node_cep, flow->local_cep);
+    } else {
+        hash_add_rcu(tab->ht, &flow->node, flow->local_port);
+    }
+    return 0;
+#endif /* !RL_HAVE_RHASHTABLE */
+}
+EXPORT_SYMBOL(rl_flowtab_insert);
+
+void
+rl_flowtab_remove(struct rl_flowtab *tab, struct flow_entry *flow)
+{
+#ifdef RL_HAVE_RHASHTABLE
+    if (tab->by_cep) {
+        rhashtable_remove_fast(&tab->ht, &flow->node_cep, flowtab_cep_params);
+    } else {
+        rhashtable_remove_fast(&tab->ht, &flow->node, flowtab_port_params);
+    }
+#else  /* !RL_HAVE_RHASHTABLE */
+    if (tab->by_cep) {
+        hash_del_rcu(&flow->node_cep);
+    } else {
+        hash_del_rcu(&flow->node);
+    }
+#endif /* !RL_HAVE_RHASHTABLE */
+}
+EXPORT_SYMBOL(rl_flowtab_remove);
+
+/* To be called under rcu_read_lock(), or with insertions and removals
+ * excluded (e.g. under FRLOCK). */
 struct flow_entry *
-flow_lookup(struct rl_dm *dm, rl_port_t port_id)
+rl_flowtab_lookup(struct rl_flowtab *tab, uint32_t key)
 {
+#ifdef RL_HAVE_RHASHTABLE
+    if (tab->by_cep) {
+        rlm_cepid_t cep_id = key;
+
+        return rhashtable_lookup_fast(&tab->ht, &cep_id, flowtab_cep_params);
+    } else {
+        rl_port_t port_id = key;
+
+        return rhashtable_lookup_fast(&tab->ht, &port_id, flowtab_port_params);
+    }
+#else  /* !RL_HAVE_RHASHTABLE */
     struct flow_entry *entry;
-    struct hlist_head *head;
-    head = &dm->flow_table[hash_min(port_id, HASH_BITS(dm->flow_table))];
-    hlist_for_each_entry (entry, head, node) {
-        if (entry->local_port == port_id) {
-            return entry;
+
+    if (tab->by_cep) {
+        hash_for_each_possible_rcu(tab->ht, entry, node_cep, key)
+        {
+            if (entry->local_cep == key) {
+                return entry;
+            }
+        }
+    } else {
+        hash_for_each_possible_rcu(tab->ht, entry, node, key)
+        {
+            if (entry->local_port == key) {
+                return entry;
+            }
         }
     }
 
     return NULL;
+#endif /* !RL_HAVE_RHASHTABLE */
+}
+EXPORT_SYMBOL(rl_flowtab_lookup);
+
+/* To be called under FLOCK or FRLOCK. */
+struct flow_entry *
+flow_lookup(struct rl_dm *dm, rl_port_t port_id)
+{
+    struct flow_entry *flow;
+
+    rcu_read_lock();
+    flow = rl_flowtab_lookup(&dm->flow_table, port_id);
+    rcu_read_unlock();
+
+    return flow;
 }
 EXPORT_SYMBOL(flow_lookup);
 
+struct flow_entry *
+flow_lookup_rcu(struct rl_dm *dm, rl_port_t port_id)
+{
+    return rl_flowtab_lookup(&dm->flow_table, port_id);
+}
+EXPORT_SYMBOL(flow_lookup_rcu);
+
+struct flow_entry *
+flow_lookup_by_cep_rcu(struct rl_dm *dm, rlm_cepid_t cep_id)
+{
+    return rl_flowtab_lookup(&dm->flow_table_by_cep, cep_id);
+}
+EXPORT_SYMBOL(flow_lookup_by_cep_rcu);
+
 struct flow_entry *
 flow_get(struct rl_dm *dm, rl_port_t port_id)
 {
@@ -991,25 +1254,19 @@ struct flow_entry *
 flow_get_by_cep(struct rl_dm *dm, rlm_cepid_t cep_id)
 {
     struct flow_entry *entry;
-    struct hlist_head *head;
 
     FRLOCK(dm);
-
-    head = &dm->flow_table_by_cep[hash_min(cep_id,
-                                           HASH_BITS(dm->flow_table_by_cep))];
-    hlist_for_each_entry (entry, head, node_cep) {
-        if (entry->local_cep == cep_id) {
-            atomic_inc(&entry->refcnt);
-            PV("FLOWREFCNT %u ++: %u\n", entry->local_port,
-               atomic_read(&entry->refcnt));
-            FRUNLOCK(dm);
-            return entry;
-        }
+    rcu_read_lock();
+    entry = rl_flowtab_lookup(&dm->flow_table_by_cep, cep_id);
+    rcu_read_unlock();
+    if (entry) {
+        atomic_inc(&entry->refcnt);
+        PV("FLOWREFCNT %u ++: %u\n", entry->local_port,
+           atomic_read(&entry->refcnt));
     }
-
     FRUNLOCK(dm);
 
-    return NULL;
+    return entry;
 }
 EXPORT_SYMBOL(flow_get_by_cep);
 
@@ -1136,7 +1393,9 @@ __flow_put(struct flow_entry *entry, bool lock)
      * which would basically result into a double free. */
     if (!atomic_dec_and_test(&entry->refcnt)) {
         /* Flow is still being used by someone. */
-        FUNLOCK(dm);
+        if (lock) {
+            FUNLOCK(dm);
+        }
         return;
     }
 
@@ -1176,12 +1435,18 @@ __flow_put(struct flow_entry *entry, bool lock)
         return;
     }
 
-    /* Detach from tables. */
-    hash_del(&entry->node);
-    bitmap_clear(dm->port_id_bitmap, entry->local_port, 1);
+    /* Detach from tables. Lock-free readers may still be using the
+     * entry, so it is freed after a grace period. */
+    rl_flowtab_remove(&dm->flow_table, entry);
+    list_del_init(&entry->node_all);
+    rl_idalloc_put(&dm->port_ids, entry->local_port);
     if (ipcp->flags & RL_K_IPCP_USE_CEP_IDS) {
-        hash_del(&entry->node_cep);
-        bitmap_clear(dm->cep_id_bitmap, entry->local_cep, 1);
+        rl_flowtab_remove(&dm->flow_table_by_cep, entry);
+        rl_idalloc_put(&dm->cep_ids, entry->local_cep);
+        /* Invalidate the receive caches which may point to this entry.
+         * The removal must be visible before the new counter value. */
+        smp_wmb();
+        atomic_inc(&ipcp->flows_gen);
     }
 
     /* Enqueue into the remove list and schedule the work. */
@@ -1212,6 +1477,8 @@ flow_del(struct flow_entry *entry)
     ipcp       = entry->txrx.ipcp;
     upper_ipcp = entry->upper.ipcp;
 
+    trace_rlite_flow_dealloc(entry);
+
     if (ipcp->ops.flow_deallocated) {
         /* Kernel-space IPCP, handle the flow deallocation here. */
         ipcp->ops.flow_deallocated(ipcp, entry);
@@ -1221,6 +1488,7 @@ flow_del(struct flow_entry *entry)
         dtp_dump(dtp);
     }
     dtp_fini(dtp);
+    txrx_fini(&entry->txrx);
 
     /* dtp_fini() may print txrx.rx_qsize, so we purge the queue after
      * calling that function. */
@@ -1328,6 +1596,15 @@ flows_removew_func(struct work_struct *w)
     }
     FUNLOCK(dm);
 
+    if (list_empty(&removeq)) {
+        return;
+    }
+
+    /* Wait for the datapath to stop using the entries, which are already
+     * out of the flow tables. A single grace period covers the whole
+     * batch. */
+    synchronize_rcu();
+
     /* Destroy the entries without holding the lock (but still grab
      * the lock to modify flow->node_rm). */
     list_for_each_entry_safe (flow, tmp, &removeq, node_rm) {
@@ -1338,6 +1615,19 @@ flows_removew_func(struct work_struct *w)
     }
 }
 
+/* Free a flow entry that was never fully added. */
+static void
+flow_free_rcu(struct rcu_head *rcu)
+{
+    struct flow_entry *entry = container_of(rcu, struct flow_entry, rcu);
+
+    if (entry->local_appl)
+        rl_free(entry->local_appl, RL_MT_FLOW);
+    if (entry->remote_appl)
+        rl_free(entry->remote_appl, RL_MT_FLOW);
+    rl_free(entry, RL_MT_FLOW);
+}
+
 static int
 flow_add(struct ipcp_entry *ipcp, struct upper_ref upper, uint32_t event_id,
          const char *local_appl, const char *remote_appl,
@@ -1347,6 +1637,7 @@ flow_add(struct ipcp_entry *ipcp, struct upper_ref upper, uint32_t event_id,
 {
     struct rl_dm *dm = ipcp->dm;
     struct flow_entry *entry;
+    long port_id, cep_id;
     int ret = 0;
 
     if (ipcp->flags & RL_K_IPCP_ZOMBIE) {
@@ -1359,79 +1650,96 @@ flow_add(struct ipcp_entry *ipcp, struct upper_ref upper, uint32_t event_id,
         return -ENOMEM;
     }
 
-    FLOCK(dm);
-
-    /* Try to alloc a port id and a cep id from the bitmaps, cep
-     * ids being allocated only if needed. */
-    entry->local_port = bitmap_find_next_zero_area(
-        dm->port_id_bitmap, PORT_ID_BITMAP_SIZE, 0, 1, 0);
-    if (ipcp->flags & RL_K_IPCP_USE_CEP_IDS) {
-        entry->local_cep = bitmap_find_next_zero_area(
-            dm->cep_id_bitmap, CEP_ID_BITMAP_SIZE, 0, 1, 0);
-    } else {
-        entry->local_cep = 0;
+    /* Try to alloc a port id and a cep id, cep ids being allocated only
+     * if needed. Id allocation does not need the FLOCK. */
+    port_id = rl_idalloc_get(&dm->port_ids);
+    cep_id  = 0;
+    if (port_id >= 0 && (ipcp->flags & RL_K_IPCP_USE_CEP_IDS)) {
+        cep_id = rl_idalloc_get(&dm->cep_ids);
+        if (cep_id < 0) {
+            rl_idalloc_put(&dm->port_ids, port_id);
+            port_id = cep_id;
+        }
+    }
+    if (port_id < 0) {
+        rl_free(entry, RL_MT_FLOW);
+        *pentry = NULL;
+        return -ENOSPC;
     }
+    entry->local_port = port_id;
+    entry->local_cep  = cep_id;
 
-    if (entry->local_port < PORT_ID_BITMAP_SIZE &&
-        entry->local_cep < CEP_ID_BITMAP_SIZE) {
-        bitmap_set(dm->port_id_bitmap, entry->local_port, 1);
+    FLOCK(dm);
 
+    /* Build the flow entry. */
+    entry->local_appl  = rl_strdup(local_appl, GFP_ATOMIC, RL_MT_FLOW);
+    entry->remote_appl = rl_strdup(remote_appl, GFP_ATOMIC, RL_MT_FLOW);
+    entry->remote_port = RL_PORT_ID_NONE; /* Not valid. */
+    entry->remote_cep  = RL_PORT_ID_NONE; /* Not valid. */
+    entry->remote_addr = RL_ADDR_NULL;    /* Not valid. */
+    entry->qos_id      = 0;               /* default */
+    entry->upper       = upper;
+    if (upper.rc) {
+        get_file(upper.rc->file);
+    }
+    entry->event_id = event_id;
+    atomic_set(&entry->refcnt, 1); /* Cogito, ergo sum. */
+    entry->flags = RL_FLOW_PENDING | RL_FLOW_NEVER_BOUND;
+    memcpy(&entry->spec, flowspec, sizeof(*flowspec));
+    txrx_init(&entry->txrx, ipcp);
+    entry->uid = dm->uid_cnt++; /* generate an unique id */
+    INIT_LIST_HEAD(&entry->node_rm);
+    entry->expires = ~0U;
+    dtp_init(&entry->dtp);
+    rl_rx_cache_init(&entry->rx_cache);
+
+    /* Insert in the tables only now, since lock-free readers can find
+     * the entry as soon as it is inserted. */
+    ret = rl_flowtab_insert(&dm->flow_table, entry);
+    if (!ret && (ipcp->flags & RL_K_IPCP_USE_CEP_IDS)) {
+        ret = rl_flowtab_insert(&dm->flow_table_by_cep, entry);
+        if (ret) {
+            rl_flowtab_remove(&dm->flow_table, entry);
+        }
+    }
+    if (ret) {
+        PE("Failed to insert flow %u in the flow tables [%d]\n",
+           entry->local_port, ret);
+        FUNLOCK(dm);
+        rl_idalloc_put(&dm->port_ids, entry->local_port);
         if (ipcp->flags & RL_K_IPCP_USE_CEP_IDS) {
-            bitmap_set(dm->cep_id_bitmap, entry->local_cep, 1);
+            rl_idalloc_put(&dm->cep_ids, entry->local_cep);
         }
-
-        /* Build and insert a flow entry in the hash table. */
-        entry->local_appl  = rl_strdup(local_appl, GFP_ATOMIC, RL_MT_FLOW);
-        entry->remote_appl = rl_strdup(remote_appl, GFP_ATOMIC, RL_MT_FLOW);
-        entry->remote_port = RL_PORT_ID_NONE; /* Not valid. */
-        entry->remote_cep  = RL_PORT_ID_NONE; /* Not valid. */
-        entry->remote_addr = RL_ADDR_NULL;    /* Not valid. */
-        entry->qos_id      = 0;               /* default */
-        entry->upper       = upper;
         if (upper.rc) {
-            get_file(upper.rc->file);
-        }
-        entry->event_id = event_id;
-        atomic_set(&entry->refcnt, 1); /* Cogito, ergo sum. */
-        entry->flags = RL_FLOW_PENDING | RL_FLOW_NEVER_BOUND;
-        memcpy(&entry->spec, flowspec, sizeof(*flowspec));
-        txrx_init(&entry->txrx, ipcp);
-        hash_add(dm->flow_table, &entry->node, entry->local_port);
-        if (ipcp->flags & RL_K_IPCP_USE_CEP_IDS) {
-            hash_add(dm->flow_table_by_cep, &entry->node_cep, entry->local_cep);
+            fput(upper.rc->file);
         }
-        entry->uid = dm->uid_cnt++; /* generate an unique id */
-        INIT_LIST_HEAD(&entry->node_rm);
-        entry->expires = ~0U;
-        dtp_init(&entry->dtp);
+        call_rcu(&entry->rcu, flow_free_rcu);
+        *pentry = NULL;
 
-        atomic_inc(&entry->refcnt); /* on behalf of the caller */
-        PV("FLOWREFCNT %u = %u\n", entry->local_port,
-           atomic_read(&entry->refcnt));
+        return ret;
+    }
+    list_add_tail(&entry->node_all, &dm->flows);
 
-        /* Start the unbound timer */
-        flows_putq_add(entry, RL_UNBOUND_FLOW_TO);
-        FUNLOCK(dm);
+    atomic_inc(&entry->refcnt); /* on behalf of the caller */
+    PV("FLOWREFCNT %u = %u\n", entry->local_port,
+       atomic_read(&entry->refcnt));
 
-        PLOCK(dm);
-        ipcp->refcnt++;
-        PV("REFCNT++ %u: %u\n", ipcp->id, ipcp->refcnt);
-        PUNLOCK(dm);
+    /* Start the unbound timer */
+    flows_putq_add(entry, RL_UNBOUND_FLOW_TO);
+    FUNLOCK(dm);
 
-        if (flowcfg) {
-            memcpy(&entry->cfg, flowcfg, sizeof(entry->cfg));
-            if (ipcp->ops.flow_init) {
-                /* Let the IPCP do some
-                 * specific initialization. */
-                ipcp->ops.flow_init(ipcp, entry);
-            }
-        }
-    } else {
-        FUNLOCK(dm);
+    PLOCK(dm);
+    ipcp->refcnt++;
+    PV("REFCNT++ %u: %u\n", ipcp->id, ipcp->refcnt);
+    PUNLOCK(dm);
 
-        rl_free(entry, RL_MT_FLOW);
-        *pentry = NULL;
-        ret     = -ENOSPC;
+    if (flowcfg) {
+        memcpy(&entry->cfg, flowcfg, sizeof(entry->cfg));
+        if (ipcp->ops.flow_init) {
+            /* Let the IPCP do some
+             * specific initialization. */
+            ipcp->ops.flow_init(ipcp, entry);
+        }
     }
 
     return ret;
@@ -1441,12 +1749,9 @@ static void
 flow_rc_probe_references(struct rl_ctrl *rc)
 {
     struct flow_entry *flow;
-    struct hlist_node *tmp;
-    int bucket;
 
     FLOCK(rc->dm);
-    hash_for_each_safe(rc->dm->flow_table, bucket, tmp, flow, node)
-    {
+    list_for_each_entry (flow, &rc->dm->flows, node_all) {
         if (flow->upper.rc == rc) {
             PE("Flow %u has a dangling reference to rc %p\n", flow->local_port,
                rc);
@@ -1491,12 +1796,10 @@ bool
 rl_ipcp_has_flows(struct ipcp_entry *ipcp, bool report_all)
 {
     struct flow_entry *flow;
-    int bucket;
     bool has_flows = false;
 
     FRLOCK(ipcp->dm);
-    hash_for_each(ipcp->dm->flow_table, bucket, flow, node)
-    {
+    list_for_each_entry (flow, &ipcp->dm->flows, node_all) {
         if (flow->txrx.ipcp == ipcp) {
             has_flows = true;
             if (report_all) {
@@ -1866,7 +2169,6 @@ rl_flow_fetch(struct rl_ctrl *rc, struct rl_msg_base *b_req)
     struct rl_kmsg_flow_fetch *req = (struct rl_kmsg_flow_fetch *)b_req;
     struct flows_fetch_q_entry *fqe;
     struct flow_entry *entry;
-    int bucket;
     int ret = -ENOMEM;
 
     if (req->ipcp_id != 0xffff) {
@@ -1882,8 +2184,7 @@ rl_flow_fetch(struct rl_ctrl *rc, struct rl_msg_base *b_req)
     FLOCK(rc->dm);
 
     if (list_empty(&rc->flows_fetch_q)) {
-        hash_for_each(rc->dm->flow_table, bucket, entry, node)
-        {
+        list_for_each_entry (entry, &rc->dm->flows, node_all) {
             if (req->ipcp_id != 0xffff &&
                 entry->txrx.ipcp->id != req->ipcp_id) {
                 /* Filter out this flow as user asked only for flows
@@ -2381,7 +2682,7 @@ static int
 rl_ipcp_get_stats(struct rl_ctrl *rc, struct rl_msg_base *bmsg)
 {
     struct rl_kmsg_ipcp_stats_req *req = (struct rl_kmsg_ipcp_stats_req *)bmsg;
-    struct rl_kmsg_ipcp_stats_resp resp;
+    struct rl_kmsg_ipcp_stats_resp *resp;
     struct ipcp_entry *ipcp;
     int ret = -EINVAL; /* Report failure by default. */
 
@@ -2389,24 +2690,30 @@ rl_ipcp_get_stats(struct rl_ctrl *rc, struct rl_msg_base *bmsg)
     if (ipcp) {
         int cpu;
 
-        memset(&resp, 0, sizeof(resp));
-        resp.hdr.msg_type = RLITE_KER_IPCP_STATS_RESP;
-        resp.hdr.event_id = req->hdr.event_id;
+        /* Too large for the stack, because of the latency histograms. */
+        resp = rl_alloc(sizeof(*resp), GFP_KERNEL | __GFP_ZERO, RL_MT_MISC);
+        if (!resp) {
+            ipcp_put(ipcp);
+            return -ENOMEM;
+        }
+        resp->hdr.msg_type = RLITE_KER_IPCP_STATS_RESP;
+        resp->hdr.event_id = req->hdr.event_id;
         /* Collect stats from all the CPUs. */
         for_each_possible_cpu(cpu)
         {
             struct rl_ipcp_stats *cpustats = per_cpu_ptr(ipcp->stats, cpu);
-            unsigned num   = sizeof(resp.stats) / sizeof(resp.stats.tx_pkt);
+            unsigned num   = sizeof(resp->stats) / sizeof(resp->stats.tx_pkt);
             uint64_t *ssrc = (uint64_t *)cpustats;
-            uint64_t *sdst = (uint64_t *)&resp.stats;
+            uint64_t *sdst = (uint64_t *)&resp->stats;
             unsigned i;
 
             for (i = 0; i < num; i++, sdst++, ssrc++) {
                 *sdst += *ssrc;
             }
         }
-        ret = rl_upqueue_append(rc, (const struct rl_msg_base *)&resp, false);
-        rl_msg_free(rl_ker_numtables, RLITE_KER_MSG_MAX, RLITE_MB(&resp));
+        ret = rl_upqueue_append(rc, (const struct rl_msg_base *)resp, false);
+        rl_msg_free(rl_ker_numtables, RLITE_KER_MSG_MAX, RLITE_MB(resp));
+        rl_free(resp, RL_MT_MISC);
     }
     ipcp_put(ipcp);
 
@@ -2527,6 +2834,7 @@ rl_flow_get_stats(struct rl_ctrl *rc, struct rl_msg_base *bmsg)
 
     /* Copy in rl_io device stats. */
     memcpy(&resp.stats, &flow->stats, sizeof(resp.stats));
+    resp.stats.rx_wakeups = atomic64_read(&flow->txrx.rx_wakeups);
 
     /* Copy in DTP state. */
     resp.dtp.snd_lwe                = dtp->snd_lwe;
@@ -2944,6 +3252,7 @@ rl_fa_resp(struct rl_ctrl *rc, struct rl_msg_base *bmsg)
     }
     spin_unlock_bh(&flow_entry->txrx.rx_lock);
     if (resp->response == 0) {
+        trace_rlite_flow_alloc(flow_entry);
         fput(rc->file);
     }
 
@@ -3121,6 +3430,7 @@ rl_fa_resp_arrived(struct ipcp_entry *ipcp, rl_port_t local_port,
     ret = rl_append_allocate_flow_resp_arrived(rc, flow_entry->event_id,
                                                local_port, response, maysleep);
     if (response == 0) {
+        trace_rlite_flow_alloc(flow_entry);
         fput(rc->file);
     }
 
@@ -3154,6 +3464,28 @@ rl_memtrack_dump(struct rl_ctrl *rc, struct rl_msg_base *bmsg)
 }
 #endif /* RL_MEMTRACK */
 
+static int
+rl_memtrack_stats(struct rl_ctrl *rc, struct rl_msg_base *bmsg)
+{
+    struct rl_kmsg_memtrack_stats_resp *resp;
+    int ret;
+
+    resp = rl_alloc(sizeof(*resp), GFP_KERNEL | __GFP_ZERO, RL_MT_MISC);
+    if (!resp) {
+        return -ENOMEM;
+    }
+
+    resp->hdr.msg_type = RLITE_KER_MEMTRACK_STATS_RESP;
+    resp->hdr.event_id = bmsg->hdr.event_id;
+#ifdef RL_MEMTRACK
+    resp->num = rl_memtrack_get_stats(resp->stats, RL_MEMTRACK_MAX_TYPES);
+#endif /* RL_MEMTRACK */
+    ret = rl_upqueue_append(rc, RLITE_MB(resp), false);
+    rl_free(resp, RL_MT_MISC);
+
+    return ret;
+}
+
 /* The table containing all the message handlers. */
 static rl_msg_handler_t rl_ctrl_handlers[] = {
     [RLITE_KER_IPCP_CREATE]           = rl_ipcp_create,
@@ -3184,7 +3516,8 @@ static rl_msg_handler_t rl_ctrl_handlers[] = {
 #ifdef RL_MEMTRACK
     [RLITE_KER_MEMTRACK_DUMP] = rl_memtrack_dump,
 #endif /* RL_MEMTRACK */
-    [RLITE_KER_MSG_MAX] = NULL,
+    [RLITE_KER_MEMTRACK_STATS_REQ] = rl_memtrack_stats,
+    [RLITE_KER_MSG_MAX]            = NULL,
 };
 
 static ssize_t
@@ -3200,6 +3533,12 @@ rl_ctrl_write(struct file *f, const char __user *ubuf, size_t len, loff_t *ppos)
         return -EINVAL;
     }
 
+    /* Requests are usually answered through the upqueue: allocate it
+     * here, where we can sleep. */
+    if (rl_upqueue_alloc(rc, GFP_KERNEL)) {
+        return -ENOMEM;
+    }
+
     kbuf = rl_alloc(len, GFP_KERNEL, RL_MT_MISC);
     if (!kbuf) {
         return -ENOMEM;
@@ -3268,63 +3607,102 @@ static ssize_t
 rl_ctrl_read(struct file *f, char __user *buf, size_t len, loff_t *ppos)
 {
     DECLARE_WAITQUEUE(wait, current);
-    struct upqueue_entry *entry;
     struct rl_ctrl *rc = (struct rl_ctrl *)f->private_data;
     bool blocking      = !(f->f_flags & O_NONBLOCK);
-    int ret            = 0;
+    bool batch         = rc->flags & RL_F_BATCH;
+    unsigned int head, tail;
+    size_t copied = 0;
+    int ret       = 0;
+
+    if (mutex_lock_interruptible(&rc->upqueue_rlock)) {
+        return -ERESTARTSYS;
+    }
 
     if (blocking) {
         add_wait_queue(&rc->upqueue_wqh, &wait);
     }
-    while (len) {
+    for (;;) {
         set_current_state(TASK_INTERRUPTIBLE);
 
         spin_lock(&rc->upqueue_lock);
-        if (list_empty(&rc->upqueue)) {
-            /* No pending messages? Let's sleep. */
-            spin_unlock(&rc->upqueue_lock);
+        head = rc->upq_head;
+        tail = rc->upq_tail;
+        spin_unlock(&rc->upqueue_lock);
+        if (head != tail) {
+            break;
+        }
 
-            if (signal_pending(current)) {
-                ret = -ERESTARTSYS;
-                break;
-            }
+        /* No pending messages? Let's sleep. */
+        if (signal_pending(current)) {
+            ret = -ERESTARTSYS;
+            break;
+        }
 
-            if (!blocking) {
-                ret = -EAGAIN;
-                break;
-            }
+        if (!blocking) {
+            ret = -EAGAIN;
+            break;
+        }
 
-            schedule();
+        schedule();
+    }
+    __set_current_state(TASK_RUNNING);
+    if (blocking) {
+        remove_wait_queue(&rc->upqueue_wqh, &wait);
+    }
+
+    /* We are the only reader, and producers only append after tail, so
+     * the records in [head, tail) can be copied without the spinlock. */
+    while (ret == 0 && head != tail) {
+        struct rl_msg_rec_hdr *rec = upq_rec(rc, head);
+        unsigned int reclen;
+
+        if (rec->len == RL_UPQ_WRAP) {
+            head += RL_UPQUEUE_SIZE_MAX - (head & (RL_UPQUEUE_SIZE_MAX - 1));
             continue;
         }
 
-        entry = list_first_entry(&rc->upqueue, struct upqueue_entry, node);
-        if (len < entry->serlen) {
-            /* Not enough space? Don't pop the entry from the upqueue. */
-            ret = -ENOBUFS;
-        } else if (unlikely(copy_to_user(buf, entry->sermsg, entry->serlen))) {
-            ret = -EFAULT;
-        } else {
-            ret = entry->serlen;
-            *ppos += ret;
+        reclen = RL_MSG_REC_SIZE(rec->len);
+        if (!batch) {
+            /* One message per read, without the record header. */
+            if (len < rec->len) {
+                ret = -ENOBUFS;
+            } else if (unlikely(copy_to_user(buf, rec + 1, rec->len))) {
+                ret = -EFAULT;
+            } else {
+                copied = rec->len;
+                head += reclen;
+            }
+            break;
+        }
 
-            /* Unlink and free the upqueue entry and the associated message. */
-            list_del_init(&entry->node);
-            rc->upqueue_size -= upqentry_size(entry);
-            rl_free(entry->sermsg, RL_MT_UPQ);
-            rl_free(entry, RL_MT_UPQ);
+        if (copied + reclen > len) {
+            if (copied == 0) {
+                /* Not even the first record fits. */
+                ret = -ENOBUFS;
+            }
+            break;
+        }
+        if (unlikely(copy_to_user(buf + copied, rec, reclen))) {
+            ret = -EFAULT;
+            break;
         }
+        copied += reclen;
+        head += reclen;
+    }
 
+    if (copied > 0) {
+        /* Release the space to the producers. Records copied before a
+         * fault are consumed anyway. */
+        spin_lock(&rc->upqueue_lock);
+        rc->upq_head = head;
         spin_unlock(&rc->upqueue_lock);
-        break;
+        *ppos += copied;
+        ret = copied;
     }
 
-    __set_current_state(TASK_RUNNING);
-    if (blocking) {
-        remove_wait_queue(&rc->upqueue_wqh, &wait);
-    }
+    mutex_unlock(&rc->upqueue_rlock);
 
-    if (ret > 0) {
+    if (copied > 0) {
         /* Some space was freed up in the upqueue: wake up processes
          * blocked on rl_upqueue_append(). */
         wake_up_interruptible_poll(&rc->upqueue_wqh,
@@ -3343,7 +3721,7 @@ rl_ctrl_poll(struct file *f, poll_table *wait)
     poll_wait(f, &rc->upqueue_wqh, wait);
 
     spin_lock(&rc->upqueue_lock);
-    if (!list_empty(&rc->upqueue)) {
+    if (rc->upq_head != rc->upq_tail) {
         mask |= POLLIN | POLLRDNORM;
     }
     spin_unlock(&rc->upqueue_lock);
@@ -3400,9 +3778,9 @@ rl_ctrl_open(struct inode *inode, struct file *f)
 
     f->private_data = rc;
     rc->file        = f;
-    INIT_LIST_HEAD(&rc->upqueue);
-    rc->upqueue_size = 0;
+    rc->upq_head    = rc->upq_tail = 0;
     spin_lock_init(&rc->upqueue_lock);
+    mutex_init(&rc->upqueue_rlock);
     init_waitqueue_head(&rc->upqueue_wqh);
 
     INIT_LIST_HEAD(&rc->flows_fetch_q);
@@ -3432,16 +3810,8 @@ rl_ctrl_release(struct inode *inode, struct file *f)
     application_del_by_rc(rc);
     flow_rc_probe_references(rc);
 
-    /* Drain upqueue. */
-    {
-        struct upqueue_entry *ue, *uet;
-
-        list_for_each_entry_safe (ue, uet, &rc->upqueue, node) {
-            list_del_init(&ue->node);
-            rl_free(ue->sermsg, RL_MT_UPQ);
-            rl_free(ue, RL_MT_UPQ);
-        }
-    }
+    /* Drop the pending messages. */
+    rl_free(rc->upqueue, RL_MT_UPQ);
 
     /* Drain flows-fetch queue. */
     {
@@ -3535,8 +3905,8 @@ extern struct miscdevice rl_io_misc;
 static bool
 rl_dm_empty(struct rl_dm *dm)
 {
-    return hash_empty(dm->ipcp_table) && hash_empty(dm->flow_table) &&
-           hash_empty(dm->flow_table_by_cep) && list_empty(&dm->difs) &&
+    return hash_empty(dm->ipcp_table) && list_empty(&dm->flows) &&
+           list_empty(&dm->difs) &&
            list_empty(&dm->ctrl_devs) && list_empty(&dm->appl_removeq) &&
            !work_pending(&dm->appl_removew) &&
            !timer_pending(&dm->flows_putq_tmr) &&
@@ -3588,10 +3958,19 @@ rl_dm_get(void)
 
     bitmap_zero(dm->ipcp_id_bitmap, IPCP_ID_BITMAP_SIZE);
     hash_init(dm->ipcp_table);
-    bitmap_zero(dm->port_id_bitmap, PORT_ID_BITMAP_SIZE);
-    hash_init(dm->flow_table);
-    bitmap_zero(dm->cep_id_bitmap, CEP_ID_BITMAP_SIZE);
-    hash_init(dm->flow_table_by_cep);
+    if (rl_idalloc_init(&dm->port_ids, PORT_ID_BITMAP_SIZE)) {
+        goto err0;
+    }
+    if (rl_idalloc_init(&dm->cep_ids, CEP_ID_BITMAP_SIZE)) {
+        goto err1;
+    }
+    if (rl_flowtab_init(&dm->flow_table, /*by_cep=*/false)) {
+        goto err2;
+    }
+    if (rl_flowtab_init(&dm->flow_table_by_cep, /*by_cep=*/true)) {
+        goto err3;
+    }
+    INIT_LIST_HEAD(&dm->flows);
     mutex_init(&dm->general_lock);
     rwlock_init(&dm->flows_lock);
     spin_lock_init(&dm->ipcps_lock);
@@ -3619,6 +3998,18 @@ rl_dm_get(void)
     PD("Data model created for namespace %p\n", net);
 
     return dm;
+
+err3:
+    rl_flowtab_fini(&dm->flow_table);
+err2:
+    rl_idalloc_fini(&dm->cep_ids);
+err1:
+    rl_idalloc_fini(&dm->port_ids);
+err0:
+    rl_free(dm, RL_MT_DM);
+    mutex_unlock(&rl_global.lock);
+
+    return NULL;
 }
 
 static struct rl_dm *
@@ -3654,6 +4045,10 @@ rl_dm_put(struct rl_dm *dm)
     cancel_work_sync(&dm->flows_removew);
     cancel_work_sync(&dm->appl_removew);
     BUG_ON(!rl_dm_empty(dm));
+    rl_flowtab_fini(&dm->flow_table_by_cep);
+    rl_flowtab_fini(&dm->flow_table);
+    rl_idalloc_fini(&dm->cep_ids);
+    rl_idalloc_fini(&dm->port_ids);
     put_net(dm->net);
     PD("Data model for namespace %p destroyed\n", dm->net);
     dm->net = NULL;
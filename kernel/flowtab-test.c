@@ -0,0 +1,321 @@
+/*
+ * Self-test and benchmark for the flow tables and the flow id allocator.
+ *
+ * Copyright (C) 2026 agent
+ * Author: agent <agent@local>
+ *
+ * This file is part of rlite.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+/*
+ * Loading this module fills a flow table with 1k, 10k and 60k flows and
+ * measures the cost of a lookup, comparing the lock-free lookup used by
+ * the datapath with a lookup done under a read-write lock with a reference
+ * taken and released on the flow (which is what the datapath used to do).
+ * With the same number of live flows, it then measures the cost of flow
+ * churn (release of a random flow and allocation of a new one), comparing
+ * the id allocator with a first-fit bitmap search.
+ * Results are printed to the kernel log, e.g.
+ *
+ *     # insmod rlite-flowtab-test.ko && rmmod rlite-flowtab-test
+ *     # dmesg | grep flowtab
+ */
+
+#include <linux/types.h>
+#include "rlite/utils.h"
+#include "rlite-kernel.h"
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/ktime.h>
+#include <linux/rcupdate.h>
+#include <linux/spinlock.h>
+
+static unsigned int lookups = 2000000;
+module_param(lookups, uint, 0444);
+MODULE_PARM_DESC(lookups, "Number of lookups for each measurement");
+
+static unsigned int churns = 200000;
+module_param(churns, uint, 0444);
+MODULE_PARM_DESC(churns, "Number of flow replacements for each measurement");
+
+static const unsigned int sizes[] = {1000, 10000, 60000};
+
+static DEFINE_RWLOCK(test_lock);
+
+/* Cheap pseudo-random generator, to look up flows in random order without
+ * measuring the cost of a better generator. */
+static inline uint32_t
+lcg_next(uint32_t *state)
+{
+    *state = *state * 1103515245U + 12345U;
+    return *state >> 8;
+}
+
+static int
+flowtab_run(struct rl_flowtab *tab, struct flow_entry **flows, unsigned int n)
+{
+    unsigned long long ns_rcu, ns_locked;
+    unsigned int found = 0;
+    uint32_t rnd = 1;
+    ktime_t t_start;
+    unsigned int i;
+    int ret;
+
+    for (i = 0; i < n; i++) {
+        ret = rl_flowtab_insert(tab, flows[i]);
+        if (ret) {
+            PE("Failed to insert flow %u [%d]\n", i, ret);
+            n = i;
+            goto out;
+        }
+    }
+
+    /* All the flows must be there, and nothing else. */
+    rcu_read_lock();
+    for (i = 0; i < n; i++) {
+        if (rl_flowtab_lookup(tab, flows[i]->local_port) != flows[i]) {
+            rcu_read_unlock();
+            PE("Lookup of flow %u failed\n", flows[i]->local_port);
+            ret = -EINVAL;
+            goto out;
+        }
+    }
+    if (rl_flowtab_lookup(tab, n)) {
+        rcu_read_unlock();
+        PE("Lookup of a missing flow succeeded\n");
+        ret = -EINVAL;
+        goto out;
+    }
+    rcu_read_unlock();
+
+    /* Lock-free lookups, like rl_normal_sdu_rx() does. */
+    t_start = ktime_get();
+    for (i = 0; i < lookups; i++) {
+        struct flow_entry *flow;
+
+        rcu_read_lock();
+        flow = rl_flowtab_lookup(tab, lcg_next(&rnd) % n);
+        found += flow != NULL;
+        rcu_read_unlock();
+    }
+    ns_rcu = ktime_to_ns(ktime_sub(ktime_get(), t_start));
+
+    /* Lookups under a read lock, taking and dropping a reference. */
+    t_start = ktime_get();
+    for (i = 0; i < lookups; i++) {
+        struct flow_entry *flow;
+
+        read_lock_bh(&test_lock);
+        flow = rl_flowtab_lookup(tab, lcg_next(&rnd) % n);
+        if (flow) {
+            atomic_inc(&flow->refcnt);
+        }
+        read_unlock_bh(&test_lock);
+        if (flow) {
+            found++;
+            atomic_dec(&flow->refcnt);
+        }
+    }
+    ns_locked = ktime_to_ns(ktime_sub(ktime_get(), t_start));
+
+    if (found != 2 * lookups) {
+        PE("Only %u lookups out of %u succeeded\n", found, 2 * lookups);
+        ret = -EINVAL;
+        goto out;
+    }
+
+    printk(KERN_INFO "flowtab: %6u flows: %4llu ns/lookup lock-free, "
+                     "%4llu ns/lookup with lock and refcount\n",
+           n, ns_rcu / lookups, ns_locked / lookups);
+    ret = 0;
+out:
+    for (i = 0; i < n; i++) {
+        rl_flowtab_remove(tab, flows[i]);
+    }
+
+    return ret;
+}
+
+#define TEST_ID_SPACE 65535
+
+/* Flow churn with @n live flows: each iteration removes a random flow from
+ * the table, releasing its id, and adds a new flow with a new id. */
+static int
+churn_run(struct rl_flowtab *tab, struct flow_entry **flows, unsigned int n)
+{
+    unsigned long *bitmap = NULL;
+    unsigned long long ns_ida, ns_ff;
+    struct rl_idalloc ida;
+    uint32_t rnd = 1;
+    ktime_t t_start;
+    unsigned int i;
+    long id;
+    int ret;
+
+    ret = rl_idalloc_init(&ida, TEST_ID_SPACE);
+    if (ret) {
+        return ret;
+    }
+    for (i = 0; i < n; i++) {
+        id = rl_idalloc_get(&ida);
+        if (id != i) {
+            PE("Unexpected id %ld (expected %u)\n", id, i);
+            if (id >= 0) {
+                rl_idalloc_put(&ida, id);
+            }
+            n   = i;
+            ret = -EINVAL;
+            goto drain;
+        }
+        flows[i]->local_port = id;
+        rl_flowtab_insert(tab, flows[i]);
+    }
+
+    t_start = ktime_get();
+    for (i = 0; i < churns; i++) {
+        struct flow_entry *flow = flows[lcg_next(&rnd) % n];
+        unsigned long old = flow->local_port;
+
+        rl_flowtab_remove(tab, flow);
+        rl_idalloc_put(&ida, old);
+        id = rl_idalloc_get(&ida);
+        BUG_ON(id < 0); /* we have just released one */
+        flow->local_port = id;
+        rl_flowtab_insert(tab, flow);
+        if (id == old) {
+            /* A released id must not be reused immediately. */
+            PE("Id %lu reused too early\n", old);
+            ret = -EINVAL;
+            break;
+        }
+    }
+    ns_ida = ktime_to_ns(ktime_sub(ktime_get(), t_start));
+drain:
+    for (i = 0; i < n; i++) {
+        rl_flowtab_remove(tab, flows[i]);
+        rl_idalloc_put(&ida, flows[i]->local_port);
+    }
+    if (ret) {
+        goto out;
+    }
+
+    /* The same, allocating the first free id under a write lock. */
+    bitmap = vzalloc(BITS_TO_LONGS(TEST_ID_SPACE) * sizeof(unsigned long));
+    if (!bitmap) {
+        ret = -ENOMEM;
+        goto out;
+    }
+    for (i = 0; i < n; i++) {
+        __set_bit(i, bitmap);
+        flows[i]->local_port = i;
+        rl_flowtab_insert(tab, flows[i]);
+    }
+
+    t_start = ktime_get();
+    for (i = 0; i < churns; i++) {
+        struct flow_entry *flow = flows[lcg_next(&rnd) % n];
+
+        write_lock_bh(&test_lock);
+        rl_flowtab_remove(tab, flow);
+        __clear_bit(flow->local_port, bitmap);
+        flow->local_port =
+            bitmap_find_next_zero_area(bitmap, TEST_ID_SPACE, 0, 1, 0);
+        __set_bit(flow->local_port, bitmap);
+        rl_flowtab_insert(tab, flow);
+        write_unlock_bh(&test_lock);
+    }
+    ns_ff = ktime_to_ns(ktime_sub(ktime_get(), t_start));
+    for (i = 0; i < n; i++) {
+        rl_flowtab_remove(tab, flows[i]);
+    }
+
+    printk(KERN_INFO "flowtab: %6u flows: %4llu ns/churn with id allocator, "
+                     "%4llu ns/churn with first-fit\n",
+           n, ns_ida / churns, ns_ff / churns);
+out:
+    if (bitmap) {
+        vfree(bitmap);
+    }
+    rl_idalloc_fini(&ida);
+
+    return ret;
+}
+
+static int __init
+rl_flowtab_test_init(void)
+{
+    unsigned int n = sizes[ARRAY_SIZE(sizes) - 1];
+    struct flow_entry **flows;
+    struct rl_flowtab tab;
+    unsigned int i;
+    int ret;
+
+    if (lookups == 0 || churns == 0) {
+        return -EINVAL;
+    }
+
+    flows = vzalloc(n * sizeof(*flows));
+    if (!flows) {
+        return -ENOMEM;
+    }
+
+    for (i = 0; i < n; i++) {
+        flows[i] = kzalloc(sizeof(*flows[i]), GFP_KERNEL);
+        if (!flows[i]) {
+            ret = -ENOMEM;
+            goto out;
+        }
+        flows[i]->local_port = i;
+        atomic_set(&flows[i]->refcnt, 1);
+    }
+
+    ret = rl_flowtab_init(&tab, /*by_cep=*/false);
+    if (ret) {
+        goto out;
+    }
+
+    for (i = 0; i < ARRAY_SIZE(sizes) && !ret; i++) {
+        ret = flowtab_run(&tab, flows, sizes[i]);
+    }
+    for (i = 0; i < ARRAY_SIZE(sizes) && !ret; i++) {
+        ret = churn_run(&tab, flows, sizes[i]);
+    }
+
+    rl_flowtab_fini(&tab);
+out:
+    /* Nobody else could see the entries, no need to wait for readers. */
+    for (i = 0; i < n && flows[i]; i++) {
+        kfree(flows[i]);
+    }
+    vfree(flows);
+
+    return ret;
+}
+
+static void __exit
+rl_flowtab_test_fini(void)
+{
+}
+
+module_init(rl_flowtab_test_init);
+module_exit(rl_flowtab_test_fini);
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Vincenzo Maffione <v.maffione@gmail.com>");
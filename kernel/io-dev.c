@@ -22,6 +22,7 @@
 #include "rlite/kernel-msg.h"
 #include "rlite/utils.h"
 #include "rlite-kernel.h"
+#include "rlite-trace.h"
 
 #include <linux/module.h>
 #include <linux/aio.h>
@@ -38,6 +39,7 @@
 #include <linux/spinlock.h>
 #include <linux/uio.h>
 #include <linux/compat.h>
+#include <linux/splice.h>
 
 static LIST_HEAD(rl_iodevs);
 static DEFINE_MUTEX(rl_iodevs_lock);
@@ -65,12 +67,79 @@ hms_time(void)
 /* Userspace queue threshold in bytes. */
 #define RL_RXQ_SIZE_MAX (1 << 20)
 
+/* Reader wakeup coalescing. An SDU queued to an empty receive queue wakes
+ * up the reader immediately. Further SDUs queued before the reader drains
+ * the queue wake it up once rx_coalesce_sdus of them are pending, or when
+ * rx_coalesce_usecs elapse. With rx_coalesce_usecs set to 0, the reader is
+ * woken up for each SDU. */
+static unsigned int rx_coalesce_usecs = 20;
+module_param(rx_coalesce_usecs, uint, 0644);
+MODULE_PARM_DESC(rx_coalesce_usecs,
+                 "Maximum delay of a coalesced reader wakeup (us)");
+
+static unsigned int rx_coalesce_sdus = 32;
+module_param(rx_coalesce_sdus, uint, 0644);
+MODULE_PARM_DESC(rx_coalesce_sdus,
+                 "Number of queued SDUs that forces a reader wakeup");
+
+/* Default for RLITE_IOCTL_BUSY_POLL. */
+static unsigned int rx_busy_poll_usecs = 0;
+module_param(rx_busy_poll_usecs, uint, 0644);
+MODULE_PARM_DESC(rx_busy_poll_usecs,
+                 "Busy-poll time of blocking reads before sleeping (us)");
+
+static void
+rl_rx_wake(struct txrx *txrx)
+{
+    /* Readers and pollers add themselves to rx_wqh before checking rx_q
+     * under rx_lock, so they cannot be missed here, and we can avoid
+     * taking the waitqueue lock when nobody is waiting. */
+    if (waitqueue_active(&txrx->rx_wqh)) {
+        atomic64_inc(&txrx->rx_wakeups);
+        wake_up_interruptible_poll(&txrx->rx_wqh,
+                                   POLLIN | POLLRDNORM | POLLRDBAND);
+    }
+}
+
+enum hrtimer_restart
+rl_rx_wake_tmr_cb(struct hrtimer *tmr)
+{
+    rl_rx_wake(container_of(tmr, struct txrx, rx_wake_tmr));
+
+    return HRTIMER_NORESTART;
+}
+
+/* Called under rx_lock after an SDU has been queued. Returns true if the
+ * reader must be woken up now. */
+static bool
+rl_rx_wake_now(struct txrx *txrx, bool was_empty)
+{
+    unsigned int usecs = READ_ONCE(rx_coalesce_usecs);
+
+    if (usecs == 0 || was_empty ||
+        ++txrx->rx_pending >= READ_ONCE(rx_coalesce_sdus)) {
+        txrx->rx_pending = 0;
+        return true;
+    }
+
+    if (!hrtimer_is_queued(&txrx->rx_wake_tmr)) {
+        hrtimer_start(&txrx->rx_wake_tmr,
+                      ns_to_ktime((uint64_t)usecs * NSEC_PER_USEC),
+                      HRTIMER_MODE_REL);
+    }
+
+    return false;
+}
+
 int
 rl_sdu_rx_flow(struct ipcp_entry *ipcp, struct flow_entry *flow,
                struct rl_buf *rb, bool qlimit)
 {
     struct ipcp_entry *upper_ipcp = flow->upper.ipcp;
     struct txrx *txrx;
+    bool wake = false;
+
+    trace_rlite_sdu_rx(flow, rb->len);
 
     if (upper_ipcp) {
         /* The flow is used by an upper IPCP. */
@@ -97,15 +166,22 @@ rl_sdu_rx_flow(struct ipcp_entry *ipcp, struct flow_entry *flow,
             (long unsigned)rb->len);
         flow->stats.rx_overrun_pkt++;
         flow->stats.rx_overrun_byte += rb->len;
+        trace_rlite_pdu_drop(ipcp, flow, rb->len, RL_DROP_RX_OVERRUN);
         rl_buf_free(rb);
     } else {
+        bool was_empty = rb_list_empty(&txrx->rx_q);
+
+        rl_buf_tstamp(rb);
         rb_list_enq(rb, &txrx->rx_q);
         txrx->rx_qsize += rl_buf_truesize(rb);
         flow->stats.rx_pkt++;
         flow->stats.rx_byte += rb->len;
+        wake = rl_rx_wake_now(txrx, was_empty);
     }
     spin_unlock_bh(&txrx->rx_lock);
-    wake_up_interruptible_poll(&txrx->rx_wqh, POLLIN | POLLRDNORM | POLLRDBAND);
+    if (wake) {
+        rl_rx_wake(txrx);
+    }
 
     return 0;
 }
@@ -114,16 +190,19 @@ EXPORT_SYMBOL(rl_sdu_rx_flow);
 int
 rl_sdu_rx(struct ipcp_entry *ipcp, struct rl_buf *rb, rl_port_t local_port)
 {
-    struct flow_entry *flow = flow_get(ipcp->dm, local_port);
+    struct flow_entry *flow;
     int ret;
 
+    rcu_read_lock();
+    flow = flow_lookup_rcu(ipcp->dm, local_port);
     if (!flow) {
+        rcu_read_unlock();
         rl_buf_free(rb);
         return -ENXIO;
     }
 
     ret = rl_sdu_rx_flow(ipcp, flow, rb, true);
-    flow_put(flow);
+    rcu_read_unlock();
 
     return ret;
 }
@@ -172,6 +251,7 @@ struct rl_io {
     uint8_t mode;
     struct flow_entry *flow;
     struct txrx *txrx;
+    unsigned int busy_poll_usecs;
 
     struct list_head node;
 };
@@ -187,7 +267,8 @@ rl_io_open(struct inode *inode, struct file *f)
         return -ENOMEM;
     }
 
-    f->private_data = rio;
+    rio->busy_poll_usecs = READ_ONCE(rx_busy_poll_usecs);
+    f->private_data      = rio;
     IODEVS_LOCK();
     list_add_tail(&rio->node, &rl_iodevs);
     IODEVS_UNLOCK();
@@ -218,6 +299,7 @@ rl_io_write_iter(struct kiocb *iocb,
     size_t tot     = 0;
     unsigned flags = (f->f_flags & O_NONBLOCK) ? 0 : RL_RMT_F_MAYSLEEP;
     bool mgmt_sdu;
+    bool frag           = false;
     bool something_sent = false;
     DECLARE_WAITQUEUE(wait, current);
     ssize_t ret = 0;
@@ -251,13 +333,33 @@ rl_io_write_iter(struct kiocb *iocb,
 
     if (unlikely((mgmt_sdu || flow->cfg.msg_boundaries) &&
                  left > ipcp->max_sdu_size)) {
-        /* We cannot split the write(): message boundaries need to be handled
-         * by EFCP fragmentation and reassembly. */
-        return -EMSGSIZE;
+        /* We cannot simply split the write(), as message boundaries need
+         * to be preserved. The IPCP may fragment the SDU, and have the
+         * receiver reassemble it, but only on in-order flows. */
+        if (mgmt_sdu || !(ipcp->flags & RL_K_IPCP_FRAGMENTATION) ||
+            !flow->cfg.in_order_delivery || left > RL_SDU_REASM_MAX) {
+            return -EMSGSIZE;
+        }
+        frag = true;
+
+        /* A non-blocking write must send the whole SDU or nothing: check
+         * in advance that the flow can take all the fragments. */
+        if (!(flags & RL_RMT_F_MAYSLEEP) && ipcp->ops.flow_writeable_frags &&
+            !ipcp->ops.flow_writeable_frags(
+                flow, DIV_ROUND_UP(left, ipcp->max_sdu_size), left)) {
+            return -EAGAIN;
+        }
     }
 
     while (left) {
         size_t copylen = min(left, (size_t)ipcp->max_sdu_size);
+        unsigned fflags = 0;
+
+        if (unlikely(frag)) {
+            fflags = !something_sent ? RL_RMT_F_FRAG_FIRST
+                                     : (copylen == left ? RL_RMT_F_FRAG_LAST
+                                                        : RL_RMT_F_FRAG_MIDDLE);
+        }
 
         rb = rl_buf_alloc(copylen, ipcp->txhdroom, ipcp->tailroom, GFP_KERNEL);
         if (unlikely(!rb)) {
@@ -310,6 +412,8 @@ rl_io_write_iter(struct kiocb *iocb,
             flow = lower_flow;
         }
 
+        rl_buf_tstamp(rb);
+
         /* Write to the flow, sleeping if needed. This can be a management write
          * (to an N-1 flow) or an application write (to an N-flow). */
         if (flags & RL_RMT_F_MAYSLEEP) {
@@ -319,7 +423,7 @@ rl_io_write_iter(struct kiocb *iocb,
         for (;;) {
             set_current_state(TASK_INTERRUPTIBLE);
 
-            ret = ipcp->ops.sdu_write(ipcp, flow, rb, flags);
+            ret = ipcp->ops.sdu_write(ipcp, flow, rb, flags | fflags);
 
             if (ret == -EAGAIN) {
                 if (signal_pending(current)) {
@@ -360,11 +464,35 @@ rl_io_write_iter(struct kiocb *iocb,
         tot += copylen;
         flow->stats.tx_pkt++;
         flow->stats.tx_byte += copylen;
+        trace_rlite_sdu_tx(flow, copylen);
+    }
+
+    if (unlikely(frag && left)) {
+        /* The SDU was only partially sent (e.g. because a concurrent
+         * writer took the room checked above), and the receiver will
+         * discard it. Report the error rather than a short write. */
+        return ret;
     }
 
     return something_sent ? tot : ret;
 }
 
+/* Spin until something is queued to @txrx, for at most @usecs. */
+static void
+rl_io_busy_poll(struct txrx *txrx, unsigned int usecs)
+{
+    uint64_t end = rl_lat_now() + (uint64_t)usecs * NSEC_PER_USEC;
+
+    /* Unlocked peek, the caller checks again under rx_lock. */
+    while (rb_list_empty(&txrx->rx_q) &&
+           !(READ_ONCE(txrx->flags) & RL_TXRX_EOF)) {
+        if (need_resched() || signal_pending(current) || rl_lat_now() > end) {
+            break;
+        }
+        cpu_relax();
+    }
+}
+
 static ssize_t
 rl_io_read_iter(struct kiocb *iocb,
 #ifdef RL_HAVE_CHRDEV_RW_ITER
@@ -385,7 +513,8 @@ rl_io_read_iter(struct kiocb *iocb,
 #else  /* AIO_RW */
     size_t ulen = iov_length(to, iov_cnt);
 #endif /* AIO_RW */
-    ssize_t ret = 0;
+    bool busy_poll = blocking && rio->busy_poll_usecs;
+    ssize_t ret    = 0;
 
     if (unlikely(!txrx)) {
         return -ENXIO;
@@ -420,6 +549,15 @@ rl_io_read_iter(struct kiocb *iocb,
                 break;
             }
 
+            if (busy_poll) {
+                /* Busy-poll once before sleeping, to save the wakeup
+                 * latency when the next SDU is about to arrive. */
+                busy_poll = false;
+                __set_current_state(TASK_RUNNING);
+                rl_io_busy_poll(txrx, rio->busy_poll_usecs);
+                continue;
+            }
+
             /* Nothing to read, let's sleep. */
             schedule();
             continue;
@@ -439,6 +577,13 @@ rl_io_read_iter(struct kiocb *iocb,
             /* Complete SDU read, consume the rb. */
             rb_list_del(rb);
             txrx->rx_qsize -= rl_buf_truesize(rb);
+            if (unlikely(rl_latency_stats)) {
+                if (flow) {
+                    rl_buf_lat_account(&flow->stats.rx_lat, rb);
+                }
+                rl_buf_lat_account(&raw_cpu_ptr(txrx->ipcp->stats)->rx_lat,
+                                   rb);
+            }
             spin_unlock_bh(&txrx->rx_lock);
 
             ret = rl_buf_copy_to_user(rb, to, rb->len);
@@ -643,6 +788,7 @@ rl_io_release_internal(struct rl_io *rio)
          * descriptor, so let's unbind from it. */
         rio->txrx->ipcp->mgmt_txrx = NULL;
         ipcp_put(rio->txrx->ipcp);
+        txrx_fini(rio->txrx);
         rl_free(rio->txrx, RL_MT_MISC);
         rio->txrx = NULL;
         break;
@@ -706,6 +852,11 @@ rl_io_ioctl(struct file *f, unsigned int cmd, unsigned long arg)
         break;
     }
 
+    case RLITE_IOCTL_BUSY_POLL:
+        /* The argument is the value, like RLITE_IOCTL_CHFLAGS. */
+        rio->busy_poll_usecs = (uint32_t)arg;
+        break;
+
     default:
         ret = -EINVAL;
         break;
@@ -743,6 +894,14 @@ static const struct file_operations rl_io_fops = {
 #ifdef RL_HAVE_CHRDEV_RW_ITER
     .write_iter = rl_io_write_iter,
     .read_iter  = rl_io_read_iter,
+    /* Allow applications (e.g. rina-gw) to splice() data between
+     * flows and sockets through a pipe. */
+    .splice_write = iter_file_splice_write,
+#ifdef RL_HAVE_COPY_SPLICE_READ
+    .splice_read = copy_splice_read,
+#else  /* !RL_HAVE_COPY_SPLICE_READ */
+    .splice_read = generic_file_splice_read,
+#endif /* !RL_HAVE_COPY_SPLICE_READ */
 #else  /* AIO_RW */
     .aio_write = rl_io_write_iter,
     .aio_read  = rl_io_read_iter,
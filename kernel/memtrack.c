@@ -23,12 +23,29 @@
  */
 
 #include <linux/types.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
 #include <asm/atomic.h>
 #include "rlite-kernel.h"
 
 #ifdef RL_MEMTRACK
 
-static atomic_t mt_count[RL_MT_MAX];
+/* Counters are per-CPU, so that allocations on different CPUs do not
+ * bounce a shared cache line; they are summed up when stats are
+ * requested. Live bytes are also folded into a global counter in batches
+ * of RL_MT_BATCH bytes, to maintain high-water marks, which are therefore
+ * accurate up to RL_MT_BATCH bytes per CPU. */
+#define RL_MT_BATCH 16384
+
+struct rl_mt_pcpu {
+    long count[RL_MT_MAX];
+    long bytes[RL_MT_MAX];
+    long unfolded[RL_MT_MAX]; /* bytes not yet folded into mt_bytes */
+};
+
+static DEFINE_PER_CPU(struct rl_mt_pcpu, mt_pcpu);
+static atomic_long_t mt_bytes[RL_MT_MAX];
+static atomic_long_t mt_hwm[RL_MT_MAX];
 
 static const char *mt_names[] = {
     [RL_MT_UTILS] = "UTILS",     [RL_MT_BUFHDR] = "BUFHDR",
@@ -41,14 +58,48 @@ static const char *mt_names[] = {
     [RL_MT_IODEV] = "IODEV",     [RL_MT_MISC] = "MISC",
 };
 
+static void
+mt_fold(rl_memtrack_t type, long delta)
+{
+    long cur = atomic_long_add_return(delta, mt_bytes + type);
+    long hwm = atomic_long_read(mt_hwm + type);
+
+    while (cur > hwm) {
+        long prev = atomic_long_cmpxchg(mt_hwm + type, hwm, cur);
+
+        if (prev == hwm) {
+            break;
+        }
+        hwm = prev;
+    }
+}
+
+/* This can be called in any context. The this_cpu_*() operations are
+ * safe against interrupts on the local CPU; if an interrupt folds the
+ * unfolded bytes concurrently, the sum of the global and per-CPU
+ * counters stays correct anyway. */
+static inline void
+mt_account(rl_memtrack_t type, long objs, long bytes)
+{
+    long unfolded;
+
+    BUG_ON(type >= RL_MT_MAX);
+    this_cpu_add(mt_pcpu.count[type], objs);
+    this_cpu_add(mt_pcpu.bytes[type], bytes);
+    unfolded = this_cpu_add_return(mt_pcpu.unfolded[type], bytes);
+    if (unlikely(unfolded >= RL_MT_BATCH || unfolded <= -RL_MT_BATCH)) {
+        this_cpu_sub(mt_pcpu.unfolded[type], unfolded);
+        mt_fold(type, unfolded);
+    }
+}
+
 void *
 rl_alloc(size_t size, gfp_t gfp, rl_memtrack_t type)
 {
     void *ret = kmalloc(size, gfp);
 
     if (ret) {
-        BUG_ON(type >= RL_MT_MAX);
-        atomic_inc(mt_count + type);
+        mt_account(type, 1, ksize(ret));
     }
 
     return ret;
@@ -61,8 +112,7 @@ rl_strdup(const char *s, gfp_t gfp, rl_memtrack_t type)
     void *ret = kstrdup(s, gfp);
 
     if (ret) {
-        BUG_ON(type >= RL_MT_MAX);
-        atomic_inc(mt_count + type);
+        mt_account(type, 1, ksize(ret));
     }
 
     return ret;
@@ -72,20 +122,54 @@ EXPORT_SYMBOL(rl_strdup);
 void
 rl_free(void *obj, rl_memtrack_t type)
 {
-    BUG_ON(type >= RL_MT_MAX);
-    atomic_dec(mt_count + type);
+    if (obj) {
+        mt_account(type, -1, -(long)ksize(obj));
+    }
     kfree(obj);
 }
 EXPORT_SYMBOL(rl_free);
 
+unsigned int
+rl_memtrack_get_stats(struct rl_memtrack_stats *stats, unsigned int max)
+{
+    unsigned int i;
+
+    for (i = 0; i < RL_MT_MAX && i < max; i++) {
+        long count = 0, bytes = 0, hwm;
+        int cpu;
+
+        for_each_possible_cpu(cpu)
+        {
+            struct rl_mt_pcpu *mt = per_cpu_ptr(&mt_pcpu, cpu);
+
+            count += READ_ONCE(mt->count[i]);
+            bytes += READ_ONCE(mt->bytes[i]);
+        }
+        hwm = atomic_long_read(mt_hwm + i);
+
+        strncpy(stats[i].name, mt_names[i], sizeof(stats[i].name) - 1);
+        stats[i].name[sizeof(stats[i].name) - 1] = '\0';
+        stats[i].count     = count;
+        stats[i].bytes     = bytes;
+        stats[i].bytes_hwm = hwm > bytes ? hwm : bytes;
+    }
+
+    return i;
+}
+
 void
 rl_memtrack_dump_stats(void)
 {
-    int i;
+    struct rl_memtrack_stats stats[RL_MT_MAX];
+    unsigned int num;
+    unsigned int i;
 
+    num = rl_memtrack_get_stats(stats, RL_MT_MAX);
     PI("Memtrack stats:\n");
-    for (i = 0; i < RL_MT_MAX; i++) {
-        PI("    %-8s:%8d\n", mt_names[i], atomic_read(mt_count + i));
+    for (i = 0; i < num; i++) {
+        PI("    %-8s:%8lld objs %12llu bytes %12llu max bytes\n", stats[i].name,
+           (long long)stats[i].count, (long long unsigned)stats[i].bytes,
+           (long long unsigned)stats[i].bytes_hwm);
     }
 }
 
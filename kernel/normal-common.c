@@ -38,6 +38,8 @@ dtp_init(struct dtp *dtp)
     dtp->cwq_len = dtp->max_cwq_len = 0;
     rb_list_init(&dtp->seqq);
     dtp->seqq_len = 0;
+    rb_list_init(&dtp->reasmq);
+    dtp->reasmq_len = 0;
     rb_list_init(&dtp->rtxq);
     dtp->rtxq_len = dtp->max_rtxq_len = 0;
     dtp->flags                        = 0;
@@ -79,6 +81,12 @@ dtp_fini(struct dtp *dtp)
     }
     dtp->seqq_len = 0;
 
+    rb_list_foreach_safe (rb, tmp, &dtp->reasmq) {
+        rb_list_del(rb);
+        rl_buf_free(rb);
+    }
+    dtp->reasmq_len = 0;
+
     rb_list_foreach_safe (rb, tmp, &dtp->rtxq) {
         rb_list_del(rb);
         rl_buf_free(rb);
@@ -21,6 +21,7 @@
 #include <linux/types.h>
 #include "rlite/utils.h"
 #include "rlite-kernel.h"
+#include "rlite-trace.h"
 #include "rlite/kernel-msg.h"
 
 #include <linux/module.h>
@@ -62,6 +63,28 @@ struct rina_pci {
     rl_qosid_t qos_id;
 } __attribute__((__packed__));
 
+/* Value of the pdu_version field of the PCI. */
+#define RL_PCI_VERSION 1
+
+/*
+ * Compact PCI, optionally used on the wire in place of the PCI above for
+ * DT PDUs, when most of its fields are small. The first byte (which takes
+ * the place of pdu_version) identifies the format and tells which optional
+ * fields are present. It is followed by pdu_flags (a single byte) and by
+ * the seqnum, dst_addr, src_addr, dst_cep, src_cep, qos_id (if nonzero),
+ * payload length and pdu_ttl fields, each one encoded as a varint (7 bits
+ * per byte, least significant first). The pdu_csum follows if nonzero.
+ * The PDU is turned back into a full PCI on reception, so that the rest
+ * of the datapath (and the checksum) only deals with the full PCI.
+ */
+#define RL_PCI_CPT_MAGIC 0xA0
+#define RL_PCI_CPT_MAGIC_MASK 0xFC
+#define RL_PCI_CPT_F_CSUM 0x01 /* pdu_csum is present */
+#define RL_PCI_CPT_F_QOS 0x02  /* qos_id is present */
+/* 8 varints of at most 10 bytes, two bytes for version and flags and two
+ * bytes for the checksum. */
+#define RL_PCI_CPT_LEN_MAX (2 + 8 * 10 + 2)
+
 /* PCI header to be used for control PDUs. */
 struct rina_pci_ctrl {
     struct rina_pci base;
@@ -110,6 +133,157 @@ rl_buf_pci_push(struct rl_buf *rb)
     return 0;
 }
 
+static inline uint8_t *
+varint_put(uint8_t *p, uint64_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+
+    return p;
+}
+
+/* Returns NULL if the varint is truncated (or if @p is NULL, so that
+ * calls can be chained and checked once). */
+static inline const uint8_t *
+varint_get(const uint8_t *p, const uint8_t *end, uint64_t *v)
+{
+    unsigned int shift = 0;
+
+    *v = 0;
+    while (p && p < end && shift < 64) {
+        uint8_t b = *p++;
+
+        *v |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            return p;
+        }
+        shift += 7;
+    }
+
+    return NULL;
+}
+
+/* Replaces the full PCI of a DT PDU about to be transmitted with the
+ * compact one, saving the former into @full. Returns the length of the
+ * compact PCI, or 0 if the PDU is to be sent with the full PCI. */
+static size_t
+rl_pci_compact(struct rl_buf *rb, struct rina_pci *full)
+{
+    struct rina_pci *pci = RL_BUF_PCI(rb);
+    uint8_t hdr[RL_PCI_CPT_LEN_MAX];
+    uint8_t *p = hdr + 2;
+    size_t clen;
+
+    if (pci->pdu_type != PDU_T_DT || pci->pdu_flags > 0xFF ||
+        pci->pdu_len < sizeof(*pci)) {
+        return 0;
+    }
+
+    hdr[0] = RL_PCI_CPT_MAGIC;
+    hdr[1] = (uint8_t)pci->pdu_flags;
+    p      = varint_put(p, pci->seqnum);
+    p      = varint_put(p, pci->dst_addr);
+    p      = varint_put(p, pci->src_addr);
+    p      = varint_put(p, pci->dst_cep);
+    p      = varint_put(p, pci->src_cep);
+    if (pci->qos_id) {
+        hdr[0] |= RL_PCI_CPT_F_QOS;
+        p = varint_put(p, pci->qos_id);
+    }
+    p = varint_put(p, pci->pdu_len - sizeof(*pci));
+    p = varint_put(p, pci->pdu_ttl);
+    if (pci->pdu_csum) {
+        hdr[0] |= RL_PCI_CPT_F_CSUM;
+        memcpy(p, &pci->pdu_csum, sizeof(pci->pdu_csum));
+        p += sizeof(pci->pdu_csum);
+    }
+
+    clen = p - hdr;
+    if (clen >= sizeof(*pci)) {
+        return 0; /* no gain */
+    }
+
+    /* The data may be shared with a clone in the retransmission queue,
+     * which must keep the full PCI. */
+    memcpy(full, pci, sizeof(*full));
+    if (rl_buf_cow_head(rb, 0, GFP_ATOMIC)) {
+        return 0;
+    }
+
+    rl_buf_custom_pop(rb, sizeof(*pci) - clen);
+    memcpy(RL_BUF_DATA(rb), hdr, clen);
+
+    return clen;
+}
+
+/* Undoes rl_pci_compact() on a PDU that was not consumed. */
+static void
+rl_pci_uncompact(struct rl_buf *rb, const struct rina_pci *full, size_t clen)
+{
+    rl_buf_custom_push(rb, sizeof(*full) - clen);
+    memcpy(RL_BUF_PCI(rb), full, sizeof(*full));
+}
+
+/* Turns the compact PCI of a received DT PDU back into a full PCI.
+ * Returns -1 if the compact PCI is malformed. */
+static int
+rl_pci_expand(struct rl_buf *rb)
+{
+    const uint8_t *p   = RL_BUF_DATA(rb);
+    const uint8_t *end = p + rb->len;
+    uint8_t fl         = p[0];
+    struct rina_pci full;
+    size_t clen;
+    uint64_t v;
+
+    full.pdu_version = RL_PCI_VERSION;
+    full.pdu_type    = PDU_T_DT;
+    full.pdu_flags   = p[1];
+    p                = varint_get(p + 2, end, &v);
+    full.seqnum      = v;
+    p                = varint_get(p, end, &v);
+    full.dst_addr    = v;
+    p                = varint_get(p, end, &v);
+    full.src_addr    = v;
+    p                = varint_get(p, end, &v);
+    full.dst_cep     = v;
+    p                = varint_get(p, end, &v);
+    full.src_cep     = v;
+    full.qos_id      = 0;
+    if (fl & RL_PCI_CPT_F_QOS) {
+        p           = varint_get(p, end, &v);
+        full.qos_id = v;
+    }
+    p             = varint_get(p, end, &v);
+    full.pdu_len  = v + sizeof(full);
+    p             = varint_get(p, end, &v);
+    full.pdu_ttl  = v;
+    full.pdu_csum = 0;
+    if (p && (fl & RL_PCI_CPT_F_CSUM)) {
+        if (p + sizeof(full.pdu_csum) > end) {
+            return -1;
+        }
+        memcpy(&full.pdu_csum, p, sizeof(full.pdu_csum));
+        p += sizeof(full.pdu_csum);
+    }
+    if (unlikely(!p)) {
+        return -1;
+    }
+
+    clen = p - RL_BUF_DATA(rb);
+    if (rl_buf_cow_head(rb, sizeof(full) - clen, GFP_ATOMIC)) {
+        return -1;
+    }
+    rl_buf_custom_pop(rb, clen);
+    rl_buf_custom_push(rb, sizeof(full));
+    memcpy(RL_BUF_PCI(rb), &full, sizeof(full));
+
+    return 0;
+}
+
 void
 rina_pci_dump(struct rina_pci *pci)
 {
@@ -701,6 +875,7 @@ rtx_tmr_cb(
                 rb_list_enq(crb, &rrbq);
                 stats->rtx_pkt++;
                 stats->rtx_byte += rb->len;
+                trace_rlite_pdu_rtx(flow, RL_BUF_PCI(rb)->seqnum, rb->len);
             }
         }
         if (!next_exp_set ||
@@ -896,11 +1071,26 @@ rmt_tx_to_lower(struct ipcp_entry *ipcp, struct flow_entry *lower_flow,
 {
     struct ipcp_entry *lower_ipcp = lower_flow->txrx.ipcp;
     bool maysleep                 = flags & RL_RMT_F_MAYSLEEP;
+    struct rl_normal *priv        = ipcp->priv;
     DECLARE_WAITQUEUE(wait, current);
+    uint64_t tstamp = 0, now = 0;
+    unsigned int len = rb->len;
+    struct rina_pci full;
+    size_t clen = 0;
     int ret;
 
     BUG_ON(!lower_ipcp);
 
+    if (priv->pci_compact) {
+        clen = rl_pci_compact(rb, &full);
+    }
+
+    if (unlikely(rl_latency_stats)) {
+        /* The time spent in the lower IPCP is accounted there, starting
+         * from the handoff. */
+        tstamp = RL_BUF_TSTAMP(rb);
+    }
+
     if (maysleep) {
         add_wait_queue(lower_flow->txrx.tx_wqh, &wait);
     }
@@ -908,6 +1098,10 @@ rmt_tx_to_lower(struct ipcp_entry *ipcp, struct flow_entry *lower_flow,
     for (;;) {
         set_current_state(TASK_INTERRUPTIBLE);
 
+        if (tstamp) {
+            RL_BUF_TSTAMP(rb) = now = rl_lat_now();
+        }
+
         /* Try to push the rb down to the lower IPCP. */
         ret = lower_ipcp->ops.sdu_write(lower_ipcp, lower_flow, rb,
                                         flags & (~RL_RMT_F_CONSUME));
@@ -931,6 +1125,7 @@ rmt_tx_to_lower(struct ipcp_entry *ipcp, struct flow_entry *lower_flow,
             if (flags & RL_RMT_F_CONSUME) {
                 struct rl_ipcp_stats *stats = raw_cpu_ptr(ipcp->stats);
                 stats->rmt.queue_drop++;
+                trace_rlite_pdu_drop(ipcp, lower_flow, len, RL_DROP_QUEUE);
                 rl_buf_free(rb);
                 rb = NULL;
                 /* The rb was managed somehow (dropped), so we must reset the
@@ -953,9 +1148,42 @@ rmt_tx_to_lower(struct ipcp_entry *ipcp, struct flow_entry *lower_flow,
         remove_wait_queue(lower_flow->txrx.tx_wqh, &wait);
     }
 
+    if (ret >= 0 && rb) {
+        trace_rlite_pdu_tx(ipcp, lower_flow, len);
+        if (clen) {
+            /* Only account the PDUs actually handed to the lower IPCP. */
+            struct rl_ipcp_stats *stats = raw_cpu_ptr(ipcp->stats);
+            stats->rmt.pci_compact_pkt++;
+            stats->rmt.pci_saved_byte += sizeof(full) - clen;
+        }
+    }
+
+    if (ret == -EAGAIN && clen) {
+        /* Not consumed, the caller may queue it and look at the PCI. */
+        rl_pci_uncompact(rb, &full, clen);
+    }
+
+    if (tstamp) {
+        if (ret == -EAGAIN) {
+            RL_BUF_TSTAMP(rb) = tstamp; /* not consumed, restore */
+        } else if (ret >= 0 && rb) {
+            rl_lat_hist_add(&raw_cpu_ptr(ipcp->stats)->tx_lat, tstamp, now);
+        }
+    }
+
     return ret;
 }
 
+/* Called when a PDU leaves the PDU scheduler. */
+static inline void
+rmt_deq_account(struct ipcp_entry *ipcp, struct rl_buf *rb)
+{
+    if (unlikely(rl_latency_stats) && RL_BUF_RMT(rb).tstamp) {
+        rl_lat_hist_add(&raw_cpu_ptr(ipcp->stats)->rmtq_lat,
+                        RL_BUF_RMT(rb).tstamp, rl_lat_now());
+    }
+}
+
 static int
 rmt_tx(struct ipcp_entry *ipcp, struct rl_buf *rb, unsigned flags)
 {
@@ -981,6 +1209,7 @@ rmt_tx(struct ipcp_entry *ipcp, struct rl_buf *rb, unsigned flags)
 
         RPD(1, "No route to IPCP %lu, dropping packet\n",
             (long unsigned)match.dst_addr);
+        trace_rlite_pdu_drop(ipcp, NULL, rb->len, RL_DROP_NOROUTE);
         rl_buf_free(rb);
         stats->rmt.noroute_drop++;
         /* Do not return -EHOSTUNREACH, this would break applications.
@@ -1011,6 +1240,7 @@ rmt_tx(struct ipcp_entry *ipcp, struct rl_buf *rb, unsigned flags)
         DECLARE_WAITQUEUE(wait, current);
 
         RL_BUF_RMT(rb).lower_flow = lower_flow;
+        RL_BUF_RMT(rb).tstamp = unlikely(rl_latency_stats) ? rl_lat_now() : 0;
 
         if (!maysleep) {
             struct rl_buf *drb, *tmp;
@@ -1038,6 +1268,7 @@ rmt_tx(struct ipcp_entry *ipcp, struct rl_buf *rb, unsigned flags)
                 rb_list_del(drb);
                 lower_flow = RL_BUF_RMT(drb).lower_flow;
                 BUG_ON(!lower_flow);
+                rmt_deq_account(ipcp, drb);
                 rmt_tx_to_lower(ipcp, lower_flow, drb, flags);
             }
         } else {
@@ -1113,6 +1344,7 @@ sched_deq_worker(struct work_struct *w)
         rb_list_foreach_safe (rb, tmp, &ready) {
             rb_list_del(rb);
             BUG_ON(!RL_BUF_RMT(rb).lower_flow);
+            rmt_deq_account(priv->ipcp, rb);
             rmt_tx_to_lower(priv->ipcp, RL_BUF_RMT(rb).lower_flow, rb,
                             RL_RMT_F_MAYSLEEP | RL_RMT_F_CONSUME);
         }
@@ -1206,6 +1438,9 @@ rl_rtxq_push(struct flow_entry *flow, struct rl_buf *rb)
         return -ENOMEM;
     }
 
+    /* Retransmissions are not accounted in the latency stats. */
+    RL_BUF_TSTAMP(crb) = 0;
+
     /* Record the rtx expiration time and current time. */
     RL_BUF_RTX(crb).jiffies     = jiffies;
     RL_BUF_RTX(crb).rtx_jiffies = RL_BUF_RTX(crb).jiffies + rtt_to_rtx(flow);
@@ -1241,6 +1476,40 @@ rl_normal_flow_writeable(struct flow_entry *flow)
     return !flow_blocked(&flow->cfg, &flow->dtp);
 }
 
+/* Same checks as flow_blocked(), for the PDUs of a fragmented SDU. */
+static bool
+rl_normal_flow_writeable_frags(struct flow_entry *flow, unsigned int npdus,
+                               size_t len)
+{
+    struct rl_flow_config *cfg = &flow->cfg;
+    struct dtp *dtp            = &flow->dtp;
+    bool ret                   = true;
+
+    spin_lock_bh(&dtp->lock);
+    if (cfg->dtcp.bandwidth && dtp->tkbk.bucket_size < len) {
+        ret = false;
+    }
+    if (cfg->dtcp.fc.fc_type == RLITE_FC_T_WIN) {
+        /* PDUs beyond the sender window go to the closed window queue. */
+        rlm_seq_t room = dtp->max_cwq_len - dtp->cwq_len;
+
+        if (dtp->snd_rwe >= dtp->next_seq_num_to_use) {
+            room += dtp->snd_rwe - dtp->next_seq_num_to_use + 1;
+        }
+        if (room < npdus) {
+            ret = false;
+        }
+    }
+    if ((cfg->dtcp.flags & DTCP_CFG_RTX_CTRL) &&
+        ((dtp->next_seq_num_to_use + npdus - 1 - dtp->snd_lwe) > dtp->cgwin ||
+         dtp->rtxq_len + npdus > dtp->max_rtxq_len)) {
+        ret = false;
+    }
+    spin_unlock_bh(&dtp->lock);
+
+    return ret;
+}
+
 static int
 rl_normal_sdu_write(struct ipcp_entry *ipcp, struct flow_entry *flow,
                     struct rl_buf *rb, unsigned flags)
@@ -1317,13 +1586,24 @@ rl_normal_sdu_write(struct ipcp_entry *ipcp, struct flow_entry *flow,
     pci->qos_id    = flow->qos_id;
     pci->dst_cep   = flow->remote_cep;
     pci->src_cep   = flow->local_cep;
-    pci->pdu_type  = PDU_T_DT;
-    pci->pdu_flags = 0;
+    pci->pdu_version = RL_PCI_VERSION;
+    pci->pdu_type    = PDU_T_DT;
+    pci->pdu_flags   = 0;
     pci->pdu_len = len = rb->len;
     pci->pdu_ttl       = priv->ttl;
     pci->pdu_csum      = 0;
     pci->seqnum        = dtp->next_seq_num_to_use++;
 
+    if (unlikely(flags & RL_RMT_F_FRAG_MASK)) {
+        if (flags & RL_RMT_F_FRAG_FIRST) {
+            pci->pdu_flags |= PDU_F_FRAG_FIRST;
+        } else if (flags & RL_RMT_F_FRAG_LAST) {
+            pci->pdu_flags |= PDU_F_FRAG_LAST;
+        } else {
+            pci->pdu_flags |= PDU_F_FRAG_MIDDLE;
+        }
+    }
+
     if (unlikely(dtp->flags & DTP_F_DRF_SET)) {
         dtp->flags &= ~DTP_F_DRF_SET;
         pci->pdu_flags |= PDU_F_DRF;
@@ -1385,9 +1665,12 @@ rl_normal_sdu_write(struct ipcp_entry *ipcp, struct flow_entry *flow,
         mod_timer(&dtp->snd_inact_tmr, jiffies + 3 * dtp->mpl_r_a);
     }
 
+    rl_buf_lat_account(&flow->stats.tx_lat, rb);
     spin_unlock_bh(&dtp->lock);
 
-    ret = rmt_tx(ipcp, rb, flags);
+    /* The fragmentation flags only refer to this IPCP: don't let them
+     * reach the lower IPCP, which would mark its own PDUs as fragments. */
+    ret = rmt_tx(ipcp, rb, flags & ~RL_RMT_F_FRAG_MASK);
     if (likely(ret != -EAGAIN)) {
         stats->tx_pkt++;
         stats->tx_byte += len;
@@ -1455,8 +1738,9 @@ rl_normal_mgmt_sdu_build(struct ipcp_entry *ipcp,
     pci->qos_id    = 0; /* Not valid. */
     pci->dst_cep   = 0; /* Not valid. */
     pci->src_cep   = 0; /* Not valid. */
-    pci->pdu_type  = PDU_T_MGMT;
-    pci->pdu_flags = 0; /* Not valid. */
+    pci->pdu_version = RL_PCI_VERSION;
+    pci->pdu_type    = PDU_T_MGMT;
+    pci->pdu_flags   = 0; /* Not valid. */
     pci->pdu_len   = rb->len;
     pci->pdu_ttl   = priv->ttl;
     pci->pdu_csum  = 0;
@@ -1492,6 +1776,16 @@ rl_normal_config(struct ipcp_entry *ipcp, const char *param_name,
         } else {
             ret = -EINVAL;
         }
+    } else if (strcmp(param_name, "pci") == 0) {
+        if (strcmp(param_value, "full") == 0) {
+            priv->pci_compact = false;
+            ret               = 0;
+        } else if (strcmp(param_value, "compact") == 0) {
+            priv->pci_compact = true;
+            ret               = 0;
+        } else {
+            ret = -EINVAL;
+        }
     } else if (strcmp(param_name, "sched") == 0) {
         if (!strcmp(param_value, "none")) {
             param_value = NULL;
@@ -1516,6 +1810,9 @@ rl_normal_config_get(struct ipcp_entry *ipcp, const char *param_name, char *buf,
     } else if (strcmp(param_name, "csum") == 0) {
         const char *value = priv->csum ? "inet" : "none";
         snprintf(buf, buflen, "%s", value);
+    } else if (strcmp(param_name, "pci") == 0) {
+        const char *value = priv->pci_compact ? "compact" : "full";
+        snprintf(buf, buflen, "%s", value);
     } else if (strcmp(param_name, "sched") == 0) {
         const char *value = priv->sched ? priv->sched->ops.name : "none";
         snprintf(buf, buflen, "%s", value);
@@ -1596,6 +1893,7 @@ ctrl_pdu_alloc(struct ipcp_entry *ipcp, struct flow_entry *flow,
         pcic->base.qos_id            = flow->qos_id;
         pcic->base.dst_cep           = flow->remote_cep;
         pcic->base.src_cep           = flow->local_cep;
+        pcic->base.pdu_version       = RL_PCI_VERSION;
         pcic->base.pdu_type          = pdu_type;
         pcic->base.pdu_flags         = 0;
         pcic->base.pdu_len           = rb->len;
@@ -1749,6 +2047,137 @@ seqq_pop_many(struct dtp *dtp, rl_seq_t max_sdu_gap, struct rb_list *qrbs)
     }
 }
 
+static void
+reasmq_purge(struct dtp *dtp)
+{
+    struct rl_buf *rb, *tmp;
+
+    rb_list_foreach_safe (rb, tmp, &dtp->reasmq) {
+        rb_list_del(rb);
+        rl_buf_free(rb);
+    }
+    dtp->reasmq_len = 0;
+}
+
+/* Called under the DTP lock on a DT PDU that is ready to be delivered, in
+ * sequence number order. Pops the PCI and appends the PDU to 'sdus' if it
+ * carries a whole SDU. Fragments are held in the reassembly queue until
+ * the last one arrives, and then they are moved to 'sdus' all together;
+ * the SDU is rebuilt by sdu_reasm_pop() once the DTP lock is released.
+ * Fragments are only produced on in-order flows, so the SDU being
+ * reassembled is lost as soon as a fragment is missing. */
+static void
+sdu_reasm(struct ipcp_entry *ipcp, struct flow_entry *flow, struct rl_buf *rb,
+          struct rb_list *sdus)
+{
+    struct rl_ipcp_stats *stats = raw_cpu_ptr(ipcp->stats);
+    struct rina_pci *pci        = RL_BUF_PCI(rb);
+    uint16_t frag               = pci->pdu_flags & PDU_F_FRAG_MASK;
+    rl_seq_t seqnum             = pci->seqnum;
+    struct dtp *dtp             = &flow->dtp;
+    struct rl_buf *first, *qrb, *tmp;
+    uint32_t nfrags = 0;
+
+    rl_buf_pci_pop(rb);
+    RL_BUF_RX(rb).cons_seqnum = seqnum;
+    RL_BUF_RX(rb).reasm_frags = 1;
+    RL_BUF_RX(rb).reasm_len   = rb->len;
+
+    if (likely(!frag && rb_list_empty(&dtp->reasmq))) {
+        rb_list_enq(rb, sdus); /* The common case. */
+        return;
+    }
+
+    if (!rb_list_empty(&dtp->reasmq) &&
+        (seqnum != dtp->reasm_next_seq || !(frag & ~PDU_F_FRAG_FIRST))) {
+        RPD(1, "Dropping partial SDU (%u bytes) on PDU [%lu]\n",
+            dtp->reasmq_len, (long unsigned)seqnum);
+        reasmq_purge(dtp);
+        stats->rx_err++;
+    }
+
+    if (!frag) {
+        rb_list_enq(rb, sdus);
+        return;
+    }
+
+    if (unlikely((rb_list_empty(&dtp->reasmq) &&
+                  !(frag & PDU_F_FRAG_FIRST)) ||
+                 dtp->reasmq_len + rb->len > RL_SDU_REASM_MAX)) {
+        RPD(1, "Dropping fragment [%lu]\n", (long unsigned)seqnum);
+        reasmq_purge(dtp);
+        rl_buf_free(rb);
+        stats->rx_err++;
+        return;
+    }
+
+    rb_list_enq(rb, &dtp->reasmq);
+    dtp->reasmq_len += rb->len;
+    dtp->reasm_next_seq = seqnum + 1;
+
+    /* Fragments held here are consumed as far as flow control is
+     * concerned: the sender must be allowed to send the whole SDU even
+     * if it is larger than the receiver window. */
+    if (dtp->rcv_lwe <= seqnum) {
+        dtp->rcv_lwe = seqnum + 1;
+    }
+
+    if (!(frag & PDU_F_FRAG_LAST)) {
+        return;
+    }
+
+    /* The SDU is complete. The first fragment records the number of
+     * fragments and the length of the whole SDU. */
+    first                      = rb_list_front(&dtp->reasmq);
+    RL_BUF_RX(first).reasm_len = dtp->reasmq_len;
+    rb_list_foreach_safe (qrb, tmp, &dtp->reasmq) {
+        rb_list_del(qrb);
+        rb_list_enq(qrb, sdus);
+        nfrags++;
+    }
+    RL_BUF_RX(first).reasm_frags = nfrags;
+    dtp->reasmq_len              = 0;
+}
+
+/* Extract the next SDU from a list filled by sdu_reasm(), copying the
+ * fragments of a reassembled SDU into a single buffer. Called without the
+ * DTP lock. Returns NULL if the SDU had to be dropped. */
+static struct rl_buf *
+sdu_reasm_pop(struct ipcp_entry *ipcp, struct rb_list *sdus)
+{
+    struct rl_buf *rb = rb_list_front(sdus);
+    uint32_t nfrags   = RL_BUF_RX(rb).reasm_frags;
+    struct rl_buf *nrb;
+
+    rb_list_del(rb);
+    if (likely(nfrags <= 1)) {
+        return rb;
+    }
+
+    nrb = rl_buf_alloc(RL_BUF_RX(rb).reasm_len, 0, 0, GFP_ATOMIC);
+    if (unlikely(!nrb)) {
+        RPV(1, "Out of memory\n");
+        raw_cpu_ptr(ipcp->stats)->rx_err++;
+    }
+
+    for (;;) {
+        if (nrb) {
+            memcpy(RL_BUF_DATA(nrb) + nrb->len, RL_BUF_DATA(rb), rb->len);
+            rl_buf_append(nrb, rb->len);
+            /* The last fragment gives the sequence number to consume. */
+            RL_BUF_RX(nrb).cons_seqnum = RL_BUF_RX(rb).cons_seqnum;
+        }
+        rl_buf_free(rb);
+        if (--nfrags == 0) {
+            break;
+        }
+        rb = rb_list_front(sdus);
+        rb_list_del(rb);
+    }
+
+    return nrb;
+}
+
 static int
 sdu_rx_ctrl(struct ipcp_entry *ipcp, struct flow_entry *flow, struct rl_buf *rb)
 {
@@ -1827,6 +2256,7 @@ sdu_rx_ctrl(struct ipcp_entry *ipcp, struct flow_entry *flow, struct rl_buf *rb)
                 dtp->cwq_len--;
                 rb_list_enq(qrb, &qrbs);
                 dtp->last_seq_num_sent++;
+                rl_buf_lat_account(&flow->stats.tx_lat, qrb);
 
                 if (flow->cfg.dtcp.flags & DTCP_CFG_RTX_CTRL) {
                     rl_rtxq_push(flow, qrb);
@@ -1944,11 +2374,12 @@ rl_normal_sdu_rx(struct ipcp_entry *ipcp, struct rl_buf *rb,
 {
     struct rl_ipcp_stats *stats = raw_cpu_ptr(ipcp->stats);
     struct rl_normal *priv      = ipcp->priv;
-    struct rina_pci *pci        = RL_BUF_PCI(rb);
+    struct rina_pci *pci;
     struct flow_entry *flow;
-    rl_seq_t seqnum    = pci->seqnum;
     struct rl_buf *crb = NULL;
     unsigned int a     = 0;
+    struct rb_list sdus;
+    rl_seq_t seqnum;
     rl_seq_t gap;
     struct dtp *dtp;
     bool deliver;
@@ -1956,6 +2387,23 @@ rl_normal_sdu_rx(struct ipcp_entry *ipcp, struct rl_buf *rb,
     bool qlimit;
     int ret = 0;
 
+    trace_rlite_pdu_rx(ipcp, lower_flow, rb->len);
+
+    if (unlikely(rb->len >= 2 && (RL_BUF_DATA(rb)[0] & RL_PCI_CPT_MAGIC_MASK) ==
+                                     RL_PCI_CPT_MAGIC)) {
+        /* Compact PCI, accepted regardless of the local configuration. */
+        if (rl_pci_expand(rb)) {
+            RPD(1, "Dropping PDU with malformed compact PCI\n");
+            trace_rlite_pdu_drop(ipcp, lower_flow, rb->len, RL_DROP_OTHER);
+            rl_buf_free(rb);
+            stats->rmt.other_drop++;
+            return NULL;
+        }
+    }
+
+    pci    = RL_BUF_PCI(rb);
+    seqnum = pci->seqnum;
+
     if (pci->pdu_len < rb->len) {
         /* Make up for tail padding introduced at lower layers. */
         rb->len = pci->pdu_len;
@@ -1963,6 +2411,7 @@ rl_normal_sdu_rx(struct ipcp_entry *ipcp, struct rl_buf *rb,
 
     if (unlikely(rb->len < sizeof(struct rina_pci))) {
         RPD(1, "Dropping PDU shorter [%zu] than PCI\n", rb->len);
+        trace_rlite_pdu_drop(ipcp, lower_flow, rb->len, RL_DROP_OTHER);
         rl_buf_free(rb);
         stats->rmt.other_drop++;
         return NULL; /* -EINVAL */
@@ -1971,6 +2420,7 @@ rl_normal_sdu_rx(struct ipcp_entry *ipcp, struct rl_buf *rb,
     if (priv->csum) {
         if (unlikely(inet_csum(pci, rb->len, 0) != 0xFFFF)) {
             RPD(1, "Dropping PDU on wrong checksum\n");
+            trace_rlite_pdu_drop(ipcp, lower_flow, rb->len, RL_DROP_CSUM);
             rl_buf_free(rb);
             stats->rmt.csum_drop++;
             return NULL;
@@ -1994,6 +2444,7 @@ rl_normal_sdu_rx(struct ipcp_entry *ipcp, struct rl_buf *rb,
 
         if (!ipcp->mgmt_txrx) {
             PW("Missing mgmt_txrx\n");
+            trace_rlite_pdu_drop(ipcp, lower_flow, rb->len, RL_DROP_OTHER);
             rl_buf_free(rb);
             stats->rmt.other_drop++;
             return NULL; /* -EINVAL */
@@ -2041,6 +2492,7 @@ rl_normal_sdu_rx(struct ipcp_entry *ipcp, struct rl_buf *rb,
         if (unlikely(pci->pdu_ttl-- == 0)) {
             RPD(1, "Dropping PDU on zero TTL\n");
             stats->rmt.ttl_drop++;
+            trace_rlite_pdu_drop(ipcp, lower_flow, len, RL_DROP_TTL);
             rl_buf_free(rb);
             return NULL; /* -EINVAL */
         }
@@ -2056,6 +2508,8 @@ rl_normal_sdu_rx(struct ipcp_entry *ipcp, struct rl_buf *rb,
             pci->pdu_csum = (uint16_t)sum;
         }
 
+        rl_buf_tstamp(rb);
+        trace_rlite_pdu_fwd(ipcp, pci->dst_addr, len);
         rmt_tx(ipcp, rb, RL_RMT_F_CONSUME);
         stats->rmt.fwd_pkt++;
         stats->rmt.fwd_byte += len;
@@ -2063,10 +2517,19 @@ rl_normal_sdu_rx(struct ipcp_entry *ipcp, struct rl_buf *rb,
         return NULL;
     }
 
-    flow = flow_get_by_cep(ipcp->dm, pci->dst_cep);
+    /* No reference is taken on the flow: the RCU read-side critical
+     * section keeps it alive until we are done with it. The flow bound
+     * to the lower flow (or to the shortcut) is cached, so that stacked
+     * IPCPs do not need a table lookup at each level. */
+    rcu_read_lock();
+    flow = rl_rx_cache_lookup(lower_flow ? &lower_flow->rx_cache
+                                         : &ipcp->rx_cache,
+                              ipcp, pci->dst_cep);
     if (!flow) {
+        rcu_read_unlock();
         RPD(1, "No flow for cep-id %u: dropping PDU\n", pci->dst_cep);
         stats->rmt.noflow_drop++;
+        trace_rlite_pdu_drop(ipcp, lower_flow, rb->len, RL_DROP_NOFLOW);
         rl_buf_free(rb);
         return NULL;
     }
@@ -2074,7 +2537,7 @@ rl_normal_sdu_rx(struct ipcp_entry *ipcp, struct rl_buf *rb,
     if (pci->pdu_type != PDU_T_DT) {
         /* This is a control PDU. */
         sdu_rx_ctrl(ipcp, flow, rb);
-        flow_put(flow);
+        rcu_read_unlock();
 
         return NULL; /* ret */
     }
@@ -2132,12 +2595,20 @@ rl_normal_sdu_rx(struct ipcp_entry *ipcp, struct rl_buf *rb,
                dtp->next_snd_ctl_seq);
         }
 
-        spin_unlock_bh(&dtp->lock);
+        /* A new run of PDUs starts, the SDU being reassembled (if any)
+         * cannot be completed. */
+        reasmq_purge(dtp);
+        rb_list_init(&sdus);
+        sdu_reasm(ipcp, flow, rb, &sdus);
 
-        RL_BUF_RX(rb).cons_seqnum = seqnum;
-        rl_buf_pci_pop(rb);
+        spin_unlock_bh(&dtp->lock);
 
-        rl_sdu_rx_flow(ipcp, flow, rb, qlimit);
+        while (!rb_list_empty(&sdus)) {
+            rb = sdu_reasm_pop(ipcp, &sdus);
+            if (rb) {
+                rl_sdu_rx_flow(ipcp, flow, rb, qlimit);
+            }
+        }
 
         goto snd_crb;
     }
@@ -2219,6 +2690,18 @@ rl_normal_sdu_rx(struct ipcp_entry *ipcp, struct rl_buf *rb,
 
         seqq_pop_many(dtp, flow->cfg.max_sdu_gap, &qrbs);
 
+        stats->rx_pkt++;
+        stats->rx_byte += rb->len;
+
+        /* Collect the SDUs to deliver, i.e. this PDU and the ones just
+         * extracted from the seqq, reassembling fragmented SDUs. */
+        rb_list_init(&sdus);
+        sdu_reasm(ipcp, flow, rb, &sdus);
+        rb_list_foreach_safe (qrb, tmp, &qrbs) {
+            rb_list_del(qrb);
+            sdu_reasm(ipcp, flow, qrb, &sdus);
+        }
+
         /* If this flow is used by an application, this SDU will be acked
          * when the application reads it, since rl_normal_sdu_rx_consumed()
          * is called. Otherwise the flow is used by an upper IPCP, and we
@@ -2230,22 +2713,12 @@ rl_normal_sdu_rx(struct ipcp_entry *ipcp, struct rl_buf *rb,
         crb = sdu_rx_sv_update(ipcp, flow, /*ack_immediate=*/false);
         spin_unlock_bh(&dtp->lock);
 
-        stats->rx_pkt++;
-        stats->rx_byte += rb->len;
-
-        RL_BUF_RX(rb).cons_seqnum = seqnum;
-        rl_buf_pci_pop(rb);
-
-        ret = rl_sdu_rx_flow(ipcp, flow, rb, qlimit);
-
-        /* Also deliver PDUs just extracted from the seqq. Note
-         * that we must use the safe version of list scanning, since
-         * rl_sdu_rx_flow() will modify qrb->node. */
-        rb_list_foreach_safe (qrb, tmp, &qrbs) {
-            rb_list_del(qrb);
-            RL_BUF_RX(qrb).cons_seqnum = seqnum;
-            rl_buf_pci_pop(qrb);
-            ret |= rl_sdu_rx_flow(ipcp, flow, qrb, qlimit);
+        /* Reassembled SDUs are rebuilt here, outside the DTP lock. */
+        while (!rb_list_empty(&sdus)) {
+            qrb = sdu_reasm_pop(ipcp, &sdus);
+            if (qrb) {
+                ret |= rl_sdu_rx_flow(ipcp, flow, qrb, qlimit);
+            }
         }
 
         goto snd_crb;
@@ -2273,7 +2746,7 @@ snd_crb:
         rmt_tx(ipcp, crb, RL_RMT_F_CONSUME);
     }
 
-    flow_put(flow);
+    rcu_read_unlock();
 
     return NULL; /* ret */
 }
@@ -2289,9 +2762,12 @@ rl_normal_sdu_rx_consumed(struct flow_entry *flow, rlm_seq_t seqnum,
     spin_lock_bh(&dtp->lock);
 
     /* Update the advertised rcv_lwe and possibly send a an FC ACK
-     * control PDU. */
-    dtp->rcv_lwe = seqnum + 1;
-    crb          = sdu_rx_sv_update(ipcp, flow, /*ack_immediate=*/false);
+     * control PDU. The rcv_lwe may be already past seqnum, because of
+     * fragments held for reassembly (see sdu_reasm()). */
+    if (dtp->rcv_lwe <= seqnum) {
+        dtp->rcv_lwe = seqnum + 1;
+    }
+    crb = sdu_rx_sv_update(ipcp, flow, /*ack_immediate=*/false);
 
     spin_unlock_bh(&dtp->lock);
 
@@ -2367,27 +2843,29 @@ rl_normal_destroy(struct ipcp_entry *ipcp)
 #endif
 
 static struct ipcp_factory normal_factory = {
-    .owner                   = THIS_MODULE,
-    .dif_type                = SHIM_DIF_TYPE,
-    .create                  = rl_normal_create,
-    .use_cep_ids             = true,
-    .ops.destroy             = rl_normal_destroy,
-    .ops.flow_allocate_req   = NULL, /* Reflect to userspace. */
-    .ops.flow_allocate_resp  = NULL, /* Reflect to userspace. */
-    .ops.flow_init           = rl_normal_flow_init,
-    .ops.sdu_write           = rl_normal_sdu_write,
-    .ops.config              = rl_normal_config,
-    .ops.config_get          = rl_normal_config_get,
-    .ops.pduft_set           = rl_pduft_set,
-    .ops.pduft_flush         = rl_pduft_flush,
-    .ops.pduft_flush_by_flow = rl_pduft_flush_by_flow,
-    .ops.pduft_del           = rl_pduft_del,
-    .ops.pduft_del_addr      = rl_pduft_del_addr,
-    .ops.mgmt_sdu_build      = rl_normal_mgmt_sdu_build,
-    .ops.sdu_rx              = rl_normal_sdu_rx,
-    .ops.flow_writeable      = rl_normal_flow_writeable,
-    .ops.qos_supported       = rl_normal_qos_supported,
-    .ops.sched_config        = rl_normal_sched_config,
+    .owner                    = THIS_MODULE,
+    .dif_type                 = SHIM_DIF_TYPE,
+    .create                   = rl_normal_create,
+    .use_cep_ids              = true,
+    .fragmentation            = true,
+    .ops.destroy              = rl_normal_destroy,
+    .ops.flow_allocate_req    = NULL, /* Reflect to userspace. */
+    .ops.flow_allocate_resp   = NULL, /* Reflect to userspace. */
+    .ops.flow_init            = rl_normal_flow_init,
+    .ops.sdu_write            = rl_normal_sdu_write,
+    .ops.config               = rl_normal_config,
+    .ops.config_get           = rl_normal_config_get,
+    .ops.pduft_set            = rl_pduft_set,
+    .ops.pduft_flush          = rl_pduft_flush,
+    .ops.pduft_flush_by_flow  = rl_pduft_flush_by_flow,
+    .ops.pduft_del            = rl_pduft_del,
+    .ops.pduft_del_addr       = rl_pduft_del_addr,
+    .ops.mgmt_sdu_build       = rl_normal_mgmt_sdu_build,
+    .ops.sdu_rx               = rl_normal_sdu_rx,
+    .ops.flow_writeable       = rl_normal_flow_writeable,
+    .ops.flow_writeable_frags = rl_normal_flow_writeable_frags,
+    .ops.qos_supported        = rl_normal_qos_supported,
+    .ops.sched_config         = rl_normal_sched_config,
 };
 
 static int __init
@@ -29,8 +29,11 @@
 #include "rlite/common.h"
 #include <linux/mutex.h>
 #include <linux/spinlock.h>
+#include <linux/seqlock.h>
 #include <linux/wait.h>
 #include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
 #include <linux/workqueue.h>
 #include <linux/interrupt.h>
 #include <linux/timer.h>
@@ -56,6 +59,10 @@
 #include <linux/socket.h> /* memcpy_{to,from}iovecend */
 #endif
 
+#ifdef RL_HAVE_RHASHTABLE
+#include <linux/rhashtable.h>
+#endif
+
 /* Enable if you wish to enable RMT queues. This is currently disabled because
  * it is not SMP scalable, and its advantages are still not clear.
  * We may reintroduce RMT queues once we add support for RMT scheduling; in
@@ -120,6 +127,10 @@ extern int verbosity;
 
 /* PDU flags */
 #define PDU_F_ECN 0x01
+#define PDU_F_FRAG_FIRST 0x02  /* first fragment of an SDU */
+#define PDU_F_FRAG_MIDDLE 0x04 /* middle fragment of an SDU */
+#define PDU_F_FRAG_LAST 0x08   /* last fragment of an SDU */
+#define PDU_F_FRAG_MASK (PDU_F_FRAG_FIRST | PDU_F_FRAG_MIDDLE | PDU_F_FRAG_LAST)
 #define PDU_F_DRF 0x80
 
 /* PDU type definitions. */
@@ -157,6 +168,8 @@ struct rl_buf *rl_buf_alloc(size_t size, size_t hdroom, size_t tailroom,
 
 struct rl_buf *rl_buf_clone(struct rl_buf *rb, gfp_t gfp);
 
+int rl_buf_cow_head(struct rl_buf *rb, size_t hdroom, gfp_t gfp);
+
 void __rl_buf_free(struct rl_buf *rb);
 
 union rl_buf_ctx {
@@ -171,11 +184,15 @@ union rl_buf_ctx {
         /* Used in the TX datapath when this rb ends up into
          * an RMT queue. */
         struct flow_entry *lower_flow;
+        uint64_t tstamp; /* enqueue time, for latency stats */
     } rmt;
 
     struct {
         /* Used in the RX datapath for flow control. */
         rlm_seq_t cons_seqnum;
+        /* Used in the RX datapath for reassembly (see sdu_reasm()). */
+        uint32_t reasm_frags;
+        uint32_t reasm_len;
     } rx;
 };
 
@@ -194,6 +211,7 @@ struct rl_buf {
     struct rina_pci *pci;
     size_t len;
     union rl_buf_ctx u;
+    uint64_t tstamp;
     struct list_head node;
 };
 
@@ -203,6 +221,7 @@ struct rl_buf {
 #define RL_BUF_RTX(rb) (rb)->u.rtx
 #define RL_BUF_RX(rb) (rb)->u.rx
 #define RL_BUF_RMT(rb) (rb)->u.rmt
+#define RL_BUF_TSTAMP(rb) (rb)->tstamp
 
 /* Amount of memory consumed by this packet. */
 static inline unsigned int
@@ -291,6 +310,9 @@ rl_buf_copy_to_user(struct rl_buf *rb, const struct iovec *to, size_t bytes)
 #define RL_BUF_RTX(rb) ((union rl_buf_ctx *)((rb)->cb))->rtx
 #define RL_BUF_RX(rb) ((union rl_buf_ctx *)((rb)->cb))->rx
 #define RL_BUF_RMT(rb) ((union rl_buf_ctx *)((rb)->cb))->rmt
+/* The timestamp is stored in the control buffer, after the context. */
+#define RL_BUF_TSTAMP(rb)                                                      \
+    (*(uint64_t *)((rb)->cb + sizeof(union rl_buf_ctx)))
 
 static inline unsigned int
 rl_buf_truesize(struct rl_buf *rb)
@@ -406,6 +428,60 @@ rb_list_front(struct rb_list *list)
 
 #endif /* RL_SKB */
 
+/* Reasons for PDU drops, reported by the rlite_pdu_drop tracepoint. The
+ * first ones match the drop counters of struct rl_rmt_stats. */
+#define RL_DROP_QUEUE 0
+#define RL_DROP_NOROUTE 1
+#define RL_DROP_CSUM 2
+#define RL_DROP_TTL 3
+#define RL_DROP_NOFLOW 4
+#define RL_DROP_OTHER 5
+#define RL_DROP_RX_OVERRUN 6 /* userspace receive queue full */
+#define RL_DROP_TX_ERR 7     /* transmission error in a shim */
+#define RL_DROP_RX_ERR 8     /* reception error in a shim */
+
+/*
+ * Latency statistics. Buffers are timestamped when they enter a stage of
+ * the datapath (write(), PDU scheduler, receive queue, ...), and the time
+ * spent in the stage is accounted in a histogram when they leave it.
+ * When the latency_stats module parameter is not set, timestamps are
+ * zeroed and nothing is accounted.
+ */
+
+extern bool rl_latency_stats;
+
+static inline uint64_t
+rl_lat_now(void)
+{
+    return ktime_to_ns(ktime_get());
+}
+
+static inline void
+rl_lat_hist_add(struct rl_lat_hist *hist, uint64_t tstamp, uint64_t now)
+{
+    unsigned int i = fls64(div_u64(now - tstamp, NSEC_PER_USEC));
+
+    if (i >= RL_LAT_BUCKETS) {
+        i = RL_LAT_BUCKETS - 1;
+    }
+    hist->buckets[i]++;
+}
+
+static inline void
+rl_buf_tstamp(struct rl_buf *rb)
+{
+    RL_BUF_TSTAMP(rb) = unlikely(rl_latency_stats) ? rl_lat_now() : 0;
+}
+
+/* Account the time elapsed since @rb was timestamped. */
+static inline void
+rl_buf_lat_account(struct rl_lat_hist *hist, struct rl_buf *rb)
+{
+    if (unlikely(rl_latency_stats) && RL_BUF_TSTAMP(rb)) {
+        rl_lat_hist_add(hist, RL_BUF_TSTAMP(rb), rl_lat_now());
+    }
+}
+
 /*
  * Kernel data-structures.
  */
@@ -417,6 +493,11 @@ struct pduft_entry;
 
 struct ipcp_ops {
     bool (*flow_writeable)(struct flow_entry *flow);
+    /* Optional, for IPCPs supporting fragmentation. Tells whether
+     * @npdus PDUs carrying @len bytes overall can be written to @flow
+     * without backpressure. */
+    bool (*flow_writeable_frags)(struct flow_entry *flow, unsigned int npdus,
+                                 size_t len);
     void (*destroy)(struct ipcp_entry *ipcp);
 
     int (*appl_register)(struct ipcp_entry *ipcp, char *appl_name, int reg);
@@ -443,6 +524,13 @@ struct ipcp_ops {
  * alternative to dropping. When this flag is set, RMT cannot return
  * EAGAIN, which is the backpressure signal for the caller. */
 #define RL_RMT_F_CONSUME 2
+/* The buffer is the first, a middle or the last fragment of an SDU larger
+ * than max_sdu_size. Only used with IPCPs that support fragmentation. */
+#define RL_RMT_F_FRAG_FIRST 4
+#define RL_RMT_F_FRAG_MIDDLE 8
+#define RL_RMT_F_FRAG_LAST 16
+#define RL_RMT_F_FRAG_MASK                                                     \
+    (RL_RMT_F_FRAG_FIRST | RL_RMT_F_FRAG_MIDDLE | RL_RMT_F_FRAG_LAST)
     int (*sdu_write)(struct ipcp_entry *ipcp, struct flow_entry *flow,
                      struct rl_buf *rb, unsigned flags);
     struct rl_buf *(*sdu_rx)(struct ipcp_entry *ipcp, struct rl_buf *rb,
@@ -476,6 +564,11 @@ struct txrx {
     spinlock_t rx_lock;
 #define RL_TXRX_EOF (1 << 0)
     uint8_t flags;
+    /* Reader wakeup coalescing (see rl_sdu_rx_flow()). The number of SDUs
+     * queued since the last wakeup is protected by rx_lock. */
+    unsigned int rx_pending;
+    struct hrtimer rx_wake_tmr;
+    atomic64_t rx_wakeups;
 
     /* Write operation support. */
     struct ipcp_entry *ipcp;
@@ -493,6 +586,22 @@ struct dif {
     struct list_head node;
 };
 
+/* Receive side cache of the last flow resolved by an IPCP when looking up
+ * the destination cep-id of incoming PDUs. There is a cache for each lower
+ * flow (plus one for the PDUs which arrive through the shortcut), so that
+ * the lookup is skipped at each level of a stack of IPCPs as long as the
+ * PDUs received from a lower flow mostly belong to the same upper flow.
+ * The cached flow is valid only while its IPCP flows_gen counter is equal
+ * to 'gen'. Readers are lock-free, while writers are serialized by 'lock'
+ * (taken with bottom halves disabled) and skip the update if the lock is
+ * contended. */
+struct rl_rx_cache {
+    seqcount_t seq;
+    spinlock_t lock;
+    struct flow_entry *flow;
+    unsigned int gen;
+};
+
 struct ipcp_entry {
     rl_ipcp_id_t id;  /* Key */
     struct rl_dm *dm; /* parent rl_dm */
@@ -505,12 +614,19 @@ struct ipcp_entry {
 
 #define RL_K_IPCP_USE_CEP_IDS (1 << 0)
 #define RL_K_IPCP_ZOMBIE (1 << 1)
+#define RL_K_IPCP_FRAGMENTATION (1 << 2)
     uint32_t flags;
 
     /* Receive side optimization. Fields protected by 'lock'. */
     struct ipcp_entry *shortcut;
     int shortcut_flows;
 
+    /* Incremented each time a flow of this IPCP is removed from the
+     * cep-id table, to invalidate the receive caches. */
+    atomic_t flows_gen;
+    /* Receive cache for the PDUs without a lower flow (shortcut). */
+    struct rl_rx_cache rx_cache;
+
     struct ipcp_ops ops;
     void *priv;
     uint16_t tailroom; /* tailroom (e.g. used by shim-eth) */
@@ -547,6 +663,9 @@ struct ipcp_factory {
     struct module *owner;
     const char *dif_type;
     bool use_cep_ids;
+    /* The IPCP can fragment SDUs larger than max_sdu_size on in-order
+     * flows (see RL_RMT_F_FRAG_*), and reassemble them on reception. */
+    bool fragmentation;
     void *(*create)(struct ipcp_entry *ipcp);
     struct ipcp_ops ops;
 
@@ -565,6 +684,9 @@ struct tkbk {
     unsigned long intval_ms;
 };
 
+/* Maximum size of an SDU reassembled from fragments. */
+#define RL_SDU_REASM_MAX (1 << 16)
+
 struct dtp {
     spinlock_t lock;
 
@@ -602,6 +724,11 @@ struct dtp {
     struct rb_list seqq;
     unsigned int seqq_len;
     struct timer_list a_tmr;
+    /* Fragments of the SDU being reassembled, their total length in
+     * bytes and the sequence number expected for the next fragment. */
+    struct rb_list reasmq;
+    unsigned int reasmq_len;
+    rlm_seq_t reasm_next_seq;
 
 #define DTP_F_DRF_SET (1 << 0)
 #define DTP_F_DRF_EXPECTED (1 << 1)
@@ -631,6 +758,8 @@ struct flow_entry {
     void *priv;
 
     struct rl_flow_stats stats;
+    /* Cache used by the upper IPCP on the receive path. */
+    struct rl_rx_cache rx_cache;
     uint32_t uid;             /* unique id */
     struct list_head node_rm; /* for flows_removeq */
     unsigned long expires;    /* absolute time in jiffies */
@@ -642,10 +771,66 @@ struct flow_entry {
 #define RL_FLOW_DEL_POSTPONED (1 << 4) /* flow removal has been postponed */
 #define RL_FLOW_INITIATOR (1 << 5)     /* local node initiated this flow */
     uint8_t flags;
+#ifdef RL_HAVE_RHASHTABLE
+    struct rhash_head node;
+    struct rhash_head node_cep;
+#else  /* !RL_HAVE_RHASHTABLE */
     struct hlist_node node;
     struct hlist_node node_cep;
+#endif /* !RL_HAVE_RHASHTABLE */
+    struct list_head node_all; /* for the list of all the flows */
+    struct rcu_head rcu;
+};
+
+/* Allocator for port ids and cep ids. Allocation uses a rotating cursor,
+ * so that its cost does not depend on the number of ids in use (as long
+ * as the id space is not almost full), and a released id is not reused
+ * before all the other free ids have been used, which protects new flows
+ * from stale PDUs addressed to old ones. */
+struct rl_idalloc {
+    spinlock_t lock;
+    unsigned long *bitmap;
+    unsigned long size;
+    unsigned long cursor;
+    unsigned long used;
+};
+
+int rl_idalloc_init(struct rl_idalloc *ida, unsigned long size);
+
+void rl_idalloc_fini(struct rl_idalloc *ida);
+
+long rl_idalloc_get(struct rl_idalloc *ida);
+
+void rl_idalloc_put(struct rl_idalloc *ida, unsigned long id);
+
+/* Number of buckets of the flow tables, when resizable tables are not
+ * available. */
+#define RL_FLOWTAB_BITS 10
+
+/* A table of flows, indexed by local port-id or by local cep-id. Lookups
+ * are lock-free (they must be called within an RCU read-side critical
+ * section), while insertions and removals must be serialized by the
+ * caller. Removed entries must not be freed before an RCU grace period
+ * has elapsed. */
+struct rl_flowtab {
+#ifdef RL_HAVE_RHASHTABLE
+    struct rhashtable ht;
+#else  /* !RL_HAVE_RHASHTABLE */
+    DECLARE_HASHTABLE(ht, RL_FLOWTAB_BITS);
+#endif /* !RL_HAVE_RHASHTABLE */
+    bool by_cep;
 };
 
+int rl_flowtab_init(struct rl_flowtab *tab, bool by_cep);
+
+void rl_flowtab_fini(struct rl_flowtab *tab);
+
+int rl_flowtab_insert(struct rl_flowtab *tab, struct flow_entry *flow);
+
+void rl_flowtab_remove(struct rl_flowtab *tab, struct flow_entry *flow);
+
+struct flow_entry *rl_flowtab_lookup(struct rl_flowtab *tab, uint32_t key);
+
 struct pduft_entry {
     struct rl_pci_match match;
     struct flow_entry *flow;
@@ -727,6 +912,65 @@ struct flow_entry *flow_nodm_get(rl_port_t port_id);
 
 struct flow_entry *flow_get_by_cep(struct rl_dm *dm, rlm_cepid_t cep_id);
 
+/* Lock-free lookups, to be called within rcu_read_lock(). The flow can
+ * be used until rcu_read_unlock() without taking a reference. */
+struct flow_entry *flow_lookup_rcu(struct rl_dm *dm, rl_port_t port_id);
+
+struct flow_entry *flow_lookup_by_cep_rcu(struct rl_dm *dm,
+                                          rlm_cepid_t cep_id);
+
+static inline void
+rl_rx_cache_init(struct rl_rx_cache *rxc)
+{
+    seqcount_init(&rxc->seq);
+    spin_lock_init(&rxc->lock);
+    rxc->flow = NULL;
+    rxc->gen  = 0;
+}
+
+/* Look up the flow of 'ipcp' bound to 'cep_id', trying the receive cache
+ * first. To be called within an RCU read-side critical section, like
+ * flow_lookup_by_cep_rcu(). */
+static inline struct flow_entry *
+rl_rx_cache_lookup(struct rl_rx_cache *rxc, struct ipcp_entry *ipcp,
+                   rlm_cepid_t cep_id)
+{
+    struct flow_entry *flow;
+    unsigned int seq;
+    unsigned int gen;
+
+    do {
+        seq  = read_seqcount_begin(&rxc->seq);
+        flow = rxc->flow;
+        gen  = rxc->gen;
+    } while (read_seqcount_retry(&rxc->seq, seq));
+
+    /* If no flow has been removed since the cache was filled, the cached
+     * flow cannot be freed before we leave the RCU critical section. */
+    if (likely(flow && gen == (unsigned int)atomic_read(&ipcp->flows_gen) &&
+               flow->local_cep == cep_id)) {
+        return flow;
+    }
+
+    gen = atomic_read(&ipcp->flows_gen);
+    smp_rmb(); /* read the counter before looking up the table */
+    flow = flow_lookup_by_cep_rcu(ipcp->dm, cep_id);
+    /* The writer may run in softirq context (network RX) or in process
+     * context (e.g. the shim-tcp4 drain worker, or a loopback transmission),
+     * so bottom halves are disabled while writing: otherwise a softirq
+     * reader interrupting the writer on the same CPU would spin forever
+     * in read_seqcount_retry(). */
+    if (flow && flow->txrx.ipcp == ipcp && spin_trylock_bh(&rxc->lock)) {
+        write_seqcount_begin(&rxc->seq);
+        rxc->flow = flow;
+        rxc->gen  = gen;
+        write_seqcount_end(&rxc->seq);
+        spin_unlock_bh(&rxc->lock);
+    }
+
+    return flow;
+}
+
 void flow_get_ref(struct flow_entry *flow);
 
 void flow_make_mortal(struct flow_entry *flow);
@@ -743,6 +987,8 @@ int rl_configstr_to_u16(const char *src, uint16_t *dst, int *changed);
 int rl_configstr_to_u32(const char *src, uint32_t *dst, int *changed);
 int rl_configstr_to_u64(const char *src, uint64_t *dst, int *changed);
 
+enum hrtimer_restart rl_rx_wake_tmr_cb(struct hrtimer *tmr);
+
 static inline void
 txrx_init(struct txrx *txrx, struct ipcp_entry *ipcp)
 {
@@ -752,8 +998,25 @@ txrx_init(struct txrx *txrx, struct ipcp_entry *ipcp)
     init_waitqueue_head(&txrx->rx_wqh);
     txrx->ipcp = ipcp;
     init_waitqueue_head(&txrx->__tx_wqh);
-    txrx->tx_wqh = &txrx->__tx_wqh; /* Use per-flow tx_wqh by default. */
-    txrx->flags  = 0;
+    txrx->tx_wqh     = &txrx->__tx_wqh; /* Use per-flow tx_wqh by default. */
+    txrx->flags      = 0;
+    txrx->rx_pending = 0;
+    atomic64_set(&txrx->rx_wakeups, 0);
+#ifdef RL_HAVE_HRTIMER_SETUP
+    hrtimer_setup(&txrx->rx_wake_tmr, rl_rx_wake_tmr_cb, CLOCK_MONOTONIC,
+                  HRTIMER_MODE_REL);
+#else  /* !RL_HAVE_HRTIMER_SETUP */
+    hrtimer_init(&txrx->rx_wake_tmr, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    txrx->rx_wake_tmr.function = rl_rx_wake_tmr_cb;
+#endif /* !RL_HAVE_HRTIMER_SETUP */
+}
+
+/* To be called before freeing the txrx, when nobody can queue to it
+ * anymore. */
+static inline void
+txrx_fini(struct txrx *txrx)
+{
+    hrtimer_cancel(&txrx->rx_wake_tmr);
 }
 
 struct rl_sched;
@@ -781,8 +1044,9 @@ struct rl_sched {
 /* Implementation of the normal IPCP. */
 struct rl_normal {
     struct ipcp_entry *ipcp;
-    uint16_t ttl; /* time to live */
-    bool csum;    /* compute/check internet checksum on each PDU */
+    uint16_t ttl;     /* time to live */
+    bool csum;        /* compute/check internet checksum on each PDU */
+    bool pci_compact; /* transmit DT PDUs with the compact PCI */
 
     /* Implementation of the PDU Forwarding Table (PDUFT): a lock, a
      * default entry, and two hash tables. One of the has tables maps
@@ -849,6 +1113,8 @@ void *rl_alloc(size_t size, gfp_t gfp, rl_memtrack_t type);
 char *rl_strdup(const char *s, gfp_t gfp, rl_memtrack_t type);
 void rl_free(void *obj, rl_memtrack_t type);
 void rl_memtrack_dump_stats(void);
+unsigned int rl_memtrack_get_stats(struct rl_memtrack_stats *stats,
+                                   unsigned int max);
 #else /* ! RL_MEMTRACK */
 #define rl_alloc(_sz, _gfp, _ty) kmalloc(_sz, _gfp)
 #define rl_strdup(_s, _gfp, _ty) kstrdup(_s, _gfp)
@@ -0,0 +1,204 @@
+/*
+ * Tracepoints for the rlite datapath and flow management.
+ *
+ * Copyright (C) 2026 agent
+ * Author: agent <agent@local>
+ *
+ * This file is part of rlite.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+/*
+ * The tracepoints are defined in the rlite module (ctrl-dev.c) and
+ * exported to the IPCP modules. They show up as rlite:rlite_* events,
+ * e.g.
+ *
+ *     # perf record -e 'rlite:*' -a sleep 10
+ *     # bpftrace scripts/rlite-trace.bt
+ */
+
+#include "rlite-kernel.h"
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM rlite
+
+#if !defined(__RLITE_TRACE_H__) || defined(TRACE_HEADER_MULTI_READ)
+#define __RLITE_TRACE_H__
+
+#include <linux/tracepoint.h>
+
+#define rl_trace_drop_reason(_r)                                               \
+    __print_symbolic(_r, {RL_DROP_QUEUE, "queue"},                             \
+                     {RL_DROP_NOROUTE, "noroute"}, {RL_DROP_CSUM, "csum"},     \
+                     {RL_DROP_TTL, "ttl"}, {RL_DROP_NOFLOW, "noflow"},         \
+                     {RL_DROP_OTHER, "other"},                                 \
+                     {RL_DROP_RX_OVERRUN, "rx_overrun"},                       \
+                     {RL_DROP_TX_ERR, "tx_err"}, {RL_DROP_RX_ERR, "rx_err"})
+
+/* SDUs written to or received on a flow, by an application or by an
+ * upper IPCP. */
+DECLARE_EVENT_CLASS(rlite_sdu,
+
+                    TP_PROTO(struct flow_entry *flow, unsigned int len),
+
+                    TP_ARGS(flow, len),
+
+                    TP_STRUCT__entry(__field(rl_ipcp_id_t, ipcp_id)
+                                         __field(rl_port_t, port_id)
+                                             __field(unsigned int, len)),
+
+                    TP_fast_assign(__entry->ipcp_id = flow->txrx.ipcp->id;
+                                   __entry->port_id = flow->local_port;
+                                   __entry->len     = len;),
+
+                    TP_printk("ipcp=%u port=%u len=%u", __entry->ipcp_id,
+                              __entry->port_id, __entry->len));
+
+DEFINE_EVENT(rlite_sdu, rlite_sdu_tx,
+             TP_PROTO(struct flow_entry *flow, unsigned int len),
+             TP_ARGS(flow, len));
+
+DEFINE_EVENT(rlite_sdu, rlite_sdu_rx,
+             TP_PROTO(struct flow_entry *flow, unsigned int len),
+             TP_ARGS(flow, len));
+
+/* PDUs transmitted or received by an IPCP on a (lower) flow. The flow
+ * may be unknown on reception. */
+DECLARE_EVENT_CLASS(
+    rlite_pdu,
+
+    TP_PROTO(struct ipcp_entry *ipcp, struct flow_entry *flow,
+             unsigned int len),
+
+    TP_ARGS(ipcp, flow, len),
+
+    TP_STRUCT__entry(__field(rl_ipcp_id_t, ipcp_id) __field(rl_port_t, port_id)
+                         __field(unsigned int, len)),
+
+    TP_fast_assign(__entry->ipcp_id = ipcp->id;
+                   __entry->port_id = flow ? flow->local_port : RL_PORT_ID_NONE;
+                   __entry->len     = len;),
+
+    TP_printk("ipcp=%u port=%u len=%u", __entry->ipcp_id, __entry->port_id,
+              __entry->len));
+
+DEFINE_EVENT(rlite_pdu, rlite_pdu_tx,
+             TP_PROTO(struct ipcp_entry *ipcp, struct flow_entry *flow,
+                      unsigned int len),
+             TP_ARGS(ipcp, flow, len));
+
+DEFINE_EVENT(rlite_pdu, rlite_pdu_rx,
+             TP_PROTO(struct ipcp_entry *ipcp, struct flow_entry *flow,
+                      unsigned int len),
+             TP_ARGS(ipcp, flow, len));
+
+TRACE_EVENT(rlite_pdu_fwd,
+
+            TP_PROTO(struct ipcp_entry *ipcp, rlm_addr_t dst_addr,
+                     unsigned int len),
+
+            TP_ARGS(ipcp, dst_addr, len),
+
+            TP_STRUCT__entry(__field(rl_ipcp_id_t, ipcp_id)
+                                 __field(rlm_addr_t, dst_addr)
+                                     __field(unsigned int, len)),
+
+            TP_fast_assign(__entry->ipcp_id  = ipcp->id;
+                           __entry->dst_addr = dst_addr;
+                           __entry->len      = len;),
+
+            TP_printk("ipcp=%u dst_addr=%llu len=%u", __entry->ipcp_id,
+                      (unsigned long long)__entry->dst_addr, __entry->len));
+
+TRACE_EVENT(
+    rlite_pdu_drop,
+
+    TP_PROTO(struct ipcp_entry *ipcp, struct flow_entry *flow,
+             unsigned int len, int reason),
+
+    TP_ARGS(ipcp, flow, len, reason),
+
+    TP_STRUCT__entry(__field(rl_ipcp_id_t, ipcp_id) __field(rl_port_t, port_id)
+                         __field(unsigned int, len) __field(int, reason)),
+
+    TP_fast_assign(__entry->ipcp_id = ipcp->id;
+                   __entry->port_id = flow ? flow->local_port : RL_PORT_ID_NONE;
+                   __entry->len     = len;
+                   __entry->reason  = reason;),
+
+    TP_printk("ipcp=%u port=%u len=%u reason=%s", __entry->ipcp_id,
+              __entry->port_id, __entry->len,
+              rl_trace_drop_reason(__entry->reason)));
+
+TRACE_EVENT(rlite_pdu_rtx,
+
+            TP_PROTO(struct flow_entry *flow, uint64_t seqnum,
+                     unsigned int len),
+
+            TP_ARGS(flow, seqnum, len),
+
+            TP_STRUCT__entry(__field(rl_ipcp_id_t, ipcp_id)
+                                 __field(rl_port_t, port_id)
+                                     __field(uint64_t, seqnum)
+                                         __field(unsigned int, len)),
+
+            TP_fast_assign(__entry->ipcp_id = flow->txrx.ipcp->id;
+                           __entry->port_id = flow->local_port;
+                           __entry->seqnum  = seqnum;
+                           __entry->len     = len;),
+
+            TP_printk("ipcp=%u port=%u seqnum=%llu len=%u", __entry->ipcp_id,
+                      __entry->port_id, (unsigned long long)__entry->seqnum,
+                      __entry->len));
+
+/* Flow allocation (the flow enters the allocated state) and deallocation
+ * (the flow is destroyed). */
+DECLARE_EVENT_CLASS(rlite_flow,
+
+                    TP_PROTO(struct flow_entry *flow),
+
+                    TP_ARGS(flow),
+
+                    TP_STRUCT__entry(__field(rl_ipcp_id_t, ipcp_id)
+                                         __field(rl_port_t, port_id)
+                                             __field(rl_port_t, remote_port)
+                                                 __field(rlm_addr_t,
+                                                         remote_addr)),
+
+                    TP_fast_assign(__entry->ipcp_id = flow->txrx.ipcp->id;
+                                   __entry->port_id     = flow->local_port;
+                                   __entry->remote_port = flow->remote_port;
+                                   __entry->remote_addr = flow->remote_addr;),
+
+                    TP_printk("ipcp=%u port=%u remote=%llu:%u",
+                              __entry->ipcp_id, __entry->port_id,
+                              (unsigned long long)__entry->remote_addr,
+                              __entry->remote_port));
+
+DEFINE_EVENT(rlite_flow, rlite_flow_alloc, TP_PROTO(struct flow_entry *flow),
+             TP_ARGS(flow));
+
+DEFINE_EVENT(rlite_flow, rlite_flow_dealloc, TP_PROTO(struct flow_entry *flow),
+             TP_ARGS(flow));
+
+#endif /* __RLITE_TRACE_H__ */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE rlite-trace
+#include <trace/define_trace.h>
@@ -25,6 +25,7 @@
 #include <linux/types.h>
 #include "rlite/utils.h"
 #include "rlite-kernel.h"
+#include "rlite-trace.h"
 #include "rlite/kernel-msg.h"
 
 #include <linux/module.h>
@@ -617,6 +618,7 @@ shim_eth_pdu_rx(struct rl_shim_eth *priv, struct sk_buff *skb)
 #endif
 
     len = rb->len;
+    trace_rlite_pdu_rx(ipcp, NULL, len);
     /* Try to shortcut the packet to the upper IPCP. */
     if ((rb = rl_sdu_rx_shortcut(ipcp, rb)) == NULL) {
         stats->rx_pkt++;
@@ -708,6 +710,7 @@ shim_eth_pdu_rx(struct rl_shim_eth *priv, struct sk_buff *skb)
 drop:
     write_unlock_bh(&priv->arpt_lock);
     stats->rx_err++;
+    trace_rlite_pdu_drop(ipcp, NULL, len, RL_DROP_RX_ERR);
     rl_buf_free(rb);
 }
 
@@ -798,6 +801,7 @@ rl_shim_eth_sdu_write(struct ipcp_entry *ipcp, struct flow_entry *flow,
     if (unlikely(!entry)) {
         rl_buf_free(rb);
         stats->tx_err++;
+        trace_rlite_pdu_drop(ipcp, flow, len, RL_DROP_TX_ERR);
         RPD(1, "called on deallocated entry\n");
         return -ENXIO;
     }
@@ -805,6 +809,7 @@ rl_shim_eth_sdu_write(struct ipcp_entry *ipcp, struct flow_entry *flow,
     if (unlikely(len > ETH_DATA_LEN)) {
         rl_buf_free(rb);
         stats->tx_err++;
+        trace_rlite_pdu_drop(ipcp, flow, len, RL_DROP_TX_ERR);
         RPD(1, "Exceeding maximum ethernet payload (%d)\n", ETH_DATA_LEN);
         return -EMSGSIZE;
     }
@@ -815,6 +820,7 @@ rl_shim_eth_sdu_write(struct ipcp_entry *ipcp, struct flow_entry *flow,
     if (!skb) {
         rl_buf_free(rb);
         stats->tx_err++;
+        trace_rlite_pdu_drop(ipcp, flow, len, RL_DROP_TX_ERR);
         return -ENOMEM;
     }
 
@@ -861,6 +867,7 @@ rl_shim_eth_sdu_write(struct ipcp_entry *ipcp, struct flow_entry *flow,
 
         RPV(1, "dev_queue_xmit() failed [%d]\n", ret);
         stats->tx_err++;
+        trace_rlite_pdu_drop(ipcp, flow, len, RL_DROP_TX_ERR);
         for (i = 0; i < priv->netdev->num_tx_queues; i++) {
             set_bit(RL_TXQ_XMIT_BUSY, &priv->txq[i].xmit_busy);
         }
@@ -871,6 +878,7 @@ rl_shim_eth_sdu_write(struct ipcp_entry *ipcp, struct flow_entry *flow,
 
     stats->tx_pkt++;
     stats->tx_byte += len;
+    trace_rlite_pdu_tx(ipcp, flow, len);
 
 #ifndef RL_SKB
     rl_buf_free(rb);
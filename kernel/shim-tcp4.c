@@ -25,6 +25,7 @@
 #include <linux/types.h>
 #include "rlite/utils.h"
 #include "rlite-kernel.h"
+#include "rlite-trace.h"
 
 #include <linux/module.h>
 #include <linux/aio.h>
@@ -39,6 +40,7 @@
 #include <linux/net.h>
 #include <linux/file.h>
 #include <linux/version.h>
+#include <linux/tcp.h>
 #include <net/sock.h>
 
 struct rl_shim_tcp4 {
@@ -66,11 +68,24 @@ struct shim_tcp4_flow {
     int cur_rx_buflen;
     bool cur_rx_hdr;
 
+    /* Staging buffer used to read many length-prefixed SDUs with a
+     * single recvmsg(). Bytes in [rxbuf_head, rxbuf_tail) have been
+     * read from the socket but not parsed yet. */
+    uint8_t *rxbuf;
+    unsigned int rxbuf_head;
+    unsigned int rxbuf_tail;
+
     struct mutex rxw_lock;
 };
 
 #define INET4_MAX_TXQ_LEN 64
 
+/* Size of the per-flow staging buffer for bulk socket reads. */
+#define TCP4_RXBUF_SIZE 16384
+
+/* Maximum number of PDUs coalesced into a single sendmsg(). */
+#define TCP4_TX_BATCH 16
+
 struct txq_entry {
     struct rl_buf *rb;
     struct shim_tcp4_flow *flow_priv;
@@ -117,6 +132,87 @@ rl_shim_tcp4_destroy(struct ipcp_entry *ipcp)
     PD("IPCP [%p] destroyed\n", priv);
 }
 
+static void
+tcp4_rx_deliver(struct shim_tcp4_flow *priv)
+{
+    struct flow_entry *flow     = priv->flow;
+    struct rl_ipcp_stats *stats = raw_cpu_ptr(flow->txrx.ipcp->stats);
+
+    if (likely(priv->cur_rx_rb)) {
+        trace_rlite_pdu_rx(flow->txrx.ipcp, flow, priv->cur_rx_rblen);
+        rl_sdu_rx_flow(flow->txrx.ipcp, flow, priv->cur_rx_rb, true);
+        stats->rx_pkt++;
+        stats->rx_byte += priv->cur_rx_rblen;
+    }
+
+    priv->cur_rx_rb     = NULL;
+    priv->cur_rx_hdr    = true;
+    priv->cur_rx_rblen  = 0;
+    priv->cur_rx_buflen = 0;
+}
+
+/* Parse as many complete SDUs as possible out of the staging buffer.
+ * If the last SDU is incomplete, its buffer is allocated and the
+ * available part of the body is moved there, so that the rest of the
+ * body can be read directly into the rl_buf. On return, the staging
+ * buffer contains at most one byte (half of a length header). */
+static void
+tcp4_rx_parse(struct shim_tcp4_flow *priv)
+{
+    struct ipcp_entry *ipcp     = priv->flow->txrx.ipcp;
+    struct rl_ipcp_stats *stats = raw_cpu_ptr(ipcp->stats);
+
+    while (priv->rxbuf_tail - priv->rxbuf_head >= sizeof(uint16_t)) {
+        unsigned int avail;
+        uint16_t lenhdr;
+
+        memcpy(&lenhdr, priv->rxbuf + priv->rxbuf_head, sizeof(lenhdr));
+        priv->rxbuf_head += sizeof(lenhdr);
+        priv->cur_rx_rblen = ntohs(lenhdr);
+        if (unlikely(!priv->cur_rx_rblen)) {
+            PE("Warning: zero length packet\n");
+            continue;
+        }
+
+        priv->cur_rx_hdr    = false;
+        priv->cur_rx_buflen = 0;
+        priv->cur_rx_rb     = rl_buf_alloc(priv->cur_rx_rblen, ipcp->rxhdroom,
+                                       ipcp->tailroom, GFP_ATOMIC);
+        if (unlikely(!priv->cur_rx_rb)) {
+            /* Keep the stream in sync by skipping the SDU body. */
+            stats->rx_err++;
+            RPV(1, "Out of memory\n");
+        } else {
+            rl_buf_append(priv->cur_rx_rb, priv->cur_rx_rblen);
+        }
+
+        avail = min_t(unsigned int, priv->rxbuf_tail - priv->rxbuf_head,
+                      priv->cur_rx_rblen);
+        if (priv->cur_rx_rb) {
+            memcpy(RL_BUF_DATA(priv->cur_rx_rb),
+                   priv->rxbuf + priv->rxbuf_head, avail);
+        }
+        priv->rxbuf_head += avail;
+        priv->cur_rx_buflen = avail;
+
+        if (priv->cur_rx_buflen < priv->cur_rx_rblen) {
+            /* Partial SDU, the staging buffer is now empty. */
+            break;
+        }
+        tcp4_rx_deliver(priv);
+    }
+
+    /* Move the leftover (if any) at the beginning of the buffer. */
+    if (priv->rxbuf_head == priv->rxbuf_tail) {
+        priv->rxbuf_head = priv->rxbuf_tail = 0;
+    } else if (priv->rxbuf_head) {
+        memmove(priv->rxbuf, priv->rxbuf + priv->rxbuf_head,
+                priv->rxbuf_tail - priv->rxbuf_head);
+        priv->rxbuf_tail -= priv->rxbuf_head;
+        priv->rxbuf_head = 0;
+    }
+}
+
 /* This must be called in process context. */
 static void
 tcp4_drain_socket_rxq(struct shim_tcp4_flow *priv)
@@ -125,7 +221,8 @@ tcp4_drain_socket_rxq(struct shim_tcp4_flow *priv)
     struct rl_ipcp_stats *stats = raw_cpu_ptr(flow->txrx.ipcp->stats);
     struct socket *sock         = priv->sock;
     struct msghdr msghdr;
-    struct iovec iov;
+    struct kvec iov;
+    bool body;
     int ret;
 
     mutex_lock(&priv->rxw_lock);
@@ -134,21 +231,25 @@ tcp4_drain_socket_rxq(struct shim_tcp4_flow *priv)
         memset(&msghdr, 0, sizeof(msghdr));
         msghdr.msg_flags = MSG_DONTWAIT;
 
-        if (priv->cur_rx_hdr) {
-            /* We're reading the 2-bytes header containing the SDU length. */
-            iov.iov_base = &priv->cur_rx_rblen;
-            iov.iov_len  = sizeof(priv->cur_rx_rblen);
-
+        /* When in the middle of an SDU whose buffer has already been
+         * allocated, read the rest of the body directly into the rl_buf.
+         * Otherwise, read as much as we can into the staging buffer, so
+         * that many small SDUs can be received with a single recvmsg(). */
+        body = !priv->cur_rx_hdr && priv->cur_rx_rb;
+        if (body) {
+            iov.iov_base = RL_BUF_DATA(priv->cur_rx_rb) + priv->cur_rx_buflen;
+            iov.iov_len  = priv->cur_rx_rblen - priv->cur_rx_buflen;
         } else {
-            /* We're reading the SDU. */
-            iov.iov_base = RL_BUF_DATA(priv->cur_rx_rb);
-            iov.iov_len  = priv->cur_rx_rblen;
+            iov.iov_base = priv->rxbuf + priv->rxbuf_tail;
+            iov.iov_len  = TCP4_RXBUF_SIZE - priv->rxbuf_tail;
+            if (!priv->cur_rx_hdr) {
+                /* Skipping the body of a dropped SDU. */
+                iov.iov_len = min_t(size_t, iov.iov_len,
+                                    priv->cur_rx_rblen - priv->cur_rx_buflen);
+            }
         }
 
-        iov.iov_base += priv->cur_rx_buflen;
-        iov.iov_len -= priv->cur_rx_buflen;
-
-        ret = kernel_recvmsg(sock, &msghdr, (struct kvec *)&iov, 1, iov.iov_len,
+        ret = kernel_recvmsg(sock, &msghdr, &iov, 1, iov.iov_len,
                              msghdr.msg_flags);
         if (ret == -EAGAIN) {
             break;
@@ -164,42 +265,17 @@ tcp4_drain_socket_rxq(struct shim_tcp4_flow *priv)
 
         NPD("read %d bytes\n", ret);
 
-        priv->cur_rx_buflen += ret;
-
-        if (priv->cur_rx_hdr &&
-            priv->cur_rx_buflen == sizeof(priv->cur_rx_rblen)) {
-            /* We have completely read the 2-bytes header. */
-            priv->cur_rx_rblen = ntohs(priv->cur_rx_rblen);
-            if (unlikely(!priv->cur_rx_rblen)) {
-                PE("Warning: zero length packet\n");
-            } else {
-                priv->cur_rx_hdr = false;
-                priv->cur_rx_rb  = rl_buf_alloc(
-                    priv->cur_rx_rblen, priv->flow->txrx.ipcp->rxhdroom,
-                    priv->flow->txrx.ipcp->tailroom, GFP_ATOMIC);
-                if (unlikely(!priv->cur_rx_rb)) {
-                    stats->rx_err++;
-                    RPV(1, "Out of memory\n");
-                    break;
-                }
-                rl_buf_append(priv->cur_rx_rb, priv->cur_rx_rblen);
-            }
-
-            priv->cur_rx_buflen = 0;
+        if (priv->cur_rx_hdr) {
+            priv->rxbuf_tail += ret;
+            tcp4_rx_parse(priv);
+            continue;
+        }
 
-        } else if (!priv->cur_rx_hdr &&
-                   priv->cur_rx_buflen == priv->cur_rx_rblen) {
+        /* Body bytes (either stored or skipped). */
+        priv->cur_rx_buflen += ret;
+        if (priv->cur_rx_buflen == priv->cur_rx_rblen) {
             /* We have completely read the SDU. */
-            rl_sdu_rx_flow(flow->txrx.ipcp, flow, priv->cur_rx_rb, true);
-
-            stats->rx_pkt++;
-            stats->rx_byte += priv->cur_rx_rblen;
-
-            priv->cur_rx_rb    = NULL;
-            priv->cur_rx_hdr   = true;
-            priv->cur_rx_rblen = 0;
-
-            priv->cur_rx_buflen = 0;
+            tcp4_rx_deliver(priv);
         }
     }
 
@@ -251,11 +327,19 @@ rl_shim_tcp4_flow_init(struct ipcp_entry *ipcp, struct flow_entry *flow)
         return -1;
     }
 
+    priv->rxbuf = rl_alloc(TCP4_RXBUF_SIZE, GFP_ATOMIC, RL_MT_SHIMDATA);
+    if (!priv->rxbuf) {
+        RPV(1, "Out of memory\n");
+        rl_free(priv, RL_MT_SHIMDATA);
+        return -1;
+    }
+
     /* This increments the file descriptor reference counter. */
     sock = sockfd_lookup(flow->cfg.fd, &err);
     if (!sock) {
         PE("Cannot find socket corresponding to file descriptor %d\n",
            flow->cfg.fd);
+        rl_free(priv->rxbuf, RL_MT_SHIMDATA);
         rl_free(priv, RL_MT_SHIMDATA);
         return err;
     }
@@ -281,6 +365,8 @@ rl_shim_tcp4_flow_init(struct ipcp_entry *ipcp, struct flow_entry *flow)
     priv->cur_rx_rblen  = 0;
     priv->cur_rx_buflen = 0;
     priv->cur_rx_hdr    = true;
+    priv->rxbuf_head    = 0;
+    priv->rxbuf_tail    = 0;
 
     priv->flow = flow;
     flow->priv = priv;
@@ -322,6 +408,10 @@ rl_shim_tcp4_flow_deallocated(struct ipcp_entry *ipcp, struct flow_entry *flow)
     fput(sock->file);
     // mutex_destroy(&priv->rxw_lock);
     flow->priv = NULL;
+    if (priv->cur_rx_rb) {
+        rl_buf_free(priv->cur_rx_rb);
+    }
+    rl_free(priv->rxbuf, RL_MT_SHIMDATA);
     rl_free(priv, RL_MT_SHIMDATA);
 
     PD("Released socket %p\n", sock);
@@ -329,26 +419,43 @@ rl_shim_tcp4_flow_deallocated(struct ipcp_entry *ipcp, struct flow_entry *flow)
     return 0;
 }
 
+/* Send a batch of PDUs belonging to the same flow with a single
+ * sendmsg(), each one preceded by its 2-bytes length header. If 'more'
+ * is set, the caller is going to send more data soon, and so the TCP
+ * stack is allowed to hold back a partial segment (MSG_MORE). The PDUs
+ * are consumed in any case. */
 static int
-tcp4_xmit(struct shim_tcp4_flow *flow_priv, struct rl_buf *rb)
+tcp4_xmit(struct shim_tcp4_flow *flow_priv, struct rl_buf **rbs, int n,
+          bool more)
 {
     struct rl_ipcp_stats *stats =
         raw_cpu_ptr(flow_priv->flow->txrx.ipcp->stats);
+    uint16_t lenhdrs[TCP4_TX_BATCH];
+    struct kvec iov[2 * TCP4_TX_BATCH];
     struct msghdr msghdr;
-    struct iovec iov[2];
-    uint16_t lenhdr = htons(rb->len);
-    int totlen      = rb->len + sizeof(lenhdr);
+    size_t bytes = 0;
+    int totlen   = 0;
     int ret;
+    int i;
+
+    BUG_ON(n <= 0 || n > TCP4_TX_BATCH);
+
+    for (i = 0; i < n; i++) {
+        lenhdrs[i]              = htons(rbs[i]->len);
+        iov[2 * i].iov_base     = &lenhdrs[i];
+        iov[2 * i].iov_len      = sizeof(lenhdrs[i]);
+        iov[2 * i + 1].iov_base = RL_BUF_DATA(rbs[i]);
+        iov[2 * i + 1].iov_len  = rbs[i]->len;
+        bytes += rbs[i]->len;
+        totlen += rbs[i]->len + sizeof(lenhdrs[i]);
+    }
 
     memset(&msghdr, 0, sizeof(msghdr));
-    iov[0].iov_base = &lenhdr;
-    iov[0].iov_len  = sizeof(lenhdr);
-    iov[1].iov_base = RL_BUF_DATA(rb);
-    iov[1].iov_len  = rb->len;
-
     msghdr.msg_flags = MSG_DONTWAIT;
-    ret =
-        kernel_sendmsg(flow_priv->sock, &msghdr, (struct kvec *)iov, 2, totlen);
+    if (more) {
+        msghdr.msg_flags |= MSG_MORE;
+    }
+    ret = kernel_sendmsg(flow_priv->sock, &msghdr, iov, 2 * n, totlen);
 
     if (unlikely(ret != totlen)) {
         PD("wspaces: %d, %lu\n", sk_stream_wspace(flow_priv->sock->sk),
@@ -357,54 +464,133 @@ tcp4_xmit(struct shim_tcp4_flow *flow_priv, struct rl_buf *rb)
             PE("kernel_sendmsg(): failed [%d]\n", ret);
 
         } else {
-            PI("kernel_sendmsg(): partial write %d/%zu\n", ret, rb->len);
+            PI("kernel_sendmsg(): partial write %d/%d\n", ret, totlen);
         }
 
-        stats->tx_err++;
+        stats->tx_err += n;
     } else {
-        NPD("kernel_sendmsg(%zu + 2)\n", rb->len);
-        stats->tx_pkt++;
-        stats->tx_byte += rb->len;
+        NPD("kernel_sendmsg(%d PDUs, %d bytes)\n", n, totlen);
+        stats->tx_pkt += n;
+        stats->tx_byte += bytes;
     }
 
-    rl_buf_free(rb);
+    for (i = 0; i < n; i++) {
+        rl_buf_free(rbs[i]);
+    }
 
     return ret;
 }
 
+/* Push out the data held back by a previous sendmsg() with MSG_MORE. */
+static void
+tcp4_push(struct shim_tcp4_flow *flow_priv)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0)
+    tcp_sock_set_cork(flow_priv->sock->sk, false);
+#else
+    int zero = 0;
+
+    kernel_setsockopt(flow_priv->sock, SOL_TCP, TCP_CORK, (char *)&zero,
+                      sizeof(zero));
+#endif
+}
+
 static void
 tcp4_tx_worker(struct work_struct *w)
 {
     struct rl_shim_tcp4 *priv = container_of(w, struct rl_shim_tcp4, txw);
-    int totlen;
+    struct shim_tcp4_flow *corked = NULL;
+    struct txq_entry *batch[TCP4_TX_BATCH];
+    struct rl_buf *rbs[TCP4_TX_BATCH];
+    struct list_head txq;
 
     for (;;) {
-        struct txq_entry *qe = NULL;
-
+        /* Grab the whole queue at once. */
+        INIT_LIST_HEAD(&txq);
         spin_lock_bh(&priv->txq_lock);
-        if (priv->txq_len) {
-            qe = list_first_entry(&priv->txq, struct txq_entry, node);
-            list_del_init(&qe->node);
-            priv->txq_len--;
-        }
+        list_splice_init(&priv->txq, &txq);
+        priv->txq_len = 0;
         spin_unlock_bh(&priv->txq_lock);
 
-        if (!qe) {
+        if (list_empty(&txq)) {
             break;
         }
 
-        totlen = qe->rb->len + sizeof(uint16_t);
+        /* Coalesce consecutive PDUs for the same flow into a single
+         * sendmsg(), as long as they fit the socket send buffer. We
+         * use MSG_MORE as long as the next batch is for the same flow,
+         * so that the TCP stack pushes out the data at the end of
+         * the run. */
+        while (!list_empty(&txq)) {
+            struct shim_tcp4_flow *flow_priv;
+            struct txq_entry *qe;
+            bool more;
+            int wspace;
+            int n = 0;
+            int i;
+
+            qe        = list_first_entry(&txq, struct txq_entry, node);
+            flow_priv = qe->flow_priv;
+            wspace    = sk_stream_wspace(flow_priv->sock->sk);
+
+            while (n < TCP4_TX_BATCH && !list_empty(&txq)) {
+                int totlen;
+
+                qe = list_first_entry(&txq, struct txq_entry, node);
+                if (qe->flow_priv != flow_priv) {
+                    break;
+                }
+                list_del_init(&qe->node);
+
+                totlen = qe->rb->len + sizeof(uint16_t);
+                if (wspace < totlen + 2) {
+                    /* Cannot backpressure here, we have to drop */
+                    RPD(1, "Dropping SDU [len=%zu]\n", qe->rb->len);
+                    trace_rlite_pdu_drop(qe->flow_priv->flow->txrx.ipcp,
+                                         qe->flow_priv->flow, qe->rb->len,
+                                         RL_DROP_QUEUE);
+                    rl_buf_free(qe->rb);
+                    flow_put(qe->flow_priv->flow);
+                    rl_free(qe, RL_MT_SHIMDATA);
+                    continue;
+                }
+                wspace -= totlen;
+                rbs[n]   = qe->rb;
+                batch[n] = qe;
+                n++;
+            }
+
+            if (corked) {
+                /* The previous batch was sent with MSG_MORE, and this
+                 * one is for the same flow. If all of its PDUs have been
+                 * dropped, nothing is going to push the corked data out,
+                 * so we do it here. */
+                if (!n) {
+                    tcp4_push(corked);
+                }
+                flow_put(corked->flow);
+                corked = NULL;
+            }
 
-        if (sk_stream_wspace(qe->flow_priv->sock->sk) < totlen + 2) {
-            /* Cannot backpressure here, we have to drop */
-            RPD(1, "Dropping SDU [len=%zu]\n", qe->rb->len);
-            rl_buf_free(qe->rb);
-        } else {
-            tcp4_xmit(qe->flow_priv, qe->rb);
-        }
+            if (!n) {
+                continue;
+            }
+
+            more = !list_empty(&txq) &&
+                   list_first_entry(&txq, struct txq_entry, node)->flow_priv ==
+                       flow_priv;
+            tcp4_xmit(flow_priv, rbs, n, more);
+            if (more) {
+                /* Keep the flow alive until the next batch. */
+                flow_get_ref(flow_priv->flow);
+                corked = flow_priv;
+            }
 
-        flow_put(qe->flow_priv->flow);
-        rl_free(qe, RL_MT_SHIMDATA);
+            for (i = 0; i < n; i++) {
+                flow_put(batch[i]->flow_priv->flow);
+                rl_free(batch[i], RL_MT_SHIMDATA);
+            }
+        }
     }
 }
 
@@ -454,6 +640,7 @@ rl_shim_tcp4_sdu_write(struct ipcp_entry *ipcp, struct flow_entry *flow,
 
         if (drop) {
             NPD(2, "Queue full, dropping PDU [len=%u]\n", rb->len);
+            trace_rlite_pdu_drop(ipcp, flow, rb->len, RL_DROP_QUEUE);
             rl_buf_free(rb);
             return -ENOSPC;
         }
@@ -463,7 +650,7 @@ rl_shim_tcp4_sdu_write(struct ipcp_entry *ipcp, struct flow_entry *flow,
         return 0;
     }
 
-    return tcp4_xmit(flow_priv, rb);
+    return tcp4_xmit(flow_priv, &rb, 1, false);
 }
 
 static int
@@ -25,6 +25,7 @@
 #include <linux/types.h>
 #include "rlite/utils.h"
 #include "rlite-kernel.h"
+#include "rlite-trace.h"
 
 #include <linux/module.h>
 #include <linux/aio.h>
@@ -205,6 +206,7 @@ udp4_drain_socket_rxq(struct shim_udp4_flow *priv)
 
         NPD("read %d bytes\n", ret);
         rb->len = ret;
+        trace_rlite_pdu_rx(flow->txrx.ipcp, flow, ret);
         rl_sdu_rx_flow(flow->txrx.ipcp, flow, rb, true);
         stats->rx_pkt++;
         stats->rx_byte += ret;
@@ -368,10 +370,12 @@ rl_shim_udp4_sdu_write(struct ipcp_entry *ipcp, struct flow_entry *flow,
 
         PE("kernel_sendmsg(%zu): failed [%d]\n", rb->len, ret);
         stats->tx_err++;
+        trace_rlite_pdu_drop(ipcp, flow, rb->len, RL_DROP_TX_ERR);
     } else {
         NPD("kernel_sendmsg(%zu)\n", rb->len);
         stats->tx_pkt++;
         stats->tx_byte += rb->len;
+        trace_rlite_pdu_tx(ipcp, flow, rb->len);
     }
 
     rl_buf_free(rb);
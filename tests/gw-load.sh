@@ -0,0 +1,118 @@
+#!/bin/bash
+
+# Load test for rina-gw: many concurrent TCP sessions are forwarded
+# by the gateway towards a RINA stream server (rina-toy), and rina-gw
+# periodically reports the number of sessions and the throughput of
+# each forwarding worker. Requires a normal IPCP in the DIF selected
+# with -d. Run it with "-m copy" and "-m splice" to compare the
+# forwarding modes.
+
+function usage {
+    echo "$0 [-n NUM_SESSIONS] [-W NUM_WORKERS] [-D DURATION_SECS] [-d DIF] [-p TCP_PORT] [-m copy|splice]"
+}
+
+N=100
+W=$(nproc)
+D=20
+DIF=n.DIF
+PORT=16800
+MODE=copy
+
+# Option parsing
+while [[ $# > 0 ]]
+do
+    key="$1"
+    case $key in
+        "-n")
+        if [ -n "$2" ]; then
+            N="$2"
+            shift
+        else
+            echo "-n requires a numeric argument"
+            exit 255
+        fi
+        ;;
+
+        "-W")
+        if [ -n "$2" ]; then
+            W="$2"
+            shift
+        else
+            echo "-W requires a numeric argument"
+            exit 255
+        fi
+        ;;
+
+        "-D")
+        if [ -n "$2" ]; then
+            D="$2"
+            shift
+        else
+            echo "-D requires a numeric argument"
+            exit 255
+        fi
+        ;;
+
+        "-d")
+        if [ -n "$2" ]; then
+            DIF="$2"
+            shift
+        else
+            echo "-d requires a DIF name"
+            exit 255
+        fi
+        ;;
+
+        "-p")
+        if [ -n "$2" ]; then
+            PORT="$2"
+            shift
+        else
+            echo "-p requires a numeric argument"
+            exit 255
+        fi
+        ;;
+
+        "-m")
+        if [ -n "$2" ]; then
+            MODE="$2"
+            shift
+        else
+            echo "-m requires a forwarding mode (copy, splice)"
+            exit 255
+        fi
+        ;;
+
+        "-h")
+            usage
+            exit 0
+        ;;
+
+        *)
+        echo "Unknown option '$key'"
+        exit 255
+        ;;
+    esac
+    shift
+done
+
+CONF=$(mktemp)
+trap "rm -f ${CONF}; kill 0" EXIT
+
+# Since rina-toy serves one flow at a time, each session gets its own
+# RINA server, which streams data on the flow allocated by the gateway,
+# and its own TCP port on the gateway.
+for i in $(seq 1 $N); do
+    echo "I2R ${DIF} gwload-server:$i 127.0.0.1 $((PORT + i))" >> ${CONF}
+    rina-toy -l -d ${DIF} -z gwload-server:$i > /dev/null &
+done
+sleep 1
+rina-gw -c ${CONF} -W ${W} -m ${MODE} -s 1 &
+sleep 1
+
+# Run the TCP clients, each one downloading through the gateway.
+for i in $(seq 1 $N); do
+    inet-toy -S -p $((PORT + i)) > /dev/null &
+done
+
+sleep ${D}
@@ -13,6 +13,10 @@ rlite-ctl dif-policy-param-mod dd addralloc cli-timeout 1000ms
 rlite-ctl dif-policy-param-mod dd addralloc raft-election-timeout 200ms
 rlite-ctl dif-policy-param-mod dd addralloc raft-heartbeat-timeout 10ms
 rlite-ctl dif-policy-param-mod dd addralloc raft-rtx-timeout 10s
+rlite-ctl dif-policy-param-mod dd addralloc raft-batch-size 1
+rlite-ctl dif-policy-param-mod dd addralloc raft-window 0
+rlite-ctl dif-policy-param-mod dd addralloc read-mode follower
+rlite-ctl dif-policy-param-mod dd addralloc read-max-staleness 2s
 
 rlite-ctl dif-policy-mod dd dft centralized-fault-tolerant
 rlite-ctl dif-policy-param-mod dd dft replicas a,b,c
@@ -20,6 +24,21 @@ rlite-ctl dif-policy-param-mod dd dft cli-timeout 2040ms
 rlite-ctl dif-policy-param-mod dd dft raft-election-timeout 40ms
 rlite-ctl dif-policy-param-mod dd dft raft-heartbeat-timeout 2040ms
 rlite-ctl dif-policy-param-mod dd dft raft-rtx-timeout 3s
+rlite-ctl dif-policy-param-mod dd dft raft-batch-size 256
+rlite-ctl dif-policy-param-mod dd dft raft-window 32
+rlite-ctl dif-policy-param-mod dd dft cache-ttl 10s
+rlite-ctl dif-policy-param-mod dd dft cache-neg-ttl 0ms
+rlite-ctl dif-policy-param-mod dd dft cache-size 64
+rlite-ctl dif-policy-param-mod dd dft cache-push-inval false
+rlite-ctl dif-policy-param-mod dd dft read-mode linearizable
+rlite-ctl dif-policy-param-mod dd dft read-lease false
+rlite-ctl dif-policy-param-mod dd dft read-max-staleness 500ms
+rlite-ctl dif-policy-mod dd dft kademlia
+rlite-ctl dif-policy-param-mod dd dft bucket-size 8
+rlite-ctl dif-policy-param-mod dd dft parallelism 2
+rlite-ctl dif-policy-param-mod dd dft replication 4
+rlite-ctl dif-policy-param-mod dd dft rpc-timeout 500ms
+rlite-ctl dif-policy-param-mod dd dft republish-intval 30s
 
 rlite-ctl dif-policy-param-mod dd enrollment timeout 300ms
 rlite-ctl dif-policy-param-mod dd enrollment keepalive 4s
@@ -32,6 +51,8 @@ rlite-ctl dif-policy-param-mod dd resalloc reliable-n-flows true
 rlite-ctl dif-policy-param-mod dd resalloc broadcast-enroller true
 
 rlite-ctl dif-policy-param-mod dd ribd refresh-intval 10s
+rlite-ctl dif-policy-param-mod dd ribd digest-sync false
+rlite-ctl dif-policy-param-mod dd ribd sync-batch 10
 
 rlite-ctl dif-policy-mod dd routing link-state
 rlite-ctl dif-policy-param-mod dd routing age-incr-intval 10s
@@ -43,5 +64,8 @@ rlite-ctl dif-policy-param-mod dd enrollment wrong-parameter 300 && exit 1
 rlite-ctl dif-policy-param-mod dd enrollment timeout wrong-value && exit 1
 rlite-ctl dif-policy-param-mod dd resalloc reliable-flows 1023 && exit 1
 rlite-ctl dif-policy-param-mod dd ribd refresh-intval 7 && exit 1
+rlite-ctl dif-policy-param-mod dd ribd sync-batch -1 && exit 1
+rlite-ctl dif-policy-param-mod dd dft bucket-size 0 && exit 1
+rlite-ctl dif-policy-param-mod dd addralloc raft-batch-size 0 && exit 1
 rlite-ctl dif-policy-param-mod dd enrollment keepalive 10 && exit 1
 exit 0
@@ -10,4 +10,5 @@ rinaperf -z rpinstance7 -p2 -c 4 -i 0
 start_daemon rinaperf -lw -z rpinstance8
 rinaperf -z rpinstance8  -c 2 -i 0
 rinaperf -z rpinstance7  -c 2 -i 0
+rinaperf -z rpinstance8 -t fsr -c 200 -P 16
 rlite-ctl ipcp-destroy sl
@@ -15,6 +15,8 @@ rlite-ctl dif-policy-list dd addralloc | grep -q "\<centralized-fault-tolerant\>
 rlite-ctl dif-policy-list dd dft | grep -q "\<fully-replicated\>"
 rlite-ctl dif-policy-mod dd dft centralized-fault-tolerant
 rlite-ctl dif-policy-list dd dft | grep -q "\<centralized-fault-tolerant\>"
+rlite-ctl dif-policy-mod dd dft kademlia
+rlite-ctl dif-policy-list dd dft | grep -q "\<kademlia\>"
 
 rlite-ctl dif-policy-list dd enrollment | grep -q "\<default\>"
 rlite-ctl dif-policy-list dd flowalloc | grep -q "\<local\>"
@@ -56,6 +56,12 @@ start_daemon_namespace c rinaperf -lw -z rpinst2
 sleep 0.5 # give some time to commit registration to the cluster
 ip netns exec c rinaperf -z rpinst1 -p 1 -c 7 -i 10
 ip netns exec s1 rinaperf -z rpinst2 -p 1 -c 3 -i 10
+# Further lookups from C are served by the client-side cache.
+ip netns exec c rinaperf -z rpinst1 -p 1 -c 1
+ip netns exec c rinaperf -z rpinst1 -p 1 -c 1
+ip netns exec c rlite-ctl dif-rib-show ceftdif | grep "Lookup cache"
+hits=$(ip netns exec c rlite-ctl dif-rib-show ceftdif | grep -o "hits: [0-9]*" | head -n 1 | awk '{print $2}')
+test "$hits" -gt 0
 # Give some time to commit the unregistrations to the cluster. This
 # is not necessary for the test to be successful, but it is useful
 # anyway to improve test coverage.
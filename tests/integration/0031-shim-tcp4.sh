@@ -0,0 +1,29 @@
+#!/bin/bash -e
+
+source tests/libtest.sh
+
+# Populate the shim-tcp4 directory. The DIF should be the same for the
+# two shims, but we'll cheat only for the purpose of testing (like in
+# the shim-udp4 test).
+mkdir -p /etc/rina
+if [ -f /etc/rina/shim-tcp4-dir ]; then
+    cp /etc/rina/shim-tcp4-dir /etc/rina/shim-tcp4-dir.save
+    cumulative_trap "mv /etc/rina/shim-tcp4-dir.save /etc/rina/shim-tcp4-dir" "EXIT"
+else
+    cumulative_trap "rm -f /etc/rina/shim-tcp4-dir" "EXIT"
+fi
+cat > /etc/rina/shim-tcp4-dir <<EOD
+rpinst1 127.0.0.1 6790 d0
+rpinst1 127.0.0.1 6790 d1
+EOD
+
+rlite-ctl ipcp-create ts0 shim-tcp4 d0
+rlite-ctl ipcp-create ts1 shim-tcp4 d1
+
+start_daemon rinaperf -lw -z rpinst1 -d d0
+# Small SDUs (many PDUs per recvmsg/sendmsg), medium ones, and SDUs
+# larger than the receive staging buffer.
+for sz in 2 100 1400 20000 65000; do
+    rinaperf -z rpinst1 -d d1 -t perf -s ${sz} -c 2000
+done
+rinaperf -z rpinst1 -d d1 -t rr -s 100 -c 500
@@ -0,0 +1,41 @@
+#!/bin/bash -e
+
+source tests/libtest.sh
+
+# Populate the shim-tcp4 directory with many entries, so that lookups
+# would be expensive if the file were scanned on each flow allocation.
+mkdir -p /etc/rina
+if [ -f /etc/rina/shim-tcp4-dir ]; then
+    cp /etc/rina/shim-tcp4-dir /etc/rina/shim-tcp4-dir.save
+    cumulative_trap "mv /etc/rina/shim-tcp4-dir.save /etc/rina/shim-tcp4-dir" "EXIT"
+else
+    cumulative_trap "rm -f /etc/rina/shim-tcp4-dir" "EXIT"
+fi
+(
+for i in $(seq 1 5000); do
+    echo "dummy${i} 10.$((i / 250)).$((i % 250)).1 7000 d0"
+done
+echo "rpinst1 127.0.0.1 6790 d0"
+echo "rpinst1 127.0.0.1 6790 d1"
+) > /etc/rina/shim-tcp4-dir
+
+rlite-ctl ipcp-create ts0 shim-tcp4 d0
+rlite-ctl ipcp-create ts1 shim-tcp4 d1
+
+start_daemon rinaperf -lw -z rpinst1 -d d0
+rinaperf -z rpinst1 -d d1 -t fsr -c 2000 -P 32
+
+# Add an entry by replacing the file: the change must be picked up
+# without restarting the shims.
+cp /etc/rina/shim-tcp4-dir /etc/rina/shim-tcp4-dir.new
+echo "rpinst2 127.0.0.1 6791 d0" >> /etc/rina/shim-tcp4-dir.new
+echo "rpinst2 127.0.0.1 6791 d1" >> /etc/rina/shim-tcp4-dir.new
+mv /etc/rina/shim-tcp4-dir.new /etc/rina/shim-tcp4-dir
+sleep 0.5
+start_daemon rinaperf -lw -z rpinst2 -d d0
+rinaperf -z rpinst2 -d d1 -t fsr -c 500
+
+# Explicit reload.
+rlite-ctl ipcp-config ts0 dir-reload 1
+rlite-ctl ipcp-config ts1 dir-reload 1
+rinaperf -z rpinst1 -d d1 -c 3 -i 0
@@ -0,0 +1,36 @@
+#!/bin/bash -e
+
+source tests/libtest.sh
+
+# Create a veth pair
+create_veth_pair rinar.veth
+ip addr add 10.11.13.13/24 dev rinar.veth.0
+ip addr add 10.11.13.14/24 dev rinar.veth.1
+cp /etc/hosts /etc/hosts.save
+cumulative_trap "cp /etc/hosts.save /etc/hosts" "EXIT"
+
+# Use /etc/hosts as a local stub resolver, with many entries so that
+# each lookup is not for free.
+(
+for i in $(seq 1 5000); do
+    echo "10.$((i / 250)).$((i % 250)).2 dummy${i}"
+done
+echo "10.11.13.13 rpinstance9"
+) > /etc/hosts
+
+rlite-ctl ipcp-create ur0 shim-udp4 d0
+rlite-ctl ipcp-create ur1 shim-udp4 d1
+rlite-ctl ipcp-config ur0 flow-del-wait-ms 100
+rlite-ctl ipcp-config ur1 flow-del-wait-ms 100
+
+start_daemon rinaperf -lw -z rpinstance9 -d d0
+# Many flow allocations, resolved by the resolver thread and then
+# served by the cache.
+rinaperf -z rpinstance9 -d d1 -t fsr -c 2000 -P 64
+# Incoming flows, with concurrent reverse lookups.
+rinaperf -z rpinstance9 -d d1 -p 4 -c 10 -i 0
+# Names that cannot be resolved must fail, also when the
+# negative result is cached.
+rinaperf -z rpinstance10 -d d1 -t fsr -c 10 && exit 1
+rinaperf -z rpinstance10 -d d1 -t fsr -c 10 && exit 1
+exit 0
@@ -0,0 +1,63 @@
+#!/bin/bash -e
+
+source tests/libtest.sh
+
+# Multi-namespace test for digest-based RIB synchronization.
+#
+#     A----B----C
+#
+for cont in a b c; do
+    create_namespace ${cont}
+    ip netns exec ${cont} rlite-ctl ipcp-create ${cont}.n normal digdif
+    ip netns exec ${cont} rlite-ctl ipcp-config ${cont}.n flow-del-wait-ms 100
+    ip netns exec ${cont} rlite-ctl dif-policy-param-mod digdif ribd refresh-intval 2s
+    ip netns exec ${cont} rlite-ctl dif-policy-param-mod digdif ribd digest-sync true
+done
+for li in ab bc; do
+    create_veth_pair veth ${li}l ${li}r
+    left=${li:0:1}
+    right=${li:1:1}
+    add_veth_to_namespace ${left} veth.${li}l
+    add_veth_to_namespace ${right} veth.${li}r
+    ip netns exec $left rlite-ctl ipcp-create ${li}l.eth shim-eth ${li}dif
+    ip netns exec $right rlite-ctl ipcp-create ${li}r.eth shim-eth ${li}dif
+    ip netns exec $left rlite-ctl ipcp-config ${li}l.eth netdev veth.${li}l
+    ip netns exec $right rlite-ctl ipcp-config ${li}r.eth netdev veth.${li}r
+    ip netns exec $left rlite-ctl ipcp-config ${li}l.eth flow-del-wait-ms 100
+    ip netns exec $right rlite-ctl ipcp-config ${li}r.eth flow-del-wait-ms 100
+    ip netns exec $left rlite-ctl ipcp-register ${left}.n ${li}dif
+    ip netns exec $right rlite-ctl ipcp-register ${right}.n ${li}dif
+done
+
+ip netns exec a rlite-ctl dif-policy-param-mod digdif addralloc nack-wait 1s
+ip netns exec a rlite-ctl ipcp-enroller-enable a.n
+ip netns exec b rlite-ctl ipcp-enroll b.n digdif abdif a.n
+ip netns exec b rlite-ctl ipcp-enroller-enable b.n
+ip netns exec c rlite-ctl ipcp-enroll c.n digdif bcdif b.n
+
+# Register some names on A, and check that they can be reached from C.
+for i in $(seq 1 8); do
+    start_daemon_namespace a rinaperf -lw -z rpdig${i}
+done
+sleep 1
+ip netns exec c rinaperf -z rpdig8 -p 1 -c 3 -i 20
+
+# Wait for a few refresh intervals. The tables are in sync, so digests
+# must be exchanged and (most) table transfers must be avoided.
+sleep 5
+for cont in a b c; do
+    ip netns exec ${cont} rlite-ctl uipcp-stats-show
+    digests=$(ip netns exec ${cont} rlite-ctl uipcp-stats-show | awk '/sync_digest_received/ {print $2}')
+    saved=$(ip netns exec ${cont} rlite-ctl uipcp-stats-show | awk '/sync_objs_saved/ {print $2}')
+    test "$digests" -gt 0
+    test "$saved" -gt 0
+done
+
+# Connectivity must be preserved after the refreshes, and also after
+# switching back to full synchronization.
+ip netns exec c rinaperf -z rpdig1 -p 1 -c 3 -i 20
+for cont in a b c; do
+    ip netns exec ${cont} rlite-ctl dif-policy-param-mod digdif ribd digest-sync false
+done
+sleep 3
+ip netns exec c rinaperf -z rpdig4 -p 1 -c 3 -i 20
@@ -0,0 +1,56 @@
+#!/bin/bash -e
+
+source tests/libtest.sh
+
+# Multi-namespace test for the kademlia dft policy.
+#
+#     A----B----C----D
+#
+for cont in a b c d; do
+    create_namespace ${cont}
+    ip netns exec ${cont} rlite-ctl ipcp-create ${cont}.n normal kaddif
+    ip netns exec ${cont} rlite-ctl ipcp-config ${cont}.n flow-del-wait-ms 100
+done
+for li in ab bc cd; do
+    create_veth_pair veth ${li}l ${li}r
+    left=${li:0:1}
+    right=${li:1:1}
+    add_veth_to_namespace ${left} veth.${li}l
+    add_veth_to_namespace ${right} veth.${li}r
+    ip netns exec $left rlite-ctl ipcp-create ${li}l.eth shim-eth ${li}dif
+    ip netns exec $right rlite-ctl ipcp-create ${li}r.eth shim-eth ${li}dif
+    ip netns exec $left rlite-ctl ipcp-config ${li}l.eth netdev veth.${li}l
+    ip netns exec $right rlite-ctl ipcp-config ${li}r.eth netdev veth.${li}r
+    ip netns exec $left rlite-ctl ipcp-config ${li}l.eth flow-del-wait-ms 100
+    ip netns exec $right rlite-ctl ipcp-config ${li}r.eth flow-del-wait-ms 100
+    ip netns exec $left rlite-ctl ipcp-register ${left}.n ${li}dif
+    ip netns exec $right rlite-ctl ipcp-register ${right}.n ${li}dif
+done
+
+# A is the enrollment master, and the policy is transferred on enrollment.
+ip netns exec a rlite-ctl dif-policy-param-mod kaddif addralloc nack-wait 1s
+ip netns exec a rlite-ctl dif-policy-mod kaddif dft kademlia
+ip netns exec a rlite-ctl dif-policy-param-mod kaddif dft replication 2
+ip netns exec a rlite-ctl dif-policy-param-mod kaddif dft republish-intval 3s
+ip netns exec a rlite-ctl ipcp-enroller-enable a.n
+ip netns exec b rlite-ctl ipcp-enroll b.n kaddif abdif a.n
+ip netns exec b rlite-ctl ipcp-enroller-enable b.n
+ip netns exec c rlite-ctl ipcp-enroll c.n kaddif bcdif b.n
+ip netns exec c rlite-ctl ipcp-enroller-enable c.n
+ip netns exec d rlite-ctl ipcp-enroll d.n kaddif cddif c.n
+for cont in b c d; do
+    ip netns exec ${cont} rlite-ctl dif-policy-list kaddif dft | grep -q "\<kademlia\>"
+done
+
+# Wait for the routing tables to be seeded.
+sleep 4
+
+# Register names at both ends, and check that they can be looked up
+# through the DHT from the other end.
+start_daemon_namespace a rinaperf -lw -z rpkad1
+start_daemon_namespace d rinaperf -lw -z rpkad2
+sleep 1
+ip netns exec d rinaperf -z rpkad1 -p 1 -c 3 -i 20
+ip netns exec a rinaperf -z rpkad2 -p 1 -c 3 -i 20
+ip netns exec b rinaperf -z rpkad2 -p 1 -c 3 -i 20
+ip netns exec a rlite-ctl dif-rib-show kaddif | grep -q "Kademlia"
@@ -0,0 +1,49 @@
+#!/bin/bash -e
+
+source tests/libtest.sh
+
+# Normal over shim-eth on a veth pair between two namespaces, so that the
+# MSS of the normal DIF is smaller than the SDUs written by the clients.
+create_veth_pair veth red green
+create_namespace green
+create_namespace red
+add_veth_to_namespace green veth.green
+add_veth_to_namespace red veth.red
+
+ip netns exec green rlite-ctl ipcp-create green.eth shim-eth edif
+ip netns exec green rlite-ctl ipcp-config green.eth netdev veth.green
+ip netns exec green rlite-ctl ipcp-config green.eth flow-del-wait-ms 100
+ip netns exec green rlite-ctl ipcp-create green.n normal mydif
+ip netns exec green rlite-ctl ipcp-config green.n flow-del-wait-ms 900
+ip netns exec green rlite-ctl ipcp-enroller-enable green.n
+ip netns exec green rlite-ctl ipcp-register green.n edif
+ip netns exec green rlite-ctl dif-policy-param-mod mydif addralloc nack-wait 1s
+start_daemon_namespace green rinaperf -lw -z rpinst1
+
+ip netns exec red rlite-ctl ipcp-create red.eth shim-eth edif
+ip netns exec red rlite-ctl ipcp-config red.eth netdev veth.red
+ip netns exec red rlite-ctl ipcp-config red.eth flow-del-wait-ms 100
+ip netns exec red rlite-ctl ipcp-create red.n normal mydif
+ip netns exec red rlite-ctl ipcp-config red.n flow-del-wait-ms 900
+ip netns exec red rlite-ctl ipcp-register red.n edif
+ip netns exec red rlite-ctl ipcp-enroll red.n mydif edif green.n
+
+# Reliable flows, with SDUs spanning a few and many fragments.
+ip netns exec red rinaperf -z rpinst1 -g 0 -s 4000 -c 10 -i 0
+ip netns exec red rinaperf -z rpinst1 -g 0 -s 65535 -c 10 -i 0
+ip netns exec red rinaperf -z rpinst1 -g 0 -t perf -s 20000 -D 2
+
+# Normal over normal: the fragments of the upper DIF must be carried
+# by the lower DIF as whole SDUs.
+ip netns exec green rlite-ctl ipcp-create green.up normal updif
+ip netns exec green rlite-ctl ipcp-config green.up flow-del-wait-ms 900
+ip netns exec green rlite-ctl ipcp-enroller-enable green.up
+ip netns exec green rlite-ctl ipcp-register green.up mydif
+ip netns exec green rlite-ctl dif-policy-param-mod updif addralloc nack-wait 1s
+start_daemon_namespace green rinaperf -lw -d updif -z rpinst2
+ip netns exec red rlite-ctl ipcp-create red.up normal updif
+ip netns exec red rlite-ctl ipcp-config red.up flow-del-wait-ms 900
+ip netns exec red rlite-ctl ipcp-register red.up mydif
+ip netns exec red rlite-ctl ipcp-enroll red.up updif mydif green.up
+ip netns exec red rinaperf -d updif -z rpinst2 -g 0 -s 4000 -c 10 -i 0
+ip netns exec red rinaperf -d updif -z rpinst2 -g 0 -s 65535 -c 10 -i 0
@@ -0,0 +1,42 @@
+#!/bin/bash -e
+
+source tests/libtest.sh
+
+# Two namespaces connected by a veth pair, with a normal DIF using the
+# compact PCI, which is transferred to the enrollee.
+create_veth_pair veth red green
+create_namespace green
+create_namespace red
+add_veth_to_namespace green veth.green
+add_veth_to_namespace red veth.red
+
+ip netns exec green rlite-ctl ipcp-create green.eth shim-eth edif
+ip netns exec green rlite-ctl ipcp-config green.eth netdev veth.green
+ip netns exec green rlite-ctl ipcp-config green.eth flow-del-wait-ms 100
+ip netns exec green rlite-ctl ipcp-create green.n normal mydif
+ip netns exec green rlite-ctl ipcp-config green.n flow-del-wait-ms 900
+ip netns exec green rlite-ctl ipcp-config green.n csum inet
+ip netns exec green rlite-ctl ipcp-enroller-enable green.n
+ip netns exec green rlite-ctl ipcp-register green.n edif
+ip netns exec green rlite-ctl dif-policy-param-mod mydif addralloc nack-wait 1s
+ip netns exec green rlite-ctl dif-policy-param-mod mydif resalloc compact-pci true
+ip netns exec green rlite-ctl ipcp-config-get green.n pci | grep "\<compact\>"
+start_daemon_namespace green rinaperf -lw -z rpinst1
+
+ip netns exec red rlite-ctl ipcp-create red.eth shim-eth edif
+ip netns exec red rlite-ctl ipcp-config red.eth netdev veth.red
+ip netns exec red rlite-ctl ipcp-config red.eth flow-del-wait-ms 100
+ip netns exec red rlite-ctl ipcp-create red.n normal mydif
+ip netns exec red rlite-ctl ipcp-config red.n flow-del-wait-ms 900
+ip netns exec red rlite-ctl ipcp-config red.n csum inet
+ip netns exec red rlite-ctl ipcp-register red.n edif
+ip netns exec red rlite-ctl ipcp-enroll red.n mydif edif green.n
+
+# Check that the PCI format was transferred on enrollment.
+ip netns exec red rlite-ctl ipcp-config-get red.n pci | grep "\<compact\>"
+
+# Unreliable and reliable flows, with compact DT PDUs in both directions.
+ip netns exec red rinaperf -z rpinst1 -p 1 -c 10 -i 0
+ip netns exec red rinaperf -z rpinst1 -g 0 -c 10 -i 0
+ip netns exec red rlite-ctl ipcp-stats red.n | grep "pci_compact_pkt *= *[1-9]"
+ip netns exec green rlite-ctl ipcp-stats green.n | grep "pci_compact_pkt *= *[1-9]"
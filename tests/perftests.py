@@ -38,6 +38,15 @@ def to_avg_stdev(vlist, nsamples):
     del vlist[-nsamples:]
     vlist.append(tuple(vals))
 
+def ipcp_tx_stats(ipcp):
+    # Returns the number of transmitted PDUs and the PCI bytes saved
+    # by the compact PCI so far.
+    out = subprocess.check_output(['rlite-ctl', 'ipcp-stats', ipcp])
+    out = out.decode('ascii')
+    pkts = re.search(r'\btx_pkt\s*=\s*(\d+)', out)
+    saved = re.search(r'rmt\.pci_saved_byte\s*=\s*(\d+)', out)
+    return int(pkts.group(1)), int(saved.group(1))
+
 
 description = "Python script to perform automated tests based on rinaperf"
 epilog = "2017 Vincenzo Maffione <v.maffione@gmail.com>"
@@ -65,8 +74,16 @@ argparser.add_argument('-o', '--output', type = str, help = "Output file for gnu
                         default = 'output.txt')
 argparser.add_argument('--sleep', type = int, default = 2,
                        help = "How many seconds to sleep between two consecutive test runs")
+argparser.add_argument('--pci', type = str, choices = ["full", "compact", "both"],
+                       help = "PCI format(s) to test, configured on the IPCP specified "
+                              "with --ipcp; the PCI bytes saved per PDU are also reported")
+argparser.add_argument('--ipcp', type = str,
+                       help = "Local normal IPCP used by the tests (needed by --pci)")
 args = argparser.parse_args()
 
+if args.pci and not args.ipcp:
+    argparser.error("--pci requires --ipcp")
+
 
 stats = []
 
@@ -76,6 +93,14 @@ if args.test_type == 'perf':
 elif args.test_type == 'rr':
     plotcols += ['ktps', 'snd_mbps', 'snd_latency']
 
+pcimodes = [None]
+if args.pci == 'both':
+    pcimodes = ['full', 'compact']
+elif args.pci:
+    pcimodes = [args.pci]
+if args.pci:
+    plotcols += ['compact', 'pci_saved']
+
 # build QoS
 qosarg = ""
 if args.max_sdu_gap >= 0:
@@ -86,17 +111,31 @@ if args.dif:
     difarg = " -d %s" % args.dif
 
 try:
-    for sz in range(args.size_min, args.size_max+1, args.size_step):
+    for sz, pcimode in [(s, p) for s in range(args.size_min, args.size_max+1,
+                                              args.size_step)
+                               for p in pcimodes]:
         cmd = ("rinaperf -s %s -t %s -D %s %s %s"
                 % (sz, args.test_type, args.duration, qosarg, difarg))
-        print("Running: %s" % cmd)
+        if pcimode:
+            subprocess.check_call(['rlite-ctl', 'ipcp-config', args.ipcp,
+                                   'pci', pcimode])
+            print("Running: %s (%s PCI)" % (cmd, pcimode))
+        else:
+            print("Running: %s" % cmd)
         t = 1
         while t <= args.trials:
+            if pcimode:
+                pkts0, saved0 = ipcp_tx_stats(args.ipcp)
             try:
                 out = subprocess.check_output(cmd.split())
             except subprocess.CalledProcessError:
                 print("Test run #%d failed" % t)
                 continue
+            pcicols = ()
+            if pcimode:
+                pkts1, saved1 = ipcp_tx_stats(args.ipcp)
+                pcicols = (float(pcimode == 'compact'),
+                           float(saved1 - saved0) / max(pkts1 - pkts0, 1))
             out = out.decode('ascii')
             outl = out.split('\n')
 
@@ -125,7 +164,7 @@ try:
                 rmbps = float(m.group(3))
 
                 prtuple = (tpackets, rpackets, tkpps, rkpps, tmbps, rmbps)
-                stats.append((sz, tkpps, rkpps, tmbps, rmbps))
+                stats.append((sz, tkpps, rkpps, tmbps, rmbps) + pcicols)
 
                 print("%d/%d pkts %.3f/%.3f Kpps %.3f/%.3f Mbps" % prtuple)
 
@@ -146,13 +185,16 @@ try:
                 latency = int(m.group(4))
 
                 prtuple = (transactions, ktps, mbps, latency)
-                stats.append((sz, ktps, mbps, latency))
+                stats.append((sz, ktps, mbps, latency) + pcicols)
 
                 print("%d transactions %.3f Ktps %.3f Mbps %d ns" % prtuple)
 
             else:
                 assert(False)
 
+            if pcimode:
+                print("%.1f PCI bytes saved per PDU" % pcicols[1])
+
             t += 1
             time.sleep(args.sleep)
 
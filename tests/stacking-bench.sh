@@ -0,0 +1,93 @@
+#!/bin/bash
+
+# Benchmark of the receive path of stacked DIFs on a single host. For
+# each stack depth, a shim-loopback DIF is created, with a chain of normal
+# DIFs on top, each one made of two IPCPs enrolled over the DIF below.
+# A rinaperf perf test and a rinaperf rr test are then run on the top
+# DIF, so that each PDU traverses all the levels of the stack (twice).
+# Compare the results across stack depths (and kernels) to measure the
+# per-level cost of the receive path.
+
+function usage {
+    echo "$0 [-m MAX_DEPTH] [-D DURATION_SECS] [-s SDU_SIZE]"
+}
+
+MAXD=4
+D=10
+SZ=400
+
+# Option parsing
+while [[ $# > 0 ]]
+do
+    key="$1"
+    case $key in
+        "-m")
+        if [ -n "$2" ]; then
+            MAXD="$2"
+            shift
+        else
+            echo "-m requires a numeric argument"
+            exit 255
+        fi
+        ;;
+
+        "-D")
+        if [ -n "$2" ]; then
+            D="$2"
+            shift
+        else
+            echo "-D requires a numeric argument"
+            exit 255
+        fi
+        ;;
+
+        "-s")
+        if [ -n "$2" ]; then
+            SZ="$2"
+            shift
+        else
+            echo "-s requires a numeric argument"
+            exit 255
+        fi
+        ;;
+
+        "-h")
+            usage
+            exit 0
+        ;;
+
+        *)
+        echo "Unknown option '$key'"
+        exit 255
+        ;;
+    esac
+    shift
+done
+
+trap "rlite-ctl reset" EXIT
+
+for depth in $(seq 1 $MAXD); do
+    rlite-ctl reset
+    rlite-ctl ipcp-create sl shim-loopback sl.DIF
+    rlite-ctl ipcp-config sl flow-del-wait-ms 100
+    LOWER="sl.DIF"
+    for l in $(seq 1 $depth); do
+        rlite-ctl ipcp-create n.1.$l normal n.$l.DIF
+        rlite-ctl ipcp-create n.2.$l normal n.$l.DIF
+        rlite-ctl ipcp-config n.1.$l flow-del-wait-ms 100
+        rlite-ctl ipcp-config n.2.$l flow-del-wait-ms 100
+        rlite-ctl ipcp-enroller-enable n.2.$l
+        rlite-ctl ipcp-register n.1.$l $LOWER
+        rlite-ctl ipcp-register n.2.$l $LOWER
+        rlite-ctl dif-policy-param-mod n.$l.DIF addralloc nack-wait 1s
+        rlite-ctl ipcp-enroll n.1.$l n.$l.DIF $LOWER n.2.$l || exit 1
+        LOWER="n.$l.DIF"
+    done
+
+    rinaperf -lw -d $LOWER -z stackbench
+    sleep 1
+    echo "Stack depth ${depth}"
+    rinaperf -d $LOWER -z stackbench -t perf -s $SZ -D $D
+    rinaperf -d $LOWER -z stackbench -t rr -s $SZ -D $D
+    pkill -f "rinaperf -lw -d $LOWER -z stackbench"
+done
@@ -627,3 +627,50 @@ rl_conf_memtrack_dump(void)
 
     return ret;
 }
+
+int
+rl_conf_memtrack_stats(struct rl_memtrack_stats *stats, unsigned int max)
+{
+    struct rl_kmsg_memtrack_stats_resp *resp;
+    struct rl_msg_base msg;
+    int ret;
+    int fd;
+
+    fd = rina_open();
+    if (fd < 0) {
+        return fd;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.hdr.msg_type = RLITE_KER_MEMTRACK_STATS_REQ;
+    msg.hdr.event_id = 1;
+
+    ret = rl_write_msg(fd, &msg, 1);
+    rl_msg_free(rl_ker_numtables, RLITE_KER_MSG_MAX, &msg);
+    if (ret < 0) {
+        goto out;
+    }
+
+    resp = (struct rl_kmsg_memtrack_stats_resp *)wait_for_next_msg(fd, 3000);
+    if (!resp) {
+        ret = -1;
+        goto out;
+    }
+    assert(resp->hdr.event_id == msg.hdr.event_id);
+
+    if (max > resp->num) {
+        max = resp->num;
+    }
+    if (max > RL_MEMTRACK_MAX_TYPES) {
+        max = RL_MEMTRACK_MAX_TYPES;
+    }
+    ret = max;
+    memcpy(stats, resp->stats, ret * sizeof(*stats));
+
+    rl_msg_free(rl_ker_numtables, RLITE_KER_MSG_MAX, RLITE_MB(resp));
+    rl_free(resp, RL_MT_MSG);
+out:
+    close(fd);
+
+    return ret;
+}
@@ -27,6 +27,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <limits.h>
 #include <errno.h>
 #include <sys/select.h>
 #include <sys/poll.h>
@@ -85,6 +86,92 @@ rl_read_next_msg(int rfd, int quiet)
     return resp;
 }
 
+int
+rl_msg_batch_init(struct rl_msg_batch *b)
+{
+    memset(b, 0, sizeof(*b));
+    b->msg_size = rl_numtables_max_size(
+        rl_ker_numtables,
+        sizeof(rl_ker_numtables) / sizeof(struct rl_msg_layout));
+    b->buf = rl_alloc(RL_MSG_BATCH_SIZE, RL_MT_MSG);
+    b->msg = RLITE_MB(rl_alloc(b->msg_size, RL_MT_MSG));
+    if (!b->buf || !b->msg) {
+        rl_msg_batch_fini(b);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    return 0;
+}
+
+static void
+rl_msg_batch_release(struct rl_msg_batch *b)
+{
+    if (b->msg_valid) {
+        rl_msg_free(rl_ker_numtables, RLITE_KER_MSG_MAX, b->msg);
+        b->msg_valid = 0;
+    }
+}
+
+void
+rl_msg_batch_fini(struct rl_msg_batch *b)
+{
+    rl_msg_batch_release(b);
+    if (b->buf) {
+        rl_free(b->buf, RL_MT_MSG);
+        b->buf = NULL;
+    }
+    if (b->msg) {
+        rl_free(b->msg, RL_MT_MSG);
+        b->msg = NULL;
+    }
+}
+
+int
+rl_msg_batch_read(int rfd, struct rl_msg_batch *b)
+{
+    int ret;
+
+    rl_msg_batch_release(b);
+    b->len = b->ofs = 0;
+    ret             = read(rfd, b->buf, RL_MSG_BATCH_SIZE);
+    if (ret > 0) {
+        b->len = ret;
+    }
+
+    return ret;
+}
+
+struct rl_msg_base *
+rl_msg_batch_next(struct rl_msg_batch *b)
+{
+    rl_msg_batch_release(b);
+
+    while (b->ofs + sizeof(struct rl_msg_rec_hdr) <= b->len) {
+        struct rl_msg_rec_hdr *rec = (struct rl_msg_rec_hdr *)(b->buf + b->ofs);
+        unsigned int reclen        = RL_MSG_REC_SIZE(rec->len);
+
+        if (b->ofs + reclen > b->len) {
+            PE("Truncated record in batch [ofs=%u, len=%u]\n", b->ofs,
+               rec->len);
+            break;
+        }
+        b->ofs += reclen;
+        if (deserialize_rlite_msg(rl_ker_numtables, RLITE_KER_MSG_MAX,
+                                  rec + 1, rec->len, (void *)b->msg,
+                                  b->msg_size)) {
+            PE("Problems during deserialization, skipping message\n");
+            continue;
+        }
+        b->msg_valid = 1;
+
+        return b->msg;
+    }
+    b->ofs = b->len;
+
+    return NULL;
+}
+
 int
 rl_write_msg(int rfd, const struct rl_msg_base *msg, int quiet)
 {
@@ -495,6 +582,84 @@ rina_flow_alloc(const char *dif_name, const char *local_appl,
                              0xffff);
 }
 
+/* Request identifiers for asynchronous flow allocations. They are
+ * process-wide, so that a completion can never be mistaken for the one of
+ * a request issued on another control file descriptor. */
+static unsigned int fa_async_id = 0;
+
+int
+rina_flow_alloc_async(int fd, const char *dif_name, const char *local_appl,
+                      const char *remote_appl,
+                      const struct rina_flow_spec *flowspec)
+{
+    struct rl_kmsg_fa_req req;
+    int req_id;
+    int ret;
+
+    if (flowspec && flowspec->version != RINA_FLOW_SPEC_VERSION) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Keep identifiers in the range [1, INT_MAX]. */
+    req_id = (int)(__sync_add_and_fetch(&fa_async_id, 1) & INT_MAX);
+    if (req_id == 0) {
+        req_id = (int)(__sync_add_and_fetch(&fa_async_id, 1) & INT_MAX);
+    }
+
+    ret = rl_fa_req_fill(&req, (uint32_t)req_id, dif_name, local_appl,
+                         remote_appl, flowspec, 0xffff);
+    if (ret) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    ret = rl_write_msg(fd, RLITE_MB(&req), 1);
+    rl_msg_free(rl_ker_numtables, RLITE_KER_MSG_MAX, RLITE_MB(&req));
+    if (ret < 0) {
+        return ret;
+    }
+
+    return req_id;
+}
+
+int
+rina_flow_alloc_complete(int fd, int *flowfd)
+{
+    struct rl_kmsg_fa_resp_arrived *resp;
+    int req_id;
+
+    if (flowfd == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    *flowfd = -1;
+
+    resp = (struct rl_kmsg_fa_resp_arrived *)rl_read_next_msg(fd, 1);
+    if (!resp) {
+        return -1;
+    }
+
+    if (resp->hdr.msg_type != RLITE_KER_FA_RESP_ARRIVED) {
+        /* Not a completion, the control file descriptor is being
+         * used for something else. */
+        rl_msg_free(rl_ker_numtables, RLITE_KER_MSG_MAX, RLITE_MB(resp));
+        rl_free(resp, RL_MT_MSG);
+        errno = EPROTO;
+        return -1;
+    }
+
+    req_id = (int)resp->hdr.event_id;
+    if (resp->response == 0) {
+        *flowfd = rl_open_appl_port(resp->port_id);
+    }
+
+    rl_msg_free(rl_ker_numtables, RLITE_KER_MSG_MAX, RLITE_MB(resp));
+    rl_free(resp, RL_MT_MSG);
+
+    return req_id;
+}
+
 /* Split accept lock and pending lists. */
 static volatile char sa_lock_var   = 0;
 static int sa_handle               = 0;
@@ -0,0 +1,50 @@
+/*
+ * Hash functions for user-space components
+ *
+ * Copyright (C) 2026 agent
+ * Author: agent <agent@local>
+ *
+ * This file is part of rlite.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <stdint.h>
+#include "rlite/utils.h"
+
+/* The djb2 string hash function. */
+unsigned int
+rl_str_hash(const char *str)
+{
+    unsigned int h = 5381;
+
+    while (*str != '\0') {
+        h = (h << 5) + h + (unsigned char)*str++;
+    }
+
+    return h;
+}
+
+/* Integer mixer, to spread keys with few significant bits (e.g. IPv4
+ * addresses) over all the bits of the hash. */
+unsigned int
+rl_u32_hash(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x45d9f3b;
+    x ^= x >> 16;
+
+    return x;
+}
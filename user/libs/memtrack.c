@@ -24,11 +24,37 @@
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h>
+#include <malloc.h>
+#include <pthread.h>
 #include "rlite/utils.h"
+#include "rlite/list.h"
 
 #ifdef RL_MEMTRACK
 
-static volatile int mt_count[RL_MT_MAX];
+/* Counters are per-thread, so that threads allocating concurrently do not
+ * contend on shared cache lines; they are summed up when stats are
+ * requested. The counters of a thread are only written by the thread
+ * itself, and are merged into mt_exited when the thread terminates.
+ * Live bytes are also folded into global counters in batches of
+ * RL_MT_BATCH bytes, to maintain high-water marks, which are therefore
+ * accurate up to RL_MT_BATCH bytes per thread. */
+#define RL_MT_BATCH 16384
+
+struct mt_counters {
+    long count[RL_MT_MAX];
+    long bytes[RL_MT_MAX];
+    long unfolded[RL_MT_MAX]; /* bytes not yet folded into mt_bytes */
+    struct list_head node;
+};
+
+static __thread struct mt_counters *mt_self;
+static pthread_once_t mt_once = PTHREAD_ONCE_INIT;
+static pthread_key_t mt_key;
+static pthread_mutex_t mt_lock = PTHREAD_MUTEX_INITIALIZER;
+static LIST_STATIC_DECL(mt_threads);
+static struct mt_counters mt_exited; /* protected by mt_lock */
+static long mt_bytes[RL_MT_MAX];
+static long mt_hwm[RL_MT_MAX];
 
 static const char *mt_names[] = {
     [RL_MT_UTILS]     = "UTILS",
@@ -44,11 +70,101 @@ static const char *mt_names[] = {
     [RL_MT_NEIGHFLOW] = "NEIGHFLOW",
 };
 
+static void
+mt_thread_exit(void *arg)
+{
+    struct mt_counters *mt = arg;
+    int i;
+
+    pthread_mutex_lock(&mt_lock);
+    for (i = 0; i < RL_MT_MAX; i++) {
+        mt_exited.count[i] += mt->count[i];
+        mt_exited.bytes[i] += mt->bytes[i];
+        mt_exited.unfolded[i] += mt->unfolded[i];
+    }
+    list_del(&mt->node);
+    pthread_mutex_unlock(&mt_lock);
+    mt_self = NULL;
+    free(mt);
+}
+
+static void
+mt_key_create(void)
+{
+    pthread_key_create(&mt_key, mt_thread_exit);
+}
+
+static struct mt_counters *
+mt_thread_register(void)
+{
+    struct mt_counters *mt;
+
+    pthread_once(&mt_once, mt_key_create);
+    mt = calloc(1, sizeof(*mt));
+    if (!mt) {
+        return NULL;
+    }
+    pthread_mutex_lock(&mt_lock);
+    list_add_tail(&mt->node, &mt_threads);
+    pthread_mutex_unlock(&mt_lock);
+    pthread_setspecific(mt_key, mt);
+    mt_self = mt;
+
+    return mt;
+}
+
+static void
+mt_fold(rl_memtrack_t ty, long delta)
+{
+    long cur = __atomic_add_fetch(mt_bytes + ty, delta, __ATOMIC_RELAXED);
+    long hwm = __atomic_load_n(mt_hwm + ty, __ATOMIC_RELAXED);
+
+    while (cur > hwm &&
+           !__atomic_compare_exchange_n(mt_hwm + ty, &hwm, cur, /*weak=*/1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+/* Only the owner thread writes its counters, so there is no need for
+ * atomic read-modify-write operations. */
+static inline void
+mt_add(long *ctr, long val)
+{
+    __atomic_store_n(ctr, __atomic_load_n(ctr, __ATOMIC_RELAXED) + val,
+                     __ATOMIC_RELAXED);
+}
+
+static void
+mt_account(rl_memtrack_t ty, long objs, long bytes)
+{
+    struct mt_counters *mt = mt_self;
+
+    assert(ty < RL_MT_MAX);
+    if (!mt) {
+        mt = mt_thread_register();
+    }
+    if (!mt) {
+        /* Out of memory, account for this one the slow way. */
+        pthread_mutex_lock(&mt_lock);
+        mt_exited.count[ty] += objs;
+        mt_exited.bytes[ty] += bytes;
+        pthread_mutex_unlock(&mt_lock);
+        mt_fold(ty, bytes);
+        return;
+    }
+    mt_add(mt->count + ty, objs);
+    mt_add(mt->bytes + ty, bytes);
+    mt->unfolded[ty] += bytes;
+    if (mt->unfolded[ty] >= RL_MT_BATCH || mt->unfolded[ty] <= -RL_MT_BATCH) {
+        mt_fold(ty, mt->unfolded[ty]);
+        mt->unfolded[ty] = 0;
+    }
+}
+
 void
 rl_mt_adjust(int inc, rl_memtrack_t ty)
 {
-    assert(ty < RL_MT_MAX);
-    __sync_fetch_and_add(mt_count + ty, inc);
+    mt_account(ty, inc, 0);
 }
 
 void *
@@ -57,8 +173,7 @@ rl_alloc(size_t size, rl_memtrack_t ty)
     void *ret = malloc(size);
 
     if (ret) {
-        assert(ty < RL_MT_MAX);
-        __sync_fetch_and_add(mt_count + ty, 1);
+        mt_account(ty, 1, malloc_usable_size(ret));
     }
 
     return ret;
@@ -70,8 +185,7 @@ rl_strdup(const char *s, rl_memtrack_t ty)
     void *ret = strdup(s);
 
     if (ret) {
-        assert(ty < RL_MT_MAX);
-        __sync_fetch_and_add(mt_count + ty, 1);
+        mt_account(ty, 1, malloc_usable_size(ret));
     }
 
     return ret;
@@ -80,19 +194,54 @@ rl_strdup(const char *s, rl_memtrack_t ty)
 void
 rl_free(void *obj, rl_memtrack_t ty)
 {
-    assert(ty < RL_MT_MAX);
-    __sync_fetch_and_sub(mt_count + ty, 1);
+    if (obj) {
+        mt_account(ty, -1, -(long)malloc_usable_size(obj));
+    }
     free(obj);
 }
 
+unsigned int
+rl_memtrack_get_stats(struct rl_memtrack_stats *stats, unsigned int max)
+{
+    struct mt_counters *mt;
+    unsigned int i;
+
+    pthread_mutex_lock(&mt_lock);
+    for (i = 0; i < RL_MT_MAX && i < max; i++) {
+        long count = mt_exited.count[i];
+        long bytes = mt_exited.bytes[i];
+        long hwm   = __atomic_load_n(mt_hwm + i, __ATOMIC_RELAXED);
+
+        list_for_each_entry (mt, &mt_threads, node) {
+            count += __atomic_load_n(mt->count + i, __ATOMIC_RELAXED);
+            bytes += __atomic_load_n(mt->bytes + i, __ATOMIC_RELAXED);
+        }
+
+        strncpy(stats[i].name, mt_names[i], sizeof(stats[i].name) - 1);
+        stats[i].name[sizeof(stats[i].name) - 1] = '\0';
+        stats[i].count     = count;
+        stats[i].bytes     = bytes;
+        stats[i].bytes_hwm = hwm > bytes ? hwm : bytes;
+    }
+    pthread_mutex_unlock(&mt_lock);
+
+    return i;
+}
+
 void
 rl_memtrack_dump_stats(void)
 {
-    int i;
+    struct rl_memtrack_stats stats[RL_MT_MAX];
+    unsigned int num;
+    unsigned int i;
 
+    num = rl_memtrack_get_stats(stats, RL_MT_MAX);
     PI("Memtrack stats:\n");
-    for (i = 0; i < RL_MT_MAX; i++) {
-        PI("    %-8s:%8d\n", mt_names[i], mt_count[i]);
+    for (i = 0; i < num; i++) {
+        PI("    %-9s:%8lld objs %12llu bytes %12llu max bytes\n",
+           stats[i].name, (long long)stats[i].count,
+           (long long unsigned)stats[i].bytes,
+           (long long unsigned)stats[i].bytes_hwm);
     }
 }
 
@@ -35,6 +35,7 @@
 #include <set>
 #include <map>
 #include <unordered_map>
+#include <vector>
 #include <chrono>
 
 #include "rlite/cpputils.hpp"
@@ -55,6 +56,18 @@ class TestReplica : public RaftSM {
     list<string> peers;
     bool failed = false;
 
+    /* Simulated time, if not null. */
+    const chrono::milliseconds *simtime = nullptr;
+
+protected:
+    chrono::system_clock::time_point clock_now() const override
+    {
+        if (simtime) {
+            return chrono::system_clock::time_point(*simtime);
+        }
+        return RaftSM::clock_now();
+    }
+
 public:
     TestReplica() = default;
     RL_NONCOPIABLE(TestReplica);
@@ -120,6 +133,10 @@ public:
 
     bool something_committed() const { return !committed_commands.empty(); }
 
+    size_t num_committed() const { return committed_commands.size(); }
+
+    void set_simtime(const chrono::milliseconds *t) { simtime = t; }
+
     /* Go over the commands committed so far, and check if there
      * are any missing numbers (adding them to the output argument). */
     set<uint32_t> get_missing_commands(set<uint32_t> acc, uint32_t Max) const
@@ -570,6 +587,519 @@ run_simulation(const list<TestEvent> &external_events,
     return 0;
 }
 
+enum class ReadMode {
+    ReadIndex = 0,
+    Lease,
+    Follower,
+};
+
+static const char *
+read_mode_repr(ReadMode mode)
+{
+    switch (mode) {
+    case ReadMode::ReadIndex:
+        return "read-index";
+    case ReadMode::Lease:
+        return "lease";
+    case ReadMode::Follower:
+        return "follower";
+    }
+    return "?";
+}
+
+/* Deliver a Raft message to a replica. */
+static int
+message_input(RaftSM *sm, const RaftMessage *msg, RaftSMOutput *out)
+{
+    if (auto *rv = dynamic_cast<const RaftRequestVote *>(msg)) {
+        return sm->request_vote_input(*rv, out);
+    } else if (auto *rvr = dynamic_cast<const RaftRequestVoteResp *>(msg)) {
+        return sm->request_vote_resp_input(*rvr, out);
+    } else if (auto *ae = dynamic_cast<const RaftAppendEntries *>(msg)) {
+        return sm->append_entries_input(*ae, out);
+    } else if (auto *aer = dynamic_cast<const RaftAppendEntriesResp *>(msg)) {
+        return sm->append_entries_resp_input(*aer, out);
+    }
+
+    return -1;
+}
+
+/* Number of events (messages sent or received, reads served) that
+ * a replica is assumed to process per millisecond, to estimate the read
+ * throughput of the cluster. */
+static constexpr unsigned int kReplicaCapacity = 100;
+
+/* Measure the read throughput of a cluster of 'n' replicas, where reads
+ * are served with the given mode, while a background write load keeps the
+ * commit index moving. Messages take one millisecond to be delivered.
+ * Returns 0 on success, 1 if a read returned stale data (for the
+ * linearizable modes), -1 on error. */
+int
+run_read_benchmark(unsigned int n, ReadMode mode)
+{
+    const chrono::milliseconds t_start(500), t_end(1500);
+    const chrono::milliseconds max_staleness(200);
+    const unsigned int reads_per_ms = 4, write_period_ms = 5;
+    map<string, std::unique_ptr<TestReplica>> replicas;
+    map<pair<RaftSM *, RaftTimerType>, chrono::milliseconds> timers;
+    map<string, unsigned long> load; /* events processed by each replica */
+    chrono::milliseconds t(0);
+    RaftSMOutput output;
+    list<string> names;
+    struct Read {
+        TestReplica *sm;
+        chrono::milliseconds t;
+        size_t committed; /* committed commands when the read started */
+    };
+    unordered_map<ReadId, Read> reads;
+    ReadId read_id_next        = 1;
+    uint32_t cmd_next          = 1;
+    unsigned long served       = 0;
+    unsigned long stale        = 0;
+    unsigned long msgs         = 0;
+    unsigned long latency_tot  = 0;
+    unsigned long lag_max      = 0;
+    unsigned long rounds_start = 0;
+
+    for (unsigned int i = 1; i <= n; i++) {
+        names.push_back("b" + to_string(i));
+    }
+    for (const auto &local : names) {
+        list<string> peers;
+
+        remove(logfile(local).c_str());
+        for (const auto &peer : names) {
+            if (peer != local) {
+                peers.push_back(peer);
+            }
+        }
+        auto sm = utils::make_unique<TestReplica>(local + "-sm", local,
+                                                  logfile(local), peers);
+        sm->set_verbosity(RaftSM::kVerboseQuiet);
+        sm->set_simtime(&t);
+        sm->set_retransmission_timeout(chrono::seconds::zero());
+        if (mode == ReadMode::Lease &&
+            sm->set_lease_timeout(sm->get_election_timeout_min() * 3 / 4)) {
+            return -1;
+        }
+        if (sm->respawn(&output)) {
+            return -1;
+        }
+        replicas[local] = std::move(sm);
+    }
+
+    auto get_leader = [&replicas]() -> TestReplica * {
+        for (const auto &kv : replicas) {
+            if (kv.second->leader()) {
+                return kv.second.get();
+            }
+        }
+        return nullptr;
+    };
+    auto max_committed = [&replicas]() -> size_t {
+        size_t ret = 0;
+        for (const auto &kv : replicas) {
+            ret = std::max(ret, kv.second->num_committed());
+        }
+        return ret;
+    };
+
+    for (const RaftTimerCmd &cmd : output.timer_commands) {
+        timers[make_pair(cmd.sm, cmd.type)] = cmd.milliseconds;
+    }
+
+    for (; t < t_end; t += chrono::milliseconds(1)) {
+        bool measure = t >= t_start;
+        RaftSMOutput output_next;
+
+        /* Deliver the messages sent in the previous millisecond. */
+        for (const auto &p : output.output_messages) {
+            auto *ae  = dynamic_cast<RaftAppendEntries *>(p.second.get());
+            auto *aer = dynamic_cast<RaftAppendEntriesResp *>(p.second.get());
+
+            if (message_input(replicas.at(p.first).get(), p.second.get(),
+                              &output_next)) {
+                return -1;
+            }
+            if (ae) {
+                load[ae->leader_id] += measure;
+            } else if (aer) {
+                load[aer->follower_id] += measure;
+            }
+            load[p.first] += measure;
+            msgs += measure;
+        }
+
+        /* Fire the expired timers. */
+        for (auto it = timers.begin(); it != timers.end();) {
+            if (it->second <= t) {
+                RaftSM *sm         = it->first.first;
+                RaftTimerType type = it->first.second;
+
+                it = timers.erase(it);
+                if (sm->timer_expired(type, &output_next)) {
+                    return -1;
+                }
+            } else {
+                ++it;
+            }
+        }
+
+        /* Client load. */
+        TestReplica *leader = get_leader();
+
+        if (leader && t.count() % write_period_ms == 0) {
+            if (leader->submit(reinterpret_cast<const char *>(&cmd_next),
+                               nullptr, &output_next)) {
+                return -1;
+            }
+            cmd_next++;
+        }
+        for (unsigned int i = 0; measure && leader && i < reads_per_ms; i++) {
+            ReadId id = read_id_next++;
+
+            if (mode == ReadMode::Follower) {
+                /* Spread the reads over all the replicas. */
+                auto it = replicas.begin();
+
+                std::advance(it, id % replicas.size());
+                if (!it->second->read_local_ok(max_staleness)) {
+                    continue;
+                }
+                lag_max = std::max(lag_max, static_cast<unsigned long>(
+                                                max_committed() -
+                                                it->second->num_committed()));
+                load[it->first]++;
+                served++;
+                continue;
+            }
+
+            reads[id] = Read{leader, t, max_committed()};
+            if (leader->read_request(id, &output_next)) {
+                return -1;
+            }
+        }
+
+        /* Serve the reads that are ready. */
+        for (ReadId id : output_next.reads_ready) {
+            const Read &r = reads.at(id);
+
+            if (r.sm->num_committed() < r.committed) {
+                stale++;
+            }
+            load[r.sm->local_name()]++;
+            latency_tot += (t - r.t).count();
+            served++;
+            reads.erase(id);
+        }
+        for (ReadId id : output_next.reads_failed) {
+            reads.erase(id);
+        }
+
+        /* Update the timers. */
+        for (const RaftTimerCmd &cmd : output_next.timer_commands) {
+            auto key = make_pair(cmd.sm, cmd.type);
+
+            if (cmd.action == RaftTimerAction::Restart) {
+                timers[key] = t + cmd.milliseconds;
+            } else {
+                timers.erase(key);
+            }
+        }
+
+        if (t == t_start && leader) {
+            rounds_start = leader->get_stats().read_rounds;
+        }
+        output = std::move(output_next);
+    }
+
+    TestReplica *leader = get_leader();
+    unsigned long load_max = 1;
+
+    for (const auto &kv : load) {
+        load_max = std::max(load_max, kv.second);
+    }
+    if (!leader || !served) {
+        cout << "Read benchmark failed: no reads served" << endl;
+        return 1;
+    }
+
+    cout << "Read benchmark: replicas " << n << ", mode "
+         << read_mode_repr(mode) << ": " << served << " reads, ";
+    if (mode == ReadMode::Follower) {
+        cout << "max lag " << lag_max << " entries";
+    } else {
+        cout << "avg latency " << static_cast<double>(latency_tot) / served
+             << " ms, "
+             << leader->get_stats().read_rounds - rounds_start << " rounds";
+    }
+    cout << ", " << static_cast<double>(msgs) / served
+         << " msgs/read, est. throughput "
+         << kReplicaCapacity * served / load_max << " reads/ms" << endl;
+
+    if (stale) {
+        cout << stale << " reads returned stale data" << endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Check that a new leader serves ReadIndex reads right after a leader
+ * change, while no client commands are being submitted. Some commands are
+ * committed by a first leader, which is then isolated (it does not receive
+ * messages nor fire timers anymore), and reads are issued to the next
+ * leader as soon as it is elected. Returns 0 on success, 1 if the reads
+ * are not served in time or return stale data, -1 on error. */
+int
+run_failover_read_test()
+{
+    const chrono::milliseconds t_end(3000), read_deadline(100);
+    const uint32_t num_cmds = 5, num_reads = 10;
+    map<string, std::unique_ptr<TestReplica>> replicas;
+    map<pair<RaftSM *, RaftTimerType>, chrono::milliseconds> timers;
+    list<string> names = {"f1", "f2", "f3"};
+    TestReplica *old_leader = nullptr;
+    TestReplica *reader     = nullptr;
+    chrono::milliseconds t(0);
+    chrono::milliseconds t_reads(0);
+    RaftSMOutput output;
+    uint32_t cmd_next = 1;
+    uint32_t issued   = 0;
+    uint32_t served   = 0;
+
+    for (const auto &local : names) {
+        list<string> peers;
+
+        remove(logfile(local).c_str());
+        for (const auto &peer : names) {
+            if (peer != local) {
+                peers.push_back(peer);
+            }
+        }
+        auto sm = utils::make_unique<TestReplica>(local + "-sm", local,
+                                                  logfile(local), peers);
+        sm->set_verbosity(RaftSM::kVerboseQuiet);
+        sm->set_simtime(&t);
+        if (sm->respawn(&output)) {
+            return -1;
+        }
+        replicas[local] = std::move(sm);
+    }
+
+    auto get_leader = [&replicas, &old_leader]() -> TestReplica * {
+        for (const auto &kv : replicas) {
+            if (kv.second.get() != old_leader && kv.second->leader()) {
+                return kv.second.get();
+            }
+        }
+        return nullptr;
+    };
+
+    for (const RaftTimerCmd &cmd : output.timer_commands) {
+        timers[make_pair(cmd.sm, cmd.type)] = cmd.milliseconds;
+    }
+
+    for (; t < t_end; t += chrono::milliseconds(1)) {
+        RaftSMOutput output_next;
+
+        /* Deliver the messages sent in the previous millisecond, except
+         * for the ones directed to the isolated leader. */
+        for (const auto &p : output.output_messages) {
+            TestReplica *sm = replicas.at(p.first).get();
+
+            if (sm != old_leader &&
+                message_input(sm, p.second.get(), &output_next)) {
+                return -1;
+            }
+        }
+
+        /* Fire the expired timers. */
+        for (auto it = timers.begin(); it != timers.end();) {
+            if (it->second <= t) {
+                RaftSM *sm         = it->first.first;
+                RaftTimerType type = it->first.second;
+
+                it = timers.erase(it);
+                if (sm != old_leader && sm->timer_expired(type, &output_next)) {
+                    return -1;
+                }
+            } else {
+                ++it;
+            }
+        }
+
+        TestReplica *leader = get_leader();
+
+        if (leader && !old_leader) {
+            if (cmd_next <= num_cmds) {
+                if (leader->submit(reinterpret_cast<const char *>(&cmd_next),
+                                   nullptr, &output_next)) {
+                    return -1;
+                }
+                cmd_next++;
+            } else if (leader->num_committed() == num_cmds) {
+                /* Isolate the leader and stop submitting commands. */
+                old_leader = leader;
+            }
+        } else if (leader && !issued) {
+            /* A new leader has been elected: read immediately. */
+            for (; issued < num_reads; issued++) {
+                if (leader->read_request(issued + 1, &output_next)) {
+                    return -1;
+                }
+            }
+            reader  = leader;
+            t_reads = t;
+        }
+
+        for (ReadId id : output_next.reads_ready) {
+            (void)id;
+            if (reader->num_committed() < num_cmds) {
+                cout << "Failover read test: read returned stale data"
+                     << endl;
+                return 1;
+            }
+            served++;
+        }
+        if (!output_next.reads_failed.empty()) {
+            cout << "Failover read test: reads failed" << endl;
+            return 1;
+        }
+        if (issued && served == num_reads) {
+            if (t - t_reads > read_deadline) {
+                break;
+            }
+            cout << "Failover read test: " << served << " reads served in "
+                 << (t - t_reads).count() << " ms after the leader change"
+                 << endl;
+            return 0;
+        }
+
+        /* Update the timers. */
+        for (const RaftTimerCmd &cmd : output_next.timer_commands) {
+            auto key = make_pair(cmd.sm, cmd.type);
+
+            if (cmd.action == RaftTimerAction::Restart) {
+                timers[key] = t + cmd.milliseconds;
+            } else {
+                timers.erase(key);
+            }
+        }
+
+        output = std::move(output_next);
+    }
+
+    cout << "Failover read test: " << served << "/" << issued
+         << " reads served in time" << endl;
+
+    return 1;
+}
+
+/* Measure the commit throughput of a cluster of three replicas, where
+ * client commands are submitted in batches of 'batch' commands (one means
+ * no batching) and at most 'window' entries can be unacked for each
+ * follower. Messages are delivered as soon as they are produced, so that
+ * the cost is dominated by the disk syncs of the log. Returns 0 on
+ * success, 1 if the replicas do not agree on the committed commands,
+ * -1 on error. */
+int
+run_batch_benchmark(unsigned int batch, unsigned int window)
+{
+    const uint32_t num_cmds = 2000;
+    map<string, std::unique_ptr<TestReplica>> replicas;
+    list<string> names = {"c1", "c2", "c3"};
+    RaftSMOutput output;
+    uint32_t cmd_next = 1;
+
+    for (const auto &local : names) {
+        list<string> peers;
+
+        remove(logfile(local).c_str());
+        for (const auto &peer : names) {
+            if (peer != local) {
+                peers.push_back(peer);
+            }
+        }
+        auto sm = utils::make_unique<TestReplica>(local + "-sm", local,
+                                                  logfile(local), peers);
+        sm->set_verbosity(RaftSM::kVerboseQuiet);
+        sm->set_replication_window(window);
+        if (sm->respawn(&output)) {
+            return -1;
+        }
+        replicas[local] = std::move(sm);
+    }
+
+    /* Deliver all the messages, including the ones produced in the
+     * meanwhile. Timers are not used. */
+    auto deliver = [&replicas](RaftSMOutput *out) -> int {
+        while (!out->output_messages.empty()) {
+            auto p = std::move(out->output_messages.front());
+
+            out->output_messages.pop_front();
+            if (message_input(replicas.at(p.first).get(), p.second.get(),
+                              out)) {
+                return -1;
+            }
+        }
+        out->timer_commands.clear();
+        return 0;
+    };
+
+    /* Make c1 the leader. */
+    TestReplica *leader = replicas.at("c1").get();
+
+    if (leader->timer_expired(RaftTimerType::Election, &output) ||
+        deliver(&output) || !leader->leader()) {
+        return -1;
+    }
+
+    auto t_start = chrono::system_clock::now();
+
+    while (cmd_next <= num_cmds) {
+        for (unsigned int i = 0; i < batch && cmd_next <= num_cmds; i++) {
+            const char *serbuf = reinterpret_cast<const char *>(&cmd_next);
+            int ret = batch > 1 ? leader->submit_batched(serbuf, nullptr)
+                                : leader->submit(serbuf, nullptr, &output);
+
+            if (ret) {
+                return -1;
+            }
+            cmd_next++;
+        }
+        if (leader->submit_flush(&output) || deliver(&output)) {
+            return -1;
+        }
+    }
+
+    auto usecs = chrono::duration_cast<chrono::microseconds>(
+                     chrono::system_clock::now() - t_start)
+                     .count();
+
+    /* A last heartbeat lets the followers know about the commit index. */
+    if (leader->timer_expired(RaftTimerType::HeartBeat, &output) ||
+        deliver(&output)) {
+        return -1;
+    }
+
+    cout << "Batch benchmark: batch " << batch << ", window " << window
+         << ": " << num_cmds * 1000000ULL / std::max(usecs, 1L)
+         << " commits/s, "
+         << static_cast<double>(leader->get_stats().ae_msgs) / num_cmds
+         << " AppendEntries/commit" << endl;
+
+    for (const auto &kv : replicas) {
+        if (!kv.second->check(num_cmds) || !kv.second->cross_check(*leader)) {
+            cout << "Replica " << kv.first << " did not commit all the "
+                 << "commands in order" << endl;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
 /*
  * Test vectors for the Raft implementation. A current limitation is that all
  * tests are positive. Each test vector is crafted in such a way that a majority
@@ -699,5 +1229,30 @@ main(int argc, char **argv)
         ++test_counter;
     }
 
+    if (test_selector <= 0) {
+        /* Reads right after a leader change. */
+        if (run_failover_read_test()) {
+            return -1;
+        }
+
+        /* Read throughput vs cluster size, for the different read modes. */
+        for (unsigned int n : {3, 5, 7, 9}) {
+            for (ReadMode mode :
+                 {ReadMode::ReadIndex, ReadMode::Lease, ReadMode::Follower}) {
+                if (run_read_benchmark(n, mode)) {
+                    return -1;
+                }
+            }
+        }
+
+        /* Commit throughput vs batch size and replication window. */
+        for (const auto &bw : vector<pair<unsigned int, unsigned int>>{
+                 {1, 128}, {8, 128}, {32, 128}, {128, 128}, {128, 16}}) {
+            if (run_batch_benchmark(bw.first, bw.second)) {
+                return -1;
+            }
+        }
+    }
+
     return 0;
 }
@@ -89,6 +89,10 @@ RaftSM::init(const list<ReplicaId> peers, RaftSMOutput *out)
     last_log_index  = 0;
     last_log_term   = 0;
     votes_collected = 0;
+    noop_index      = 0;
+    pending_reads.clear();
+    read_round_active = false;
+    lease_expiry      = std::chrono::system_clock::time_point();
 
     if (first_boot) {
         char null[kLogVotedForSize];
@@ -178,7 +182,7 @@ RaftSM::init(const list<ReplicaId> peers, RaftSMOutput *out)
         servers[rid].match_index      = 0;
         servers[rid].next_index_acked = servers[rid].next_index_unacked =
             last_log_index + 1;
-        servers[rid].last_ae_time = std::chrono::system_clock::now();
+        servers[rid].last_ae_time = clock_now();
     }
 
     /* Initialization is complete, we can set the election timer and return to
@@ -234,7 +238,7 @@ RaftSM::log_disk_flush()
 }
 
 int
-RaftSM::log_u32_write(unsigned long pos, uint32_t val)
+RaftSM::log_u32_write(unsigned long pos, uint32_t val, bool sync)
 {
     logfile.seekp(pos);
     if (logfile.fail()) {
@@ -246,7 +250,7 @@ RaftSM::log_u32_write(unsigned long pos, uint32_t val)
         IOS_ERR() << "Failed to write u32 at position " << pos << endl;
         return -1;
     }
-    return log_disk_flush();
+    return sync ? log_disk_flush() : 0;
 }
 
 int
@@ -277,7 +281,8 @@ RaftSM::magic_check()
 }
 
 int
-RaftSM::log_buf_write(unsigned long pos, const char *buf, size_t len)
+RaftSM::log_buf_write(unsigned long pos, const char *buf, size_t len,
+                      bool sync)
 {
     logfile.seekp(pos);
     if (logfile.fail()) {
@@ -290,7 +295,7 @@ RaftSM::log_buf_write(unsigned long pos, const char *buf, size_t len)
                   << endl;
         return -1;
     }
-    return log_disk_flush();
+    return sync ? log_disk_flush() : 0;
 }
 
 int
@@ -399,6 +404,9 @@ RaftSM::back_to_follower(RaftSMOutput *out)
     if ((ret = vote_for_candidate(string()))) {
         return ret;
     }
+    /* Writing the vote synced to disk any batched log entry. */
+    batched_entries = 0;
+    reads_fail(out);
     switch_state(RaftState::Follower);
     out->timer_commands.push_back(RaftTimerCmd(
         this, RaftTimerType::Election, RaftTimerAction::Restart,
@@ -437,8 +445,14 @@ RaftSM::catch_up_term(Term term, RaftSMOutput *out)
 }
 
 int
-RaftSM::log_entry_get_term(LogIndex index, Term *term)
+RaftSM::log_entry_get_term(LogIndex index, Term *term, bool *noop)
 {
+    int ret;
+
+    if (noop) {
+        *noop = false;
+    }
+
     if (index == 0) {
         *term = 0;
         return 0;
@@ -448,7 +462,16 @@ RaftSM::log_entry_get_term(LogIndex index, Term *term)
         return 1; /* no such entry */
     }
 
-    return log_u32_read(kLogEntriesOfs + (index - 1) * log_entry_size, term);
+    if ((ret = log_u32_read(kLogEntriesOfs + (index - 1) * log_entry_size,
+                            term))) {
+        return ret;
+    }
+    if (noop) {
+        *noop = (*term & kNoopTermFlag) != 0;
+    }
+    *term &= ~kNoopTermFlag;
+
+    return 0;
 }
 
 int
@@ -465,7 +488,8 @@ RaftSM::log_entry_get_command(LogIndex index, char *const serbuf)
 
 /* Prepare a RaftAppendEntries for each follower. If there are no log entries
  * to be sent, an heartbeat message is prepared. Otherwise the message can
- * contain multiple entries. As a result, this function is idempotent.
+ * contain multiple entries, up to MaxAppendEntriesBytes. As a result, this
+ * function is idempotent.
  * The 'strategy' argument defines which entries are sent to each peer:
  *   - If LogReplicateStrategy::Unacked, all the log entries that are
  *     currently unacked are selected (both the ones yet to be sent and the
@@ -474,87 +498,143 @@ RaftSM::log_entry_get_command(LogIndex index, char *const serbuf)
  *   - If LogReplicateStrategy::Unsent, only the log entries that have
  *     not been sent yet are selected. This enables pipelining of client
  *     submissions.
+ * In both cases, no more than ReplicationWindow entries can be unacked
+ * for each follower, so that a slow follower does not cause the leader to
+ * send (and retransmit) an unbounded amount of entries.
  *
  *      <===Acked===><===Sent-but-unacked===><===Yet-to-be-sent===>
  * */
 int
 RaftSM::prepare_append_entries(LogReplicateStrategy strategy, RaftSMOutput *out)
 {
-    auto now = std::chrono::system_clock::now();
+    bool all_servers = true;
+    int ret;
+
+    /* Entries must be on disk before they are replicated. */
+    if ((ret = batch_sync())) {
+        return ret;
+    }
 
     for (auto &kv : servers) {
-        if (strategy == LogReplicateStrategy::Unacked &&
-            now >= kv.second.last_ae_time + RtxTimeout) {
-            kv.second.next_index_unacked = kv.second.next_index_acked;
-            if (kv.second.next_index_unacked < last_log_index) {
-                IOS_INF() << "Retransmitting to " << kv.first << endl;
-            }
+        bool sent = false;
+
+        if ((ret = append_entries_to(kv.first, strategy, &sent, out))) {
+            return ret;
         }
+        all_servers = all_servers && sent;
+    }
 
-        do {
-            auto msg            = utils::make_unique<RaftAppendEntries>();
-            msg->term           = current_term;
-            msg->leader_id      = local_id;
-            msg->leader_commit  = commit_index;
-            msg->prev_log_index = kv.second.next_index_unacked - 1;
-            if (log_entry_get_term(msg->prev_log_index, &msg->prev_log_term)) {
-                return -1;
-            }
+    /* The heartbeat timer is restarted only if all the followers were sent
+     * something, otherwise they may not hear from us for too long. */
+    if (all_servers) {
+        out->timer_commands.push_back(RaftTimerCmd(this,
+                                                   RaftTimerType::HeartBeat,
+                                                   RaftTimerAction::Restart,
+                                                   HeartbeatTimeout));
+    }
+    return 0;
+}
+
+/* Prepare the RaftAppendEntries for a single follower, as described
+ * for prepare_append_entries(). Nothing is sent if the replication window
+ * is full and there are no entries to be retransmitted. */
+int
+RaftSM::append_entries_to(const ReplicaId &id, LogReplicateStrategy strategy,
+                          bool *sent, RaftSMOutput *out)
+{
+    Server &server      = servers.at(id);
+    auto now            = clock_now();
+    LogIndex window_end = last_log_index + 1;
+    int ret;
 
-            LogIndex i = kv.second.next_index_unacked;
-            for (size_t chunk_bytes = 0;
-                 i <= last_log_index && chunk_bytes <= kMaxLogChunkBytes; i++) {
-                auto bufcopy =
-                    std::unique_ptr<char[]>(new char[log_command_size]);
-                Term term = 0;
-                int ret;
+    if (ReplicationWindow) {
+        window_end =
+            std::min(window_end, server.next_index_acked + ReplicationWindow);
+    }
 
-                if ((ret = log_entry_get_term(i, &term))) {
-                    return ret;
-                }
-                if ((ret = log_entry_get_command(i, bufcopy.get()))) {
-                    return ret;
-                }
-                chunk_bytes += log_entry_size;
-                msg->entries.push_back(
-                    std::make_pair(term, std::move(bufcopy)));
+    if (strategy == LogReplicateStrategy::Unacked &&
+        now >= server.last_ae_time + RtxTimeout) {
+        server.next_index_unacked = server.next_index_acked;
+        if (server.next_index_unacked < last_log_index) {
+            IOS_INF() << "Retransmitting to " << id << endl;
+        }
+    }
+
+    if (strategy == LogReplicateStrategy::Unsent &&
+        server.next_index_unacked >= window_end &&
+        server.next_index_unacked <= last_log_index) {
+        stats.window_full++;
+        *sent = false;
+        return 0;
+    }
+
+    do {
+        auto msg            = utils::make_unique<RaftAppendEntries>();
+        msg->term           = current_term;
+        msg->leader_id      = local_id;
+        msg->leader_commit  = commit_index;
+        msg->prev_log_index = server.next_index_unacked - 1;
+        msg->read_seq       = read_round_active ? read_seq_next : 0;
+        if (log_entry_get_term(msg->prev_log_index, &msg->prev_log_term)) {
+            return -1;
+        }
+
+        LogIndex i = server.next_index_unacked;
+        for (size_t chunk_bytes = 0;
+             i < window_end &&
+             (msg->entries.empty() ||
+              chunk_bytes + log_entry_size <= MaxAppendEntriesBytes);
+             i++) {
+            auto bufcopy = std::unique_ptr<char[]>(new char[log_command_size]);
+            Term term    = 0;
+            bool noop    = false;
+
+            if ((ret = log_entry_get_term(i, &term, &noop))) {
+                return ret;
             }
-            kv.second.next_index_unacked = i;
-            if (!msg->entries.empty()) {
-                kv.second.last_ae_time = now;
+            if ((ret = log_entry_get_command(i, bufcopy.get()))) {
+                return ret;
             }
-            out->output_messages.push_back(make_pair(kv.first, std::move(msg)));
-        } while (kv.second.next_index_unacked < last_log_index);
-    }
+            chunk_bytes += log_entry_size;
+            msg->entries.push_back(std::make_pair(
+                noop ? (term | kNoopTermFlag) : term, std::move(bufcopy)));
+        }
+        server.next_index_unacked = i;
+        if (!msg->entries.empty()) {
+            server.last_ae_time = now;
+            stats.ae_msgs++;
+        }
+        out->output_messages.push_back(make_pair(id, std::move(msg)));
+    } while (server.next_index_unacked < window_end);
+
+    *sent = true;
 
-    out->timer_commands.push_back(RaftTimerCmd(this, RaftTimerType::HeartBeat,
-                                               RaftTimerAction::Restart,
-                                               HeartbeatTimeout));
     return 0;
 }
 
-/* Append a new entry to the end of our log, and updates last log index. */
+/* Append a new entry to the end of our log, and updates last log index.
+ * The term may carry the kNoopTermFlag. */
 int
-RaftSM::append_log_entry(const Term term, const char *serbuf)
+RaftSM::append_log_entry(const Term term, const char *serbuf, bool sync)
 {
     LogIndex new_index      = last_log_index + 1;
     unsigned long entry_pos = kLogEntriesOfs + (new_index - 1) * log_entry_size;
     int ret                 = 0;
 
     /* First write the current term. */
-    if ((ret = log_u32_write(entry_pos, term))) {
+    if ((ret = log_u32_write(entry_pos, term, /*sync=*/false))) {
         return ret;
     }
 
     /* Second, serialize the log entry and write the serialized content. */
     if ((ret = log_buf_write(entry_pos + sizeof(Term), serbuf,
-                             log_command_size))) {
+                             log_command_size, sync))) {
         return ret;
     }
 
     /* Update our last log index and term. */
     last_log_index = new_index;
-    last_log_term  = term;
+    last_log_term  = term & ~kNoopTermFlag;
 
     if (verbosity >= kVerboseInfo) {
         IOS_INF() << "Append log entry term=" << last_log_term
@@ -571,12 +651,16 @@ RaftSM::apply_committed_entries()
 
     for (; last_applied < commit_index; last_applied++) {
         LogIndex next = last_applied + 1;
+        bool noop;
         Term term;
         int ret;
 
-        if (log_entry_get_term(next, &term) != 0) {
+        if (log_entry_get_term(next, &term, &noop) != 0) {
             return -1;
         }
+        if (noop) {
+            continue; /* nothing to apply */
+        }
         if (!serbuf) {
             serbuf = std::unique_ptr<char[]>(new char[log_command_size]);
         }
@@ -596,6 +680,8 @@ RaftSM::apply_committed_entries()
 int
 RaftSM::log_truncate(LogIndex index)
 {
+    int ret;
+
     assert(index <= last_log_index);
     if (index == last_log_index) {
         return 0; /* nothing to do */
@@ -616,7 +702,12 @@ RaftSM::log_truncate(LogIndex index)
     stats.discarded += last_log_index - index;
     last_log_index = index;
 
-    return log_open(/*first_boot=*/false);
+    if ((ret = log_open(/*first_boot=*/false))) {
+        return ret;
+    }
+
+    /* The last entry may come from an older term. */
+    return log_entry_get_term(last_log_index, &last_log_term);
 }
 
 int
@@ -636,6 +727,25 @@ RaftSM::request_vote_input(const RaftRequestVote &msg, RaftSMOutput *out)
                   << ", last_log_index=" << msg.last_log_index << ")" << endl;
     }
 
+    if (LeaseTimeout > std::chrono::milliseconds::zero() &&
+        msg.candidate_id != leader_id &&
+        (leader() || (!leader_id.empty() &&
+                      clock_now() < last_leader_contact + ElectionTimeoutMin))) {
+        /* We recently heard from a leader, which may be serving reads under
+         * lease. Refuse to vote, without updating our term. */
+        if (verbosity >= kVerboseInfo) {
+            IOS_INF() << "Vote for " << msg.candidate_id
+                      << " not granted (leader " << leader_id << " is alive)"
+                      << endl;
+        }
+        resp               = utils::make_unique<RaftRequestVoteResp>();
+        resp->term         = current_term;
+        resp->vote_granted = false;
+        out->output_messages.push_back(
+            make_pair(msg.candidate_id, std::move(resp)));
+        return 0;
+    }
+
     if ((ret = catch_up_term(msg.term, out)) < 0) {
         return ret;
     }
@@ -726,10 +836,26 @@ RaftSM::request_vote_resp_input(const RaftRequestVoteResp &resp,
         kv.second.match_index      = 0;
         kv.second.next_index_acked = kv.second.next_index_unacked =
             last_log_index + 1;
-        kv.second.last_ae_time = std::chrono::system_clock::now();
+        kv.second.last_ae_time = clock_now();
+    }
+    read_round_active = false;
+    lease_expiry      = std::chrono::system_clock::time_point();
+
+    /* Append a no-op entry for our term. Entries of previous terms are
+     * committed only together with an entry of our term, so without
+     * this entry reads (and clients waiting for their commands) would
+     * block until a new command is submitted. */
+    {
+        std::unique_ptr<char[]> noop(new char[log_command_size]());
+
+        if ((ret = append_log_entry(current_term | kNoopTermFlag,
+                                    noop.get()))) {
+            return ret;
+        }
+        noop_index = last_log_index;
     }
 
-    /* Prepare heartbeat messages for the other replicas and set the
+    /* Send the no-op entry to the other replicas and set the
      * heartbeat timer. */
     if ((ret = prepare_append_entries(LogReplicateStrategy::Unsent, out))) {
         return ret;
@@ -747,6 +873,7 @@ RaftSM::append_entries_input(const RaftAppendEntries &msg, RaftSMOutput *out)
 {
     std::unique_ptr<RaftAppendEntriesResp> resp;
     Term prev_log_term = 0;
+    bool log_match;
     int ret;
 
     if (check_output_arg(out)) {
@@ -784,42 +911,64 @@ RaftSM::append_entries_input(const RaftAppendEntries &msg, RaftSMOutput *out)
         return ret;
     }
 
-    leader_id = msg.leader_id;
+    leader_id           = msg.leader_id;
+    last_leader_contact = clock_now();
+    resp->read_seq      = msg.read_seq;
+
+    /* Check if our log matches the leader's one up to prev_log_index. This
+     * is needed for heartbeats too, since we cannot commit entries that
+     * may have been overwritten by the leader. */
+    if ((ret = log_entry_get_term(msg.prev_log_index, &prev_log_term)) < 0) {
+        return ret;
+    }
+    log_match = msg.prev_log_index <= last_log_index && ret == 0 &&
+                msg.prev_log_term == prev_log_term;
 
     if (!msg.entries.empty()) {
         /* Check if we can accept the received entries. */
-        if ((ret = log_entry_get_term(msg.prev_log_index, &prev_log_term)) <
-            0) {
-            return ret;
-        }
-        resp->success = msg.prev_log_index <= last_log_index && ret == 0 &&
-                        msg.prev_log_term == prev_log_term;
+        resp->success = log_match;
         if (resp->success) {
             if ((ret = log_truncate(msg.prev_log_index))) {
                 return ret;
             }
+            /* Write all the entries, and sync them to disk once. */
             for (const auto &entry : msg.entries) {
                 Term term                = entry.first;
                 const char *const serbuf = entry.second.get();
 
-                if ((ret = append_log_entry(term, serbuf))) {
+                if ((ret = append_log_entry(term, serbuf, /*sync=*/false))) {
                     return ret;
                 }
             }
+            if ((ret = log_disk_flush())) {
+                return ret;
+            }
             resp->log_index = last_log_index;
         }
     }
 
-    if (msg.leader_commit > commit_index) {
-        commit_index = std::min(msg.leader_commit, last_log_index);
-        if ((ret = apply_committed_entries())) {
-            return ret;
+    /* Only the prefix of the log which matches the leader's one can be
+     * committed. */
+    if (log_match) {
+        LogIndex new_commit = std::min(
+            msg.leader_commit,
+            msg.prev_log_index + static_cast<LogIndex>(msg.entries.size()));
+
+        if (new_commit > commit_index) {
+            commit_index = new_commit;
+            if ((ret = apply_committed_entries())) {
+                return ret;
+            }
         }
     }
 
-    /* We need to reply only if this is not an heartbeat message. */
+    /* We need to reply only if this is not an heartbeat message, or
+     * if the leader asked to confirm its leadership. */
     if (!msg.entries.empty()) {
         out->output_messages.push_back(make_pair(leader_id, std::move(resp)));
+    } else if (msg.read_seq) {
+        resp->heartbeat = true;
+        out->output_messages.push_back(make_pair(leader_id, std::move(resp)));
     }
 
     return 0;
@@ -862,6 +1011,14 @@ RaftSM::append_entries_resp_input(const RaftAppendEntriesResp &resp,
         return -1;
     }
 
+    if (resp.read_seq && (ret = read_ack(resp.follower_id, resp.read_seq, out))) {
+        return ret;
+    }
+
+    if (resp.heartbeat) {
+        return 0; /* nothing else to do */
+    }
+
     Server &follower = servers[resp.follower_id];
 
     if (resp.success) {
@@ -914,6 +1071,21 @@ RaftSM::append_entries_resp_input(const RaftAppendEntriesResp &resp,
                 if ((ret = apply_committed_entries())) {
                     return ret;
                 }
+                /* Some reads may be waiting for these entries. */
+                reads_serve(out);
+            }
+        }
+
+        /* The window of this follower may have been full: send the
+         * entries that could not be sent so far. */
+        if (follower.next_index_unacked <= last_log_index) {
+            bool sent;
+
+            if ((ret = batch_sync()) ||
+                (ret = append_entries_to(resp.follower_id,
+                                         LogReplicateStrategy::Unsent, &sent,
+                                         out))) {
+                return ret;
             }
         }
     } else {
@@ -1024,4 +1196,208 @@ RaftSM::submit(const char *const serbuf, LogIndex *log_index_p,
     return 0;
 }
 
+int
+RaftSM::submit_batched(const char *const serbuf, LogIndex *log_index_p)
+{
+    int ret;
+
+    if (!leader()) {
+        IOS_ERR() << "submit_batched() on non-leaders is not supported"
+                  << endl;
+        return -1;
+    }
+
+    if ((ret = append_log_entry(current_term, serbuf, /*sync=*/false))) {
+        return ret;
+    }
+    batched_entries++;
+
+    if (log_index_p) {
+        *log_index_p = last_log_index;
+    }
+
+    return 0;
+}
+
+int
+RaftSM::submit_flush(RaftSMOutput *out)
+{
+    int ret;
+
+    if (check_output_arg(out)) {
+        return -1;
+    }
+
+    if (!batched_entries) {
+        return 0; /* nothing to do */
+    }
+
+    if (!leader()) {
+        return batch_sync();
+    }
+
+    /* This syncs the batch and sends it to the followers. */
+    if ((ret = prepare_append_entries(LogReplicateStrategy::Unsent, out))) {
+        return ret;
+    }
+
+    return 0;
+}
+
+/* Sync to disk the log entries appended by submit_batched(). */
+int
+RaftSM::batch_sync()
+{
+    if (!batched_entries) {
+        return 0;
+    }
+    stats.batches++;
+    stats.batched_entries += batched_entries;
+    batched_entries = 0;
+
+    return log_disk_flush();
+}
+
+int
+RaftSM::read_request(ReadId id, RaftSMOutput *out)
+{
+    PendingRead r;
+
+    if (check_output_arg(out)) {
+        return -1;
+    }
+
+    if (!leader()) {
+        IOS_ERR() << "read_request() on non-leaders is not supported" << endl;
+        return -1;
+    }
+
+    /* The read must reflect all the entries committed so far. If we have
+     * not committed our no-op entry yet, our commit_index may be behind the
+     * one of the previous leader; in that case we wait for the no-op entry
+     * to be committed, which commits all the entries before it. */
+    r.id    = id;
+    r.index = std::max(commit_index, noop_index);
+
+    if (lease_valid()) {
+        /* No need to confirm leadership. */
+        r.seq = read_seq_confirmed;
+        stats.reads_lease++;
+    } else {
+        /* Wait for a new round of heartbeats (the next one if a round is
+         * in progress, since it may have started before this read). */
+        r.seq = read_seq_next + 1;
+        stats.reads_index++;
+    }
+    pending_reads.push_back(r);
+
+    if (r.seq > read_seq_confirmed && !read_round_active) {
+        return read_round_start(out);
+    }
+
+    reads_serve(out);
+
+    return 0;
+}
+
+/* Start a round of heartbeats to confirm that we are still the leader. */
+int
+RaftSM::read_round_start(RaftSMOutput *out)
+{
+    read_round_active = true;
+    read_seq_next++;
+    read_round_acks.clear();
+    read_round_start_time = clock_now();
+    stats.read_rounds++;
+
+    if (quorum() <= 1) {
+        return read_round_complete(out);
+    }
+
+    return prepare_append_entries(LogReplicateStrategy::Unsent, out);
+}
+
+int
+RaftSM::read_ack(const ReplicaId &follower, uint64_t seq, RaftSMOutput *out)
+{
+    if (!leader() || !read_round_active || seq != read_seq_next) {
+        return 0; /* late or duplicated acknowledgement */
+    }
+
+    read_round_acks.insert(follower);
+    if (read_round_acks.size() + 1 < quorum()) {
+        return 0; /* quorum not reached yet */
+    }
+
+    return read_round_complete(out);
+}
+
+/* A majority of the replicas acknowledged our leadership. */
+int
+RaftSM::read_round_complete(RaftSMOutput *out)
+{
+    read_round_active  = false;
+    read_seq_confirmed = read_seq_next;
+    if (LeaseTimeout > std::chrono::milliseconds::zero()) {
+        /* Nobody can be elected before the followers that acknowledged
+         * the round time out, and they received the heartbeats after
+         * the round started. */
+        lease_expiry = read_round_start_time + LeaseTimeout;
+    }
+
+    reads_serve(out);
+
+    /* Reads arrived during the round need another round. */
+    for (const auto &r : pending_reads) {
+        if (r.seq > read_seq_confirmed) {
+            return read_round_start(out);
+        }
+    }
+
+    return 0;
+}
+
+void
+RaftSM::reads_serve(RaftSMOutput *out)
+{
+    for (auto it = pending_reads.begin(); it != pending_reads.end();) {
+        if (it->seq <= read_seq_confirmed && it->index <= last_applied) {
+            out->reads_ready.push_back(it->id);
+            it = pending_reads.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void
+RaftSM::reads_fail(RaftSMOutput *out)
+{
+    for (const auto &r : pending_reads) {
+        out->reads_failed.push_back(r.id);
+        stats.reads_failed++;
+    }
+    pending_reads.clear();
+    read_round_active = false;
+    lease_expiry      = std::chrono::system_clock::time_point();
+}
+
+bool
+RaftSM::lease_valid() const
+{
+    return leader() && LeaseTimeout > std::chrono::milliseconds::zero() &&
+           clock_now() < lease_expiry;
+}
+
+bool
+RaftSM::read_local_ok(std::chrono::milliseconds max_staleness) const
+{
+    if (leader()) {
+        return true;
+    }
+
+    return !leader_id.empty() &&
+           clock_now() <= last_leader_contact + max_staleness;
+}
+
 } /* namespace raft */
@@ -170,6 +170,18 @@ struct rl_msg_layout rl_uipcps_numtables[] = {
         {
             .copylen = sizeof(struct rl_msg_base),
         },
+    [RLITE_U_SERVER_STATS_DUMP] =
+        {
+            .copylen = sizeof(struct rl_msg_base),
+        },
+    [RLITE_U_MEMTRACK_STATS_REQ] =
+        {
+            .copylen = sizeof(struct rl_msg_base),
+        },
+    [RLITE_U_MEMTRACK_STATS_RESP] =
+        {
+            .copylen = sizeof(struct rl_cmsg_memtrack_stats_resp),
+        },
     [RLITE_U_MSG_MAX] = {
         .copylen = 0,
     }};
@@ -44,7 +44,7 @@
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <sys/eventfd.h>
-#include <poll.h>
+#include <sys/epoll.h>
 #include <signal.h>
 #include <fcntl.h>
 
@@ -52,11 +52,13 @@
 
 using namespace std;
 
-FwdWorker::FwdWorker(int idx_, int verb) : idx(idx_), nfds(0), verbose(verb)
+FwdWorker::FwdWorker(int idx_, int verb, FwdMode mode_)
+    : idx(idx_), next_session_id(1), num_sessions(0), fwd_bytes(0),
+      splice_fallbacks(0), mode(mode_), verbose(verb)
 {
-    repoll_syncfd = eventfd(0, 0);
-    if (repoll_syncfd < 0) {
-        perror("eventfd()");
+    epfd = epoll_create1(0);
+    if (epfd < 0) {
+        perror("epoll_create1()");
         exit(EXIT_FAILURE);
     }
 
@@ -72,7 +74,7 @@ FwdWorker::FwdWorker(int idx_, int verb) : idx(idx_), nfds(0), verbose(verb)
 FwdWorker::~FwdWorker()
 {
     th.join();
-    close(repoll_syncfd);
+    close(epfd);
     close(closed_syncfd);
 }
 
@@ -103,26 +105,172 @@ FwdWorker::eventfd_drain(int fd)
 }
 
 void
-FwdWorker::submit(FwdToken token, int cfd, int rfd)
+FwdWorker::submit(FwdToken token, int cfd, int rfd, bool cfd_rx)
 {
     std::lock_guard<std::mutex> guard(lock);
-
-    if (nfds >= 2 * MAX_SESSIONS) {
-        printf("too many sessions, shutting down %d <--> %d\n", cfd, rfd);
-        close(cfd);
-        close(rfd);
-        return;
+    uint64_t sid = next_session_id++;
+    std::unique_ptr<FwdSession> s(new FwdSession(token, cfd, rfd));
+    FwdSession *sp = s.get();
+
+    sp->fds[1].rx = cfd_rx;
+
+    if (mode == FwdMode::Splice) {
+        /* One pipe for each direction. If we cannot get them, this
+         * session will just use copy mode. */
+        sp->splice = true;
+        for (int i = 0; i < 2; i++) {
+            if (pipe2(sp->fds[i].pipefd, O_NONBLOCK)) {
+                perror("pipe2()");
+                splice_fallback(sp);
+                break;
+            }
+        }
     }
 
-    /* Append two entries in the fds array. Mapping is implicit
-     * between two consecutive entries. */
-    fds[nfds++] = Fd(rfd, token);
-    fds[nfds++] = Fd(cfd, token);
-    eventfd_write(repoll_syncfd); /* trigger repoll */
+    /* Register both file descriptors with epoll. Since epoll_ctl() can
+     * be called while the worker is blocked in epoll_wait(), there is
+     * no need to wake up the worker. */
+    for (int i = 0; i < 2; i++) {
+        struct epoll_event ev;
+
+        ev.events   = 0;
+        ev.data.u64 = (sid << 1) | i;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, sp->fds[i].fd, &ev)) {
+            perror("epoll_ctl(ADD)");
+            if (i == 1) {
+                epoll_ctl(epfd, EPOLL_CTL_DEL, sp->fds[0].fd, nullptr);
+            }
+            sp->splice = false;
+            splice_fallback(sp); /* release the pipes */
+            close(cfd);
+            close(rfd);
+            return;
+        }
+    }
+    sessions[sid] = std::move(s);
+    num_sessions++;
+    update_events(sid, sp, 0);
+    update_events(sid, sp, 1);
 
     if (verbose >= 1) {
-        printf("New mapping created %d <--> %d [entries=%d,%d]\n", cfd, rfd,
-               nfds - 2, nfds - 1);
+        printf("w%d: New mapping created %d %s %d [session=%llu,%s]\n",
+               idx, cfd, cfd_rx ? "<-->" : "<--", rfd,
+               (long long unsigned)sid, sp->splice ? "splice" : "copy");
+    }
+}
+
+/* Called under worker lock. Move any data out of the pipes into the
+ * copy buffers and release the pipes, so that the session continues
+ * in copy mode. Since we never splice more than FDFWD_MAX_BUFSZ bytes
+ * into an empty pipe, the pipe content always fits the buffer. */
+void
+FwdWorker::splice_fallback(FwdSession *s)
+{
+    for (int i = 0; i < 2; i++) {
+        struct Fd &f = s->fds[i];
+
+        if (f.len > 0 && f.pipefd[0] >= 0) {
+            int m = read(f.pipefd[0], f.data, f.len);
+
+            if (m != f.len) {
+                perror("read(pipe)");
+            }
+            f.len = m > 0 ? m : 0;
+            f.ofs = 0;
+        }
+        for (int k = 0; k < 2; k++) {
+            if (f.pipefd[k] >= 0) {
+                close(f.pipefd[k]);
+                f.pipefd[k] = -1;
+            }
+        }
+    }
+
+    if (s->splice) {
+        s->splice = false;
+        splice_fallbacks++;
+    }
+}
+
+/* Called under worker lock. Move data from entry i to the output
+ * buffer (or pipe) of the mapped entry, which must be empty. Returns
+ * the number of bytes moved, or the read()/splice() error. */
+int
+FwdWorker::fwd_in(FwdSession *s, int i)
+{
+    struct Fd &out = s->fds[i ^ 1];
+    int m;
+
+    if (s->splice) {
+        m = splice(s->fds[i].fd, nullptr, out.pipefd[1], nullptr,
+                   FDFWD_MAX_BUFSZ, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (m >= 0 || errno != EINVAL) {
+            if (m > 0) {
+                out.len = m;
+            }
+            return m;
+        }
+        /* The source file descriptor does not support splice(). */
+        splice_fallback(s);
+    }
+
+    m = read(s->fds[i].fd, out.data, FDFWD_MAX_BUFSZ);
+    if (m > 0) {
+        out.len = m;
+        out.ofs = 0;
+    }
+
+    return m;
+}
+
+/* Called under worker lock. Flush (part of) the output buffer (or pipe)
+ * of entry i. Returns the number of bytes written, or the
+ * write()/splice() error. */
+int
+FwdWorker::fwd_out(FwdSession *s, int i)
+{
+    struct Fd &f = s->fds[i];
+    int m;
+
+    if (s->splice) {
+        m = splice(f.pipefd[0], nullptr, f.fd, nullptr, f.len,
+                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (m >= 0 || errno != EINVAL) {
+            if (m > 0) {
+                f.len -= m;
+                f.bytes += m;
+            }
+            return m;
+        }
+        /* The destination file descriptor does not support splice(). */
+        splice_fallback(s);
+    }
+
+    m = write(f.fd, f.data + f.ofs, f.len);
+    if (m > 0) {
+        f.ofs += m;
+        f.len -= m;
+        f.bytes += m;
+    }
+
+    return m;
+}
+
+/* Print per-session counters. */
+void
+FwdWorker::dump_sessions()
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    for (const auto &kv : sessions) {
+        const FwdSession *s = kv.second.get();
+
+        printf("w%d: session %llu [%s] %d --> %d: %llu bytes, "
+               "%d --> %d: %llu bytes\n",
+               idx, (long long unsigned)kv.first,
+               s->splice ? "splice" : "copy", s->fds[1].fd, s->fds[0].fd,
+               (long long unsigned)s->fds[0].bytes, s->fds[0].fd,
+               s->fds[1].fd, (long long unsigned)s->fds[1].bytes);
     }
 }
 
@@ -143,21 +291,88 @@ FwdWorker::get_next_closed()
     return ret;
 }
 
-/* Called under worker lock. */
 void
-FwdWorker::terminate(unsigned int i, int ret, int errcode)
+FwdWorker::shutdown(FwdToken token)
 {
-    unsigned j;
-    string how;
+    std::lock_guard<std::mutex> guard(lock);
+    vector<uint64_t> sids;
 
-    i &= ~(0x1);
-    j = i | 0x1;
+    for (const auto &kv : sessions) {
+        if (kv.second->fds[0].token == token) {
+            sids.push_back(kv.first);
+        }
+    }
+
+    for (uint64_t sid : sids) {
+        terminate(sid, sessions[sid].get(), 0, 0);
+    }
+}
 
-    close(fds[i].fd);
-    close(fds[j].fd);
-    fds[i].closed = fds[j].closed = true;
-    if (fds[i].token > 0) {
-        terminated.push_back(fds[i].token);
+void
+FwdWorker::token_bytes(std::map<FwdToken, std::pair<uint64_t, uint64_t>> &out)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    for (const auto &kv : sessions) {
+        const FwdSession *s = kv.second.get();
+        auto &entry         = out[s->fds[0].token];
+
+        entry.first += s->fds[0].bytes;
+        entry.second += s->fds[1].bytes;
+    }
+}
+
+/* Called under worker lock. Recompute the events of interest for entry i
+ * of session s. We want POLLOUT if there is pending data in the output
+ * buffer of entry i, and POLLIN if the output buffer of the mapped entry
+ * is empty (since data read from i goes there), unless we do not read
+ * from entry i. */
+void
+FwdWorker::update_events(uint64_t sid, FwdSession *s, int i)
+{
+    struct Fd &f = s->fds[i];
+    struct epoll_event ev;
+
+    ev.events = 0;
+    if (f.len) {
+        ev.events |= EPOLLOUT;
+    }
+    if (f.rx && !s->fds[i ^ 1].len) {
+        ev.events |= EPOLLIN;
+    }
+
+    if (ev.events == f.events) {
+        return; /* nothing to do */
+    }
+
+    ev.data.u64 = (sid << 1) | i;
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, f.fd, &ev)) {
+        perror("epoll_ctl(MOD)");
+        return;
+    }
+    f.events = ev.events;
+}
+
+/* Called under worker lock. The session object is destroyed. */
+void
+FwdWorker::terminate(uint64_t sid, FwdSession *s, int ret, int errcode)
+{
+    string how;
+
+    /* Explicitly remove the file descriptors from the epoll set, as
+     * they may be duplicates of file descriptors that stay open. */
+    for (int i = 0; i < 2; i++) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, s->fds[i].fd, nullptr);
+        close(s->fds[i].fd);
+        s->fds[i].closed = true;
+        for (int k = 0; k < 2; k++) {
+            if (s->fds[i].pipefd[k] >= 0) {
+                close(s->fds[i].pipefd[k]);
+            }
+        }
+    }
+    if (s->fds[0].token > 0) {
+        terminated.push_back(s->fds[0].token);
         eventfd_write(closed_syncfd);
     }
 
@@ -170,19 +385,22 @@ FwdWorker::terminate(unsigned int i, int ret, int errcode)
             how += ")";
         }
 
-        cout << "w" << idx << ": Session " << fds[i].fd << " <--> " << fds[j].fd
-             << " closed " << how << " [entries=" << i << "," << j << "]"
-             << endl;
+        cout << "w" << idx << ": Session " << s->fds[0].fd << " <--> "
+             << s->fds[1].fd << " closed " << how << " [session=" << sid
+             << ", bytes=" << s->fds[1].bytes << "/" << s->fds[0].bytes
+             << "]" << endl;
     }
 
-    /* fds entries are recovered at the beginning of the run() main loop */
+    sessions.erase(sid);
+    num_sessions--;
 }
 
+#define FDFWD_MAX_EVENTS 64
+
 void
 FwdWorker::run()
 {
-    struct pollfd pollfds[1 + MAX_SESSIONS * 2];
-    struct pollfd *pfds = pollfds + 1;
+    struct epoll_event events[FDFWD_MAX_EVENTS];
 
     if (verbose >= 1) {
         printf("w%d starts\n", idx);
@@ -191,139 +409,89 @@ FwdWorker::run()
     for (;;) {
         int nrdy;
 
-        pfds[-1].fd     = repoll_syncfd;
-        pfds[-1].events = POLLIN;
-
-        /* Load the poll array with the active fd mappings, also recycling
-         * the entries of closed sessions. */
-        lock.lock();
-        for (int i = 0; i < nfds;) {
-            int j = i + 1; /* index of the mapped entry */
-
-            if (fds[i].closed) {
-                nfds -= 2;
-                if (i < nfds) {
-                    fds[i] = fds[nfds - 1];
-                    fds[j] = fds[nfds];
-                    if (verbose >= 1) {
-                        printf("Recycled entries %d,%d\n", i, j);
-                    }
-                }
+        nrdy = epoll_wait(epfd, events, FDFWD_MAX_EVENTS, -1);
+        if (nrdy < 0) {
+            if (errno == EINTR) {
                 continue;
             }
-
-            pfds[i].fd     = fds[i].fd;
-            pfds[j].fd     = fds[j].fd;
-            pfds[i].events = pfds[j].events = 0;
-
-            /* If there is pending data in the output buffer for entry i,
-             * request POLLOUT to flush that data. Otherwise request POLLIN
-             * on the mapped entry, but only if the mapped entry does not
-             * need to flush its own output buffer. */
-            if (fds[i].len) {
-                pfds[i].events = POLLOUT;
-            } else if (!fds[j].len) {
-                pfds[j].events = POLLIN;
-            }
-
-            /* Same logic for the mapped entry. */
-            if (fds[j].len) {
-                pfds[j].events = POLLOUT;
-            } else if (!fds[i].len) {
-                pfds[i].events = POLLIN;
-            }
-
-            i += 2;
-        }
-        lock.unlock();
-
-        if (verbose >= 2) {
-            printf("w%d polls %d file descriptors\n", idx, nfds + 1);
-        }
-        nrdy = poll(pollfds, nfds + 1, -1);
-        if (nrdy < 0) {
-            perror("poll()");
+            perror("epoll_wait()");
             break;
 
         } else if (nrdy == 0) {
-            printf("w%d: poll() timeout\n", idx);
+            printf("w%d: epoll_wait() timeout\n", idx);
             continue;
         }
 
-        if (pfds[-1].revents) {
-            /* We've been requested to repoll the queue. */
-            nrdy--;
-            if (pfds[-1].revents & POLLIN) {
-                if (verbose >= 2) {
-                    printf("w%d: Mappings changed, rebuilding poll array\n",
-                           idx);
-                }
-                lock.lock();
-                eventfd_drain(repoll_syncfd);
-                lock.unlock();
-
-            } else {
-                printf("w%d: Error event %d on repoll_syncfd\n", idx,
-                       pfds[-1].revents);
-            }
-
-            continue;
+        if (verbose >= 2) {
+            printf("w%d: %d file descriptors ready\n", idx, nrdy);
         }
 
         lock.lock();
 
-        for (int i = 0, n = 0; n < nrdy && i < nfds; i++) {
+        for (int n = 0; n < nrdy; n++) {
+            uint64_t sid     = events[n].data.u64 >> 1;
+            int i            = events[n].data.u64 & 0x1;
+            uint32_t revents = events[n].events;
+            FwdSession *s;
             int j;
 
-            if (!pfds[i].revents || fds[i].closed) {
-                /* No events on this fd, or the session has
-                 * been terminated by the mapped fd (in a previous
-                 * iteration of this loop). Let's skip it. */
+            auto sit = sessions.find(sid);
+            if (sit == sessions.end()) {
+                /* The session has been terminated by the mapped fd
+                 * (in a previous iteration of this loop). Let's
+                 * skip it. */
                 continue;
             }
+            s = sit->second.get();
 
             if (verbose >= 2) {
-                printf("w%d: fd %d ready, events %d\n", idx, pfds[i].fd,
-                       pfds[i].revents);
+                printf("w%d: fd %d ready, events %u\n", idx, s->fds[i].fd,
+                       revents);
             }
 
-            /* Consume the events on this fd. */
-            n++;
-
             j = i ^ 0x1; /* index to the mapped fds entry */
 
-            if (pfds[i].revents & POLLIN) {
+            if ((revents & EPOLLIN) && !s->fds[j].len) {
                 int m;
 
-                assert(fds[j].len == 0);
                 /* The output buffer for entry j is empty and, there
                  * is data to read from the mapped entry i. Load the
                  * output buffer with this data. */
-                m = read(fds[i].fd, fds[j].data, FDFWD_MAX_BUFSZ);
-                if (m <= 0) {
-                    terminate(i, m, errno);
-                } else {
-                    fds[j].len = m;
-                    fds[j].ofs = 0;
+                m = fwd_in(s, i);
+                if (m < 0 && errno == EAGAIN) {
+                    continue;
+                } else if (m <= 0) {
+                    terminate(sid, s, m, errno);
+                    continue;
                 }
+                update_events(sid, s, i);
+                update_events(sid, s, j);
 
-            } else if (pfds[i].revents & POLLOUT) {
+            } else if ((revents & EPOLLOUT) && s->fds[i].len) {
                 int m;
 
-                assert(fds[i].len > 0);
                 /* There is data in the output buffer of entry i. Try to
                  * flush it. */
-                m = write(fds[i].fd, fds[i].data + fds[i].ofs, fds[i].len);
-                if (m <= 0) {
-                    terminate(i, m, errno);
-                } else {
-                    fds[i].ofs += m;
-                    fds[i].len -= m;
-                    if (verbose >= 2) {
-                        printf("Forwarded %d bytes %d --> %d\n", m, fds[j].fd,
-                               fds[i].fd);
-                    }
+                m = fwd_out(s, i);
+                if (m < 0 && errno == EAGAIN) {
+                    continue;
+                } else if (m <= 0) {
+                    terminate(sid, s, m, errno);
+                    continue;
+                }
+                fwd_bytes += m;
+                if (verbose >= 2) {
+                    printf("Forwarded %d bytes %d --> %d\n", m, s->fds[j].fd,
+                           s->fds[i].fd);
+                }
+                if (!s->fds[i].len) {
+                    update_events(sid, s, i);
+                    update_events(sid, s, j);
                 }
+
+            } else if (revents & (EPOLLERR | EPOLLHUP)) {
+                /* Error or hangup with no data to consume. */
+                terminate(sid, s, -1, revents & EPOLLERR ? EIO : EPIPE);
             }
         }
 
@@ -30,59 +30,138 @@
 #ifndef __FDFWD_HH__
 #define __FDFWD_HH__
 
-#define MAX_SESSIONS 16
 #define FDFWD_MAX_BUFSZ 16384
 
 #include <list>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <map>
+#include <atomic>
 #include <thread>
 #include <mutex>
+#include <cstdint>
 
 using FwdToken = unsigned int;
 
+enum class FwdMode {
+    Copy,   /* read()/write() through a userspace buffer */
+    Splice, /* splice() through a pipe, falling back to Copy if the
+             * file descriptors do not support it */
+};
+
 struct Fd {
     int fd;
     int len;
     int ofs;
     bool closed;
+    bool rx;         /* data is read from fd */
     FwdToken token;
+    uint32_t events; /* events currently registered with epoll */
+    int pipefd[2];   /* in splice mode, holds the output data */
+    uint64_t bytes;  /* bytes written to fd */
     char data[FDFWD_MAX_BUFSZ];
 
-    Fd(int _fd, FwdToken t) : fd(_fd), len(0), ofs(0), closed(false), token(t)
+    Fd(int _fd, FwdToken t)
+        : fd(_fd), len(0), ofs(0), closed(false), rx(true), token(t),
+          events(0), pipefd{-1, -1}, bytes(0)
+    {
+    }
+    Fd()
+        : fd(0), len(0), ofs(0), closed(false), rx(true), token(0), events(0),
+          pipefd{-1, -1}, bytes(0)
+    {
+    }
+};
+
+/* A forwarding session between two file descriptors. Data read from
+ * fds[i] is stored in the output buffer (or pipe) of fds[i^1]. */
+struct FwdSession {
+    struct Fd fds[2];
+    bool splice;
+
+    FwdSession(FwdToken token, int cfd, int rfd) : splice(false)
     {
+        fds[0] = Fd(rfd, token);
+        fds[1] = Fd(cfd, token);
     }
-    Fd() : fd(0), len(0), ofs(0), closed(false), token(0) {}
 };
 
 class FwdWorker {
     std::thread th;
     std::mutex lock;
-    int repoll_syncfd;
+    int epfd;
     int idx;
 
     /* Holds the active mappings between RINA file descriptors and
-     * socket file descriptors. */
-    struct Fd fds[MAX_SESSIONS * 2];
-    int nfds;
+     * socket file descriptors, indexed by session id. The epoll user
+     * data for an fd is (session_id << 1) | side. */
+    std::unordered_map<uint64_t, std::unique_ptr<FwdSession>> sessions;
+    uint64_t next_session_id;
 
     /* List of tokens corresponding to terminated mappings, together
      * with an eventfd file descriptor to notify termination. */
     std::list<unsigned int> terminated;
     int closed_syncfd;
 
+    /* Statistics, readable from any thread. */
+    std::atomic<unsigned int> num_sessions;
+    std::atomic<uint64_t> fwd_bytes;
+    std::atomic<unsigned int> splice_fallbacks;
+
+    FwdMode mode;
     int verbose;
 
     void eventfd_write(int fd);
     void eventfd_drain(int fd);
-    void terminate(unsigned int i, int ret, int errcode);
+    void update_events(uint64_t sid, FwdSession *s, int i);
+    void terminate(uint64_t sid, FwdSession *s, int ret, int errcode);
+    int fwd_in(FwdSession *s, int i);
+    int fwd_out(FwdSession *s, int i);
+    void splice_fallback(FwdSession *s);
 
 public:
-    FwdWorker(int idx_, int verb);
+    FwdWorker(int idx_, int verb, FwdMode mode_ = FwdMode::Copy);
     ~FwdWorker();
 
-    void submit(FwdToken token, int cfd, int rfd);
+    /* Start forwarding between cfd and rfd. If cfd_rx is false, data is
+     * only forwarded from rfd to cfd, e.g. because cfd is shared with
+     * another session that reads from it. */
+    void submit(FwdToken token, int cfd, int rfd, bool cfd_rx = true);
     void run();
     FwdToken get_next_closed();
     int closed_eventfd() const { return closed_syncfd; }
+    int index() const { return idx; }
+    unsigned int active_sessions() const { return num_sessions; }
+    uint64_t forwarded_bytes() const { return fwd_bytes; }
+    unsigned int splice_fallback_count() const { return splice_fallbacks; }
+    void dump_sessions();
+
+    /* Terminate all the sessions submitted with the given token. */
+    void shutdown(FwdToken token);
+
+    /* Accumulate the bytes written to the rfd and cfd of each session
+     * into the entry of the corresponding token. */
+    void token_bytes(std::map<FwdToken, std::pair<uint64_t, uint64_t>> &out);
+
+    /* Select the worker with the smallest number of active sessions. */
+    template <class T>
+    static FwdWorker *least_loaded(const std::vector<T> &workers);
 };
 
+template <class T>
+FwdWorker *
+FwdWorker::least_loaded(const std::vector<T> &workers)
+{
+    FwdWorker *best = nullptr;
+
+    for (const auto &w : workers) {
+        if (!best || w->active_sessions() < best->active_sessions()) {
+            best = &(*w);
+        }
+    }
+
+    return best;
+}
+
 #endif /* __FDFWD_HH__ */
@@ -41,6 +41,7 @@
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <ctime>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -124,9 +125,10 @@ struct Remote {
     string app_name;
     string dif_name;
 
-    /* Name of the local tun device and associated file descriptor. */
+    /* Name of the local tun device and associated file descriptors,
+     * one for each queue of the (multi-queue) device. */
     string tun_name;
-    int tun_fd;
+    vector<int> tun_fds;
 
     /* IP address of the local and remote tunnel endpoint, and tunnel subnet. */
     IPAddr tun_local_addr;
@@ -145,13 +147,20 @@ struct Remote {
     /* Prevent duplicated data flow for this remote. */
     std::mutex mutex;
 
-    Remote() : tun_fd(-1), rfd(-1)
+    /* Forwarding statistics: bytes sent to and received from the
+     * remote, as of the last statistics dump. */
+    FwdToken stats_token;
+    uint64_t stats_tx_bytes;
+    uint64_t stats_rx_bytes;
+
+    Remote() : rfd(-1), stats_token(0), stats_tx_bytes(0), stats_rx_bytes(0)
     {
         flow_alloc_needed[IPOR_CTRL] = flow_alloc_needed[IPOR_DATA] = true;
     }
 
     Remote(const string &a, const string &d, const IPAddr &i)
-        : app_name(a), dif_name(d), tun_fd(-1), tun_subnet(i), rfd(-1)
+        : app_name(a), dif_name(d), tun_subnet(i), rfd(-1), stats_token(0),
+          stats_tx_bytes(0), stats_rx_bytes(0)
     {
         flow_alloc_needed[IPOR_CTRL] = flow_alloc_needed[IPOR_DATA] = true;
     }
@@ -167,8 +176,6 @@ struct Remote {
     int mss_configure() const;
 };
 
-#define NUM_WORKERS 1
-
 class IPoRINA {
     /* Control device to listen for incoming connections. */
     int rfd = -1;
@@ -179,7 +186,8 @@ class IPoRINA {
     list<Route> local_routes;
 
     /* Map to keep track of active sessions. Used to react on
-     * session termination. */
+     * session termination. All the sessions of a remote (one for
+     * each TUN queue) share the same token. */
     map<FwdToken, string> active_sessions;
     FwdToken next_submit_token = 1;
 
@@ -196,6 +204,13 @@ public:
     /* Enable verbose mode */
     int verbose = 0;
 
+    /* Number of forwarding workers and of TUN queues per remote. */
+    int num_workers = 1;
+    int num_queues  = 1;
+
+    /* Period for statistics dump (0 to disable). */
+    unsigned int stats_period = 0;
+
     /* QoS parameters */
     int max_delay = 0;
     int max_loss  = RINA_FLOW_SPEC_LOSS_MAX;
@@ -207,6 +222,7 @@ public:
     void dump_conf();
     void connect_to_remotes();
     int submit(Remote *r);
+    void dump_stats(unsigned int period_secs);
 };
 
 /*
@@ -389,7 +405,7 @@ IPoRINA::IPoRINA() : rfd(-1), verbose(0) {}
 void
 IPoRINA::start_workers()
 {
-    for (int i = 0; i < NUM_WORKERS; i++) {
+    for (int i = 0; i < num_workers; i++) {
         workers.push_back(
             std::unique_ptr<FwdWorker>(new FwdWorker(i, verbose)));
     }
@@ -583,15 +599,28 @@ Remote::tun_alloc()
         return 0;
     }
 
+    /* Create a multi-queue device, and attach a queue for each
+     * forwarding session we are going to use for this remote. The
+     * kernel spreads the transmitted packets over the queues
+     * according to their flow hash. */
     tname[0] = '\0';
-    tun_fd   = os_tun_alloc(tname, IFF_TUN | IFF_NO_PI);
-    if (tun_fd < 0) {
-        cerr << "Failed to create tunnel" << endl;
-        return -1;
+    for (int q = 0; q < g->num_queues; q++) {
+        int fd = os_tun_alloc(tname, IFF_TUN | IFF_NO_PI | IFF_MULTI_QUEUE);
+
+        if (fd < 0) {
+            cerr << "Failed to create tunnel" << endl;
+            for (int qfd : tun_fds) {
+                close(qfd);
+            }
+            tun_fds.clear();
+            return -1;
+        }
+        tun_fds.push_back(fd);
     }
     tun_name = tname;
     if (g->verbose) {
-        cout << "Created tunnel device " << tun_name << endl;
+        cout << "Created tunnel device " << tun_name << " with "
+             << tun_fds.size() << " queues" << endl;
     }
 
     return 0;
@@ -937,60 +966,156 @@ IPoRINA::setup(void)
 int
 IPoRINA::submit(Remote *r)
 {
-    int dupfd;
+    FwdToken token = next_submit_token++;
+
+    /* Create a forwarding session for each TUN queue, each one using
+     * its own duplicate of the data flow file descriptor, and hand it
+     * over to the least loaded worker. Only the session of the first
+     * queue reads from the data flow, so that packets coming from the
+     * remote are not reordered and the workers do not contend on the
+     * flow. Any queue can be used to inject them into the kernel. */
+    for (size_t q = 0; q < r->tun_fds.size(); q++) {
+        int tunfd;
+        int flowfd;
+
+        /* Duplicate the queue fd, since FwdWorker::submit() consumes
+         * it and we want the TUN device to survive. */
+        tunfd = dup(r->tun_fds[q]);
+        if (tunfd < 0) {
+            perror("dup(tun_fd)");
+            break;
+        }
+        flowfd = q + 1 < r->tun_fds.size() ? dup(r->rfd) : r->rfd;
+        if (flowfd < 0) {
+            perror("dup(rfd)");
+            close(tunfd);
+            break;
+        }
+        FwdWorker::least_loaded(workers)->submit(token, flowfd, tunfd,
+                                                 /*cfd_rx=*/q == 0);
+        if (flowfd == r->rfd) {
+            r->rfd = -1; /* ownership passing, we won't need this anymore */
+        }
+    }
 
-    dupfd = dup(r->tun_fd);
-    if (dupfd < 0) {
-        perror("dup(tun_fd)");
-        return dupfd;
+    if (r->rfd >= 0) {
+        /* Something went wrong above. */
+        close(r->rfd);
+        r->rfd = -1;
+        for (const auto &w : workers) {
+            w->shutdown(token);
+        }
+        return -1;
     }
-    /* Duplicate the tun_fd, since FwdWorker::submit() consumes it and
-     * we want the TUN device to survive. */
-    workers[0]->submit(next_submit_token, r->rfd, dupfd);
-    r->rfd = -1; /* ownership passing, we won't need this anymore */
-    active_sessions[next_submit_token++] = r->app_name;
+    active_sessions[token] = r->app_name;
 
     return 0;
 }
 
+void
+IPoRINA::dump_stats(unsigned int period_secs)
+{
+    std::map<FwdToken, std::pair<uint64_t, uint64_t>> counters;
+
+    for (const auto &w : workers) {
+        w->token_bytes(counters);
+        cout << "w" << w->index() << ": " << w->active_sessions()
+             << " sessions" << endl;
+    }
+
+    for (const auto &kv : active_sessions) {
+        Remote *r = remotes.count(kv.second) ? remotes[kv.second].get()
+                                             : nullptr;
+        uint64_t tx, rx;
+
+        if (!r) {
+            continue;
+        }
+        /* Sessions are submitted with the TUN queue as 'rfd' and the
+         * data flow as 'cfd'. */
+        rx = counters[kv.first].first;
+        tx = counters[kv.first].second;
+        if (r->stats_token != kv.first) {
+            /* New data flow since last time. */
+            r->stats_token    = kv.first;
+            r->stats_tx_bytes = r->stats_rx_bytes = 0;
+        }
+        printf("Remote %s [%s]: tx %.3f Mbps, rx %.3f Mbps\n",
+               r->app_name.c_str(), r->tun_name.c_str(),
+               (tx - r->stats_tx_bytes) * 8.0 / (1000000.0 * period_secs),
+               (rx - r->stats_rx_bytes) * 8.0 / (1000000.0 * period_secs));
+        r->stats_tx_bytes = tx;
+        r->stats_rx_bytes = rx;
+    }
+    fflush(stdout);
+}
+
 int
 IPoRINA::main_loop()
 {
     /* Wait for incoming control/data connections from remote peers, and
      * also for terminating sessions. */
+    time_t last_stats = time(nullptr);
+
     for (;;) {
-        FwdWorker *const worker = workers[0].get();
-        struct pollfd pfd[2];
+        vector<struct pollfd> pfd(1 + workers.size());
+        bool closed = false;
         int cfd;
         int ret;
 
         pfd[0].fd     = rfd;
-        pfd[1].fd     = worker->closed_eventfd();
-        pfd[0].events = pfd[1].events = POLLIN;
-        ret = poll(pfd, sizeof(pfd) / sizeof(pfd[0]), -1);
+        pfd[0].events = POLLIN;
+        for (size_t i = 0; i < workers.size(); i++) {
+            pfd[1 + i].fd     = workers[i]->closed_eventfd();
+            pfd[1 + i].events = POLLIN;
+        }
+        ret = poll(pfd.data(), pfd.size(),
+                   stats_period ? 1000 * (int)stats_period : -1);
         if (ret < 0) {
             perror("poll(lfd)");
             return -1;
-        } else if (ret == 0) {
+        }
+
+        if (stats_period && time(nullptr) - last_stats >= stats_period) {
+            dump_stats(time(nullptr) - last_stats);
+            last_stats = time(nullptr);
+        }
+
+        if (ret == 0) {
             /* Timeout or spuriorus notification. */
             continue;
         }
 
-        if (pfd[1].revents & POLLIN) {
-            /* Some sessions terminated. */
+        for (size_t i = 0; i < workers.size(); i++) {
+            FwdWorker *const worker = workers[i].get();
             FwdToken token;
             bool notify = false;
 
+            if (!(pfd[1 + i].revents & POLLIN)) {
+                continue;
+            }
+
+            /* Some sessions terminated. */
+            closed = true;
             while ((token = worker->get_next_closed()) != 0) {
                 if (!active_sessions.count(token) ||
                     !remotes.count(active_sessions[token])) {
-                    cerr << "Failed to match completed session (token=" << token
-                         << ")" << endl;
+                    /* This may be one of the other sessions of a
+                     * remote that we already shut down. */
+                    if (verbose > 1) {
+                        cerr << "Failed to match completed session (token="
+                             << token << ")" << endl;
+                    }
                 } else {
                     Remote *r = remotes[active_sessions[token]].get();
                     cout << "Remote " << active_sessions[token]
                          << " disconnected" << endl;
                     active_sessions.erase(token);
+                    /* Also terminate the sessions bound to the other
+                     * TUN queues of this remote. */
+                    for (const auto &w : workers) {
+                        w->shutdown(token);
+                    }
                     r->ip_cleanup();
 
                     std::lock_guard<std::mutex> lock(r->mutex);
@@ -1005,11 +1130,13 @@ IPoRINA::main_loop()
                 std::unique_lock<std::mutex> lk(connect_lock);
                 connect_work.notify_one();
             }
+        }
+
+        if (closed || !(pfd[0].revents & POLLIN)) {
             continue;
         }
 
         /* New incoming connection. */
-        assert(pfd[0].revents & POLLIN);
         cfd = rina_flow_accept(rfd, nullptr, nullptr, 0);
         if (cfd < 0) {
             if (errno == ENOSPC) {
@@ -1341,7 +1468,13 @@ usage(void)
          << "   -E NUM : maximum delay introduced by the flow (microseconds)"
          << endl
          << "   -w : run in background" << endl
-         << "   -v : be verbose" << endl;
+         << "   -v : be verbose" << endl
+         << "   -W NUM : number of forwarding workers (default = number of "
+            "CPUs)"
+         << endl
+         << "   -Q NUM : number of TUN queues per remote (default 1)" << endl
+         << "   -s SECONDS : print per-remote statistics periodically"
+         << endl;
 }
 
 int
@@ -1351,7 +1484,9 @@ main(int argc, char **argv)
     bool background      = false;
     int opt;
 
-    while ((opt = getopt(argc, argv, "hc:vL:E:w")) != -1) {
+    g->num_workers = std::max(1U, std::thread::hardware_concurrency());
+
+    while ((opt = getopt(argc, argv, "hc:vL:E:wW:Q:s:")) != -1) {
         switch (opt) {
         case 'h':
             usage();
@@ -1385,6 +1520,26 @@ main(int argc, char **argv)
             background = true;
             break;
 
+        case 'W':
+            g->num_workers = atoi(optarg);
+            if (g->num_workers <= 0 || g->num_workers > 256) {
+                cout << "    Invalid number of workers " << optarg << endl;
+                return -1;
+            }
+            break;
+
+        case 'Q':
+            g->num_queues = atoi(optarg);
+            if (g->num_queues <= 0 || g->num_queues > 256) {
+                cout << "    Invalid number of queues " << optarg << endl;
+                return -1;
+            }
+            break;
+
+        case 's':
+            g->stats_period = atoi(optarg);
+            break;
+
         default:
             printf("    Unrecognized option %c\n", opt);
             usage();
@@ -36,6 +36,8 @@
 #include <cstdlib>
 #include <cerrno>
 #include <cassert>
+#include <ctime>
+#include <thread>
 #include <unistd.h>
 
 #include <sys/types.h>
@@ -135,7 +137,6 @@ RinaName::operator=(const RinaName &other)
     return *this;
 }
 
-#define NUM_WORKERS 1
 
 struct Gateway {
     string appl_name;
@@ -162,17 +163,25 @@ struct Gateway {
 
     vector<FwdWorker *> workers;
 
-    Gateway();
+    /* Used to compute per-worker throughput. */
+    vector<uint64_t> last_fwd_bytes;
+
+    Gateway(int num_workers, FwdMode mode);
     ~Gateway();
+
+    /* Hand over a new session to the least loaded worker. */
+    void submit(int cfd, int rfd);
+    void dump_stats(unsigned int period_secs);
 };
 
-Gateway::Gateway()
+Gateway::Gateway(int num_workers, FwdMode mode)
 {
     appl_name = "rina-gw/1";
 
     /* Start workers. */
-    for (int i = 0; i < NUM_WORKERS; i++) {
-        workers.push_back(new FwdWorker(i, verbose));
+    for (int i = 0; i < num_workers; i++) {
+        workers.push_back(new FwdWorker(i, verbose, mode));
+        last_fwd_bytes.push_back(0);
     }
 }
 
@@ -193,6 +202,37 @@ Gateway::~Gateway()
     }
 }
 
+void
+Gateway::submit(int cfd, int rfd)
+{
+    FwdWorker::least_loaded(workers)->submit(0, cfd, rfd);
+}
+
+void
+Gateway::dump_stats(unsigned int period_secs)
+{
+    unsigned int tot_sessions = 0;
+    double tot_mbps           = 0.0;
+
+    for (unsigned int i = 0; i < workers.size(); i++) {
+        uint64_t bytes = workers[i]->forwarded_bytes();
+        double mbps =
+            (bytes - last_fwd_bytes[i]) * 8.0 / (1000000.0 * period_secs);
+
+        last_fwd_bytes[i] = bytes;
+        tot_sessions += workers[i]->active_sessions();
+        tot_mbps += mbps;
+        printf("w%d: %u sessions %.3f Mbps (%u splice fallbacks)\n",
+               workers[i]->index(), workers[i]->active_sessions(), mbps,
+               workers[i]->splice_fallback_count());
+        if (verbose >= 1) {
+            workers[i]->dump_sessions();
+        }
+    }
+    printf("total: %u sessions %.3f Mbps\n", tot_sessions, tot_mbps);
+    fflush(stdout);
+}
+
 Gateway *gw = NULL; /* global data structure */
 
 static void
@@ -315,7 +355,7 @@ accept_rina_flow(int fd, const InetName &inet)
     }
 
     if (ret == 0) {
-        gw->workers[0]->submit(0, cfd, rfd);
+        gw->submit(cfd, rfd);
         return 0;
     }
 
@@ -390,7 +430,7 @@ complete_flow_alloc(int wfd, int cfd)
     }
 
     set_nonblocking(rfd);
-    gw->workers[0]->submit(0, cfd, rfd);
+    gw->submit(cfd, rfd);
 
     return 0;
 }
@@ -525,15 +565,23 @@ usage(void)
          << "    -v <increase verbosity>" << endl
          << "    -c PATH_TO_CONFIG_FILE (default = '/etc/rina/rina-gw.conf')"
          << endl
-         << "    -w <run in background>" << endl;
+         << "    -w <run in background>" << endl
+         << "    -W NUM_WORKERS (default = number of CPUs)" << endl
+         << "    -s SECONDS <print per-worker statistics periodically>"
+         << endl
+         << "    -m FORWARDING_MODE (copy or splice, default = copy)" << endl;
 }
 
 int
 main(int argc, char **argv)
 {
-    const char *confname = "/etc/rina/rina-gw.conf";
-    struct pollfd pfd[128];
+    const char *confname      = "/etc/rina/rina-gw.conf";
+    int num_workers           = std::thread::hardware_concurrency();
+    unsigned int stats_period = 0;
+    FwdMode mode              = FwdMode::Copy;
+    vector<struct pollfd> pfd;
     bool background = false;
+    time_t last_stats;
     int ret;
     int opt;
 
@@ -544,7 +592,7 @@ main(int argc, char **argv)
         return -1;
     }
 
-    while ((opt = getopt(argc, argv, "hvc:w")) != -1) {
+    while ((opt = getopt(argc, argv, "hvc:wW:s:m:")) != -1) {
         switch (opt) {
         case 'h':
             usage();
@@ -562,6 +610,29 @@ main(int argc, char **argv)
             background = true;
             break;
 
+        case 'W':
+            num_workers = atoi(optarg);
+            if (num_workers <= 0) {
+                printf("    Invalid number of workers %s\n", optarg);
+                return -1;
+            }
+            break;
+
+        case 's':
+            stats_period = atoi(optarg);
+            break;
+
+        case 'm':
+            if (strcmp(optarg, "copy") == 0) {
+                mode = FwdMode::Copy;
+            } else if (strcmp(optarg, "splice") == 0) {
+                mode = FwdMode::Splice;
+            } else {
+                printf("    Unknown forwarding mode %s\n", optarg);
+                return -1;
+            }
+            break;
+
         default:
             printf("    Unrecognized option %c\n", opt);
             usage();
@@ -577,17 +648,24 @@ main(int argc, char **argv)
     }
 
     /* Build the Gateway object. The constructor also starts the workers. */
-    gw = new Gateway();
+    if (num_workers <= 0) {
+        num_workers = 1;
+    }
+    gw = new Gateway(num_workers, mode);
 
     parse_conf(confname);
     print_conf();
     setup_for_listening();
+    last_stats = time(NULL);
 
     for (;;) {
         vector<int> completed_flow_allocs;
         vector<int> completed_conns;
         int n = 0;
 
+        pfd.resize(gw->r2i_fd_map.size() + gw->i2r_fd_map.size() +
+                   gw->pending_fa_reqs.size() + gw->pending_conns.size());
+
         /* Load listening RINA "sockets". */
         for (map<int, InetName>::iterator mit = gw->r2i_fd_map.begin();
              mit != gw->r2i_fd_map.end(); mit++, n++) {
@@ -616,12 +694,19 @@ main(int argc, char **argv)
             pfd[n].events = POLLOUT;
         }
 
-        ret = poll(pfd, n, -1 /* no timeout */);
-        if (ret <= 0) {
+        ret = poll(pfd.data(), n,
+                   stats_period ? 1000 * (int)stats_period
+                                : -1 /* no timeout */);
+        if (ret < 0) {
             perror("poll()");
             break;
         }
 
+        if (stats_period && time(NULL) - last_stats >= (time_t)stats_period) {
+            gw->dump_stats(time(NULL) - last_stats);
+            last_stats = time(NULL);
+        }
+
         /* Now check which events were ready. */
         n = 0;
 
@@ -658,7 +743,7 @@ main(int argc, char **argv)
              mit != gw->pending_conns.end(); mit++, n++) {
             if (pfd[n].revents & POLLOUT) {
                 /* TCP connection handshake completed. */
-                gw->workers[0]->submit(0, mit->first, mit->second);
+                gw->submit(mit->first, mit->second);
                 completed_conns.push_back(mit->first);
             }
         }
@@ -102,6 +102,13 @@
  *   - When the server-side test function returns, the worker sends a 32 bytes
  *     message on the control flow, to inform the client about the test
  *     results. Finally, both control and data flows are closed.
+ *
+ * The "fsr" (flow setup rate) test does not follow the protocol above, as
+ * it only measures how fast the client can allocate flows towards the
+ * server. The client keeps a window of flow allocation requests in flight
+ * on a single control file descriptor, and closes each flow as soon as it
+ * is allocated. The server just sees flows being deallocated before any
+ * configuration message is received.
  */
 
 #define SDU_SIZE_MAX 65535
@@ -114,6 +121,7 @@
 #define RP_OPCODE_STOP 4 /* must be the last */
 
 #define CLI_FA_TIMEOUT_MSECS 5000
+#define CLI_FSR_WINDOW_DFLT 32
 #define CLI_RESULT_TIMEOUT_MSECS 5000
 #define RP_DATA_WAIT_MSECS 10000
 
@@ -184,6 +192,7 @@ struct rinaperf {
     int cli_flow_allocated; /* client flows allocated ? */
     int background;         /* server runs as a daemon process */
     int cdf;                /* report CDF percentiles */
+    int fsr_window;         /* max pending flow allocations (fsr test) */
 
     /* Synchronization between client threads and main thread. */
     sem_t cli_barrier;
@@ -1112,7 +1121,13 @@ config_msg_read(int cfd, struct rp_config_msg *cfg)
     int ret = read(cfd, cfg, sizeof(*cfg));
 
     if (ret != sizeof(*cfg)) {
-        if (ret < 0) {
+        if (ret == 0) {
+            /* Flow deallocated by the client before sending anything,
+             * as it happens with the flow setup rate test. */
+            if (_rp.verbose) {
+                PRINTF("Flow deallocated remotely\n");
+            }
+        } else if (ret < 0) {
             perror("read(cfg)");
         } else {
             PRINTF("Error reading test configuration: wrong length %d "
@@ -1286,6 +1301,106 @@ out:
     return NULL;
 }
 
+/* Flow setup rate test: allocate @cnt flows towards the server, keeping at
+ * most rp->fsr_window requests in flight on a single control file
+ * descriptor. Each flow is closed as soon as it is allocated. */
+static int
+fsr_client(struct rinaperf *rp, unsigned int cnt)
+{
+    unsigned int window    = rp->fsr_window;
+    unsigned int issued    = 0;
+    unsigned int completed = 0;
+    unsigned int failed    = 0;
+    unsigned int inflight  = 0;
+    struct timespec t_start, t_end;
+    struct pollfd pfd[2];
+    long long ns;
+    int ret = 0;
+    int fd;
+
+    fd = rina_open();
+    if (fd < 0) {
+        perror("rina_open(fsr)");
+        return -1;
+    }
+
+    if (fcntl(fd, F_SETFL, O_NONBLOCK)) {
+        perror("fcntl(F_SETFL)");
+        close(fd);
+        return -1;
+    }
+
+    pfd[0].fd     = fd;
+    pfd[1].fd     = rp->stop_pipe[0];
+    pfd[0].events = pfd[1].events = POLLIN;
+
+    PRINTF("Starting flow setup rate test; flows: %u, window: %u\n", cnt,
+           window);
+    rp->cli_flow_allocated = 1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
+
+    while (completed < cnt && !rp->cli_stop) {
+        int n;
+
+        /* Fill the window with new requests. */
+        for (; inflight < window && issued < cnt; issued++, inflight++) {
+            if (rina_flow_alloc_async(fd, rp->dif_name, rp->cli_appl_name,
+                                      rp->srv_appl_name, &rp->flowspec) < 0) {
+                perror("rina_flow_alloc_async()");
+                ret = -1;
+                goto out;
+            }
+        }
+
+        n = poll(pfd, 2, CLI_FA_TIMEOUT_MSECS);
+        if (n < 0) {
+            perror("poll(fsr)");
+            ret = -1;
+            break;
+        } else if (n == 0) {
+            PRINTF("Timeout: %u flow allocations still pending\n", inflight);
+            ret = -1;
+            break;
+        }
+
+        if (pfd[1].revents & POLLIN) {
+            break; /* stopped */
+        }
+
+        /* Collect all the completions that are ready. */
+        for (;;) {
+            int ffd;
+
+            if (rina_flow_alloc_complete(fd, &ffd) < 0) {
+                if (errno != EAGAIN) {
+                    perror("rina_flow_alloc_complete()");
+                    ret = -1;
+                    goto out;
+                }
+                break;
+            }
+            inflight--;
+            completed++;
+            if (ffd < 0) {
+                failed++;
+            } else {
+                close(ffd);
+            }
+        }
+    }
+out:
+    clock_gettime(CLOCK_MONOTONIC, &t_end);
+    ns = nanodiff(&t_end, &t_start);
+    close(fd);
+
+    PRINTF("%10s %12s %10s %12s\n", "", "Completed", "Failed", "Flows/s");
+    PRINTF("%-10s %12u %10u %12.1f\n", "Client", completed, failed,
+           ns ? (1000000000.0 * (completed - failed)) / ns : 0.0);
+
+    return (ret || failed) ? -1 : 0;
+}
+
 /* Turn this program into a daemon process. */
 static void
 daemonize(void)
@@ -1487,7 +1602,7 @@ usage(void)
         "   -h : show this help\n"
         "   -l : run in server mode (listen) instead of client mode\n"
         "   -t TEST : specify the type of the test to be performed "
-        "(ping, perf, rr)\n"
+        "(ping, perf, rr, fsr)\n"
         "   -D NUM : test duration in seconds (default 10, except for ping)\n"
         "   -d DIF : name of DIF to which register or ask to allocate a flow\n"
         "   -c NUM : number of SDUs to send during the test\n"
@@ -1502,6 +1617,8 @@ usage(void)
         "   -z APNAME : application process name and instance of the rinaperf "
         "server\n"
         "   -p NUM : client runs NUM parallel instances, using NUM threads\n"
+        "   -P NUM : max number of pending flow allocations in fsr test "
+        "(default %u)\n"
         "   -w : server runs in background\n"
         "   -L NUM : maximum loss probability introduced by the flow "
         "(NUM/%u)\n"
@@ -1510,7 +1627,7 @@ usage(void)
         "before each line in ping test\n"
         "   -C : client prints cumulative density function in ping mode\n"
         "   -v : be verbose\n",
-        RINA_FLOW_SPEC_LOSS_MAX);
+        CLI_FSR_WINDOW_DFLT, RINA_FLOW_SPEC_LOSS_MAX);
 }
 
 int
@@ -1551,11 +1668,12 @@ main(int argc, char **argv)
     pthread_mutex_init(&rp->ticket_lock, NULL);
     rp->background = 0;
     rp->cdf        = 0; /* Don't report CDF percentiles. */
+    rp->fsr_window = CLI_FSR_WINDOW_DFLT;
 
     /* Start with a default flow configuration (unreliable flow). */
     rina_flow_spec_unreliable(&rp->flowspec);
 
-    while ((opt = getopt(argc, argv, "hlt:d:c:s:i:B:g:b:a:z:p:D:L:E:TwvC")) !=
+    while ((opt = getopt(argc, argv, "hlt:d:c:s:i:B:g:b:a:z:p:P:D:L:E:TwvC")) !=
            -1) {
         switch (opt) {
         case 'h':
@@ -1634,6 +1752,14 @@ main(int argc, char **argv)
             }
             break;
 
+        case 'P':
+            rp->fsr_window = atoi(optarg);
+            if (rp->fsr_window <= 0) {
+                PRINTF("    Invalid 'window' %d\n", rp->fsr_window);
+                return -1;
+            }
+            break;
+
         case 'D':
             rp->duration = atoi(optarg);
             if (rp->duration < 0) {
@@ -1732,14 +1858,15 @@ main(int argc, char **argv)
             }
         }
 
-        if (wt.desc == NULL) {
+        if (wt.desc) {
+            wt.test_config.opcode = descs[i].opcode;
+        } else if (strcmp(type, "fsr") != 0) {
             PRINTF("    Unknown test type '%s'\n", type);
             usage();
             return -1;
         }
-        wt.test_config.opcode = descs[i].opcode;
-        wt.test_config.cnt    = cnt;
-        wt.test_config.size   = size;
+        wt.test_config.cnt  = cnt;
+        wt.test_config.size = size;
     }
 
     /* Set some signal handler */
@@ -1764,6 +1891,11 @@ main(int argc, char **argv)
         return rp->cfd;
     }
 
+    if (!listen && wt.desc == NULL) {
+        /* Flow setup rate test. */
+        return fsr_client(rp, cnt ? cnt : 1000);
+    }
+
     if (!listen) {
         /* Client mode. */
         struct worker *workers = calloc(rp->parallel, sizeof(*workers));
@@ -835,6 +835,32 @@ ipcps_show(int argc, char **argv, struct cmd_descriptor *cd)
     return 0;
 }
 
+/* Print the non-empty buckets of a latency histogram, if any. */
+static void
+lat_hist_print(const char *name, const struct rl_lat_hist *hist)
+{
+    int header = 0;
+    int i;
+
+    for (i = 0; i < RL_LAT_BUCKETS; i++) {
+        if (!hist->buckets[i]) {
+            continue;
+        }
+        if (!header) {
+            printf("    %s:\n", name);
+            header = 1;
+        }
+        if (i == RL_LAT_BUCKETS - 1) {
+            printf("        >= %10llu us          : %10llu\n", 1ULL << (i - 1),
+                   (long long unsigned)hist->buckets[i]);
+        } else {
+            printf("        %10llu us - %10llu us: %10llu\n",
+                   i ? (1ULL << (i - 1)) : 0ULL, (1ULL << i) - 1,
+                   (long long unsigned)hist->buckets[i]);
+        }
+    }
+}
+
 static int
 ipcp_stats(int argc, char **argv, struct cmd_descriptor *cd)
 {
@@ -886,7 +912,9 @@ ipcp_stats(int argc, char **argv, struct cmd_descriptor *cd)
            "    rmt.csum_drop      = %llu\n"
            "    rmt.ttl_drop       = %llu\n"
            "    rmt.noflow_drop    = %llu\n"
-           "    rmt.other_drop     = %llu\n",
+           "    rmt.other_drop     = %llu\n"
+           "    rmt.pci_compact_pkt= %llu\n"
+           "    rmt.pci_saved_byte = %llu\n",
            attrs->name, (unsigned long long)stats.tx_pkt, sbuf[0],
            (unsigned long long)stats.tx_err, (unsigned long long)stats.rx_pkt,
            sbuf[1], (unsigned long long)stats.rx_err,
@@ -898,7 +926,12 @@ ipcp_stats(int argc, char **argv, struct cmd_descriptor *cd)
            (unsigned long long)stats.rmt.csum_drop,
            (unsigned long long)stats.rmt.ttl_drop,
            (unsigned long long)stats.rmt.noflow_drop,
-           (unsigned long long)stats.rmt.other_drop);
+           (unsigned long long)stats.rmt.other_drop,
+           (unsigned long long)stats.rmt.pci_compact_pkt,
+           (unsigned long long)stats.rmt.pci_saved_byte);
+    lat_hist_print("tx latency (write to lower flow)", &stats.tx_lat);
+    lat_hist_print("PDU scheduler queueing delay", &stats.rmtq_lat);
+    lat_hist_print("rx queueing delay (to read)", &stats.rx_lat);
 
     return 0;
 }
@@ -953,7 +986,7 @@ flows_show(int argc, char **argv, struct cmd_descriptor *cd)
             }
 
             PI_S("  ipcp %u, addr:port %llu:%u<-->%llu:%u, %s"
-                 "rx(pkt:%llu, %s, drop:%llu), "
+                 "rx(pkt:%llu, %s, drop:%llu, wakeups:%llu), "
                  "tx(pkt:%llu, %s)\n",
                  rl_flow->ipcp_id, (long long unsigned int)rl_flow->local_addr,
                  rl_flow->local_port,
@@ -962,6 +995,7 @@ flows_show(int argc, char **argv, struct cmd_descriptor *cd)
                  (long long unsigned)stats.rx_pkt,
                  byteprint(bbuf[0], blen, stats.rx_byte),
                  (long long unsigned)stats.rx_overrun_pkt,
+                 (long long unsigned)stats.rx_wakeups,
                  (long long unsigned)stats.tx_pkt,
                  byteprint(bbuf[1], blen, stats.tx_byte));
         }
@@ -974,6 +1008,7 @@ flows_show(int argc, char **argv, struct cmd_descriptor *cd)
 static int
 flow_dump(int argc, char **argv, struct cmd_descriptor *cd)
 {
+    struct rl_flow_stats stats;
     struct rl_flow_dtp dtp;
     unsigned long port_id;
     int ret;
@@ -1024,6 +1059,11 @@ flow_dump(int argc, char **argv, struct cmd_descriptor *cd)
         (unsigned long)dtp.last_lwe_sent, (unsigned long)dtp.last_seq_num_acked,
         (unsigned long)dtp.next_snd_ctl_seq, (unsigned long)dtp.seqq_len);
 
+    if (rl_conf_flow_get_stats(port_id, &stats) == 0) {
+        lat_hist_print("tx latency (write to DTP release)", &stats.tx_lat);
+        lat_hist_print("rx queueing delay (to read)", &stats.rx_lat);
+    }
+
     return 0;
 }
 
@@ -1268,22 +1308,95 @@ ipcp_route_mod(int argc, char **argv, struct cmd_descriptor *cd)
     return request_response(RLITE_MB(&req), NULL, TO_DFLT_MSECS);
 }
 
-#ifdef RL_MEMTRACK
+/* Kernel stats, printed next to the uipcps ones by memtrack_handler(). */
+static struct rl_memtrack_stats ker_mt_stats[RL_MEMTRACK_MAX_TYPES];
+static int ker_mt_num;
+
+static void
+memtrack_print_entry(const struct rl_memtrack_stats *st)
+{
+    char sbuf[2][32];
+
+    printf("%-10s %8lld %8s %8s", st->name, (long long)st->count,
+           byteprint(sbuf[0], sizeof(sbuf[0]), st->bytes),
+           byteprint(sbuf[1], sizeof(sbuf[1]), st->bytes_hwm));
+}
+
+static int
+memtrack_handler(struct rl_msg_base_resp *b_resp)
+{
+    struct rl_cmsg_memtrack_stats_resp *resp =
+        (struct rl_cmsg_memtrack_stats_resp *)b_resp;
+    struct rl_memtrack_stats ktot, utot;
+    int num = resp->num;
+    int i;
+
+    if (num > RL_MEMTRACK_MAX_TYPES) {
+        num = RL_MEMTRACK_MAX_TYPES;
+    }
+    memset(&ktot, 0, sizeof(ktot));
+    memset(&utot, 0, sizeof(utot));
+    strcpy(ktot.name, "TOTAL");
+    strcpy(utot.name, "TOTAL");
+
+    printf("%-38s   %-38s\n", "Kernel", "uipcps");
+    printf("%-10s %8s %8s %8s   %-10s %8s %8s %8s\n", "Type", "Objects",
+           "Bytes", "Max", "Type", "Objects", "Bytes", "Max");
+    for (i = 0; i < ker_mt_num || i < num; i++) {
+        if (i < ker_mt_num) {
+            memtrack_print_entry(ker_mt_stats + i);
+            ktot.count += ker_mt_stats[i].count;
+            ktot.bytes += ker_mt_stats[i].bytes;
+            ktot.bytes_hwm += ker_mt_stats[i].bytes_hwm;
+        } else {
+            printf("%38s", "");
+        }
+        printf("   ");
+        if (i < num) {
+            memtrack_print_entry(resp->stats + i);
+            utot.count += resp->stats[i].count;
+            utot.bytes += resp->stats[i].bytes;
+            utot.bytes_hwm += resp->stats[i].bytes_hwm;
+        }
+        printf("\n");
+    }
+    /* The total of the high-water marks is an upper bound for the
+     * high-water mark of the total. */
+    memtrack_print_entry(&ktot);
+    printf("   ");
+    memtrack_print_entry(&utot);
+    printf("\n");
+
+    return 0;
+}
+
 static int
 memtrack_dump(int argc, char **argv, struct cmd_descriptor *cd)
 {
     struct rl_msg_base req;
 
-    /* trigger kernel-space dump */
-    rl_conf_memtrack_dump();
+    ker_mt_num = rl_conf_memtrack_stats(ker_mt_stats, RL_MEMTRACK_MAX_TYPES);
+    if (ker_mt_num < 0) {
+        PE("Failed to get kernel memory stats\n");
+        ker_mt_num = 0;
+    }
 
-    /* trigger user-space dump */
-    req.hdr.msg_type = RLITE_U_MEMTRACK_DUMP;
+    req.hdr.msg_type = RLITE_U_MEMTRACK_STATS_REQ;
+    req.hdr.event_id = 0;
+
+    return request_response(RLITE_MB(&req), memtrack_handler, TO_DFLT_MSECS);
+}
+
+static int
+uipcps_stats_dump(int argc, char **argv, struct cmd_descriptor *cd)
+{
+    struct rl_msg_base req;
+
+    req.hdr.msg_type = RLITE_U_SERVER_STATS_DUMP;
     req.hdr.event_id = 0;
 
     return request_response(RLITE_MB(&req), NULL, TO_DFLT_MSECS);
 }
-#endif
 
 static int
 ipcp_rib_show_handler(struct rl_msg_base_resp *b_resp)
@@ -1734,14 +1847,18 @@ static struct cmd_descriptor cmd_descriptors[] = {
         .func = ipcp_policy_param_mod,
     },
 #endif
-#ifdef RL_MEMTRACK
     {
         .name     = "memtrack",
         .usage    = "",
         .num_args = 0,
         .func     = memtrack_dump,
     },
-#endif
+    {
+        .name     = "uipcps-stats",
+        .usage    = "",
+        .num_args = 0,
+        .func     = uipcps_stats_dump,
+    },
 };
 
 #define NUM_COMMANDS (sizeof(cmd_descriptors) / sizeof(struct cmd_descriptor))
@@ -0,0 +1,302 @@
+/*
+ * Simulation of Kademlia lookups, to measure hop count and latency.
+ *
+ * Copyright (C) 2026 agent
+ * Author: agent <agent@local>
+ *
+ * This file is part of rlite.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+#include <iostream>
+#include <vector>
+#include <queue>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <random>
+#include <cmath>
+#include <unistd.h>
+
+#include "uipcp-normal-kad.hpp"
+
+using rlite::kad::NodeId;
+using rlite::kad::Contact;
+
+/* Timeout (in milliseconds) for requests sent to a node that is down. */
+static constexpr unsigned int kRpcTimeout = 1000;
+
+struct SimNode {
+    rlite::kad::RoutingTable rt;
+    std::set<std::string> store;
+    bool alive = true;
+
+    SimNode(NodeId id, unsigned int k) : rt(id, k) {}
+};
+
+struct Sim {
+    unsigned int k;
+    unsigned int alpha;
+    std::unordered_map<NodeId, SimNode> nodes;
+    std::vector<NodeId> ids;
+
+    Sim(unsigned int k, unsigned int alpha) : k(k), alpha(alpha) {}
+
+    /* Round trip time between two nodes, in milliseconds, from 2 to 100. */
+    static unsigned int rtt(NodeId a, NodeId b)
+    {
+        return 2 + (rlite::kad::key_id(std::to_string(a ^ b)) % 99);
+    }
+
+    struct Result {
+        bool found        = false;
+        unsigned int hops = 0;
+        unsigned int msecs = 0;
+        std::vector<Contact> closest;
+    };
+
+    /* Run an iterative lookup of 'target' from node 'src', looking for
+     * 'key' if not empty. Responses are processed in the order of arrival,
+     * like it would happen with real requests in flight. */
+    Result lookup(NodeId src, NodeId target, const std::string &key);
+};
+
+Sim::Result
+Sim::lookup(NodeId src, NodeId target, const std::string &key)
+{
+    struct Event {
+        unsigned int t;
+        NodeId from;
+        bool operator<(const Event &o) const { return t > o.t; }
+    };
+    SimNode &me = nodes.at(src);
+    std::vector<Contact> seeds = me.rt.closest(target, k);
+    std::priority_queue<Event> events;
+    unsigned int now = 0;
+    Result res;
+
+    seeds.push_back(Contact(src, std::string()));
+    rlite::kad::Lookup lookup(target, seeds, k, alpha);
+
+    for (;;) {
+        for (const Contact &c : lookup.next()) {
+            if (c.id == src) {
+                /* Answer to ourselves. */
+                if (!key.empty() && me.store.count(key)) {
+                    res.found = true;
+                    return res;
+                }
+                lookup.response(src, me.rt.closest(target, k));
+                continue;
+            }
+            SimNode &dst = nodes.at(c.id);
+            events.push({now + (dst.alive ? rtt(src, c.id) : kRpcTimeout),
+                         c.id});
+        }
+
+        if (events.empty()) {
+            break;
+        }
+
+        Event ev = events.top();
+        SimNode &dst = nodes.at(ev.from);
+
+        events.pop();
+        now = ev.t;
+        if (!dst.alive) {
+            me.rt.remove(ev.from);
+            lookup.failure(ev.from);
+            continue;
+        }
+
+        /* The responder learns about us, and we learn about it. */
+        dst.rt.update(Contact(src, std::string()));
+        me.rt.update(Contact(ev.from, std::string()));
+        if (!key.empty() && dst.store.count(key)) {
+            res.found = true;
+            res.hops  = lookup.hops(ev.from);
+            res.msecs = now;
+            return res;
+        }
+        lookup.response(ev.from, dst.rt.closest(target, k));
+    }
+
+    res.msecs   = now;
+    res.closest = lookup.closest(k);
+
+    return res;
+}
+
+int
+main(int argc, char **argv)
+{
+    auto usage = []() {
+        std::cout << "kad-test -n SIZE\n"
+                     "         -k BUCKET_SIZE\n"
+                     "         -a PARALLELISM\n"
+                     "         -r REPLICATION\n"
+                     "         -f PERCENTAGE_OF_FAILED_NODES\n"
+                     "         -v be verbose\n"
+                     "         -h show this help and exit\n";
+    };
+    unsigned int n     = 1000;
+    unsigned int k     = 20;
+    unsigned int alpha = 3;
+    unsigned int r     = 3;
+    unsigned int fail  = 5;
+    int verbosity      = 0;
+    std::mt19937_64 rng(1);
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hvn:k:a:r:f:")) != -1) {
+        switch (opt) {
+        case 'h':
+            usage();
+            return 0;
+
+        case 'v':
+            verbosity++;
+            break;
+
+        case 'n':
+            n = std::atoi(optarg);
+            break;
+
+        case 'k':
+            k = std::atoi(optarg);
+            break;
+
+        case 'a':
+            alpha = std::atoi(optarg);
+            break;
+
+        case 'r':
+            r = std::atoi(optarg);
+            break;
+
+        case 'f':
+            fail = std::atoi(optarg);
+            break;
+
+        default:
+            std::cout << "    Unrecognized option " << static_cast<char>(opt)
+                      << std::endl;
+            usage();
+            return -1;
+        }
+    }
+
+    if (n < 2 || k < 1 || alpha < 1 || r < 1 || fail >= 100) {
+        usage();
+        return -1;
+    }
+
+    Sim sim(k, alpha);
+
+    /* Nodes join one at a time, by looking up themselves through a
+     * random node that already joined. */
+    while (sim.ids.size() < n) {
+        NodeId id = rng() & 0xffffffffULL;
+
+        if (id == 0 || sim.nodes.count(id)) {
+            continue;
+        }
+        sim.nodes.emplace(id, SimNode(id, k));
+        if (!sim.ids.empty()) {
+            NodeId boot = sim.ids[rng() % sim.ids.size()];
+
+            sim.nodes.at(id).rt.update(Contact(boot, std::string()));
+            sim.lookup(id, id, std::string());
+        }
+        sim.ids.push_back(id);
+    }
+
+    /* Store some keys at the 'r' closest nodes. */
+    std::vector<std::string> keys;
+
+    for (unsigned int i = 0; i < n; i++) {
+        std::string key = "appl" + std::to_string(i);
+        NodeId src      = sim.ids[rng() % n];
+        auto res = sim.lookup(src, rlite::kad::key_id(key), std::string());
+
+        for (unsigned int j = 0; j < r && j < res.closest.size(); j++) {
+            sim.nodes.at(res.closest[j].id).store.insert(key);
+        }
+        keys.push_back(key);
+    }
+
+    /* Bring some nodes down, without telling anyone. */
+    for (unsigned int i = 0; i < n * fail / 100; i++) {
+        sim.nodes.at(sim.ids[rng() % n]).alive = false;
+    }
+
+    /* Look up random keys from random (alive) nodes. */
+    unsigned int lookups = 0, found = 0, hops_max = 0, msecs_max = 0;
+    uint64_t hops_tot = 0, msecs_tot = 0;
+
+    while (lookups < n) {
+        NodeId src = sim.ids[rng() % n];
+
+        if (!sim.nodes.at(src).alive) {
+            continue;
+        }
+
+        const std::string &key = keys[rng() % keys.size()];
+        auto res = sim.lookup(src, rlite::kad::key_id(key), key);
+
+        lookups++;
+        if (!res.found) {
+            if (verbosity >= 1) {
+                std::cout << "Lookup of " << key << " from " << src
+                          << " failed" << std::endl;
+            }
+            continue;
+        }
+        found++;
+        hops_tot += res.hops;
+        msecs_tot += res.msecs;
+        hops_max  = std::max(hops_max, res.hops);
+        msecs_max = std::max(msecs_max, res.msecs);
+        if (verbosity >= 2) {
+            std::cout << "Lookup of " << key << " from " << src << ": "
+                      << res.hops << " hops, " << res.msecs << " ms"
+                      << std::endl;
+        }
+    }
+
+    double hops_avg = found ? static_cast<double>(hops_tot) / found : 0;
+
+    std::cout << "Nodes: " << n << ", k: " << k << ", alpha: " << alpha
+              << ", replication: " << r << ", failed nodes: " << fail << "%"
+              << std::endl;
+    std::cout << "Lookups: " << lookups << ", found: " << found
+              << ", avg hops: " << hops_avg << ", max hops: " << hops_max
+              << ", avg latency: " << (found ? msecs_tot / found : 0)
+              << " ms, max latency: " << msecs_max << " ms" << std::endl;
+
+    /* Without failures all the lookups must succeed; with failures we
+     * tolerate the loss of all the replicas of a key. In any case lookups
+     * must take a logarithmic number of hops. */
+    if (found * 100 < lookups * (fail ? 99 : 100)) {
+        std::cout << "Too many lookups failed" << std::endl;
+        return -1;
+    }
+    if (hops_avg > std::ceil(std::log2(n))) {
+        std::cout << "Too many hops" << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
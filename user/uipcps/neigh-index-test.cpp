@@ -0,0 +1,190 @@
+/*
+ * Tests for the address to name index of the neighbors seen.
+ *
+ * Copyright (C) 2026 agent
+ * Author: agent <agent@local>
+ *
+ * This file is part of rlite.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <cstring>
+#include <unistd.h>
+
+#include "uipcp-container.h"
+#include "uipcp-normal.hpp"
+
+struct TestRib : public rlite::UipcpRib {
+    TestRib(struct uipcp *_u) : rlite::UipcpRib(_u, nullptr)
+    {
+        myaddr = 1;
+    }
+
+    static std::string name(unsigned int i)
+    {
+        return "n" + std::to_string(i) + ":1";
+    }
+
+    void add(unsigned int i, rlm_addr_t addr)
+    {
+        gpb::NeighborCandidate cand;
+
+        cand.set_ap_name("n" + std::to_string(i));
+        cand.set_ap_instance("1");
+        cand.set_address(addr);
+        cand.add_lower_difs("ethAB.DIF");
+        neighbor_seen_update(name(i), cand);
+    }
+
+    /* Check that the index agrees with neighbors_seen. */
+    bool consistent() const
+    {
+        if (neighbors_seen_by_addr.size() != neighbors_seen.size()) {
+            return false;
+        }
+        for (const auto &kv : neighbors_seen_by_addr) {
+            auto mit = neighbors_seen.find(kv.second);
+
+            if (mit == neighbors_seen.end() ||
+                mit->second.address() != kv.first) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+};
+
+int
+main(int argc, char **argv)
+{
+    auto usage = []() {
+        std::cout << "neigh-index-test -n NUM_NEIGHBORS\n"
+                     "                 -h show this help and exit\n";
+    };
+    unsigned int n = 50000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hn:")) != -1) {
+        switch (opt) {
+        case 'h':
+            usage();
+            return 0;
+
+        case 'n':
+            n = std::atoi(optarg);
+            break;
+
+        default:
+            std::cout << "    Unrecognized option " << static_cast<char>(opt)
+                      << std::endl;
+            usage();
+            return -1;
+        }
+    }
+
+    if (n < 10) {
+        usage();
+        return -1;
+    }
+
+    char uipcp_name[32];
+    struct uipcp uipcp;
+
+    strncpy(uipcp_name, "neigh-index-test", sizeof(uipcp_name));
+    uipcp.name = uipcp_name;
+    TestRib rib(&uipcp);
+
+    /* Populate with a large number of candidates, using addresses
+     * 2 ... n+1 (1 is our address). */
+    for (unsigned int i = 0; i < n; i++) {
+        rib.add(i, i + 2);
+    }
+    if (!rib.consistent()) {
+        std::cout << "Index inconsistent after insertion" << std::endl;
+        return -1;
+    }
+
+    /* Look up all the addresses. */
+    auto t_start = std::chrono::system_clock::now();
+
+    for (unsigned int i = 0; i < n; i++) {
+        if (rib.lookup_neighbor_by_address(i + 2) != TestRib::name(i)) {
+            std::cout << "Lookup of address " << i + 2 << " failed"
+                      << std::endl;
+            return -1;
+        }
+    }
+
+    auto nsecs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     std::chrono::system_clock::now() - t_start)
+                     .count();
+
+    if (rib.lookup_neighbor_by_address(1) != std::string(uipcp_name) ||
+        rib.lookup_neighbor_by_address(n + 2) != std::string()) {
+        std::cout << "Lookup of our address or of an unknown address failed"
+                  << std::endl;
+        return -1;
+    }
+
+    /* Change the address of the first tenth of the neighbors (e.g.
+     * because the address allocator assigned them a new one). The old
+     * addresses must not resolve anymore. */
+    for (unsigned int i = 0; i < n / 10; i++) {
+        rib.add(i, n + 2 + i);
+    }
+    for (unsigned int i = 0; i < n / 10; i++) {
+        if (rib.lookup_neighbor_by_address(i + 2) != std::string() ||
+            rib.lookup_neighbor_by_address(n + 2 + i) != TestRib::name(i)) {
+            std::cout << "Address change of " << TestRib::name(i)
+                      << " not reflected in the index" << std::endl;
+            return -1;
+        }
+    }
+
+    /* Updates that do not change the address leave the index alone. */
+    rib.add(n - 1, n + 1);
+    if (rib.lookup_neighbor_by_address(n + 1) != TestRib::name(n - 1)) {
+        std::cout << "Lookup after update failed" << std::endl;
+        return -1;
+    }
+
+    /* Two neighbors temporarily conflicting on the same address: the
+     * address resolves as long as one of them is there. */
+    rib.add(n, n / 2);
+    rib.neighbor_seen_remove(TestRib::name(n / 2 - 2));
+    if (rib.lookup_neighbor_by_address(n / 2) != TestRib::name(n)) {
+        std::cout << "Lookup of a conflicting address failed" << std::endl;
+        return -1;
+    }
+
+    /* Remove everybody. */
+    for (unsigned int i = 0; i <= n; i++) {
+        rib.neighbor_seen_remove(TestRib::name(i));
+    }
+    if (!rib.consistent() || !rib.neighbors_seen_by_addr.empty() ||
+        rib.lookup_neighbor_by_address(n + 1) != std::string()) {
+        std::cout << "Index not empty after removal" << std::endl;
+        return -1;
+    }
+
+    std::cout << "Neighbors: " << n << ", avg lookup time: " << nsecs / n
+              << " ns" << std::endl;
+
+    return 0;
+}
@@ -29,6 +29,7 @@
 #include <sys/eventfd.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <sys/ioctl.h>
 
 #include "rlite/conf.h"
 #include "rlite/utils.h"
@@ -362,20 +363,72 @@ struct uipcp_loop_fdh {
     struct list_head tmpnode; /* private for the uipcp_loop */
 };
 
+/* Maximum number of batches read from the control device for each
+ * iteration of the event loop. */
+#define UIPCP_LOOP_BATCHES_MAX 8
+
+static void
+uipcp_loop_dispatch(struct uipcp *uipcp, struct rl_msg_base *msg)
+{
+    uipcp_msg_handler_t handler = NULL;
+
+    assert(msg->hdr.msg_type < RLITE_KER_MSG_MAX);
+
+    switch (msg->hdr.msg_type) {
+    case RLITE_KER_FA_REQ:
+        handler = uipcp->ops.fa_req;
+        break;
+
+    case RLITE_KER_FA_RESP:
+        handler = uipcp->ops.fa_resp;
+        break;
+
+    case RLITE_KER_APPL_REGISTER:
+        handler = uipcp->ops.appl_register;
+        break;
+
+    case RLITE_KER_FLOW_DEALLOCATED:
+        handler = uipcp->ops.flow_deallocated;
+        break;
+
+    case RLITE_KER_FA_REQ_ARRIVED:
+        handler = uipcp->ops.neigh_fa_req_arrived;
+        break;
+
+    case RLITE_KER_FLOW_STATE:
+        handler = uipcp->ops.flow_state_update;
+        break;
+
+    default:
+        UPE(uipcp, "Message type %u not handled\n", msg->hdr.msg_type);
+        break;
+    }
+
+    if (handler) {
+        handler(uipcp, msg);
+    }
+}
+
 static void *
 uipcp_loop(void *opaque)
 {
     struct uipcp *uipcp = opaque;
+    struct rl_msg_batch batch;
+
+    if (rl_msg_batch_init(&batch)) {
+        UPE(uipcp, "Out of memory\n");
+        return NULL;
+    }
 
     for (;;) {
-        int maxfd                   = MAX(uipcp->cfd, uipcp->eventfd);
-        uipcp_msg_handler_t handler = NULL;
+        int maxfd = MAX(uipcp->cfd, uipcp->eventfd);
         struct uipcp_loop_fdh *fdh;
         struct timeval *top = NULL;
         struct rl_msg_base *msg;
         struct timeval to;
         fd_set rdfs;
         int ret;
+        int i;
 
         FD_ZERO(&rdfs);
         FD_SET(uipcp->cfd, &rdfs);
@@ -514,52 +567,24 @@ uipcp_loop(void *opaque)
             continue;
         }
 
-        /* Read the next message posted by the kernel. */
-        msg = rl_read_next_msg(uipcp->cfd, 0);
-        if (!msg) {
-            continue;
-        }
-
-        assert(msg->hdr.msg_type < RLITE_KER_MSG_MAX);
-
-        switch (msg->hdr.msg_type) {
-        case RLITE_KER_FA_REQ:
-            handler = uipcp->ops.fa_req;
-            break;
-
-        case RLITE_KER_FA_RESP:
-            handler = uipcp->ops.fa_resp;
-            break;
-
-        case RLITE_KER_APPL_REGISTER:
-            handler = uipcp->ops.appl_register;
-            break;
-
-        case RLITE_KER_FLOW_DEALLOCATED:
-            handler = uipcp->ops.flow_deallocated;
-            break;
-
-        case RLITE_KER_FA_REQ_ARRIVED:
-            handler = uipcp->ops.neigh_fa_req_arrived;
-            break;
-
-        case RLITE_KER_FLOW_STATE:
-            handler = uipcp->ops.flow_state_update;
-            break;
-
-        default:
-            UPE(uipcp, "Message type %u not handled\n", msg->hdr.msg_type);
-            break;
-        }
-
-        if (handler) {
-            handler(uipcp, msg);
+        /* Drain the messages posted by the kernel, a batch at a time,
+         * without starving the other file descriptors. */
+        for (i = 0; i < UIPCP_LOOP_BATCHES_MAX; i++) {
+            ret = rl_msg_batch_read(uipcp->cfd, &batch);
+            if (ret <= 0) {
+                if (ret < 0 && errno != EAGAIN) {
+                    UPE(uipcp, "read(cfd) failed [%s]\n", strerror(errno));
+                }
+                break;
+            }
+            while ((msg = rl_msg_batch_next(&batch)) != NULL) {
+                uipcp_loop_dispatch(uipcp, msg);
+            }
         }
-
-        rl_msg_free(rl_ker_numtables, RLITE_KER_MSG_MAX, RLITE_MB(msg));
-        rl_free(msg, RL_MT_MSG);
     }
 
+    rl_msg_batch_fini(&batch);
+
     return NULL;
 }
 
@@ -933,6 +958,13 @@ uipcp_add(struct uipcps *uipcps, struct rl_kmsg_ipcp_update *upd)
         goto err3;
     }
 
+    /* The event loop reads kernel messages in batches. */
+    ret = ioctl(uipcp->cfd, RLITE_IOCTL_CHFLAGS, RL_F_BATCH);
+    if (ret) {
+        PE("ioctl(RL_F_BATCH) failed [%s]\n", strerror(errno));
+        goto err3;
+    }
+
     uipcp->eventfd = eventfd(0, 0);
     if (uipcp->eventfd < 0) {
         PE("eventfd() failed [%s]\n", strerror(errno));
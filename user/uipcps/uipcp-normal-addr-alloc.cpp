@@ -29,7 +29,11 @@ public:
     int allocate(const std::string &ipcp_name, rlm_addr_t *addr) override;
     int rib_handler(const CDAPMessage *rm, const MsgSrcInfo &src) override;
     int sync_neigh(const std::shared_ptr<NeighFlow> &nf,
-                   unsigned int limit) const override;
+                   const SyncBatch &batch) const override;
+    bool sync_digest(SyncDigest &d) const override;
+    int sync_neigh_buckets(const std::shared_ptr<NeighFlow> &nf,
+                           const std::vector<bool> &mask,
+                           const SyncBatch &batch) const override;
 
     static std::string ReqObjClass;
 
@@ -56,27 +60,57 @@ DistributedAddrAllocator::dump(std::stringstream &ss) const
     ss << endl;
 }
 
+bool
+DistributedAddrAllocator::sync_digest(SyncDigest &d) const
+{
+    for (const auto &kva : addr_alloc_table) {
+        d.add(std::to_string(kva.first), kva.second.requestor(), kva.second);
+    }
+
+    return true;
+}
+
 int
-DistributedAddrAllocator::sync_neigh(const std::shared_ptr<NeighFlow> &nf,
-                                     unsigned int limit) const
+DistributedAddrAllocator::sync_neigh_buckets(
+    const std::shared_ptr<NeighFlow> &nf, const std::vector<bool> &mask,
+    const SyncBatch &batch) const
 {
-    int ret = 0;
+    gpb::AddrAllocEntries l;
+    SyncBatch b = batch;
+    int ret     = 0;
+
+    for (const auto &kva : addr_alloc_table) {
+        size_t objbytes;
 
-    for (auto ati = addr_alloc_table.begin(); ati != addr_alloc_table.end();) {
-        gpb::AddrAllocEntries l;
+        if (!mask.empty() &&
+            !mask[SyncDigest::bucket(std::to_string(kva.first))]) {
+            continue;
+        }
 
-        while (l.entries_size() < static_cast<int>(limit) &&
-               ati != addr_alloc_table.end()) {
-            *l.add_entries() = ati->second;
-            ati++;
+        objbytes = SyncBatch::obj_size(kva.second);
+        if (b.full(objbytes)) {
+            ret |= nf->sync_obj(true, ObjClass, TableName, &l);
+            l = gpb::AddrAllocEntries();
+            b.reset();
         }
+        *l.add_entries() = kva.second;
+        b.add(objbytes);
+    }
 
+    if (l.entries_size()) {
         ret |= nf->sync_obj(true, ObjClass, TableName, &l);
     }
 
     return ret;
 }
 
+int
+DistributedAddrAllocator::sync_neigh(const std::shared_ptr<NeighFlow> &nf,
+                                     const SyncBatch &batch) const
+{
+    return sync_neigh_buckets(nf, std::vector<bool>(), batch);
+}
+
 int
 DistributedAddrAllocator::allocate(const std::string &ipcp_name,
                                    rlm_addr_t *result)
@@ -497,6 +531,9 @@ CentralizedFaultTolerantAddrAllocator::reconfigure()
 
     /* Create the client anyway. */
     client = utils::make_unique<Client>(this, peers);
+    client->set_read_spread(rib->get_param_value<std::string>(
+                                AddrAllocator::Prefix, "read-mode") ==
+                            "follower");
     UPI(rib->uipcp, "Client initialized\n");
 
     /* I'm one of the replicas. Create a Raft state machine and
@@ -519,6 +556,10 @@ CentralizedFaultTolerantAddrAllocator::reconfigure()
         raft->set_election_timeout(election_timeout, election_timeout * 2);
         raft->set_heartbeat_timeout(heartbeat_timeout);
         raft->set_retransmission_timeout(rtx_timeout);
+        if (raft->set_read_policy(AddrAllocator::Prefix) ||
+            raft->set_replication_policy(AddrAllocator::Prefix)) {
+            return -1;
+        }
 
         return raft->init(peers);
     }
@@ -759,7 +800,13 @@ UipcpRib::addra_lib_init()
          {"raft-heartbeat-timeout",
           PolicyParam(Msecs(int(CeftReplica::kHeartBeatTimeoutMsecs)))},
          {"raft-rtx-timeout",
-          PolicyParam(Msecs(int(CeftReplica::kRtxTimeoutMsecs)))}});
+          PolicyParam(Msecs(int(CeftReplica::kRtxTimeoutMsecs)))},
+         {"raft-batch-size", PolicyParam(CeftReplica::kBatchSize, 1, 1024)},
+         {"raft-window",
+          PolicyParam(int(CeftReplica::kReplicationWindow), 0, 65536)},
+         {"read-mode", PolicyParam(string("any"))},
+         {"read-lease", PolicyParam(true)},
+         {"read-max-staleness", PolicyParam(Secs(1))}});
 }
 
 } // namespace rlite
@@ -26,9 +26,11 @@
 #include <iterator>
 #include <cstdlib>
 #include <chrono>
+#include <iomanip>
 
 #include "uipcp-normal.hpp"
 #include "uipcp-normal-ceft.hpp"
+#include "uipcp-normal-kad.hpp"
 #include "Raft.pb.h"
 
 using namespace std;
@@ -54,8 +56,12 @@ public:
     int appl_register(const struct rl_kmsg_appl_register *req) override;
     int rib_handler(const CDAPMessage *rm, const MsgSrcInfo &src) override;
     int sync_neigh(const std::shared_ptr<NeighFlow> &nf,
-                   unsigned int limit) const override;
-    int neighs_refresh(size_t limit) override;
+                   const SyncBatch &batch) const override;
+    int neighs_refresh(const SyncBatch &batch) override;
+    bool sync_digest(SyncDigest &d) const override;
+    int sync_neigh_buckets(const std::shared_ptr<NeighFlow> &nf,
+                           const std::vector<bool> &mask,
+                           const SyncBatch &batch) const override;
 
     void mod_table(const gpb::DFTEntry &e, bool add, gpb::DFTSlice *added,
                    gpb::DFTSlice *removed);
@@ -285,49 +291,96 @@ FullyReplicatedDFT::dump(stringstream &ss) const
     ss << endl;
 }
 
+bool
+FullyReplicatedDFT::sync_digest(SyncDigest &d) const
+{
+    for (const auto &kve : dft_table) {
+        d.add(kve.first + "\n" + kve.second->ipcp_name(),
+              std::to_string(kve.second->seqnum()), *kve.second);
+    }
+
+    return true;
+}
+
 int
-FullyReplicatedDFT::sync_neigh(const std::shared_ptr<NeighFlow> &nf,
-                               unsigned int limit) const
+FullyReplicatedDFT::sync_neigh_buckets(const std::shared_ptr<NeighFlow> &nf,
+                                       const std::vector<bool> &mask,
+                                       const SyncBatch &batch) const
 {
-    int ret = 0;
+    gpb::DFTSlice dft_slice;
+    SyncBatch b = batch;
+    int ret     = 0;
 
-    for (auto eit = dft_table.begin(); eit != dft_table.end();) {
-        gpb::DFTSlice dft_slice;
+    for (const auto &kve : dft_table) {
+        size_t objbytes;
+
+        if (!mask.empty() &&
+            !mask[SyncDigest::bucket(kve.first + "\n" +
+                                     kve.second->ipcp_name())]) {
+            continue;
+        }
 
-        while (dft_slice.entries_size() < static_cast<int>(limit) &&
-               eit != dft_table.end()) {
-            *dft_slice.add_entries() = *eit->second;
-            eit++;
+        objbytes = SyncBatch::obj_size(*kve.second);
+        if (b.full(objbytes)) {
+            ret |= nf->sync_obj(true, ObjClass, TableName, &dft_slice);
+            dft_slice = gpb::DFTSlice();
+            b.reset();
         }
+        *dft_slice.add_entries() = *kve.second;
+        b.add(objbytes);
+    }
 
+    if (dft_slice.entries_size()) {
         ret |= nf->sync_obj(true, ObjClass, TableName, &dft_slice);
     }
 
     return ret;
 }
 
+int
+FullyReplicatedDFT::sync_neigh(const std::shared_ptr<NeighFlow> &nf,
+                               const SyncBatch &batch) const
+{
+    return sync_neigh_buckets(nf, std::vector<bool>(), batch);
+}
+
 /* Propagate local entries (i.e. the ones corresponding to locally
- * registered applications) to all our neighbors. */
+ * registered applications) to all our neighbors. This is not needed
+ * with digest-based synchronization, since changes to local entries are
+ * propagated as they happen, and the digests take care of repairing
+ * neighbors that missed some of them. */
 int
-FullyReplicatedDFT::neighs_refresh(size_t limit)
+FullyReplicatedDFT::neighs_refresh(const SyncBatch &batch)
 {
-    int ret = 0;
+    gpb::DFTSlice dft_slice;
+    SyncBatch b = batch;
+    int ret     = 0;
 
-    for (auto eit = dft_table.begin(); eit != dft_table.end();) {
-        gpb::DFTSlice dft_slice;
+    if (rib->get_param_value<bool>(UipcpRib::RibDaemonPrefix,
+                                   "digest-sync")) {
+        return 0;
+    }
 
-        while (dft_slice.entries_size() < static_cast<int>(limit) &&
-               eit != dft_table.end()) {
-            if (eit->second->ipcp_name() == rib->myname) { /* local */
-                *dft_slice.add_entries() = *eit->second;
-            }
-            eit++;
+    for (const auto &kve : dft_table) {
+        size_t objbytes;
+
+        if (kve.second->ipcp_name() != rib->myname) { /* not local */
+            continue;
         }
 
-        if (dft_slice.entries_size()) {
+        objbytes = SyncBatch::obj_size(*kve.second);
+        if (b.full(objbytes)) {
             ret |=
                 rib->neighs_sync_obj_all(true, ObjClass, TableName, &dft_slice);
+            dft_slice = gpb::DFTSlice();
+            b.reset();
         }
+        *dft_slice.add_entries() = *kve.second;
+        b.add(objbytes);
+    }
+
+    if (dft_slice.entries_size()) {
+        ret |= rib->neighs_sync_obj_all(true, ObjClass, TableName, &dft_slice);
     }
 
     return ret;
@@ -359,6 +412,17 @@ class CentralizedFaultTolerantDFT : public DFT {
 
         uint64_t seqnum_next = 1;
 
+        /* Clients that looked up a name (and may have cached the result),
+         * to be notified when the mapping for that name changes. */
+        std::unordered_map<
+            std::string,
+            std::unordered_map<rlm_addr_t, std::chrono::system_clock::time_point>>
+            readers;
+        size_t readers_cnt = 0;
+
+        void readers_add(const std::string &appl_name, rlm_addr_t addr);
+        void readers_notify(const std::string &appl_name);
+
     public:
         Replica(CentralizedFaultTolerantDFT *dft)
             : CeftReplica(dft->rib, std::string("ceft-dft-") + dft->rib->myname,
@@ -385,9 +449,38 @@ class CentralizedFaultTolerantDFT : public DFT {
     class Client : public CeftClient {
         uint64_t seqnum_next = 1;
 
+        /* Cache of the lookup results. An empty node name means that the
+         * name was not found (negative entry). */
+        struct CacheEntry {
+            std::string node;
+            std::chrono::system_clock::time_point expiry;
+        };
+        std::unordered_map<std::string, CacheEntry> cache;
+
+        /* Lookups waiting for a response from the replicas, so that
+         * concurrent lookups for the same name are coalesced. */
+        struct InflightLookup {
+            uint64_t seq;
+            std::chrono::system_clock::time_point t_start;
+        };
+        std::unordered_map<std::string, InflightLookup> inflight;
+        uint64_t lookup_seq_next = 1;
+
+        struct {
+            uint64_t hits;
+            uint64_t neg_hits;
+            uint64_t misses;
+            uint64_t coalesced;
+            uint64_t invalidations;
+            uint64_t timeouts;
+            uint64_t latency_usecs;
+            uint64_t latency_max_usecs;
+        } stats;
+
         struct PendingReq : public CeftClient::PendingReq {
             std::string appl_name;
             uint32_t kevent_id;
+            uint64_t lookup_seq = 0;
             PendingReq() = default;
             PendingReq(gpb::OpCode op_code, Msecs timeout,
                        const std::string &appl_name, uint32_t kevent_id)
@@ -407,13 +500,24 @@ class CentralizedFaultTolerantDFT : public DFT {
                std::list<raft::ReplicaId> names)
             : CeftClient(dft->rib, std::move(names))
         {
+            memset(&stats, 0, sizeof(stats));
         }
         int client_process_rib_msg(const CDAPMessage *rm,
                                    CeftClient::PendingReq *const bpr,
                                    rlm_addr_t src_addr) override;
+        void client_process_timeout(CeftClient::PendingReq *const bpr) override;
         int lookup_req(const std::string &appl_name, std::string *dst_node,
                        const std::string &preferred, uint32_t cookie);
         int appl_register(const struct rl_kmsg_appl_register *req);
+        int cache_inval_handler(const CDAPMessage *rm);
+        void dump(std::stringstream &ss) const;
+
+    private:
+        bool cache_lookup(const std::string &appl_name, std::string *node);
+        void cache_update(const std::string &appl_name,
+                          const std::string &node);
+        void lookup_complete(const std::string &appl_name,
+                             const std::string &node, bool cacheable);
     };
     std::unique_ptr<Client> client;
 
@@ -431,13 +535,20 @@ public:
             ss << "Directory Forwarding Table: not available locally" << endl
                << endl;
         }
+        if (client) {
+            client->dump(ss);
+        }
     }
 
     int lookup_req(const std::string &appl_name, std::string *dst_node,
                    const std::string &preferred, uint32_t cookie) override
     {
         if (raft) {
-            return raft->lookup_req(appl_name, dst_node, preferred, cookie);
+            if (raft->local_read_ok()) {
+                return raft->lookup_req(appl_name, dst_node, preferred, cookie);
+            }
+            /* Our local state cannot be trusted, ask the leader. */
+            client->set_leader_id(raft->leader_name());
         }
         return client->lookup_req(appl_name, dst_node, preferred, cookie);
     }
@@ -456,6 +567,11 @@ public:
 
     int rib_handler(const CDAPMessage *rm, const MsgSrcInfo &src) override
     {
+        if (rm->obj_name == CacheObjName) {
+            /* Cache invalidation pushed by a replica. */
+            return client ? client->cache_inval_handler(rm) : 0;
+        }
+
         if (!raft || (rm->obj_class == ObjClass && rm->is_response())) {
             /* We may be a replica (raft != nullptr), but if this is a response
              * to a request done by us with the role of simple clients we
@@ -465,8 +581,19 @@ public:
 
         return raft->rib_handler(rm, src);
     }
+
+    static std::string CacheObjClass;
+    static std::string CacheObjName;
+
+    static constexpr int kCacheTtlSecs       = 30;
+    static constexpr int kCacheNegTtlMsecs   = 1000;
+    static constexpr int kCacheSize          = 1024;
+    static constexpr size_t kCacheReadersMax = 16384;
 };
 
+std::string CentralizedFaultTolerantDFT::CacheObjClass = "dft_cache";
+std::string CentralizedFaultTolerantDFT::CacheObjName  = DFT::Prefix + "/cache";
+
 int
 CentralizedFaultTolerantDFT::reconfigure()
 {
@@ -487,6 +614,9 @@ CentralizedFaultTolerantDFT::reconfigure()
 
     /* Create the client anyway. */
     client = utils::make_unique<Client>(this, peers);
+    client->set_read_spread(
+        rib->get_param_value<std::string>(DFT::Prefix, "read-mode") ==
+        "follower");
     UPI(rib->uipcp, "Client initialized\n");
 
     /* I'm one of the replicas. Create a Raft state machine and
@@ -505,6 +635,10 @@ CentralizedFaultTolerantDFT::reconfigure()
         raft->set_election_timeout(election_timeout, election_timeout * 2);
         raft->set_heartbeat_timeout(heartbeat_timeout);
         raft->set_retransmission_timeout(rtx_timeout);
+        if (raft->set_read_policy(DFT::Prefix) ||
+            raft->set_replication_policy(DFT::Prefix)) {
+            return -1;
+        }
 
         return raft->init(peers);
     }
@@ -518,6 +652,26 @@ CentralizedFaultTolerantDFT::Client::lookup_req(const std::string &appl_name,
                                                 const std::string &preferred,
                                                 uint32_t cookie)
 {
+    std::string cached;
+
+    if (cache_lookup(appl_name, &cached)) {
+        if (cached.empty()) {
+            stats.neg_hits++;
+            return -1;
+        }
+        stats.hits++;
+        *dst_node = cached;
+        return 0;
+    }
+
+    if (inflight.count(appl_name)) {
+        /* A lookup for this name is already in progress, the caller
+         * will be notified when it completes. */
+        stats.coalesced++;
+        *dst_node = std::string();
+        return 0;
+    }
+
     /* Prepare an M_READ for a read operation. */
     auto m = utils::make_unique<CDAPMessage>();
 
@@ -525,10 +679,16 @@ CentralizedFaultTolerantDFT::Client::lookup_req(const std::string &appl_name,
 
     auto timeout = rib->get_param_value<Msecs>(DFT::Prefix, "cli-timeout");
     auto pr = utils::make_unique<PendingReq>(m->op_code, timeout, appl_name, 0);
+    uint64_t seq   = lookup_seq_next++;
+    pr->lookup_seq = seq;
+    inflight[appl_name] =
+        InflightLookup{seq, std::chrono::system_clock::now()};
     int ret = send_to_replicas(std::move(m), std::move(pr), OpSemantics::Get);
     if (ret) {
+        inflight.erase(appl_name);
         return ret;
     }
+    stats.misses++;
 
     UPI(rib->uipcp, "Read request for '%s' issued\n", appl_name.c_str());
 
@@ -559,6 +719,9 @@ CentralizedFaultTolerantDFT::Client::appl_register(
                                              req->hdr.event_id);
     gpb::DFTEntry dft_entry;
 
+    /* The mapping for this name is going to change. */
+    cache.erase(appl_name);
+
     dft_entry.set_ipcp_name(rib->myname);
     dft_entry.set_allocated_appl_name(apname2gpb(appl_name));
     dft_entry.set_seqnum(seqnum_next++);
@@ -605,6 +768,12 @@ CentralizedFaultTolerantDFT::Client::client_process_rib_msg(
         break;
     case gpb::M_READ_R: {
         std::string remote_node;
+        auto it = inflight.find(pr->appl_name);
+
+        if (it == inflight.end() || it->second.seq != pr->lookup_seq) {
+            /* Another replica answered first. */
+            break;
+        }
 
         if (rm->result) {
             UPD(uipcp, "Lookup of name '%s' failed remotely [%s]\n",
@@ -615,9 +784,7 @@ CentralizedFaultTolerantDFT::Client::client_process_rib_msg(
                 pr->appl_name.c_str(), remote_node.c_str());
         }
 
-        /* Flush any pending flow allocation requests that were
-         * waiting for the result of this lookup. */
-        rib->dft_lookup_resolved(pr->appl_name, remote_node);
+        lookup_complete(pr->appl_name, remote_node, /*cacheable=*/true);
         break;
     }
     default:
@@ -627,6 +794,239 @@ CentralizedFaultTolerantDFT::Client::client_process_rib_msg(
     return 0;
 }
 
+/* A lookup request expired. If no other replica can still answer, give up
+ * and fail the flow allocations waiting for this lookup. */
+void
+CentralizedFaultTolerantDFT::Client::client_process_timeout(
+    CeftClient::PendingReq *const bpr)
+{
+    PendingReq const *pr = dynamic_cast<PendingReq *>(bpr);
+
+    if (pr->op_code != gpb::M_READ) {
+        return;
+    }
+
+    auto it = inflight.find(pr->appl_name);
+    if (it == inflight.end() || it->second.seq != pr->lookup_seq) {
+        return;
+    }
+
+    for (const auto &kv : pending) {
+        auto other = dynamic_cast<PendingReq *>(kv.second.get());
+
+        if (other->op_code == gpb::M_READ &&
+            other->lookup_seq == pr->lookup_seq) {
+            return; /* still waiting for another replica */
+        }
+    }
+
+    stats.timeouts++;
+    /* Don't cache the failure, as the name may exist. */
+    lookup_complete(pr->appl_name, std::string(), /*cacheable=*/false);
+}
+
+/* Flush any pending flow allocation requests that were waiting for the
+ * result of this lookup. */
+void
+CentralizedFaultTolerantDFT::Client::lookup_complete(
+    const std::string &appl_name, const std::string &node, bool cacheable)
+{
+    auto it    = inflight.find(appl_name);
+    auto usecs = std::chrono::duration_cast<std::chrono::microseconds>(
+                     std::chrono::system_clock::now() - it->second.t_start)
+                     .count();
+
+    stats.latency_usecs += usecs;
+    stats.latency_max_usecs =
+        std::max(stats.latency_max_usecs, static_cast<uint64_t>(usecs));
+    inflight.erase(it);
+    if (cacheable) {
+        cache_update(appl_name, node);
+    }
+    rib->dft_lookup_resolved(appl_name, node);
+}
+
+bool
+CentralizedFaultTolerantDFT::Client::cache_lookup(const std::string &appl_name,
+                                                  std::string *node)
+{
+    auto it = cache.find(appl_name);
+
+    if (it == cache.end()) {
+        return false;
+    }
+
+    if (it->second.expiry <= std::chrono::system_clock::now()) {
+        cache.erase(it);
+        return false;
+    }
+
+    *node = it->second.node;
+
+    return true;
+}
+
+void
+CentralizedFaultTolerantDFT::Client::cache_update(const std::string &appl_name,
+                                                  const std::string &node)
+{
+    auto ttl =
+        rib->get_param_value<Msecs>(DFT::Prefix,
+                                    node.empty() ? "cache-neg-ttl"
+                                                 : "cache-ttl");
+    auto size = rib->get_param_value<int>(DFT::Prefix, "cache-size");
+    auto now  = std::chrono::system_clock::now();
+
+    if (ttl == Msecs(0) || size == 0) {
+        return; /* caching disabled */
+    }
+
+    if (!cache.count(appl_name) && cache.size() >= static_cast<size_t>(size)) {
+        /* Make room, dropping the expired entries or, if there are none,
+         * the one that would expire first. */
+        auto victim = cache.end();
+
+        for (auto it = cache.begin(); it != cache.end();) {
+            if (it->second.expiry <= now) {
+                it = cache.erase(it);
+                continue;
+            }
+            if (victim == cache.end() ||
+                it->second.expiry < victim->second.expiry) {
+                victim = it;
+            }
+            ++it;
+        }
+        if (cache.size() >= static_cast<size_t>(size) &&
+            victim != cache.end()) {
+            cache.erase(victim);
+        }
+    }
+
+    cache[appl_name] = CacheEntry{node, now + ttl};
+}
+
+int
+CentralizedFaultTolerantDFT::Client::cache_inval_handler(const CDAPMessage *rm)
+{
+    std::string appl_name;
+
+    if (rm->op_code != gpb::M_DELETE) {
+        UPE(rib->uipcp, "M_DELETE expected\n");
+        return 0;
+    }
+
+    rm->get_obj_value(appl_name);
+    if (cache.erase(appl_name)) {
+        stats.invalidations++;
+        UPD(rib->uipcp, "Cached lookup for '%s' invalidated\n",
+            appl_name.c_str());
+    }
+
+    return 0;
+}
+
+void
+CentralizedFaultTolerantDFT::Client::dump(std::stringstream &ss) const
+{
+    uint64_t lookups =
+        stats.hits + stats.neg_hits + stats.misses + stats.coalesced;
+    uint64_t resolved = stats.misses;
+
+    ss << "Lookup cache (" << cache.size() << " entries):" << endl;
+    ss << "    Lookups: " << lookups << ", hits: " << stats.hits
+       << ", negative hits: " << stats.neg_hits
+       << ", misses: " << stats.misses << ", coalesced: " << stats.coalesced;
+    if (lookups) {
+        ss << ", hit rate: " << std::setprecision(3)
+           << 100.0 * (stats.hits + stats.neg_hits) / lookups << "%";
+    }
+    ss << endl
+       << "    Invalidations: " << stats.invalidations
+       << ", timeouts: " << stats.timeouts << endl;
+    /* Cache hits do not add any latency to flow allocation. */
+    ss << "    Name resolution latency: ";
+    if (resolved && lookups) {
+        ss << "avg " << stats.latency_usecs / lookups << " us"
+           << ", avg on miss " << stats.latency_usecs / resolved << " us"
+           << ", max " << stats.latency_max_usecs << " us";
+    } else {
+        ss << "n/a";
+    }
+    ss << endl << endl;
+}
+
+/* Remember that a client read the mapping for a name, so that it can be
+ * notified if the mapping changes while it is still cached. */
+void
+CentralizedFaultTolerantDFT::Replica::readers_add(const std::string &appl_name,
+                                                  rlm_addr_t addr)
+{
+    auto ttl = std::max(rib->get_param_value<Msecs>(DFT::Prefix, "cache-ttl"),
+                        rib->get_param_value<Msecs>(DFT::Prefix,
+                                                    "cache-neg-ttl"));
+    auto now = std::chrono::system_clock::now();
+
+    if (addr == RL_ADDR_NULL || addr == rib->myaddr || ttl == Msecs(0) ||
+        !rib->get_param_value<bool>(DFT::Prefix, "cache-push-inval")) {
+        return;
+    }
+
+    if (readers_cnt >= kCacheReadersMax) {
+        /* Drop the readers whose cache entries have expired anyway. */
+        for (auto rit = readers.begin(); rit != readers.end();) {
+            for (auto ait = rit->second.begin(); ait != rit->second.end();) {
+                if (ait->second <= now) {
+                    ait = rit->second.erase(ait);
+                    readers_cnt--;
+                } else {
+                    ++ait;
+                }
+            }
+            if (rit->second.empty()) {
+                rit = readers.erase(rit);
+            } else {
+                ++rit;
+            }
+        }
+        if (readers_cnt >= kCacheReadersMax) {
+            return; /* the client will rely on the TTL */
+        }
+    }
+
+    auto &addrs = readers[appl_name];
+    if (!addrs.count(addr)) {
+        readers_cnt++;
+    }
+    addrs[addr] = now + ttl;
+}
+
+void
+CentralizedFaultTolerantDFT::Replica::readers_notify(
+    const std::string &appl_name)
+{
+    auto rit = readers.find(appl_name);
+    auto now = std::chrono::system_clock::now();
+
+    if (rit == readers.end()) {
+        return;
+    }
+
+    for (const auto &kv : rit->second) {
+        if (kv.second <= now) {
+            continue;
+        }
+
+        auto m = utils::make_unique<CDAPMessage>();
+
+        m->m_delete(CacheObjClass, CacheObjName);
+        m->set_obj_value(appl_name);
+        rib->send_to_dst_addr(std::move(m), kv.first);
+    }
+    readers_cnt -= rit->second.size();
+    readers.erase(rit);
+}
+
 /* Apply a command to the replicated state machine. We just pass the command
  * to the same multimap implementation used by the fully replicated DFT. */
 int
@@ -641,6 +1041,7 @@ CentralizedFaultTolerantDFT::Replica::apply(const char *const serbuf,
     e.set_seqnum(seqnum_next++);
     assert(c->opcode == Command::OpcodeSet || c->opcode == Command::OpcodeDel);
     impl->mod_table(e, c->opcode == Command::OpcodeSet, nullptr, nullptr);
+    readers_notify(c->appl_name);
 
     return 0;
 }
@@ -723,6 +1124,7 @@ CentralizedFaultTolerantDFT::Replica::replica_process_rib_msg(
                     /*result_reason=*/ret ? "No match found" : string());
         m->invoke_id = rm->invoke_id;
         m->set_obj_value(remote_node);
+        readers_add(appl_name, src_addr);
         rib->send_to_dst_addr(std::move(m), src_addr);
     } else {
         UPE(uipcp, "M_WRITE(dft), M_READ(dft) or M_DELETE(dft) expected\n");
@@ -732,6 +1134,812 @@ CentralizedFaultTolerantDFT::Replica::replica_process_rib_msg(
     return 0;
 }
 
+/* A Directory Forwarding Table distributed over a Kademlia DHT, where
+ * node addresses are used as DHT identifiers. Each registration is stored
+ * at the nodes whose addresses are closest to the hash of the application
+ * name, which are found by means of iterative parallel lookups. Nodes
+ * periodically republish the registrations of their local applications,
+ * and stored entries expire if they are not republished. */
+class KademliaDFT : public DFT {
+    /* An iterative lookup in progress, together with what to do once the
+     * lookup is complete. */
+    struct Operation {
+        enum class Type {
+            FindValue = 0,
+            Store,
+            Remove,
+        };
+
+        Type type;
+        std::string appl_name;
+        std::unique_ptr<kad::Lookup> lookup;
+        gpb::DFTEntry entry; /* entry to store or remove */
+        std::string preferred;
+        uint32_t cookie = 0;
+        std::chrono::system_clock::time_point t_start;
+    };
+
+    /* A FIND request in flight. */
+    struct Rpc {
+        uint64_t op_id;
+        kad::NodeId dst;
+        std::chrono::system_clock::time_point deadline;
+    };
+
+    struct StoredEntry {
+        gpb::DFTEntry entry;
+        std::chrono::system_clock::time_point expiry;
+    };
+
+    /* Routing table, rebuilt when our address changes. */
+    std::unique_ptr<kad::RoutingTable> rt;
+
+    /* Entries stored here, because we are one of the nodes closest
+     * to their key. */
+    std::multimap<std::string, StoredEntry> store;
+
+    /* Registrations of local applications. */
+    std::map<std::string, gpb::DFTEntry> local_entries;
+
+    std::unordered_map<uint64_t, Operation> ops;
+    uint64_t op_id_next = 1;
+    std::unordered_map<int, Rpc> rpcs;
+    std::unique_ptr<TimeoutEvent> rpc_timer;
+    std::unique_ptr<TimeoutEvent> republish_timer;
+    uint64_t seqnum_next = 1;
+
+    struct {
+        uint64_t lookups;
+        uint64_t lookups_failed;
+        uint64_t hops;
+        uint64_t latency_usecs;
+        uint64_t rpcs_sent;
+        uint64_t rpcs_timedout;
+    } stats;
+
+public:
+    RL_NODEFAULT_NONCOPIABLE(KademliaDFT);
+    KademliaDFT(UipcpRib *_ur) : DFT(_ur)
+    {
+        memset(&stats, 0, sizeof(stats));
+        republish_tmr_restart();
+    }
+    ~KademliaDFT();
+
+    void dump(std::stringstream &ss) const override;
+
+    int lookup_req(const std::string &appl_name, std::string *dst_node,
+                   const std::string &preferred, uint32_t cookie) override;
+    int appl_register(const struct rl_kmsg_appl_register *req) override;
+    int rib_handler(const CDAPMessage *rm, const MsgSrcInfo &src) override;
+    int reconfigure() override;
+
+    static std::string FindObjClass;
+    static std::string StoreObjClass;
+    static std::string ObjName;
+
+    static constexpr int kBucketSize          = 20;
+    static constexpr int kParallelism         = 3;
+    static constexpr int kReplication         = 3;
+    static constexpr int kRpcTimeoutMsecs     = 1000;
+    static constexpr int kRepublishIntvalSecs = 60;
+
+private:
+    kad::RoutingTable &routing_table();
+    void routing_table_seed();
+    kad::Contact myself() const { return kad::Contact(rib->myaddr, rib->myname); }
+    void contact_learn(const gpb::KadContact &c);
+    void contact_fill(gpb::KadContact *c) const;
+    const gpb::DFTEntry *store_find(const std::string &appl_name,
+                                    const std::string &preferred,
+                                    uint32_t cookie) const;
+    void store_mod(const gpb::DFTEntry &e, bool add);
+
+    uint64_t op_start(Operation::Type type, const std::string &appl_name,
+                      const gpb::DFTEntry *entry);
+    void op_advance(uint64_t op_id, std::string *result = nullptr);
+    std::string op_complete(uint64_t op_id, const gpb::DFTEntry *found,
+                            unsigned int hops);
+    int rpc_send(uint64_t op_id, const kad::Contact &c);
+    void rpc_timer_update();
+    void rpc_timeout();
+
+    int find_handler(const CDAPMessage *rm, const MsgSrcInfo &src);
+    int store_handler(const CDAPMessage *rm, const MsgSrcInfo &src);
+
+    void republish_tmr_restart();
+    void republish();
+};
+
+std::string KademliaDFT::FindObjClass  = "kad_find";
+std::string KademliaDFT::StoreObjClass = "kad_store";
+std::string KademliaDFT::ObjName       = DFT::Prefix + "/kad";
+
+KademliaDFT::~KademliaDFT()
+{
+    /* Fail the name lookups still in progress. */
+    for (const auto &kv : ops) {
+        if (kv.second.type == Operation::Type::FindValue) {
+            rib->dft_lookup_resolved(kv.second.appl_name, std::string());
+        }
+    }
+    for (const auto &kv : rpcs) {
+        rib->invoke_id_mgr.put_invoke_id(kv.first);
+    }
+}
+
+int
+KademliaDFT::reconfigure()
+{
+    routing_table_seed();
+    return 0;
+}
+
+/* Our address is our DHT identifier, so the routing table has to be rebuilt
+ * if the address changes (e.g. after enrollment). */
+kad::RoutingTable &
+KademliaDFT::routing_table()
+{
+    if (!rt || rt->self_id() != rib->myaddr) {
+        auto k = rib->get_param_value<int>(DFT::Prefix, "bucket-size");
+        auto nrt = utils::make_unique<kad::RoutingTable>(rib->myaddr, k);
+
+        if (rt) {
+            for (const auto &c : rt->closest(rt->self_id(), rt->size())) {
+                nrt->update(c);
+            }
+        }
+        rt = std::move(nrt);
+    }
+
+    return *rt;
+}
+
+/* Insert the DIF members we know about into the routing table. */
+void
+KademliaDFT::routing_table_seed()
+{
+    kad::RoutingTable &table = routing_table();
+
+    for (const auto &kvn : rib->neighbors_seen) {
+        if (kvn.second.address() != RL_ADDR_NULL) {
+            table.update(kad::Contact(kvn.second.address(), kvn.first));
+        }
+    }
+}
+
+void
+KademliaDFT::contact_learn(const gpb::KadContact &c)
+{
+    if (c.address() != RL_ADDR_NULL) {
+        routing_table().update(kad::Contact(c.address(), c.ipcp_name()));
+    }
+}
+
+void
+KademliaDFT::contact_fill(gpb::KadContact *c) const
+{
+    c->set_address(rib->myaddr);
+    c->set_ipcp_name(rib->myname);
+}
+
+/* Select one of the stored entries for 'appl_name', honoring the preferred
+ * node if any, or balancing by means of the cookie. */
+const gpb::DFTEntry *
+KademliaDFT::store_find(const std::string &appl_name,
+                        const std::string &preferred, uint32_t cookie) const
+{
+    auto range = store.equal_range(appl_name);
+    int d      = distance(range.first, range.second);
+    auto mit   = range.first;
+
+    if (d == 0) {
+        return nullptr;
+    }
+
+    if (!preferred.empty()) {
+        for (; mit != range.second; mit++) {
+            if (mit->second.entry.ipcp_name() == preferred) {
+                return &mit->second.entry;
+            }
+        }
+        return nullptr;
+    }
+
+    std::advance(mit, cookie % d);
+
+    return &mit->second.entry;
+}
+
+void
+KademliaDFT::store_mod(const gpb::DFTEntry &e, bool add)
+{
+    auto expiry = std::chrono::system_clock::now() +
+                  3 * rib->get_param_value<Msecs>(DFT::Prefix,
+                                                  "republish-intval");
+    string key = apname2string(e.appl_name());
+    auto range = store.equal_range(key);
+    auto mit   = range.first;
+
+    for (; mit != range.second; mit++) {
+        if (mit->second.entry.ipcp_name() == e.ipcp_name()) {
+            break;
+        }
+    }
+
+    if (add) {
+        if (mit == range.second) {
+            store.insert(make_pair(key, StoredEntry{e, expiry}));
+            UPD(rib->uipcp, "DFT entry %s --> %s stored\n", key.c_str(),
+                e.ipcp_name().c_str());
+        } else if (e.seqnum() >= mit->second.entry.seqnum()) {
+            mit->second.entry  = e;
+            mit->second.expiry = expiry;
+        }
+    } else if (mit != range.second &&
+               e.seqnum() >= mit->second.entry.seqnum()) {
+        store.erase(mit);
+        UPD(rib->uipcp, "DFT entry %s --> %s removed\n", key.c_str(),
+            e.ipcp_name().c_str());
+    }
+}
+
+int
+KademliaDFT::lookup_req(const std::string &appl_name, std::string *dst_node,
+                        const std::string &preferred, uint32_t cookie)
+{
+    const gpb::DFTEntry *e;
+    std::string found;
+    uint64_t op_id;
+
+    /* Try with the local applications and the entries stored here. */
+    if (local_entries.count(appl_name) &&
+        (preferred.empty() || preferred == rib->myname)) {
+        *dst_node = rib->myname;
+        return 0;
+    }
+
+    e = store_find(appl_name, preferred, cookie);
+    if (e) {
+        *dst_node = e->ipcp_name();
+        return 0;
+    }
+
+    /* Only one lookup for each name at a time. */
+    for (const auto &kv : ops) {
+        if (kv.second.type == Operation::Type::FindValue &&
+            kv.second.appl_name == appl_name) {
+            *dst_node = std::string();
+            return 0;
+        }
+    }
+
+    op_id = op_start(Operation::Type::FindValue, appl_name, /*entry=*/nullptr);
+    ops[op_id].preferred = preferred;
+    ops[op_id].cookie    = cookie;
+    op_advance(op_id, &found);
+
+    if (ops.count(op_id)) {
+        /* The response will come later. */
+        *dst_node = std::string();
+        return 0;
+    }
+
+    /* The lookup completed without sending any request. */
+    if (found.empty()) {
+        return -1;
+    }
+    *dst_node = found;
+
+    return 0;
+}
+
+int
+KademliaDFT::appl_register(const struct rl_kmsg_appl_register *req)
+{
+    struct uipcp *uipcp = rib->uipcp;
+    string appl_name(req->appl_name);
+    gpb::DFTEntry entry;
+
+    if (req->reg) {
+        int ret;
+
+        if (local_entries.count(appl_name)) {
+            UPE(uipcp, "Application %s already registered on this uipcp\n",
+                appl_name.c_str());
+            return uipcp_appl_register_resp(uipcp, RLITE_ERR, req->hdr.event_id,
+                                            req->appl_name);
+        }
+
+        ret = uipcp_appl_register_resp(uipcp, RLITE_SUCC, req->hdr.event_id,
+                                       req->appl_name);
+        if (ret) {
+            return ret;
+        }
+
+        entry.set_ipcp_name(rib->myname);
+        entry.set_allocated_appl_name(apname2gpb(appl_name));
+        entry.set_seqnum(seqnum_next++);
+        local_entries[appl_name] = entry;
+        op_advance(op_start(Operation::Type::Store, appl_name, &entry));
+    } else {
+        auto lit = local_entries.find(appl_name);
+
+        if (lit == local_entries.end()) {
+            UPE(uipcp, "Application %s was not registered here\n",
+                appl_name.c_str());
+            return 0;
+        }
+        entry = lit->second;
+        entry.set_seqnum(seqnum_next++);
+        local_entries.erase(lit);
+        op_advance(op_start(Operation::Type::Remove, appl_name, &entry));
+    }
+
+    UPD(uipcp, "Application %s %sregistered\n", appl_name.c_str(),
+        req->reg ? "" : "un");
+
+    return 0;
+}
+
+uint64_t
+KademliaDFT::op_start(Operation::Type type, const std::string &appl_name,
+                      const gpb::DFTEntry *entry)
+{
+    auto k     = rib->get_param_value<int>(DFT::Prefix, "bucket-size");
+    auto alpha = rib->get_param_value<int>(DFT::Prefix, "parallelism");
+    kad::NodeId target = kad::key_id(appl_name);
+    uint64_t op_id     = op_id_next++;
+    Operation &op      = ops[op_id];
+
+    if (routing_table().size() == 0) {
+        routing_table_seed();
+    }
+
+    std::vector<kad::Contact> seeds = routing_table().closest(target, k);
+
+    /* We are a candidate as well, and we will answer to ourselves. */
+    seeds.push_back(myself());
+    op.type      = type;
+    op.appl_name = appl_name;
+    op.lookup    = utils::make_unique<kad::Lookup>(target, seeds, k, alpha);
+    op.t_start   = std::chrono::system_clock::now();
+    if (entry) {
+        op.entry = *entry;
+    }
+
+    return op_id;
+}
+
+/* Send the next queries for an operation, and complete the operation if
+ * the lookup is over. In that case, the result of a FIND_VALUE operation
+ * is returned in @result (if not NULL). */
+void
+KademliaDFT::op_advance(uint64_t op_id, std::string *result)
+{
+    for (;;) {
+        auto oit = ops.find(op_id);
+
+        if (oit == ops.end()) {
+            return;
+        }
+
+        Operation &op                   = oit->second;
+        std::vector<kad::Contact> queue = op.lookup->next();
+
+        if (queue.empty()) {
+            if (op.lookup->finished()) {
+                std::string res = op_complete(op_id, nullptr, 0);
+
+                if (result) {
+                    *result = std::move(res);
+                }
+            }
+            return;
+        }
+
+        for (const auto &c : queue) {
+            if (c.id != rib->myaddr) {
+                if (rpc_send(op_id, c)) {
+                    op.lookup->failure(c.id);
+                }
+                continue;
+            }
+
+            /* Answer to ourselves. */
+            if (op.type == Operation::Type::FindValue) {
+                const gpb::DFTEntry *e =
+                    store_find(op.appl_name, op.preferred, op.cookie);
+
+                if (e) {
+                    std::string res = op_complete(op_id, e, 0);
+
+                    if (result) {
+                        *result = std::move(res);
+                    }
+                    return;
+                }
+            }
+            auto k = rib->get_param_value<int>(DFT::Prefix, "bucket-size");
+            op.lookup->response(
+                c.id, routing_table().closest(op.lookup->target_id(), k));
+        }
+    }
+}
+
+/* Complete an operation and remove it. Returns the name of the node found
+ * by a FIND_VALUE operation, or an empty string. */
+std::string
+KademliaDFT::op_complete(uint64_t op_id, const gpb::DFTEntry *found,
+                         unsigned int hops)
+{
+    Operation &op = ops.at(op_id);
+    std::string result;
+    auto usecs    = std::chrono::duration_cast<std::chrono::microseconds>(
+                     std::chrono::system_clock::now() - op.t_start)
+                     .count();
+
+    if (op.type == Operation::Type::FindValue) {
+        stats.lookups++;
+        if (found) {
+            result = found->ipcp_name();
+            stats.hops += hops;
+            stats.latency_usecs += usecs;
+            UPD(rib->uipcp, "Lookup of name '%s' resolved to node '%s'\n",
+                op.appl_name.c_str(), result.c_str());
+        } else {
+            stats.lookups_failed++;
+            UPD(rib->uipcp, "Lookup of name '%s' failed\n",
+                op.appl_name.c_str());
+        }
+        std::string appl_name = op.appl_name;
+        ops.erase(op_id);
+        rib->dft_lookup_resolved(appl_name, result);
+        return result;
+    }
+
+    /* Store (or remove) the entry at the closest nodes. */
+    auto r = rib->get_param_value<int>(DFT::Prefix, "replication");
+    bool add = (op.type == Operation::Type::Store);
+    gpb::KadStoreReq sreq;
+
+    *sreq.add_entries() = op.entry;
+    contact_fill(sreq.mutable_sender());
+    for (const auto &c : op.lookup->closest(r)) {
+        if (c.id == rib->myaddr) {
+            store_mod(op.entry, add);
+            continue;
+        }
+
+        auto m = utils::make_unique<CDAPMessage>();
+
+        if (add) {
+            m->m_write(StoreObjClass, ObjName);
+        } else {
+            m->m_delete(StoreObjClass, ObjName);
+        }
+        rib->send_to_dst_addr(std::move(m), c.id, &sreq);
+    }
+    ops.erase(op_id);
+
+    return result;
+}
+
+int
+KademliaDFT::rpc_send(uint64_t op_id, const kad::Contact &c)
+{
+    auto m = utils::make_unique<CDAPMessage>();
+    const Operation &op = ops.at(op_id);
+    gpb::KadFindReq req;
+    int invoke_id;
+    int ret;
+
+    req.set_target(op.lookup->target_id());
+    if (op.type == Operation::Type::FindValue) {
+        req.set_appl_name(op.appl_name);
+    }
+    contact_fill(req.mutable_sender());
+
+    m->m_read(FindObjClass, ObjName);
+    m->invoke_id = invoke_id = rib->invoke_id_mgr.get_invoke_id();
+    rpcs[invoke_id] =
+        Rpc{op_id, c.id,
+            std::chrono::system_clock::now() +
+                rib->get_param_value<Msecs>(DFT::Prefix, "rpc-timeout")};
+    ret = rib->send_to_dst_addr(std::move(m), c.id, &req);
+    if (ret) {
+        rpcs.erase(invoke_id);
+        rib->invoke_id_mgr.put_invoke_id(invoke_id);
+        return ret;
+    }
+    stats.rpcs_sent++;
+    rpc_timer_update();
+
+    return 0;
+}
+
+void
+KademliaDFT::rpc_timer_update()
+{
+    auto t_min = std::chrono::system_clock::time_point::max();
+    auto now   = std::chrono::system_clock::now();
+
+    for (const auto &kv : rpcs) {
+        t_min = std::min(t_min, kv.second.deadline);
+    }
+
+    if (t_min == std::chrono::system_clock::time_point::max()) {
+        rpc_timer = nullptr;
+        return;
+    }
+
+    rpc_timer = utils::make_unique<TimeoutEvent>(
+        std::max(Msecs(1), std::chrono::duration_cast<Msecs>(t_min - now)),
+        rib->uipcp, this, [](struct uipcp *uipcp, void *arg) {
+            auto dft = static_cast<KademliaDFT *>(arg);
+            std::lock_guard<std::mutex> guard(dft->rib->mutex);
+            dft->rpc_timer->fired();
+            dft->rpc_timeout();
+        });
+}
+
+/* Called from timer context, under RIB lock. */
+void
+KademliaDFT::rpc_timeout()
+{
+    auto now = std::chrono::system_clock::now();
+    std::vector<uint64_t> touched;
+
+    for (auto it = rpcs.begin(); it != rpcs.end();) {
+        if (it->second.deadline > now) {
+            ++it;
+            continue;
+        }
+
+        /* Forget about the unresponsive node. */
+        UPD(rib->uipcp, "Kademlia request to node %llu timed out\n",
+            (long long unsigned)it->second.dst);
+        stats.rpcs_timedout++;
+        routing_table().remove(it->second.dst);
+        auto oit = ops.find(it->second.op_id);
+        if (oit != ops.end()) {
+            oit->second.lookup->failure(it->second.dst);
+            touched.push_back(it->second.op_id);
+        }
+        rib->invoke_id_mgr.put_invoke_id(it->first);
+        it = rpcs.erase(it);
+    }
+
+    for (uint64_t op_id : touched) {
+        op_advance(op_id);
+    }
+    rpc_timer_update();
+}
+
+int
+KademliaDFT::rib_handler(const CDAPMessage *rm, const MsgSrcInfo &src)
+{
+    if (rm->obj_class == FindObjClass) {
+        return find_handler(rm, src);
+    } else if (rm->obj_class == StoreObjClass) {
+        return store_handler(rm, src);
+    }
+
+    UPE(rib->uipcp, "Unexpected object class '%s'\n", rm->obj_class.c_str());
+
+    return 0;
+}
+
+int
+KademliaDFT::find_handler(const CDAPMessage *rm, const MsgSrcInfo &src)
+{
+    struct uipcp *uipcp = rib->uipcp;
+    auto k = rib->get_param_value<int>(DFT::Prefix, "bucket-size");
+    const char *objbuf;
+    size_t objlen;
+
+    if (rm->op_code != gpb::M_READ && rm->op_code != gpb::M_READ_R) {
+        UPE(uipcp, "M_READ or M_READ_R expected\n");
+        return 0;
+    }
+
+    rm->get_obj_value(objbuf, objlen);
+    if (!objbuf) {
+        UPE(uipcp, "M_READ does not contain a nested message\n");
+        return 0;
+    }
+
+    if (rm->op_code == gpb::M_READ) {
+        /* Answer with the closest contacts we know about, and with the
+         * matching entries, if any. */
+        auto m = utils::make_unique<CDAPMessage>();
+        gpb::KadFindReq req;
+        gpb::KadFindResp resp;
+
+        req.ParseFromArray(objbuf, objlen);
+        contact_learn(req.sender());
+
+        for (const auto &c : routing_table().closest(req.target(), k)) {
+            gpb::KadContact *kc = resp.add_contacts();
+
+            kc->set_address(c.id);
+            kc->set_ipcp_name(c.name);
+        }
+        if (!req.appl_name().empty()) {
+            auto range = store.equal_range(req.appl_name());
+
+            for (auto mit = range.first; mit != range.second; mit++) {
+                *resp.add_entries() = mit->second.entry;
+            }
+        }
+        contact_fill(resp.mutable_sender());
+
+        m->m_read_r(rm->obj_class, rm->obj_name);
+        m->invoke_id = rm->invoke_id;
+
+        return rib->send_to_dst_addr(std::move(m), req.sender().address(),
+                                     &resp);
+    }
+
+    /* This is a response to one of our requests. */
+    auto rit = rpcs.find(rm->invoke_id);
+    gpb::KadFindResp resp;
+    std::vector<kad::Contact> contacts;
+    uint64_t op_id;
+
+    if (rit == rpcs.end()) {
+        UPD(uipcp, "Cannot find pending request with invoke id %d\n",
+            rm->invoke_id);
+        return 0;
+    }
+    op_id = rit->second.op_id;
+    rpcs.erase(rit);
+    rib->invoke_id_mgr.put_invoke_id(rm->invoke_id);
+    rpc_timer_update();
+
+    resp.ParseFromArray(objbuf, objlen);
+    contact_learn(resp.sender());
+
+    auto oit = ops.find(op_id);
+    if (oit == ops.end()) {
+        return 0; /* operation already complete */
+    }
+
+    Operation &op = oit->second;
+
+    if (op.type == Operation::Type::FindValue && resp.entries_size() > 0) {
+        const gpb::DFTEntry *e = &resp.entries(0);
+
+        /* Honor the preferred node, or balance with the cookie. */
+        if (!op.preferred.empty()) {
+            e = nullptr;
+            for (const gpb::DFTEntry &re : resp.entries()) {
+                if (re.ipcp_name() == op.preferred) {
+                    e = &re;
+                    break;
+                }
+            }
+        } else {
+            e = &resp.entries(op.cookie % resp.entries_size());
+        }
+
+        if (e) {
+            op_complete(op_id, e, op.lookup->hops(resp.sender().address()));
+            return 0;
+        }
+    }
+
+    for (const gpb::KadContact &kc : resp.contacts()) {
+        contacts.emplace_back(kc.address(), kc.ipcp_name());
+    }
+    op.lookup->response(resp.sender().address(), contacts);
+    op_advance(op_id);
+
+    return 0;
+}
+
+int
+KademliaDFT::store_handler(const CDAPMessage *rm, const MsgSrcInfo &src)
+{
+    const char *objbuf;
+    gpb::KadStoreReq sreq;
+    size_t objlen;
+
+    if (rm->op_code != gpb::M_WRITE && rm->op_code != gpb::M_DELETE) {
+        UPE(rib->uipcp, "M_WRITE or M_DELETE expected\n");
+        return 0;
+    }
+
+    rm->get_obj_value(objbuf, objlen);
+    if (!objbuf) {
+        UPE(rib->uipcp, "M_WRITE does not contain a nested message\n");
+        return 0;
+    }
+
+    sreq.ParseFromArray(objbuf, objlen);
+    contact_learn(sreq.sender());
+    for (const gpb::DFTEntry &e : sreq.entries()) {
+        store_mod(e, rm->op_code == gpb::M_WRITE);
+    }
+
+    return 0;
+}
+
+void
+KademliaDFT::republish_tmr_restart()
+{
+    republish_timer = utils::make_unique<TimeoutEvent>(
+        rib->get_param_value<Msecs>(DFT::Prefix, "republish-intval"),
+        rib->uipcp, this, [](struct uipcp *uipcp, void *arg) {
+            auto dft = static_cast<KademliaDFT *>(arg);
+            std::lock_guard<std::mutex> guard(dft->rib->mutex);
+            dft->republish_timer->fired();
+            dft->republish();
+        });
+}
+
+/* Called from timer context, under RIB lock. Refresh the routing table,
+ * republish local registrations and discard expired entries. */
+void
+KademliaDFT::republish()
+{
+    auto now = std::chrono::system_clock::now();
+
+    routing_table_seed();
+
+    for (const auto &kv : local_entries) {
+        op_advance(op_start(Operation::Type::Store, kv.first, &kv.second));
+    }
+
+    for (auto mit = store.begin(); mit != store.end();) {
+        if (mit->second.expiry <= now &&
+            mit->second.entry.ipcp_name() != rib->myname) {
+            UPD(rib->uipcp, "DFT entry %s --> %s expired\n",
+                mit->first.c_str(), mit->second.entry.ipcp_name().c_str());
+            mit = store.erase(mit);
+        } else {
+            ++mit;
+        }
+    }
+
+    republish_tmr_restart();
+}
+
+void
+KademliaDFT::dump(std::stringstream &ss) const
+{
+    ss << "Directory Forwarding Table (Kademlia):" << endl;
+    for (const auto &kv : store) {
+        ss << "    Application: " << kv.first
+           << ", Remote node: " << kv.second.entry.ipcp_name()
+           << ", Seqnum: " << kv.second.entry.seqnum() << endl;
+    }
+    for (const auto &kv : local_entries) {
+        ss << "    Application: " << kv.first
+           << ", Remote node: " << rib->myname << " [local]" << endl;
+    }
+    ss << endl;
+
+    if (rt) {
+        ss << "Kademlia routing table (" << rt->size()
+           << " contacts):" << endl;
+        rt->dump(ss);
+    }
+    ss << "    Lookups: " << stats.lookups
+       << ", failed: " << stats.lookups_failed;
+    if (stats.lookups > stats.lookups_failed) {
+        uint64_t ok = stats.lookups - stats.lookups_failed;
+
+        ss << ", avg hops: " << std::setprecision(3)
+           << static_cast<double>(stats.hops) / ok
+           << ", avg latency: " << stats.latency_usecs / ok << " us";
+    }
+    ss << endl
+       << "    Requests sent: " << stats.rpcs_sent
+       << ", timed out: " << stats.rpcs_timedout << endl
+       << endl;
+}
+
 void
 UipcpRib::dft_lib_init()
 {
@@ -746,14 +1954,38 @@ UipcpRib::dft_lib_init()
         [](UipcpRib *rib) {
             return utils::make_unique<CentralizedFaultTolerantDFT>(rib);
         },
-        {DFT::TableName},
+        {DFT::TableName, CentralizedFaultTolerantDFT::CacheObjName},
         {{"replicas", PolicyParam(string())},
          {"cli-timeout", PolicyParam(Secs(int(CeftClient::kTimeoutSecs)))},
+         {"cache-ttl",
+          PolicyParam(Secs(int(CentralizedFaultTolerantDFT::kCacheTtlSecs)))},
+         {"cache-neg-ttl",
+          PolicyParam(
+              Msecs(int(CentralizedFaultTolerantDFT::kCacheNegTtlMsecs)))},
+         {"cache-size",
+          PolicyParam(CentralizedFaultTolerantDFT::kCacheSize, 0, 65536)},
+         {"cache-push-inval", PolicyParam(true)},
+         {"read-mode", PolicyParam(string("any"))},
+         {"read-lease", PolicyParam(true)},
+         {"read-max-staleness", PolicyParam(Secs(1))},
          {"raft-election-timeout", PolicyParam(Secs(1))},
          {"raft-heartbeat-timeout",
           PolicyParam(Msecs(int(CeftReplica::kHeartBeatTimeoutMsecs)))},
          {"raft-rtx-timeout",
-          PolicyParam(Msecs(int(CeftReplica::kRtxTimeoutMsecs)))}});
+          PolicyParam(Msecs(int(CeftReplica::kRtxTimeoutMsecs)))},
+         {"raft-batch-size", PolicyParam(CeftReplica::kBatchSize, 1, 1024)},
+         {"raft-window",
+          PolicyParam(int(CeftReplica::kReplicationWindow), 0, 65536)}});
+    UipcpRib::policy_register(
+        DFT::Prefix, "kademlia",
+        [](UipcpRib *rib) { return utils::make_unique<KademliaDFT>(rib); },
+        {KademliaDFT::ObjName},
+        {{"bucket-size", PolicyParam(KademliaDFT::kBucketSize, 1, 256)},
+         {"parallelism", PolicyParam(KademliaDFT::kParallelism, 1, 16)},
+         {"replication", PolicyParam(KademliaDFT::kReplication, 1, 64)},
+         {"rpc-timeout", PolicyParam(Msecs(int(KademliaDFT::kRpcTimeoutMsecs)))},
+         {"republish-intval",
+          PolicyParam(Secs(int(KademliaDFT::kRepublishIntvalSecs)))}});
 }
 
 } // namespace rlite
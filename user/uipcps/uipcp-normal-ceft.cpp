@@ -88,6 +88,9 @@ CeftReplica::process_sm_output(raft::RaftSMOutput out)
             mm->set_leader_commit(ae->leader_commit);
             mm->set_prev_log_index(ae->prev_log_index);
             mm->set_prev_log_term(ae->prev_log_term);
+            if (ae->read_seq) {
+                mm->set_read_seq(ae->read_seq);
+            }
             for (const auto &p : ae->entries) {
                 gpb::RaftLogEntry *ge = mm->add_entries();
                 ge->set_term(p.first);
@@ -101,6 +104,10 @@ CeftReplica::process_sm_output(raft::RaftSMOutput out)
             mm->set_follower_id(aer->follower_id);
             mm->set_log_index(aer->log_index);
             mm->set_success(aer->success);
+            if (aer->read_seq) {
+                mm->set_read_seq(aer->read_seq);
+                mm->set_heartbeat(aer->heartbeat);
+            }
             obj       = std::move(mm);
             obj_class = AppendEntriesRespObjClass;
         } else {
@@ -112,6 +119,25 @@ CeftReplica::process_sm_output(raft::RaftSMOutput out)
             rib->send_to_dst_node(std::move(m), pair.first, obj.get(), nullptr);
     }
 
+    /* Serve the reads that are now safe, and forget about the ones that
+     * failed (clients will retry). */
+    for (raft::ReadId id : out.reads_ready) {
+        auto mit = pending_reads.find(id);
+
+        if (mit != pending_reads.end()) {
+            std::vector<CommandToSubmit> commands;
+
+            replica_process_rib_msg(mit->second.m.get(),
+                                    mit->second.requestor_addr, &commands);
+            pending_reads.erase(mit);
+        }
+    }
+    for (raft::ReadId id : out.reads_failed) {
+        UPD(rib->uipcp, "Read %llu dropped, not the leader anymore\n",
+            (long long unsigned)id);
+        pending_reads.erase(id);
+    }
+
     /* Here we make an assumption about the raft library, that is one
      * and only one timer is active at all times; so for example if the
      * heartbeat timer is active, the leader election timer can't be active.
@@ -156,6 +182,20 @@ CeftReplica::process_timeout()
     return process_sm_output(std::move(out));
 }
 
+int
+CeftReplica::process_flush()
+{
+    std::lock_guard<std::mutex> guard(rib->mutex);
+    raft::RaftSMOutput out;
+
+    flush_timer = nullptr;
+    if (submit_flush(&out)) {
+        UPE(rib->uipcp, "Failed to flush submitted commands\n");
+    }
+
+    return process_sm_output(std::move(out));
+}
+
 /* Apply a command to the replicated state machine. */
 int
 CeftReplica::apply(raft::LogIndex index, raft::Term term,
@@ -250,6 +290,7 @@ CeftReplica::rib_handler(const CDAPMessage *rm, const MsgSrcInfo &src)
         ae->leader_commit  = mm.leader_commit();
         ae->prev_log_index = mm.prev_log_index();
         ae->prev_log_term  = mm.prev_log_term();
+        ae->read_seq       = mm.read_seq();
         for (int i = 0; i < mm.entries_size(); i++) {
             size_t bufsize = mm.entries(i).buffer().size();
             auto bufcopy   = std::unique_ptr<char[]>(new char[bufsize]);
@@ -268,7 +309,11 @@ CeftReplica::rib_handler(const CDAPMessage *rm, const MsgSrcInfo &src)
         aer->follower_id = mm.follower_id();
         aer->log_index   = mm.log_index();
         aer->success     = mm.success();
+        aer->read_seq    = mm.read_seq();
+        aer->heartbeat   = mm.heartbeat();
         ret              = append_entries_resp_input(*aer, &out);
+    } else if (rm->op_code == gpb::M_READ && read_mode != ReadMode::Any) {
+        ret = read_input(rm, src.addr, &out);
     } else {
         /* This is not a message belonging to the raft protocol. Forward it
          * to the underlying implementation. */
@@ -278,11 +323,12 @@ CeftReplica::rib_handler(const CDAPMessage *rm, const MsgSrcInfo &src)
 
         /* Submit commands to the raft state machine, if any. */
         for (auto &command : commands) {
+            const char *const serbuf =
+                reinterpret_cast<const char *const>(command.first.get());
             raft::LogIndex index;
 
-            ret =
-                submit(reinterpret_cast<const char *const>(command.first.get()),
-                       &index, &out);
+            ret = batch_size > 1 ? submit_batched(serbuf, &index)
+                                 : submit(serbuf, &index, &out);
             if (ret) {
                 UPE(uipcp, "Failed to submit command (%s) to the RaftSM\n",
                     rm->obj_class.c_str());
@@ -291,6 +337,20 @@ CeftReplica::rib_handler(const CDAPMessage *rm, const MsgSrcInfo &src)
             pending[index] = utils::make_unique<PendingResp>(
                 std::move(command.second), src.addr, curr_term());
         }
+
+        /* Replicate the batch right away if it is full, otherwise wait
+         * for the other messages received in this event loop iteration. */
+        if (submit_pending() >= batch_size) {
+            ret = submit_flush(&out);
+        } else if (submit_pending() && !flush_timer) {
+            flush_timer = utils::make_unique<TimeoutEvent>(
+                Msecs(0), rib->uipcp, this,
+                [](struct uipcp *uipcp, void *arg) {
+                    auto replica = static_cast<CeftReplica *>(arg);
+                    replica->flush_timer->fired();
+                    replica->process_flush();
+                });
+        }
     }
 
     if (ret) {
@@ -301,6 +361,94 @@ CeftReplica::rib_handler(const CDAPMessage *rm, const MsgSrcInfo &src)
     return process_sm_output(std::move(out));
 }
 
+int
+CeftReplica::set_read_policy(const std::string &component)
+{
+    auto mode = rib->get_param_value<std::string>(component, "read-mode");
+
+    if (mode == "any") {
+        read_mode = ReadMode::Any;
+    } else if (mode == "linearizable") {
+        read_mode = ReadMode::Linearizable;
+    } else if (mode == "follower") {
+        read_mode = ReadMode::Follower;
+    } else {
+        UPE(rib->uipcp, "Invalid read-mode '%s'\n", mode.c_str());
+        return -1;
+    }
+
+    read_max_staleness =
+        rib->get_param_value<Msecs>(component, "read-max-staleness");
+    if (read_mode == ReadMode::Linearizable &&
+        rib->get_param_value<bool>(component, "read-lease")) {
+        /* Leave a margin for clock drift. */
+        set_lease_timeout(get_election_timeout_min() * 3 / 4);
+    } else {
+        set_lease_timeout(Msecs(0));
+    }
+
+    return 0;
+}
+
+int
+CeftReplica::set_replication_policy(const std::string &component)
+{
+    batch_size = static_cast<unsigned int>(
+        rib->get_param_value<int>(component, "raft-batch-size"));
+    set_replication_window(static_cast<unsigned int>(
+        rib->get_param_value<int>(component, "raft-window")));
+    /* A batch should fit a single RaftAppendEntries message. */
+    set_max_append_entries_bytes(MGMTBUF_SIZE_MAX -
+                                 UipcpRib::kRIBSyncHeadroom);
+
+    return 0;
+}
+
+/* Serve an M_READ according to the read mode. */
+int
+CeftReplica::read_input(const CDAPMessage *rm, rlm_addr_t src_addr,
+                        raft::RaftSMOutput *out)
+{
+    if (read_mode == ReadMode::Follower) {
+        std::vector<CommandToSubmit> commands;
+
+        if (!read_local_ok(read_max_staleness)) {
+            UPD(rib->uipcp, "Ignoring read, local state may be too stale\n");
+            return 0;
+        }
+
+        return replica_process_rib_msg(rm, src_addr, &commands);
+    }
+
+    if (!leader()) {
+        /* Let the leader answer. */
+        UPD(rib->uipcp, "Ignoring read request, let the leader answer\n");
+        return 0;
+    }
+
+    raft::ReadId id   = read_id_next++;
+    pending_reads[id] = PendingResp(utils::make_unique<CDAPMessage>(*rm),
+                                    src_addr, curr_term());
+
+    return read_request(id, out);
+}
+
+/* Can the local replica be read, according to the read mode? */
+bool
+CeftReplica::local_read_ok() const
+{
+    switch (read_mode) {
+    case ReadMode::Any:
+        return true;
+    case ReadMode::Follower:
+        return read_local_ok(read_max_staleness);
+    case ReadMode::Linearizable:
+        return lease_valid();
+    }
+
+    return false;
+}
+
 int
 CeftClient::process_timeout()
 {
@@ -319,6 +467,7 @@ CeftClient::mod_pending_timer()
 {
     auto t_min = std::chrono::system_clock::time_point::max();
     auto now   = std::chrono::system_clock::now();
+    std::vector<std::unique_ptr<PendingReq>> expired;
 
     for (auto mit = pending.begin(); mit != pending.end();) {
         if (mit->second->t <= now) {
@@ -338,6 +487,8 @@ CeftClient::mod_pending_timer()
                     reader_id.c_str());
                 reader_id.clear();
             }
+            rib->invoke_id_mgr.put_invoke_id(mit->first);
+            expired.push_back(std::move(mit->second));
             mit = pending.erase(mit);
         } else {
             if (mit->second->t < t_min) {
@@ -360,15 +511,29 @@ CeftClient::mod_pending_timer()
                 cli->process_timeout();
             });
     }
+
+    /* Let the implementation react to the expired requests. This is done
+     * last, as it may result into new requests being sent. */
+    for (const auto &pr : expired) {
+        client_process_timeout(pr.get());
+    }
 }
 
 int
 CeftClient::send_to_replicas(std::unique_ptr<CDAPMessage> m,
                              std::unique_ptr<PendingReq> pr, OpSemantics sem)
 {
-    const raft::ReplicaId &selected_id =
+    raft::ReplicaId selected_id =
         (sem == OpSemantics::Get) ? reader_id : leader_id;
 
+    if (sem == OpSemantics::Get && read_spread && !replicas.empty()) {
+        /* Spread the reads over all the replicas. */
+        auto it = replicas.begin();
+
+        std::advance(it, read_rr++ % replicas.size());
+        selected_id = *it;
+    }
+
     /* If we have a selected for this operation (leader or selected reader), we
      * send it to that replica only; otherwise we send it to all the replicas.
      */
@@ -437,6 +602,7 @@ CeftClient::rib_handler(const CDAPMessage *rm, const MsgSrcInfo &src)
     /* Handle the message to the underlying implementation. */
     int ret = client_process_rib_msg(rm, pi->second.get(), src.addr);
     pending.erase(pi);
+    rib->invoke_id_mgr.put_invoke_id(rm->invoke_id);
     mod_pending_timer();
 
     return ret;
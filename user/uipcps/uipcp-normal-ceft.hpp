@@ -43,6 +43,12 @@ class CeftReplica : public raft::RaftSM {
     std::unique_ptr<TimeoutEvent> timer;
     raft::RaftTimerType timer_type;
 
+    /* Commands submitted while processing the messages received in the
+     * same event loop iteration are replicated together (up to batch_size
+     * commands), when flush_timer fires. */
+    unsigned int batch_size = 1;
+    std::unique_ptr<TimeoutEvent> flush_timer;
+
     /* Support for client commands that are pending, waiting for
      * being applied to the replicated state machine. */
     struct PendingResp {
@@ -59,6 +65,25 @@ class CeftReplica : public raft::RaftSM {
 
     std::unordered_map<raft::LogIndex, std::unique_ptr<PendingResp>> pending;
 
+    /* How M_READ requests are served: by any replica from its local
+     * state ("any"), by the leader after making sure that it is still the
+     * leader ("linearizable"), or by any replica that recently heard from
+     * the leader ("follower"). */
+    enum class ReadMode {
+        Any = 0,
+        Linearizable,
+        Follower,
+    };
+    ReadMode read_mode = ReadMode::Any;
+    Msecs read_max_staleness;
+
+    /* Linearizable reads waiting to be served. */
+    std::unordered_map<raft::ReadId, PendingResp> pending_reads;
+    raft::ReadId read_id_next = 1;
+
+    int read_input(const CDAPMessage *rm, rlm_addr_t src_addr,
+                   raft::RaftSMOutput *out);
+
     static std::string ReqVoteObjClass;
     static std::string ReqVoteRespObjClass;
     static std::string AppendEntriesObjClass;
@@ -83,6 +108,7 @@ public:
     int init(const std::list<raft::ReplicaId> &peers);
     int process_sm_output(raft::RaftSMOutput out);
     int process_timeout();
+    int process_flush();
     int apply(raft::LogIndex index, raft::Term term,
               const char *const serbuf) override final;
     int rib_handler(const CDAPMessage *rm, const MsgSrcInfo &src);
@@ -92,6 +118,19 @@ public:
     virtual int replica_process_rib_msg(
         const CDAPMessage *rm, rlm_addr_t src_addr,
         std::vector<CommandToSubmit> *commands) = 0;
+
+    /* Load the read-mode, read-lease and read-max-staleness parameters
+     * of 'component'. */
+    int set_read_policy(const std::string &component);
+
+    /* Load the raft-batch-size and raft-window parameters of 'component'. */
+    int set_replication_policy(const std::string &component);
+
+    /* Default maximum number of commands replicated together. */
+    static constexpr int kBatchSize = 64;
+
+    /* True if local lookups are allowed by the read mode. */
+    bool local_read_ok() const;
 };
 
 /* The CeftClient class provides the client-side generic glue functionalities
@@ -112,6 +151,9 @@ protected:
     raft::ReplicaId leader_id;
     /* The replica that responded first to an M_READ, if any. */
     raft::ReplicaId reader_id;
+    /* If true, reads go to the replicas in round robin. */
+    bool read_spread     = false;
+    unsigned int read_rr = 0;
     std::unique_ptr<TimeoutEvent> timer;
 
     struct PendingReq {
@@ -150,12 +192,18 @@ public:
                                        CeftClient::PendingReq *const bpr,
                                        rlm_addr_t src_addr) = 0;
 
+    /* Called when a pending request expires without a response, after
+     * the request has been removed from the pending map. */
+    virtual void client_process_timeout(CeftClient::PendingReq *const bpr) {}
+
     /* For external hints. */
     void set_leader_id(const raft::ReplicaId &name)
     {
         leader_id = reader_id = name;
     }
 
+    void set_read_spread(bool spread) { read_spread = spread; }
+
     /* Timeout in seconds for client requests to the replicas. */
     static constexpr int kTimeoutSecs = 5;
 };
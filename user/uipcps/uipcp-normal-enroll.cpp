@@ -22,6 +22,7 @@
  */
 
 #include <unistd.h>
+#include <algorithm>
 #include <cassert>
 #include <pthread.h>
 #include <poll.h>
@@ -165,6 +166,22 @@ NeighFlow::sync_obj(bool create, const string &obj_class,
     return ret;
 }
 
+/* Maximum size of a management message that can be sent on this flow. */
+size_t
+NeighFlow::max_msg_size()
+{
+    if (mss == 0) {
+        mss = rina_flow_mss_get(flow_fd);
+        if (mss == 0) {
+            UPD(rib->uipcp, "Failed to get MSS of flow %d [%s]\n", flow_fd,
+                strerror(errno));
+            mss = kDefaultMss;
+        }
+    }
+
+    return std::min(static_cast<size_t>(mss), size_t(MGMTBUF_SIZE_MAX));
+}
+
 void
 EnrollmentResources::enrollment_abort()
 {
@@ -503,9 +520,10 @@ EnrollmentResources::enrollee_default(std::unique_lock<std::mutex> &lk)
             return -1;
         }
 
-        /* Configure TTL after the update of the EFCP data transfer
-         * constants. */
+        /* Configure TTL and PCI format after the update of the EFCP data
+         * transfer constants. */
         rib->update_ttl();
+        rib->update_pci();
     }
 
     for (;;) {
@@ -1081,11 +1099,151 @@ operator==(const gpb::NeighborCandidate &a, const gpb::NeighborCandidate &o)
     return s1 == s2;
 }
 
+static uint64_t
+fnv1a64(const std::string &s, uint64_t h = 14695981039346656037ULL)
+{
+    for (unsigned char c : s) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+
+    return h;
+}
+
+/* Finalizer step, to spread the FNV-1a output over all the bits. */
+static uint64_t
+hash_mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+size_t
+SyncBatch::obj_size(const ::google::protobuf::MessageLite &obj)
+{
+#ifdef HAVE_GPB_BYTE_SIZE_LONG
+    return obj.ByteSizeLong();
+#else
+    return obj.ByteSize();
+#endif
+}
+
+bool
+SyncBatch::full(size_t objbytes) const
+{
+    if (objs == 0) {
+        return false; /* always accept at least one object */
+    }
+
+    return (max_objs > 0 && objs >= max_objs) ||
+           bytes + objbytes + kObjOverhead > max_bytes;
+}
+
+void
+SyncBatch::add(size_t objbytes)
+{
+    objs++;
+    bytes += objbytes + kObjOverhead;
+}
+
+/* Estimate the number of messages needed to send @nobjs objects
+ * for a total of @nbytes bytes. */
+uint64_t
+SyncBatch::msgs(uint64_t nobjs, uint64_t nbytes) const
+{
+    uint64_t n;
+
+    nbytes += nobjs * kObjOverhead;
+    n = (nbytes + max_bytes - 1) / max_bytes;
+    if (max_objs > 0) {
+        n = std::max(n, (nobjs + max_objs - 1) / max_objs);
+    }
+
+    return n;
+}
+
+size_t
+SyncDigest::bucket(const std::string &key)
+{
+    return hash_mix(fnv1a64(key)) % kBuckets;
+}
+
+void
+SyncDigest::add(const std::string &key, const std::string &version,
+                const ::google::protobuf::MessageLite &obj)
+{
+    size_t b = bucket(key);
+
+    hashes[b] += hash_mix(fnv1a64(version, fnv1a64(key)));
+    objs[b]++;
+    bytes[b] += SyncBatch::obj_size(obj);
+}
+
+uint64_t
+SyncDigest::root() const
+{
+    uint64_t h = 0;
+
+    for (uint64_t bh : hashes) {
+        h = hash_mix(h ^ bh);
+    }
+
+    return h;
+}
+
+/* Tables replicated among all the IPCPs of the DIF, which are
+ * synchronized with the neighbors. */
+std::vector<std::pair<std::string, const Component *>>
+UipcpRib::sync_tables() const
+{
+    return {{Routing::TableName, routing},
+            {DFT::TableName, dft},
+            {AddrAllocator::TableName, addra}};
+}
+
+/* Batching limits for the RIB synchronization messages sent on the
+ * neighbor flow @nf, or to all the neighbors if @nf is nullptr. */
+SyncBatch
+UipcpRib::sync_batch(const std::shared_ptr<NeighFlow> &nf)
+{
+    size_t mss = MGMTBUF_SIZE_MAX;
+    SyncBatch batch;
+
+    batch.max_objs = get_param_value<int>(RibDaemonPrefix, "sync-batch");
+
+    if (nf) {
+        mss = nf->max_msg_size();
+    } else {
+        for (const auto &kvn : neighbors) {
+            if (!kvn.second->has_flows() ||
+                kvn.second->mgmt_conn()->enroll_state !=
+                    EnrollState::NEIGH_ENROLLED) {
+                continue;
+            }
+            mss = std::min(mss, kvn.second->mgmt_conn()->max_msg_size());
+        }
+    }
+
+    batch.max_bytes =
+        mss > 2 * kRIBSyncHeadroom ? mss - kRIBSyncHeadroom : mss / 2;
+
+    return batch;
+}
+
 int
 UipcpRib::sync_rib(const std::shared_ptr<NeighFlow> &nf)
 {
-    unsigned int limit = 10; /* Hardwired for now, but at least we limit. */
-    int ret            = 0;
+    auto t_start    = std::chrono::system_clock::now();
+    SyncBatch batch = sync_batch(nf);
+    bool digest = get_param_value<bool>(RibDaemonPrefix, "digest-sync");
+    gpb::RibDigest rd;
+    uint64_t usecs;
+    int ret = 0;
 
     UPD(uipcp, "Starting RIB sync with neighbor '%s'\n",
         static_cast<string>(nf->neigh_name).c_str());
@@ -1097,41 +1255,198 @@ UipcpRib::sync_rib(const std::shared_ptr<NeighFlow> &nf)
 
         /* Temporarily insert a neighbor representing myself,
          * to simplify the loop below. */
-        neighbors_seen[my_name] = cand;
+        neighbor_seen_update(my_name, cand);
 
         /* Scan all the neighbors I know about. */
-        for (auto cit = neighbors_seen.begin(); cit != neighbors_seen.end();) {
-            gpb::NeighborCandidateList ncl;
+        gpb::NeighborCandidateList ncl;
+        SyncBatch b = batch;
+
+        for (const auto &kvc : neighbors_seen) {
+            size_t objbytes = SyncBatch::obj_size(kvc.second);
 
-            while (ncl.candidates_size() < static_cast<int>(limit) &&
-                   cit != neighbors_seen.end()) {
-                *ncl.add_candidates() = cit->second;
-                cit++;
+            if (b.full(objbytes)) {
+                ret |= nf->sync_obj(true, Neighbor::ObjClass,
+                                    Neighbor::TableName, &ncl);
+                ncl = gpb::NeighborCandidateList();
+                b.reset();
             }
+            *ncl.add_candidates() = kvc.second;
+            b.add(objbytes);
+        }
 
+        if (ncl.candidates_size() > 0) {
             ret |= nf->sync_obj(true, Neighbor::ObjClass, Neighbor::TableName,
                                 &ncl);
         }
 
         /* Remove myself. */
-        neighbors_seen.erase(my_name);
+        neighbor_seen_remove(my_name);
     }
 
-    /* Synchronize lower flow database. */
-    ret |= routing->sync_neigh(nf, limit);
+    /* Synchronize lower flow database, Directory Forwarding Table and
+     * address allocation table. When possible, we only send the root
+     * hash of a table, and let the neighbor tell us which buckets
+     * differ (see sync_digest_handler()). */
+    for (const auto &t : sync_tables()) {
+        SyncDigest d;
 
-    /* Synchronize Directory Forwarding Table. */
-    ret |= dft->sync_neigh(nf, limit);
+        if (digest && t.second->sync_digest(d)) {
+            gpb::RibTableDigest *td = rd.add_tables();
 
-    /* Synchronize address allocation table. */
-    ret |= addra->sync_neigh(nf, limit);
+            td->set_table(t.first);
+            td->set_root(d.root());
+        } else {
+            ret |= t.second->sync_neigh(nf, batch);
+        }
+    }
 
-    UPD(uipcp, "Finished RIB sync with neighbor '%s'\n",
-        static_cast<string>(nf->neigh_name).c_str());
+    if (rd.tables_size() > 0) {
+        ret |= sync_digest_send(nf, rd);
+    }
+
+    usecs = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::system_clock::now() - t_start)
+                .count();
+    stats.sync_rib_count++;
+    stats.sync_rib_last_usecs = usecs;
+    stats.sync_rib_max_usecs  = std::max(stats.sync_rib_max_usecs, usecs);
+
+    UPD(uipcp, "Finished RIB sync with neighbor '%s' (%llu us)\n",
+        static_cast<string>(nf->neigh_name).c_str(),
+        static_cast<long long unsigned>(usecs));
+
+    return ret;
+}
+
+int
+UipcpRib::sync_digest_send(const std::shared_ptr<NeighFlow> &nf,
+                           const gpb::RibDigest &rd)
+{
+    CDAPMessage m;
+    int ret;
+
+    m.m_write(RibDigestObjClass, RibDigestObjName);
+    ret = nf->send_to_port_id(&m, 0, &rd);
+    if (ret) {
+        UPE(uipcp, "send_to_port_id() failed [%s]\n", strerror(errno));
+    } else {
+        stats.sync_digest_sent++;
+    }
 
     return ret;
 }
 
+int
+UipcpRib::sync_digest_handler(const CDAPMessage *rm, const MsgSrcInfo &src)
+{
+    const char *objbuf;
+    gpb::RibDigest reply;
+    gpb::RibDigest rd;
+    SyncBatch batch;
+    size_t objlen;
+
+    if (rm->op_code != gpb::M_WRITE) {
+        UPE(uipcp, "M_WRITE expected\n");
+        return 0;
+    }
+
+    if (!src.nf) {
+        UPE(uipcp, "RIB digest not received from a neighbor\n");
+        return 0;
+    }
+
+    rm->get_obj_value(objbuf, objlen);
+    if (!objbuf) {
+        UPE(uipcp, "M_WRITE does not contain a nested message\n");
+        return 0;
+    }
+
+    rd.ParseFromArray(objbuf, objlen);
+    stats.sync_digest_received++;
+    batch = sync_batch(src.nf);
+
+    for (const gpb::RibTableDigest &td : rd.tables()) {
+        const Component *comp = nullptr;
+        uint64_t pushed       = 0;
+        uint64_t pushed_bytes = 0;
+        uint64_t total        = 0;
+        uint64_t total_bytes  = 0;
+        SyncDigest d;
+
+        for (const auto &t : sync_tables()) {
+            if (t.first == td.table()) {
+                comp = t.second;
+            }
+        }
+
+        if (!comp || !comp->sync_digest(d)) {
+            UPW(uipcp, "Digest for table %s not supported\n",
+                td.table().c_str());
+            continue;
+        }
+
+        for (size_t i = 0; i < SyncDigest::kBuckets; i++) {
+            total += d.objs[i];
+            total_bytes += d.bytes[i];
+        }
+
+        if (td.buckets_size() == 0) {
+            /* Only the root hash was sent. If it matches our own, the
+             * tables are in sync. Otherwise we reply with the hashes of
+             * all our buckets, so that the neighbor can push the entries
+             * belonging to the buckets that differ. */
+            if (td.root() == d.root()) {
+                stats.sync_objs_saved += total;
+                stats.sync_bytes_saved += total_bytes;
+                stats.sync_msgs_saved += batch.msgs(total, total_bytes);
+            } else {
+                gpb::RibTableDigest *rtd = reply.add_tables();
+
+                rtd->set_table(td.table());
+                rtd->set_root(d.root());
+                for (uint64_t h : d.hashes) {
+                    rtd->add_buckets(h);
+                }
+            }
+            continue;
+        }
+
+        if (td.buckets_size() != static_cast<int>(SyncDigest::kBuckets)) {
+            UPE(uipcp, "Digest for table %s has %d buckets (%u expected)\n",
+                td.table().c_str(), td.buckets_size(),
+                static_cast<unsigned>(SyncDigest::kBuckets));
+            continue;
+        }
+
+        /* Push our entries for the (non-empty) buckets that differ. */
+        std::vector<bool> mask(SyncDigest::kBuckets, false);
+
+        for (size_t i = 0; i < SyncDigest::kBuckets; i++) {
+            if (d.hashes[i] != td.buckets(i) && d.objs[i] > 0) {
+                mask[i] = true;
+                pushed += d.objs[i];
+                pushed_bytes += d.bytes[i];
+                stats.sync_buckets_pushed++;
+            }
+        }
+
+        if (pushed > 0) {
+            comp->sync_neigh_buckets(src.nf, mask, batch);
+        }
+        stats.sync_objs_pushed += pushed;
+        stats.sync_objs_saved += total - pushed;
+        stats.sync_bytes_saved += total_bytes - pushed_bytes;
+        stats.sync_msgs_saved += batch.msgs(total, total_bytes) -
+                                 batch.msgs(pushed, pushed_bytes);
+    }
+
+    if (reply.tables_size() > 0) {
+        sync_digest_send(src.nf, reply);
+    }
+
+    return 0;
+}
+
 void
 UipcpRib::neighs_refresh_tmr_restart()
 {
@@ -1148,12 +1463,12 @@ void
 UipcpRib::neighs_refresh()
 {
     std::lock_guard<std::mutex> guard(mutex);
-    size_t limit = 10;
+    SyncBatch batch = sync_batch(nullptr);
 
     UPV(uipcp, "Refreshing neighbors RIB\n");
 
-    routing->neighs_refresh(limit);
-    dft->neighs_refresh(limit);
+    routing->neighs_refresh(batch);
+    dft->neighs_refresh(batch);
     {
         gpb::NeighborCandidateList ncl;
 
@@ -1161,6 +1476,36 @@ UipcpRib::neighs_refresh()
         neighs_sync_obj_all(true, Neighbor::ObjClass, Neighbor::TableName,
                             &ncl);
     }
+
+    if (get_param_value<bool>(RibDaemonPrefix, "digest-sync")) {
+        /* Send the root hashes of our tables to all the neighbors, which
+         * will ask for the differing buckets, if any. */
+        gpb::RibDigest rd;
+
+        for (const auto &t : sync_tables()) {
+            SyncDigest d;
+
+            if (t.second->sync_digest(d)) {
+                gpb::RibTableDigest *td = rd.add_tables();
+
+                td->set_table(t.first);
+                td->set_root(d.root());
+            }
+        }
+
+        for (const auto &kvn : neighbors) {
+            if (rd.tables_size() == 0) {
+                break;
+            }
+            if (!kvn.second->has_flows() ||
+                kvn.second->mgmt_conn()->enroll_state !=
+                    EnrollState::NEIGH_ENROLLED) {
+                continue;
+            }
+            sync_digest_send(kvn.second->mgmt_conn(), rd);
+        }
+    }
+
     neighs_refresh_tmr_restart();
 }
 
@@ -1259,23 +1604,70 @@ UipcpRib::lookup_node_address(const std::string &node_name) const
 }
 
 std::string
-UipcpRib::lookup_neighbor_by_address(rlm_addr_t address)
+UipcpRib::lookup_neighbor_by_address(rlm_addr_t address) const
 {
     if (address == myaddr) {
         return myname;
     }
 
-    for (const auto &kvn : neighbors_seen) {
-        if (kvn.second.address() == address) {
-            return utils::rina_string_from_components(kvn.second.ap_name(),
-                                                      kvn.second.ap_instance(),
-                                                      string(), string());
-        }
+    auto mit = neighbors_seen_by_addr.find(address);
+
+    if (mit != neighbors_seen_by_addr.end()) {
+        return mit->second;
     }
 
     return string();
 }
 
+/* Remove the entry for 'name' from the reverse index, if any. */
+static void
+addr_index_remove(std::unordered_multimap<rlm_addr_t, string> &index,
+                  rlm_addr_t address, const string &name)
+{
+    auto range = index.equal_range(address);
+
+    for (auto it = range.first; it != range.second; it++) {
+        if (it->second == name) {
+            index.erase(it);
+            return;
+        }
+    }
+}
+
+void
+UipcpRib::neighbor_seen_update(const std::string &name,
+                               const gpb::NeighborCandidate &cand)
+{
+    auto mit = neighbors_seen.find(name);
+
+    if (mit != neighbors_seen.end()) {
+        if (mit->second.address() != cand.address()) {
+            /* The neighbor changed its address. */
+            addr_index_remove(neighbors_seen_by_addr, mit->second.address(),
+                              name);
+            neighbors_seen_by_addr.emplace(cand.address(), name);
+        }
+        mit->second = cand;
+        return;
+    }
+
+    neighbors_seen[name] = cand;
+    neighbors_seen_by_addr.emplace(cand.address(), name);
+}
+
+void
+UipcpRib::neighbor_seen_remove(const std::string &name)
+{
+    auto mit = neighbors_seen.find(name);
+
+    if (mit == neighbors_seen.end()) {
+        return;
+    }
+
+    addr_index_remove(neighbors_seen_by_addr, mit->second.address(), name);
+    neighbors_seen.erase(mit);
+}
+
 static string
 common_lower_dif(const gpb::NeighborCandidate &cand, const list<string> l2)
 {
@@ -1329,13 +1721,12 @@ UipcpRib::neighbors_handler(const CDAPMessage *rm, const MsgSrcInfo &src)
         }
 
         if (add) {
-            if (mit != neighbors_seen.end() &&
-                neighbors_seen[neigh_name] == nc) {
+            if (mit != neighbors_seen.end() && mit->second == nc) {
                 /* We've already seen this one. */
                 continue;
             }
 
-            neighbors_seen[neigh_name] = nc;
+            neighbor_seen_update(neigh_name, nc);
             *prop_ncl.add_candidates() = nc;
             propagate                  = true;
 
@@ -1363,7 +1754,7 @@ UipcpRib::neighbors_handler(const CDAPMessage *rm, const MsgSrcInfo &src)
             }
 
             /* Let's forget about this neighbor. */
-            neighbors_seen.erase(mit);
+            neighbor_seen_remove(neigh_name);
             *prop_ncl.add_candidates() = nc;
             propagate                  = true;
             if (neighbors_cand.count(neigh_name)) {
@@ -1954,7 +2345,7 @@ UipcpRib::check_for_address_conflicts()
     map<rlm_addr_t, string> m;
 
     /* Temporarily insert a neighbor representing myself. */
-    neighbors_seen[myname] = cand;
+    neighbor_seen_update(myname, cand);
 
     for (const auto &kvn : neighbors_seen) {
         rlm_addr_t addr = kvn.second.address();
@@ -1969,7 +2360,7 @@ UipcpRib::check_for_address_conflicts()
         }
     }
 
-    neighbors_seen.erase(myname); /* Remove temporary. */
+    neighbor_seen_remove(myname); /* Remove temporary. */
 
     if (need_to_change) {
         /* My address conflicts with someone else, and I am the
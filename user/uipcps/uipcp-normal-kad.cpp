@@ -0,0 +1,277 @@
+/*
+ * Kademlia routing table and iterative lookups.
+ *
+ * Copyright (C) 2026 agent
+ * Author: agent <agent@local>
+ *
+ * This file is part of rlite.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <algorithm>
+#include <string>
+#include <sstream>
+
+#include "uipcp-normal-kad.hpp"
+
+namespace rlite {
+namespace kad {
+
+NodeId
+key_id(const std::string &key)
+{
+    uint64_t h = 14695981039346656037ULL; /* FNV-1a */
+
+    for (unsigned char c : key) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+
+    /* Finalizer, to spread the hash over all the bits. */
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+int
+RoutingTable::bucket_index(NodeId id) const
+{
+    uint64_t d = distance(self, id);
+
+    if (d == 0) {
+        return -1;
+    }
+
+    return static_cast<int>(kIdBits) - 1 - __builtin_clzll(d);
+}
+
+bool
+RoutingTable::update(const Contact &c)
+{
+    int idx = bucket_index(c.id);
+
+    if (idx < 0) {
+        return false; /* this is ourselves */
+    }
+
+    std::list<Contact> &bucket = buckets[idx];
+
+    for (auto it = bucket.begin(); it != bucket.end(); it++) {
+        if (it->id == c.id) {
+            /* Move to the tail, as the most recently seen one. */
+            bucket.erase(it);
+            bucket.push_back(c);
+            return true;
+        }
+    }
+
+    if (bucket.size() >= k) {
+        return false;
+    }
+
+    bucket.push_back(c);
+
+    return true;
+}
+
+void
+RoutingTable::remove(NodeId id)
+{
+    int idx = bucket_index(id);
+
+    if (idx < 0) {
+        return;
+    }
+
+    buckets[idx].remove_if([id](const Contact &c) { return c.id == id; });
+}
+
+std::vector<Contact>
+RoutingTable::closest(NodeId target, unsigned int n) const
+{
+    std::vector<Contact> ret;
+
+    for (const auto &bucket : buckets) {
+        ret.insert(ret.end(), bucket.begin(), bucket.end());
+    }
+
+    auto cmp = [target](const Contact &a, const Contact &b) {
+        return distance(a.id, target) < distance(b.id, target);
+    };
+
+    if (ret.size() > n) {
+        std::partial_sort(ret.begin(), ret.begin() + n, ret.end(), cmp);
+        ret.resize(n);
+    } else {
+        std::sort(ret.begin(), ret.end(), cmp);
+    }
+
+    return ret;
+}
+
+size_t
+RoutingTable::size() const
+{
+    size_t ret = 0;
+
+    for (const auto &bucket : buckets) {
+        ret += bucket.size();
+    }
+
+    return ret;
+}
+
+void
+RoutingTable::dump(std::stringstream &ss) const
+{
+    for (unsigned int i = 0; i < buckets.size(); i++) {
+        if (buckets[i].empty()) {
+            continue;
+        }
+        ss << "    Bucket " << i << ":";
+        for (const auto &c : buckets[i]) {
+            ss << " " << c.name << "(" << c.id << ")";
+        }
+        ss << std::endl;
+    }
+}
+
+Lookup::Lookup(NodeId target, const std::vector<Contact> &seeds,
+               unsigned int k, unsigned int alpha)
+    : target(target), k(k), alpha(alpha)
+{
+    for (const auto &c : seeds) {
+        shortlist.insert({distance(c.id, target), {c, State::Idle, 1}});
+    }
+}
+
+std::vector<Contact>
+Lookup::next()
+{
+    std::vector<Contact> ret;
+    unsigned int considered = 0;
+
+    /* Query the closest candidates not queried yet, only considering
+     * the k closest ones that did not fail. */
+    for (auto &kv : shortlist) {
+        Candidate &cand = kv.second;
+
+        if (inflight >= alpha || considered >= k) {
+            break;
+        }
+        if (cand.state == State::Failed) {
+            continue;
+        }
+        considered++;
+        if (cand.state == State::Idle) {
+            cand.state = State::InFlight;
+            inflight++;
+            ret.push_back(cand.contact);
+        }
+    }
+
+    return ret;
+}
+
+void
+Lookup::response(NodeId from, const std::vector<Contact> &contacts)
+{
+    auto it = shortlist.find(distance(from, target));
+    unsigned int hops;
+
+    if (it == shortlist.end() || it->second.state != State::InFlight) {
+        return; /* unexpected or late response */
+    }
+
+    it->second.state = State::Responded;
+    hops             = it->second.hops;
+    inflight--;
+
+    for (const auto &c : contacts) {
+        /* This does not overwrite existing candidates. */
+        shortlist.insert({distance(c.id, target), {c, State::Idle, hops + 1}});
+    }
+}
+
+void
+Lookup::failure(NodeId from)
+{
+    auto it = shortlist.find(distance(from, target));
+
+    if (it == shortlist.end() || it->second.state != State::InFlight) {
+        return;
+    }
+
+    it->second.state = State::Failed;
+    inflight--;
+}
+
+unsigned int
+Lookup::hops(NodeId id) const
+{
+    auto it = shortlist.find(distance(id, target));
+
+    return it == shortlist.end() ? 0 : it->second.hops;
+}
+
+bool
+Lookup::finished() const
+{
+    unsigned int considered = 0;
+
+    if (inflight > 0) {
+        return false;
+    }
+
+    for (const auto &kv : shortlist) {
+        if (considered >= k) {
+            break;
+        }
+        if (kv.second.state == State::Failed) {
+            continue;
+        }
+        if (kv.second.state == State::Idle) {
+            return false;
+        }
+        considered++;
+    }
+
+    return true;
+}
+
+std::vector<Contact>
+Lookup::closest(unsigned int n) const
+{
+    std::vector<Contact> ret;
+
+    for (const auto &kv : shortlist) {
+        if (ret.size() >= n) {
+            break;
+        }
+        if (kv.second.state == State::Responded) {
+            ret.push_back(kv.second.contact);
+        }
+    }
+
+    return ret;
+}
+
+} // namespace kad
+} // namespace rlite
@@ -0,0 +1,150 @@
+/*
+ * Kademlia routing table and iterative lookups.
+ *
+ * Copyright (C) 2026 agent
+ * Author: agent <agent@local>
+ *
+ * This file is part of rlite.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <string>
+#include <list>
+#include <map>
+#include <vector>
+#include <sstream>
+#include <cstdint>
+
+namespace rlite {
+namespace kad {
+
+/* DHT identifiers. Nodes use their address as identifier, while keys
+ * (e.g. application names) are hashed into the same space. */
+using NodeId = uint64_t;
+
+/* Number of bits in the identifier space, and so number of k-buckets. */
+static constexpr unsigned int kIdBits = 64;
+
+/* The XOR metric. */
+inline uint64_t
+distance(NodeId a, NodeId b)
+{
+    return a ^ b;
+}
+
+/* Map a key into the identifier space. */
+NodeId key_id(const std::string &key);
+
+struct Contact {
+    NodeId id = 0;
+    std::string name; /* name of the IPCP */
+
+    Contact() = default;
+    Contact(NodeId id, const std::string &name) : id(id), name(name) {}
+};
+
+/* The Kademlia routing table. Contacts are organized in kIdBits k-buckets,
+ * where the i-th bucket contains contacts whose distance from ourselves
+ * is in [2^i, 2^(i+1)). Each bucket holds at most k contacts, sorted from
+ * the least recently seen to the most recently seen. */
+class RoutingTable {
+    NodeId self;
+    unsigned int k;
+    std::vector<std::list<Contact>> buckets;
+
+public:
+    RoutingTable(NodeId self, unsigned int k)
+        : self(self), k(k), buckets(kIdBits)
+    {
+    }
+
+    NodeId self_id() const { return self; }
+
+    /* Index of the bucket where @id belongs, or -1 if @id is ourselves. */
+    int bucket_index(NodeId id) const;
+
+    /* Insert a contact or mark it as the most recently seen one. If the
+     * bucket is full, old contacts are preferred (they are more likely to
+     * stay alive) and the new one is discarded. Returns true if the
+     * contact is in the table after the call. */
+    bool update(const Contact &c);
+
+    /* Remove an unresponsive contact. */
+    void remove(NodeId id);
+
+    /* Return up to @n contacts, sorted by increasing distance from
+     * @target. */
+    std::vector<Contact> closest(NodeId target, unsigned int n) const;
+
+    size_t size() const;
+
+    void dump(std::stringstream &ss) const;
+};
+
+/* State of an iterative lookup for a target identifier. At most alpha
+ * queries are in flight at any time, and the lookup terminates when the
+ * k closest contacts known have all been queried. */
+class Lookup {
+    enum class State {
+        Idle = 0,
+        InFlight,
+        Responded,
+        Failed,
+    };
+
+    struct Candidate {
+        Contact contact;
+        State state;
+        unsigned int hops;
+    };
+
+    NodeId target;
+    unsigned int k;
+    unsigned int alpha;
+    unsigned int inflight = 0;
+
+    /* Candidates sorted by distance from the target. */
+    std::map<uint64_t, Candidate> shortlist;
+
+public:
+    Lookup(NodeId target, const std::vector<Contact> &seeds, unsigned int k,
+           unsigned int alpha);
+
+    NodeId target_id() const { return target; }
+
+    /* Select the next contacts to be queried, which are marked as in
+     * flight. */
+    std::vector<Contact> next();
+
+    /* Report that @from answered with a list of @contacts closer to the
+     * target. */
+    void response(NodeId from, const std::vector<Contact> &contacts);
+
+    /* Report that the query to @from failed or timed out. */
+    void failure(NodeId from);
+
+    /* Number of hops needed to reach @id, starting from the seeds (which
+     * are at one hop). */
+    unsigned int hops(NodeId id) const;
+
+    bool finished() const;
+
+    /* The (up to) @n closest contacts that answered. */
+    std::vector<Contact> closest(unsigned int n) const;
+};
+
+} // namespace kad
+} // namespace rlite
@@ -354,8 +354,12 @@ public:
     int rib_handler(const CDAPMessage *rm, const MsgSrcInfo &src) override;
 
     int sync_neigh(const std::shared_ptr<NeighFlow> &nf,
-                   unsigned int limit) const override;
-    int neighs_refresh(size_t limit) override;
+                   const SyncBatch &batch) const override;
+    int neighs_refresh(const SyncBatch &batch) override;
+    bool sync_digest(SyncDigest &d) const override;
+    int sync_neigh_buckets(const std::shared_ptr<NeighFlow> &nf,
+                           const std::vector<bool> &mask,
+                           const SyncBatch &batch) const override;
     void age_incr();
     void age_incr_tmr_restart();
 
@@ -542,24 +546,59 @@ LinkStateRouting::flow_state_update(struct rl_kmsg_flow_state *upd)
     return 0;
 }
 
+static std::string
+lower_flow_key(const gpb::LowerFlow &lf)
+{
+    return lf.local_node() + "\n" + lf.remote_node();
+}
+
+/* The age is not part of the digest, since it is not synchronized
+ * among the IPCPs. */
+bool
+LinkStateRouting::sync_digest(SyncDigest &d) const
+{
+    for (const auto &kvi : re.db) {
+        for (const auto &kvj : kvi.second) {
+            const gpb::LowerFlow &lf = kvj.second;
+            stringstream version;
+
+            version << lf.seqnum() << ":" << lf.cost() << ":" << lf.state();
+            d.add(lower_flow_key(lf), version.str(), lf);
+        }
+    }
+
+    return true;
+}
+
 int
-LinkStateRouting::sync_neigh(const std::shared_ptr<NeighFlow> &nf,
-                             unsigned int limit) const
+LinkStateRouting::sync_neigh_buckets(const std::shared_ptr<NeighFlow> &nf,
+                                     const std::vector<bool> &mask,
+                                     const SyncBatch &batch) const
 {
     gpb::LowerFlowList lfl;
     auto func =
         std::bind(&NeighFlow::sync_obj, nf, true, ObjClass, TableName, &lfl);
-    int ret = 0;
+    SyncBatch b = batch;
+    int ret     = 0;
 
     for (const auto &kvi : re.db) {
         for (const auto &kvj : kvi.second) {
             const gpb::LowerFlow &flow = kvj.second;
+            size_t objbytes;
 
-            *lfl.add_flows() = flow;
-            if (lfl.flows_size() >= static_cast<int>(limit)) {
+            if (!mask.empty() &&
+                !mask[SyncDigest::bucket(lower_flow_key(flow))]) {
+                continue;
+            }
+
+            objbytes = SyncBatch::obj_size(flow);
+            if (b.full(objbytes)) {
                 ret |= func();
                 lfl = gpb::LowerFlowList();
+                b.reset();
             }
+            *lfl.add_flows() = flow;
+            b.add(objbytes);
         }
     }
 
@@ -571,10 +610,24 @@ LinkStateRouting::sync_neigh(const std::shared_ptr<NeighFlow> &nf,
 }
 
 int
-LinkStateRouting::neighs_refresh(size_t limit)
+LinkStateRouting::sync_neigh(const std::shared_ptr<NeighFlow> &nf,
+                             const SyncBatch &batch) const
 {
-    unordered_map<NodeId, gpb::LowerFlow>::iterator jt;
-    int ret = 0;
+    return sync_neigh_buckets(nf, std::vector<bool>(), batch);
+}
+
+/* Renew the local entries that are getting old and propagate them
+ * to the neighbors. Unless digest-based synchronization is enabled,
+ * we also propagate all the other local entries, in case some
+ * neighbor missed them. */
+int
+LinkStateRouting::neighs_refresh(const SyncBatch &batch)
+{
+    bool digest =
+        rib->get_param_value<bool>(UipcpRib::RibDaemonPrefix, "digest-sync");
+    gpb::LowerFlowList lfl;
+    SyncBatch b = batch;
+    int ret     = 0;
 
     if (re.db.size() == 0) {
         /* Still not enrolled to anyone, nothing to do. */
@@ -589,22 +642,31 @@ LinkStateRouting::neighs_refresh(size_t limit)
     auto age_thresh = rib->get_param_value<Msecs>(Routing::Prefix, "age-max");
     age_thresh      = age_thresh * 30 / 100;
 
-    for (auto jt = it->second.begin(); jt != it->second.end();) {
-        gpb::LowerFlowList lfl;
-
-        while (lfl.flows_size() < static_cast<int>(limit) &&
-               jt != it->second.end()) {
-            auto age = Secs(jt->second.age());
+    for (auto &kv : it->second) {
+        gpb::LowerFlow &flow = kv.second;
+        auto age             = Secs(flow.age());
+        size_t objbytes;
+
+        /* Renew the entry by incrementing its sequence number if
+         * we reached ~1/3 of the maximum age. */
+        if (age >= age_thresh) {
+            flow.set_seqnum(flow.seqnum() + 1);
+            flow.set_age(0);
+        } else if (digest) {
+            continue;
+        }
 
-            /* Renew the entry by incrementing its sequence number if
-             * we reached ~1/3 of the maximum age. */
-            if (age >= age_thresh) {
-                jt->second.set_seqnum(jt->second.seqnum() + 1);
-                jt->second.set_age(0);
-            }
-            *lfl.add_flows() = jt->second;
-            jt++;
+        objbytes = SyncBatch::obj_size(flow);
+        if (b.full(objbytes)) {
+            ret |= rib->neighs_sync_obj_all(true, ObjClass, TableName, &lfl);
+            lfl = gpb::LowerFlowList();
+            b.reset();
         }
+        *lfl.add_flows() = flow;
+        b.add(objbytes);
+    }
+
+    if (lfl.flows_size() > 0) {
         ret |= rib->neighs_sync_obj_all(true, ObjClass, TableName, &lfl);
     }
 
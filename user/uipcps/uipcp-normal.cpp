@@ -87,6 +87,9 @@ std::string UipcpRib::LowerFlowObjName = "/mgmt/" + UipcpRib::LowerFlowObjClass;
 std::string UipcpRib::EnrollmentPrefix = "/mgmt/enrollment";
 std::string UipcpRib::ResourceAllocPrefix = "/mgmt/resalloc";
 std::string UipcpRib::RibDaemonPrefix     = "/mgmt/ribd";
+std::string UipcpRib::RibDigestObjClass   = "rib_digest";
+std::string UipcpRib::RibDigestObjName =
+    UipcpRib::RibDaemonPrefix + "/" + UipcpRib::RibDigestObjClass;
 
 std::unordered_map<std::string, std::set<PolicyBuilder>>
     UipcpRib::available_policies;
@@ -137,8 +140,6 @@ apname2string(const gpb::APName &gname)
         gname.ae_instance());
 }
 
-#define MGMTBUF_SIZE_MAX 8092
-
 int
 UipcpRib::mgmt_bound_flow_write(const struct rl_mgmt_hdr *mhdr, void *buf,
                                 size_t buflen)
@@ -487,6 +488,7 @@ UipcpRib::UipcpRib(struct uipcp *_u)
     dt_constants.set_max_rtx_time(1000 /* ms */);
     dt_constants.set_max_ack_delay(200 /* ms */);
     dt_constants.set_ctrl_seq_num_width(dt_constants.seq_num_width());
+    dt_constants.set_compact_pci(false);
 
     params_map[UipcpRib::EnrollmentPrefix]["timeout"] =
         PolicyParam(Msecs(int(kEnrollTimeoutMsecs)));
@@ -502,8 +504,13 @@ UipcpRib::UipcpRib(struct uipcp *_u)
         PolicyParam(false);
     params_map[UipcpRib::ResourceAllocPrefix]["broadcast-enroller"] =
         PolicyParam(true);
+    params_map[UipcpRib::ResourceAllocPrefix]["compact-pci"] =
+        PolicyParam(false);
     params_map[UipcpRib::RibDaemonPrefix]["refresh-intval"] =
         PolicyParam(Secs(int(kRIBRefreshIntvalSecs)));
+    params_map[UipcpRib::RibDaemonPrefix]["digest-sync"] = PolicyParam(true);
+    params_map[UipcpRib::RibDaemonPrefix]["sync-batch"] =
+        PolicyParam(0, 0, 65535);
 
     policy_mod(FlowAllocator::Prefix, "local");
     assert(fa);
@@ -525,6 +532,11 @@ UipcpRib::UipcpRib(struct uipcp *_u)
                              return keepalive_handler(rm, src);
                          });
 
+    rib_handler_register(RibDigestObjName,
+                         [this](const CDAPMessage *rm, const MsgSrcInfo &src) {
+                             return sync_digest_handler(rm, src);
+                         });
+
     rib_handler_register(StatusObjName,
                          [this](const CDAPMessage *rm, const MsgSrcInfo &src) {
                              return status_handler(rm, src);
@@ -823,7 +835,17 @@ UipcpRib::dump_stats(std::stringstream &ss) const
         {"fa_request_issued", stats.fa_request_issued},
         {"fa_response_received", stats.fa_response_received},
         {"fa_request_received", stats.fa_request_received},
-        {"fa_response_issued", stats.fa_response_issued}};
+        {"fa_response_issued", stats.fa_response_issued},
+        {"sync_digest_sent", stats.sync_digest_sent},
+        {"sync_digest_received", stats.sync_digest_received},
+        {"sync_buckets_pushed", stats.sync_buckets_pushed},
+        {"sync_objs_pushed", stats.sync_objs_pushed},
+        {"sync_objs_saved", stats.sync_objs_saved},
+        {"sync_msgs_saved", stats.sync_msgs_saved},
+        {"sync_bytes_saved", stats.sync_bytes_saved},
+        {"sync_rib_count", stats.sync_rib_count},
+        {"sync_rib_last_usecs", stats.sync_rib_last_usecs},
+        {"sync_rib_max_usecs", stats.sync_rib_max_usecs}};
 
     ss << "Uipcp stats:" << std::endl;
     for (const auto &p : pairs) {
@@ -1466,6 +1488,15 @@ UipcpRib::policy_param_mod(const std::string &component,
         components[component]->reconfigure();
     }
 
+    /* The PCI format is a data transfer constant, which is transferred to
+     * the IPCPs enrolling from now on. */
+    if (component == UipcpRib::ResourceAllocPrefix &&
+        param_name == "compact-pci") {
+        dt_constants.set_compact_pci(
+            get_param_value<bool>(UipcpRib::ResourceAllocPrefix, param_name));
+        update_pci();
+    }
+
     /* Fix-ups. */
     if (params_map[EnrollmentPrefix].count("nack-wait")) {
         auto eto =
@@ -1727,6 +1758,24 @@ UipcpRib::update_ttl()
     return 0;
 }
 
+int
+UipcpRib::update_pci()
+{
+    const char *pci = dt_constants.compact_pci() ? "compact" : "full";
+
+    /* Keep the policy parameter in sync, as the data transfer constants
+     * may have been received with the enrollment. */
+    params_map[UipcpRib::ResourceAllocPrefix]["compact-pci"].value.b =
+        dt_constants.compact_pci();
+
+    if (rl_conf_ipcp_config(uipcp->id, "pci", pci)) {
+        UPE(uipcp, "Failed to configure PCI format %s for IPCP %s\n", pci,
+            uipcp->name);
+    }
+
+    return 0;
+}
+
 int
 UipcpRib::policy_list(const struct rl_cmsg_ipcp_policy_list_req *req,
                       stringstream &msg)
@@ -30,6 +30,7 @@
 #include <unordered_set>
 #include <set>
 #include <list>
+#include <vector>
 #include <ctime>
 #include <sstream>
 #include <utility>
@@ -71,6 +72,9 @@ namespace rlite {
 using Msecs = std::chrono::milliseconds;
 using Secs  = std::chrono::seconds;
 
+/* Maximum size of a management SDU. */
+#define MGMTBUF_SIZE_MAX 8092
+
 enum class PolicyParamType {
     Int = 0,
     Bool,
@@ -170,6 +174,12 @@ struct NeighFlow {
      * or were we the target? */
     bool initiator = false;
 
+    /* Maximum SDU size of the flow, or 0 if not known yet. */
+    unsigned int mss = 0;
+
+    /* MSS assumed when the actual one cannot be retrieved. */
+    static constexpr unsigned int kDefaultMss = 1400;
+
     /* Statistics about management traffic. */
     struct {
         struct {
@@ -195,6 +205,7 @@ struct NeighFlow {
     int sync_obj(bool create, const std::string &obj_class,
                  const std::string &obj_name,
                  const ::google::protobuf::MessageLite *obj = nullptr);
+    size_t max_msg_size();
 
     static std::string KeepaliveObjName;
     static std::string KeepaliveObjClass;
@@ -282,6 +293,48 @@ struct MsgSrcInfo {
     }
 };
 
+/* Packs RIB objects into as few messages as possible when synchronizing
+ * with neighbors, without exceeding the maximum number of objects (if any)
+ * and the maximum size allowed for a message. The current batch must be
+ * flushed when full() returns true, before adding the next object. */
+struct SyncBatch {
+    unsigned int max_objs = 0; /* 0 means no limit */
+    size_t max_bytes      = MGMTBUF_SIZE_MAX;
+    unsigned int objs     = 0;
+    size_t bytes          = 0;
+
+    /* Encoding overhead of an object within a repeated field. */
+    static constexpr size_t kObjOverhead = 4;
+
+    static size_t obj_size(const ::google::protobuf::MessageLite &obj);
+    bool full(size_t objbytes) const;
+    void add(size_t objbytes);
+    void reset() { objs = bytes = 0; }
+    uint64_t msgs(uint64_t nobjs, uint64_t nbytes) const;
+};
+
+/* Summary of a table replicated among the IPCPs of a DIF, used to
+ * synchronize with a neighbor only the parts of the table that differ.
+ * Entries are spread over kBuckets buckets by hashing their key, and the
+ * hash of a bucket combines the hashes of its entries (key and version,
+ * but not volatile fields like the age) in an order-independent way. */
+struct SyncDigest {
+    static constexpr size_t kBuckets = 64;
+
+    std::vector<uint64_t> hashes;
+    std::vector<uint32_t> objs;  /* number of entries per bucket */
+    std::vector<uint64_t> bytes; /* serialized size of each bucket */
+
+    SyncDigest() : hashes(kBuckets, 0), objs(kBuckets, 0), bytes(kBuckets, 0)
+    {
+    }
+
+    static size_t bucket(const std::string &key);
+    void add(const std::string &key, const std::string &version,
+             const ::google::protobuf::MessageLite &obj);
+    uint64_t root() const;
+};
+
 /* Base class for all the component of a normal IPCP. */
 struct Component {
     /* Dump the current state of the component. */
@@ -303,11 +356,25 @@ struct Component {
      * objects to a single neighbor, while the other is used to send the
      * local objects to all the neighbors. */
     virtual int sync_neigh(const std::shared_ptr<NeighFlow> &nf,
-                           unsigned int limit) const
+                           const SyncBatch &batch) const
+    {
+        return 0;
+    }
+    virtual int neighs_refresh(const SyncBatch &batch) { return 0; }
+
+    /* Components that replicate a table among all the IPCPs of the DIF
+     * may also support digest-based synchronization. The first method
+     * computes the digest of the local table (returning false if digests
+     * are not supported), while the second one sends to a neighbor the
+     * local entries that belong to the buckets selected by @mask (all
+     * the buckets if @mask is empty). */
+    virtual bool sync_digest(SyncDigest &d) const { return false; }
+    virtual int sync_neigh_buckets(const std::shared_ptr<NeighFlow> &nf,
+                                   const std::vector<bool> &mask,
+                                   const SyncBatch &batch) const
     {
         return 0;
     }
-    virtual int neighs_refresh(size_t limit) { return 0; }
     virtual ~Component() {}
 };
 
@@ -548,6 +615,12 @@ struct UipcpRib {
      * to the object. */
     std::unordered_map<std::string, std::shared_ptr<Neighbor>> neighbors;
     std::unordered_map<std::string, gpb::NeighborCandidate> neighbors_seen;
+    /* Reverse index of neighbors_seen, from addresses to names. More than
+     * one neighbor may use the same address while an address conflict is
+     * being resolved (see check_for_address_conflicts()). The index is
+     * kept in sync by neighbor_seen_update() and neighbor_seen_remove(),
+     * which must be used to modify neighbors_seen. */
+    std::unordered_multimap<rlm_addr_t, std::string> neighbors_seen_by_addr;
     std::unordered_set<std::string> neighbors_cand;
     std::unordered_set<std::string> neighbors_deleted;
 
@@ -608,12 +681,26 @@ struct UipcpRib {
         uint64_t fa_response_received;
         uint64_t fa_request_received;
         uint64_t fa_response_issued;
+        uint64_t sync_digest_sent;
+        uint64_t sync_digest_received;
+        uint64_t sync_buckets_pushed;
+        uint64_t sync_objs_pushed;
+        uint64_t sync_objs_saved;
+        uint64_t sync_msgs_saved;
+        uint64_t sync_bytes_saved;
+        uint64_t sync_rib_count;
+        uint64_t sync_rib_last_usecs;
+        uint64_t sync_rib_max_usecs;
     } stats;
 
     /* Time interval (in seconds) between two consecutive periodic
      * RIB synchronizations. */
     static constexpr int kRIBRefreshIntvalSecs = 30;
 
+    /* Space reserved for PCI and CDAP header in RIB synchronization
+     * messages. */
+    static constexpr size_t kRIBSyncHeadroom = 128;
+
     /* Default value for keepalive parameters. */
     static constexpr int kKeepaliveTimeoutSecs = 20;
     static constexpr int kKeepaliveThresh      = 3;
@@ -638,6 +725,8 @@ struct UipcpRib {
     static std::string LowerFlowObjName;
     static std::string ResourceAllocPrefix;
     static std::string RibDaemonPrefix;
+    static std::string RibDigestObjClass;
+    static std::string RibDigestObjName;
 
     RL_NODEFAULT_NONCOPIABLE(UipcpRib);
     UipcpRib(struct uipcp *_u, void *test);
@@ -664,9 +753,13 @@ struct UipcpRib {
     int set_address(rlm_addr_t address);
     void update_address(rlm_addr_t new_addr);
     rlm_addr_t lookup_node_address(const std::string &node_name) const;
-    std::string lookup_neighbor_by_address(rlm_addr_t address);
+    std::string lookup_neighbor_by_address(rlm_addr_t address) const;
+    void neighbor_seen_update(const std::string &name,
+                              const gpb::NeighborCandidate &cand);
+    void neighbor_seen_remove(const std::string &name);
     void check_for_address_conflicts();
     int update_ttl();
+    int update_pci();
 
     gpb::NeighborCandidate neighbor_cand_get() const;
     int lookup_neigh_flow_by_port_id(rl_port_t port_id,
@@ -712,6 +805,10 @@ struct UipcpRib {
         bool create, const std::string &obj_class, const std::string &obj_name,
         const ::google::protobuf::MessageLite *obj = nullptr) const;
     int sync_rib(const std::shared_ptr<NeighFlow> &nf);
+    SyncBatch sync_batch(const std::shared_ptr<NeighFlow> &nf);
+    std::vector<std::pair<std::string, const Component *>> sync_tables() const;
+    int sync_digest_send(const std::shared_ptr<NeighFlow> &nf,
+                         const gpb::RibDigest &rd);
 
     /* Receive info from neighbors. */
     int cdap_dispatch(const CDAPMessage *rm, const MsgSrcInfo &src);
@@ -721,6 +818,7 @@ struct UipcpRib {
 
     int neighbors_handler(const CDAPMessage *rm, const MsgSrcInfo &src);
     int keepalive_handler(const CDAPMessage *rm, const MsgSrcInfo &src);
+    int sync_digest_handler(const CDAPMessage *rm, const MsgSrcInfo &src);
     int status_handler(const CDAPMessage *rm, const MsgSrcInfo &src);
 
     int lowerflow_handler(const CDAPMessage *rm, const MsgSrcInfo &src);
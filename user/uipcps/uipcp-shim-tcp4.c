@@ -29,6 +29,8 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sys/inotify.h>
 
 #include "rlite/list.h"
 #include "uipcp-container.h"
@@ -50,88 +52,169 @@ struct tcp4_endpoint {
     struct list_head node;
 };
 
+struct tcp4_dir_entry {
+    char *appl_name;
+    struct sockaddr_in addr;
+    int in_dif; /* entry refers to our DIF */
+
+    struct list_head name_node;
+    struct list_head addr_node;
+    struct list_head node;
+};
+
+/* In-memory copy of the directory file, indexed both by application name
+ * (only the entries for our DIF) and by IP address. Entries are inserted
+ * in file order, so that the first matching line wins, as it happens when
+ * scanning the file. */
+struct tcp4_dir {
+    unsigned int num_buckets;
+    struct list_head *by_name;
+    struct list_head *by_addr;
+    struct list_head entries;
+    unsigned int num_entries;
+};
+
 struct shim_tcp4 {
     struct uipcp *uipcp;
     char *dif_name; /* Name of my DIF. */
     struct list_head endpoints;
     struct list_head bindpoints;
     uint32_t kevent_id_cnt;
+
+    /* Directory, replaced as a whole on reload. The lock is needed because
+     * explicit reloads come from the configuration thread. */
+    pthread_mutex_t dir_lock;
+    struct tcp4_dir *dir;
+    int inotify_fd;
 };
 
 #define SHIM(_u) ((struct shim_tcp4 *)((_u)->priv))
 
+#define TCP4_DIR_PATH "/etc/rina"
+#define TCP4_DIR_FILE "shim-tcp4-dir"
+#define TCP4_DIR_MIN_BUCKETS 64
+
+static void
+dir_free(struct tcp4_dir *dir)
+{
+    struct tcp4_dir_entry *e, *tmp;
+
+    if (!dir) {
+        return;
+    }
+
+    list_for_each_entry_safe (e, tmp, &dir->entries, node) {
+        list_del(&e->node);
+        rl_free(e->appl_name, RL_MT_SHIMDATA);
+        rl_free(e, RL_MT_SHIMDATA);
+    }
+    if (dir->by_name) {
+        rl_free(dir->by_name, RL_MT_SHIMDATA);
+    }
+    if (dir->by_addr) {
+        rl_free(dir->by_addr, RL_MT_SHIMDATA);
+    }
+    rl_free(dir, RL_MT_SHIMDATA);
+}
+
+/* Parse the next directory line, splitting it in place into the name, IP,
+ * port and DIF fields. Returns 0 if the line is well formed. */
 static int
-parse_directory(struct shim_tcp4 *shim, int appl2sock, struct sockaddr_in *addr,
-                char **appl_name)
+parse_directory_line(char *linebuf, char **nm_out, char **ip_out,
+                     char **port_out, char **shnm_out)
+{
+    /* I know, strtok_r, strsep, etc. etc. I just wanted to have
+     * some fun ;) */
+    char *nm = linebuf;
+    char *ip, *port, *shnm, *eol;
+
+    while (*nm != '\0' && isspace(*nm))
+        nm++;
+    if (*nm == '\0')
+        return -1;
+
+    ip = nm;
+    while (*ip != '\0' && !isspace(*ip))
+        ip++;
+    if (*ip == '\0')
+        return -1;
+
+    *ip = '\0';
+    ip++;
+    while (*ip != '\0' && isspace(*ip))
+        ip++;
+    if (*ip == '\0')
+        return -1;
+
+    port = ip;
+    while (*port != '\0' && !isspace(*port))
+        port++;
+    if (*port == '\0')
+        return -1;
+
+    *port = '\0';
+    port++;
+    while (*port != '\0' && isspace(*port))
+        port++;
+    if (*port == '\0')
+        return -1;
+
+    shnm = port;
+    while (*shnm != '\0' && !isspace(*shnm))
+        shnm++;
+    if (*shnm == '\0')
+        return -1;
+
+    *shnm = '\0';
+    shnm++;
+    while (*shnm != '\0' && isspace(*shnm))
+        shnm++;
+
+    eol = shnm;
+    while (*eol != '\0' && !isspace(*eol))
+        eol++;
+    if (*eol != '\0')
+        *eol = '\0';
+
+    *nm_out   = nm;
+    *ip_out   = ip;
+    *port_out = port;
+    *shnm_out = shnm;
+
+    return 0;
+}
+
+/* Load the whole directory file into a new tcp4_dir. */
+static struct tcp4_dir *
+parse_directory(struct shim_tcp4 *shim)
 {
-    const char *dirfile = "/etc/rina/shim-tcp4-dir";
+    const char *dirfile = TCP4_DIR_PATH "/" TCP4_DIR_FILE;
+    struct tcp4_dir *dir;
+    struct list_head entries;
+    unsigned int num_entries = 0;
+    struct tcp4_dir_entry *e, *tmp;
     FILE *fin;
     char *linebuf = NULL;
     size_t sz;
     ssize_t n;
-    int found = 0;
+    unsigned int i;
 
     fin = fopen(dirfile, "r");
     if (!fin) {
         UPE(shim->uipcp, "Could not open directory file '%s'\n", dirfile);
-        return -1;
+        return NULL;
     }
 
-    while (!found && (n = getline(&linebuf, &sz, fin)) > 0) {
-        /* I know, strtok_r, strsep, etc. etc. I just wanted to have
-         * some fun ;) */
-        char *nm = linebuf;
-        char *ip, *port, *shnm, *eol;
+    list_init(&entries);
+
+    while ((n = getline(&linebuf, &sz, fin)) > 0) {
+        char *nm, *ip, *port, *shnm;
         struct sockaddr_in cur_addr;
         int ret;
 
-        while (*nm != '\0' && isspace(*nm))
-            nm++;
-        if (*nm == '\0')
-            continue;
-
-        ip = nm;
-        while (*ip != '\0' && !isspace(*ip))
-            ip++;
-        if (*ip == '\0')
-            continue;
-
-        *ip = '\0';
-        ip++;
-        while (*ip != '\0' && isspace(*ip))
-            ip++;
-        if (*ip == '\0')
-            continue;
-
-        port = ip;
-        while (*port != '\0' && !isspace(*port))
-            port++;
-        if (*port == '\0')
+        if (parse_directory_line(linebuf, &nm, &ip, &port, &shnm)) {
             continue;
-
-        *port = '\0';
-        port++;
-        while (*port != '\0' && isspace(*port))
-            port++;
-        if (*port == '\0')
-            continue;
-
-        shnm = port;
-        while (*shnm != '\0' && !isspace(*shnm))
-            shnm++;
-        if (*shnm == '\0')
-            continue;
-
-        *shnm = '\0';
-        shnm++;
-        while (*shnm != '\0' && isspace(*shnm))
-            shnm++;
-
-        eol = shnm;
-        while (*eol != '\0' && !isspace(*eol))
-            eol++;
-        if (*eol != '\0')
-            *eol = '\0';
+        }
 
         memset(&cur_addr, 0, sizeof(cur_addr));
         cur_addr.sin_family = AF_INET;
@@ -142,52 +225,198 @@ parse_directory(struct shim_tcp4 *shim, int appl2sock, struct sockaddr_in *addr,
             continue;
         }
 
-        if (appl2sock) {
-            if (strcmp(nm, *appl_name) == 0 &&
-                strcmp(shnm, shim->dif_name) == 0) {
-                memcpy(addr, &cur_addr, sizeof(cur_addr));
-                found = 1;
-            }
-
-        } else { /* sock2appl */
-            if (addr->sin_family == cur_addr.sin_family &&
-                /* addr->sin_port == cur_addr.sin_port && */
-                memcmp(&addr->sin_addr, &cur_addr.sin_addr,
-                       sizeof(cur_addr.sin_addr)) == 0) {
-                *appl_name = rl_strdup(nm, RL_MT_SHIMDATA);
-                if (!(*appl_name)) {
-                    UPE(shim->uipcp, "Out of memory\n");
-                    found = 0;
-                } else {
-                    found = 1;
-                }
-            }
+        e = rl_alloc(sizeof(*e), RL_MT_SHIMDATA);
+        if (!e) {
+            UPE(shim->uipcp, "Out of memory\n");
+            goto err;
+        }
+        memset(e, 0, sizeof(*e));
+        e->appl_name = rl_strdup(nm, RL_MT_SHIMDATA);
+        if (!e->appl_name) {
+            UPE(shim->uipcp, "Out of memory\n");
+            rl_free(e, RL_MT_SHIMDATA);
+            goto err;
         }
+        memcpy(&e->addr, &cur_addr, sizeof(cur_addr));
+        e->in_dif = strcmp(shnm, shim->dif_name) == 0;
+        list_add_tail(&e->node, &entries);
+        num_entries++;
 
         NPD("dir '%s' '%s'[%d] '%d'\n", nm, ip, ret, atoi(port));
     }
 
+    dir = rl_alloc(sizeof(*dir), RL_MT_SHIMDATA);
+    if (!dir) {
+        UPE(shim->uipcp, "Out of memory\n");
+        goto err;
+    }
+    memset(dir, 0, sizeof(*dir));
+    list_init(&dir->entries);
+
+    /* Keep the load factor below one. */
+    dir->num_buckets = TCP4_DIR_MIN_BUCKETS;
+    while (dir->num_buckets < num_entries) {
+        dir->num_buckets <<= 1;
+    }
+    dir->by_name =
+        rl_alloc(dir->num_buckets * sizeof(struct list_head), RL_MT_SHIMDATA);
+    dir->by_addr =
+        rl_alloc(dir->num_buckets * sizeof(struct list_head), RL_MT_SHIMDATA);
+    if (!dir->by_name || !dir->by_addr) {
+        UPE(shim->uipcp, "Out of memory\n");
+        dir_free(dir);
+        goto err;
+    }
+    for (i = 0; i < dir->num_buckets; i++) {
+        list_init(&dir->by_name[i]);
+        list_init(&dir->by_addr[i]);
+    }
+
+    list_for_each_entry_safe (e, tmp, &entries, node) {
+        list_del(&e->node);
+        list_add_tail(&e->node, &dir->entries);
+        list_add_tail(&e->addr_node,
+                      &dir->by_addr[rl_u32_hash(e->addr.sin_addr.s_addr) &
+                                    (dir->num_buckets - 1)]);
+        if (e->in_dif) {
+            list_add_tail(&e->name_node,
+                          &dir->by_name[rl_str_hash(e->appl_name) &
+                                        (dir->num_buckets - 1)]);
+        } else {
+            list_init(&e->name_node);
+        }
+    }
+    dir->num_entries = num_entries;
+
     if (linebuf) {
         free(linebuf);
     }
+    fclose(fin);
 
+    return dir;
+err:
+    list_for_each_entry_safe (e, tmp, &entries, node) {
+        list_del(&e->node);
+        rl_free(e->appl_name, RL_MT_SHIMDATA);
+        rl_free(e, RL_MT_SHIMDATA);
+    }
+    if (linebuf) {
+        free(linebuf);
+    }
     fclose(fin);
 
-    return found ? 0 : -1;
+    return NULL;
+}
+
+/* Reload the directory from file, replacing the current one only if
+ * the new one could be loaded. */
+static int
+directory_reload(struct shim_tcp4 *shim)
+{
+    struct tcp4_dir *dir = parse_directory(shim);
+    struct tcp4_dir *old;
+
+    if (!dir) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&shim->dir_lock);
+    old       = shim->dir;
+    shim->dir = dir;
+    pthread_mutex_unlock(&shim->dir_lock);
+
+    dir_free(old);
+    UPD(shim->uipcp, "Directory loaded with %u entries\n", dir->num_entries);
+
+    return 0;
+}
+
+/* Called when something changes in the directory containing the
+ * directory file. */
+static void
+directory_changed(struct uipcp *uipcp, int ifd, void *opaque)
+{
+    struct shim_tcp4 *shim = SHIM(uipcp);
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int reload = 0;
+    ssize_t n;
+
+    while ((n = read(ifd, buf, sizeof(buf))) > 0) {
+        char *p;
+
+        for (p = buf; p < buf + n;) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+
+            if (ev->len && strcmp(ev->name, TCP4_DIR_FILE) == 0) {
+                reload = 1;
+            }
+            p += sizeof(*ev) + ev->len;
+        }
+    }
+
+    if (reload) {
+        directory_reload(shim);
+    }
 }
 
 static int
 appl_name_to_sock_addr(struct shim_tcp4 *shim, const char *appl_name,
                        struct sockaddr_in *addr)
 {
-    return parse_directory(shim, 1, addr, (char **)&appl_name);
+    struct tcp4_dir_entry *e;
+    int ret = -1;
+
+    pthread_mutex_lock(&shim->dir_lock);
+    if (shim->dir) {
+        struct tcp4_dir *dir = shim->dir;
+        struct list_head *bucket =
+            &dir->by_name[rl_str_hash(appl_name) & (dir->num_buckets - 1)];
+
+        list_for_each_entry (e, bucket, name_node) {
+            if (strcmp(e->appl_name, appl_name) == 0) {
+                memcpy(addr, &e->addr, sizeof(*addr));
+                ret = 0;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&shim->dir_lock);
+
+    return ret;
 }
 
 static int
 sock_addr_to_appl_name(struct shim_tcp4 *shim, const struct sockaddr_in *addr,
                        char **appl_name)
 {
-    return parse_directory(shim, 0, (struct sockaddr_in *)addr, appl_name);
+    struct tcp4_dir_entry *e;
+    int ret = -1;
+
+    pthread_mutex_lock(&shim->dir_lock);
+    if (shim->dir) {
+        struct tcp4_dir *dir = shim->dir;
+        struct list_head *bucket =
+            &dir->by_addr[rl_u32_hash(addr->sin_addr.s_addr) &
+                          (dir->num_buckets - 1)];
+
+        list_for_each_entry (e, bucket, addr_node) {
+            if (addr->sin_family == e->addr.sin_family &&
+                /* addr->sin_port == e->addr.sin_port && */
+                memcmp(&addr->sin_addr, &e->addr.sin_addr,
+                       sizeof(e->addr.sin_addr)) == 0) {
+                *appl_name = rl_strdup(e->appl_name, RL_MT_SHIMDATA);
+                if (!(*appl_name)) {
+                    UPE(shim->uipcp, "Out of memory\n");
+                } else {
+                    ret = 0;
+                }
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&shim->dir_lock);
+
+    return ret;
 }
 
 static int
@@ -573,6 +802,30 @@ shim_tcp4_init(struct uipcp *uipcp)
     list_init(&shim->bindpoints);
     shim->kevent_id_cnt = 1;
 
+    /* Load the directory once, and reload it only when the file changes
+     * or when explicitly asked to. A missing file is not fatal, since
+     * it may be created later. We watch the parent directory to catch
+     * files that are replaced by means of rename(). */
+    pthread_mutex_init(&shim->dir_lock, NULL);
+    shim->dir = NULL;
+    directory_reload(shim);
+
+    shim->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (shim->inotify_fd < 0) {
+        UPW(uipcp, "inotify_init1() failed [%s], directory changes need "
+                   "an explicit reload\n",
+            strerror(errno));
+    } else if (inotify_add_watch(shim->inotify_fd, TCP4_DIR_PATH,
+                                 IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        UPW(uipcp, "inotify_add_watch(%s) failed [%s], directory changes "
+                   "need an explicit reload\n",
+            TCP4_DIR_PATH, strerror(errno));
+        close(shim->inotify_fd);
+        shim->inotify_fd = -1;
+    } else {
+        uipcp_loop_fdh_add(uipcp, shim->inotify_fd, directory_changed, NULL);
+    }
+
     return 0;
 }
 
@@ -602,12 +855,32 @@ shim_tcp4_fini(struct uipcp *uipcp)
         }
     }
 
+    if (shim->inotify_fd >= 0) {
+        uipcp_loop_fdh_del(uipcp, shim->inotify_fd);
+        close(shim->inotify_fd);
+    }
+    dir_free(shim->dir);
+    pthread_mutex_destroy(&shim->dir_lock);
+
     rl_free(shim->dif_name, RL_MT_SHIMDATA);
     rl_free(shim, RL_MT_SHIM);
 
     return 0;
 }
 
+static int
+shim_tcp4_config(struct uipcp *uipcp, const struct rl_cmsg_ipcp_config *cmsg)
+{
+    struct shim_tcp4 *shim = SHIM(uipcp);
+
+    if (strcmp(cmsg->name, "dir-reload") == 0) {
+        return directory_reload(shim);
+    }
+
+    /* We don't know how to handle this request. */
+    return ENOSYS;
+}
+
 struct uipcp_ops shim_tcp4_ops = {
     .init             = shim_tcp4_init,
     .fini             = shim_tcp4_fini,
@@ -615,4 +888,5 @@ struct uipcp_ops shim_tcp4_ops = {
     .fa_req           = shim_tcp4_fa_req,
     .fa_resp          = shim_tcp4_fa_resp,
     .flow_deallocated = shim_tcp4_flow_deallocated,
+    .config           = shim_tcp4_config,
 };
@@ -33,6 +33,9 @@
 #include <netdb.h>
 #include <netinet/udp.h>
 #include <netinet/ip.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/eventfd.h>
 
 #include "rlite/list.h"
 #include "uipcp-container.h"
@@ -44,7 +47,9 @@ struct udp4_endpoint {
     struct sockaddr_in remote_addr;
     rl_port_t port_id;
     uint32_t kevent_id;
+    int hashed; /* linked in the endpoint table */
     struct list_head tmpq;
+    struct list_head hnode;
     struct list_head node;
 };
 
@@ -65,6 +70,51 @@ struct udp4_bindpoint {
     struct list_head node;
 };
 
+enum {
+    UDP4_RES_NAME2ADDR = 0,
+    UDP4_RES_ADDR2NAME,
+};
+
+/* What to do when a resolution completes. */
+enum {
+    UDP4_CTX_REGISTER = 0, /* application registration */
+    UDP4_CTX_FA_REQ,       /* local flow allocation request */
+    UDP4_CTX_INCOMING,     /* first packet of an incoming flow */
+};
+
+/* A name resolution request, performed by the resolver thread, so that
+ * the uipcp loop never blocks on getaddrinfo() and getnameinfo(). */
+struct udp4_resolution {
+    int type;
+    int ctx;
+    char *name;              /* input for NAME2ADDR, output for ADDR2NAME */
+    struct sockaddr_in addr; /* output for NAME2ADDR, input for ADDR2NAME */
+    int result;              /* 0 on success */
+    uint32_t event_id;       /* for UDP4_CTX_REGISTER */
+    uint32_t kevent_id;      /* endpoint, for UDP4_CTX_FA_REQ/INCOMING */
+    char *local_appl;        /* for UDP4_CTX_INCOMING */
+    struct list_head node;
+};
+
+/* Resolver cache entry. Both successful and failed resolutions are
+ * cached, the latter for a shorter time. */
+struct udp4_cache_entry {
+    int type;
+    char *key; /* name, or IP address in dotted notation */
+    char *name;
+    struct sockaddr_in addr;
+    int result;
+    time_t expire;
+    struct list_head hnode; /* cache bucket */
+    struct list_head lnode; /* insertion order */
+};
+
+#define UDP4_CACHE_BUCKETS 256
+#define UDP4_CACHE_MAX_ENTRIES 4096
+#define UDP4_CACHE_TTL_SECS 30
+#define UDP4_CACHE_NEG_TTL_SECS 5
+#define UDP4_EP_MIN_BUCKETS 64
+
 struct shim_udp4 {
     struct uipcp *uipcp;
 
@@ -75,6 +125,27 @@ struct shim_udp4 {
     struct list_head endpoints;
     struct list_head bindpoints;
     uint32_t kevent_id_cnt;
+
+    /* Endpoints indexed by remote address, to dispatch received
+     * datagrams. */
+    struct list_head *ep_table;
+    unsigned int ep_table_buckets;
+    unsigned int ep_table_entries;
+
+    /* Resolver thread, with its request and completion queues. The
+     * eventfd is used to signal completions to the uipcp loop. */
+    pthread_t resolver_th;
+    pthread_mutex_t res_lock;
+    pthread_cond_t res_cond;
+    struct list_head res_pending;
+    struct list_head res_done;
+    int res_stop;
+    int res_efd;
+
+    /* Resolver cache, only accessed by the uipcp loop. */
+    struct list_head cache_table[UDP4_CACHE_BUCKETS];
+    struct list_head cache_age;
+    unsigned int cache_entries;
 };
 
 #define SHIM(_u) ((struct shim_udp4 *)((_u)->priv))
@@ -162,6 +233,240 @@ ipaddr_to_rina_name(struct shim_udp4 *shim, char **name,
     return 0;
 }
 
+static void
+udp4_resolution_free(struct udp4_resolution *res)
+{
+    if (res->name) {
+        rl_free(res->name, RL_MT_SHIMDATA);
+    }
+    if (res->local_appl) {
+        rl_free(res->local_appl, RL_MT_SHIMDATA);
+    }
+    rl_free(res, RL_MT_SHIMDATA);
+}
+
+static struct udp4_resolution *
+udp4_resolution_alloc(struct shim_udp4 *shim, int type, int ctx,
+                      const char *name)
+{
+    struct udp4_resolution *res = rl_alloc(sizeof(*res), RL_MT_SHIMDATA);
+
+    if (!res) {
+        UPE(shim->uipcp, "Out of memory\n");
+        return NULL;
+    }
+    memset(res, 0, sizeof(*res));
+    res->type = type;
+    res->ctx  = ctx;
+    if (name) {
+        res->name = rl_strdup(name, RL_MT_SHIMDATA);
+        if (!res->name) {
+            UPE(shim->uipcp, "Out of memory\n");
+            rl_free(res, RL_MT_SHIMDATA);
+            return NULL;
+        }
+    }
+
+    return res;
+}
+
+/* The cache key is the name for forward lookups and the IP address for
+ * reverse lookups. */
+static const char *
+udp4_cache_key(const struct udp4_resolution *res, char *buf, size_t len)
+{
+    if (res->type == UDP4_RES_NAME2ADDR) {
+        return res->name;
+    }
+
+    return inet_ntop(AF_INET, &res->addr.sin_addr, buf, len);
+}
+
+static void
+udp4_cache_entry_free(struct shim_udp4 *shim, struct udp4_cache_entry *ce)
+{
+    list_del(&ce->hnode);
+    list_del(&ce->lnode);
+    shim->cache_entries--;
+    rl_free(ce->key, RL_MT_SHIMDATA);
+    if (ce->name) {
+        rl_free(ce->name, RL_MT_SHIMDATA);
+    }
+    rl_free(ce, RL_MT_SHIMDATA);
+}
+
+static struct udp4_cache_entry *
+udp4_cache_lookup(struct shim_udp4 *shim, int type, const char *key)
+{
+    struct list_head *bucket =
+        &shim->cache_table[rl_str_hash(key) % UDP4_CACHE_BUCKETS];
+    struct udp4_cache_entry *ce, *tmp;
+
+    list_for_each_entry_safe (ce, tmp, bucket, hnode) {
+        if (ce->type == type && strcmp(ce->key, key) == 0) {
+            if (ce->expire <= time(NULL)) {
+                udp4_cache_entry_free(shim, ce);
+                return NULL;
+            }
+            return ce;
+        }
+    }
+
+    return NULL;
+}
+
+static void
+udp4_cache_insert(struct shim_udp4 *shim, const struct udp4_resolution *res)
+{
+    char strbuf[INET_ADDRSTRLEN];
+    struct udp4_cache_entry *ce;
+    const char *key;
+
+    key = udp4_cache_key(res, strbuf, sizeof(strbuf));
+    if (!key) {
+        return;
+    }
+
+    ce = udp4_cache_lookup(shim, res->type, key);
+    if (ce) {
+        udp4_cache_entry_free(shim, ce);
+    }
+
+    if (shim->cache_entries >= UDP4_CACHE_MAX_ENTRIES) {
+        /* Evict the oldest entry. */
+        udp4_cache_entry_free(shim, list_first_entry(&shim->cache_age,
+                                                     struct udp4_cache_entry,
+                                                     lnode));
+    }
+
+    ce = rl_alloc(sizeof(*ce), RL_MT_SHIMDATA);
+    if (!ce) {
+        return;
+    }
+    memset(ce, 0, sizeof(*ce));
+    ce->type   = res->type;
+    ce->result = res->result;
+    ce->key    = rl_strdup(key, RL_MT_SHIMDATA);
+    if (res->result == 0 && res->name) {
+        ce->name = rl_strdup(res->name, RL_MT_SHIMDATA);
+    }
+    if (!ce->key || (res->result == 0 && res->name && !ce->name)) {
+        if (ce->key) {
+            rl_free(ce->key, RL_MT_SHIMDATA);
+        }
+        rl_free(ce, RL_MT_SHIMDATA);
+        return;
+    }
+    memcpy(&ce->addr, &res->addr, sizeof(ce->addr));
+    ce->expire = time(NULL) + (res->result ? UDP4_CACHE_NEG_TTL_SECS
+                                           : UDP4_CACHE_TTL_SECS);
+    list_add_tail(&ce->hnode,
+                  &shim->cache_table[rl_str_hash(key) % UDP4_CACHE_BUCKETS]);
+    list_add_tail(&ce->lnode, &shim->cache_age);
+    shim->cache_entries++;
+}
+
+/* Body of the resolver thread. */
+static void *
+udp4_resolver_worker(void *opaque)
+{
+    struct shim_udp4 *shim = opaque;
+
+    for (;;) {
+        struct udp4_resolution *res;
+
+        pthread_mutex_lock(&shim->res_lock);
+        while (list_empty(&shim->res_pending) && !shim->res_stop) {
+            pthread_cond_wait(&shim->res_cond, &shim->res_lock);
+        }
+        if (shim->res_stop) {
+            pthread_mutex_unlock(&shim->res_lock);
+            break;
+        }
+        res = list_first_entry(&shim->res_pending, struct udp4_resolution,
+                               node);
+        list_del(&res->node);
+        pthread_mutex_unlock(&shim->res_lock);
+
+        if (res->type == UDP4_RES_NAME2ADDR) {
+            res->result = rina_name_to_ipaddr(shim, res->name, &res->addr);
+        } else {
+            res->result = ipaddr_to_rina_name(shim, &res->name, &res->addr);
+        }
+
+        pthread_mutex_lock(&shim->res_lock);
+        list_add_tail(&res->node, &shim->res_done);
+        pthread_mutex_unlock(&shim->res_lock);
+        eventfd_signal(shim->res_efd, 1);
+    }
+
+    return NULL;
+}
+
+static void udp4_resolution_complete(struct shim_udp4 *shim,
+                                     struct udp4_resolution *res);
+
+/* Start a name resolution. If the result is in the cache, the request is
+ * completed immediately, otherwise it is handed over to the resolver
+ * thread and completed later in the context of the uipcp loop.
+ * Takes ownership of @res. */
+static void
+udp4_resolve(struct shim_udp4 *shim, struct udp4_resolution *res)
+{
+    char strbuf[INET_ADDRSTRLEN];
+    struct udp4_cache_entry *ce = NULL;
+    const char *key;
+
+    key = udp4_cache_key(res, strbuf, sizeof(strbuf));
+    if (key) {
+        ce = udp4_cache_lookup(shim, res->type, key);
+    }
+
+    if (ce) {
+        res->result = ce->result;
+        if (res->type == UDP4_RES_NAME2ADDR) {
+            memcpy(&res->addr, &ce->addr, sizeof(res->addr));
+        } else if (ce->result == 0) {
+            res->name = rl_strdup(ce->name, RL_MT_SHIMDATA);
+            if (!res->name) {
+                res->result = -1;
+            }
+        }
+        udp4_resolution_complete(shim, res);
+        return;
+    }
+
+    pthread_mutex_lock(&shim->res_lock);
+    list_add_tail(&res->node, &shim->res_pending);
+    pthread_cond_signal(&shim->res_cond);
+    pthread_mutex_unlock(&shim->res_lock);
+}
+
+/* Called by the uipcp loop when the resolver thread completes some
+ * requests. */
+static void
+udp4_resolver_completions(struct uipcp *uipcp, int efd, void *opaque)
+{
+    struct shim_udp4 *shim = SHIM(uipcp);
+    struct udp4_resolution *res, *tmp;
+    struct list_head done;
+
+    eventfd_drain(efd);
+
+    list_init(&done);
+    pthread_mutex_lock(&shim->res_lock);
+    while (!list_empty(&shim->res_done)) {
+        list_add_tail(list_pop_front(&shim->res_done), &done);
+    }
+    pthread_mutex_unlock(&shim->res_lock);
+
+    list_for_each_entry_safe (res, tmp, &done, node) {
+        list_del(&res->node);
+        udp4_cache_insert(shim, res);
+        udp4_resolution_complete(shim, res);
+    }
+}
+
 /* Fills information needed by the kernel to send UDP packets: file
  * descriptor (to identify the UDP socket), destination IP and destination
  * UDP port. */
@@ -174,15 +479,62 @@ udp4_flow_config_fill(struct udp4_endpoint *ep, struct rl_flow_config *cfg)
     cfg->inet_port = ep->remote_addr.sin_port;
 }
 
+static unsigned int
+udp4_addr_hash(const struct sockaddr_in *addr)
+{
+    return rl_u32_hash(addr->sin_addr.s_addr ^
+                       ((uint32_t)addr->sin_port << 16));
+}
+
+/* Index an endpoint by its remote address, growing the table when the
+ * load factor exceeds one. */
+static void
+udp4_ep_table_insert(struct shim_udp4 *shim, struct udp4_endpoint *ep)
+{
+    if (shim->ep_table_entries >= shim->ep_table_buckets) {
+        unsigned int nb         = shim->ep_table_buckets << 1;
+        struct list_head *table = rl_alloc(nb * sizeof(*table), RL_MT_SHIMDATA);
+
+        if (table) {
+            struct udp4_endpoint *cur;
+            unsigned int i;
+
+            for (i = 0; i < nb; i++) {
+                list_init(&table[i]);
+            }
+            list_for_each_entry (cur, &shim->endpoints, node) {
+                if (cur->hashed) {
+                    list_del(&cur->hnode);
+                    list_add_tail(&cur->hnode,
+                                  &table[udp4_addr_hash(&cur->remote_addr) &
+                                         (nb - 1)]);
+                }
+            }
+            rl_free(shim->ep_table, RL_MT_SHIMDATA);
+            shim->ep_table         = table;
+            shim->ep_table_buckets = nb;
+        }
+    }
+
+    list_add_tail(&ep->hnode,
+                  &shim->ep_table[udp4_addr_hash(&ep->remote_addr) &
+                                  (shim->ep_table_buckets - 1)]);
+    ep->hashed = 1;
+    shim->ep_table_entries++;
+}
+
 /* Lookup the specified remote IP address and port among the existing socket
  * endpoints. */
 static struct udp4_endpoint *
 udp4_endpoint_lookup(struct shim_udp4 *shim,
                      const struct sockaddr_in *remote_addr)
 {
+    struct list_head *bucket =
+        &shim->ep_table[udp4_addr_hash(remote_addr) &
+                        (shim->ep_table_buckets - 1)];
     struct udp4_endpoint *ep;
 
-    list_for_each_entry (ep, &shim->endpoints, node) {
+    list_for_each_entry (ep, bucket, hnode) {
         if (memcmp(remote_addr, &ep->remote_addr, sizeof(*remote_addr)) == 0) {
             return ep;
         }
@@ -192,7 +544,8 @@ udp4_endpoint_lookup(struct shim_udp4 *shim,
 }
 
 /* Open an UDP socket and add it to the list of endpoints. The socket
- * is bound in order to allocate an UDP port. */
+ * is bound in order to allocate an UDP port. The endpoint is indexed
+ * by remote address only once the latter is known. */
 static struct udp4_endpoint *
 udp4_endpoint_open(struct shim_udp4 *shim)
 {
@@ -223,6 +576,11 @@ udp4_endpoint_open(struct shim_udp4 *shim)
         return NULL;
     }
     list_init(&ep->tmpq);
+    list_init(&ep->hnode);
+
+    /* Endpoints get a kevent_id also for locally initiated flows, to
+     * match them on resolution completion. */
+    ep->kevent_id = shim->kevent_id_cnt++;
 
     list_add_tail(&ep->node, &shim->endpoints);
 
@@ -230,12 +588,16 @@ udp4_endpoint_open(struct shim_udp4 *shim)
 }
 
 static void
-udp4_endpoint_close(struct udp4_endpoint *ep)
+udp4_endpoint_close(struct shim_udp4 *shim, struct udp4_endpoint *ep)
 {
     struct udp4_tmpq_packet *tpkt, *tmp;
 
     close(ep->fd);
     list_del(&ep->node);
+    if (ep->hashed) {
+        list_del(&ep->hnode);
+        shim->ep_table_entries--;
+    }
     list_for_each_entry_safe (tpkt, tmp, &ep->tmpq, node) {
         list_del(&tpkt->node);
         rl_free(tpkt, RL_MT_SHIMDATA);
@@ -243,6 +605,20 @@ udp4_endpoint_close(struct udp4_endpoint *ep)
     rl_free(ep, RL_MT_SHIMDATA);
 }
 
+static struct udp4_endpoint *
+get_endpoint_by_kevent_id(struct shim_udp4 *shim, uint32_t kevent_id)
+{
+    struct udp4_endpoint *ep;
+
+    list_for_each_entry (ep, &shim->endpoints, node) {
+        if (kevent_id == ep->kevent_id) {
+            return ep;
+        }
+    }
+
+    return NULL;
+}
+
 /* Forward the packet to the (in-kernel) socket receive queue associated
  * to ep->fd. This can be done as soon as the kernel is able to read from
  * the UDP socket, see rl_shim_udp4_flow_init().*/
@@ -287,7 +663,9 @@ udp4_fwd_sdu(struct shim_udp4 *shim, struct udp4_endpoint *ep,
 static void
 udp4_recv_dgram(struct uipcp *uipcp, int bfd, void *opaque)
 {
-    struct shim_udp4 *shim = SHIM(uipcp);
+    struct shim_udp4 *shim    = SHIM(uipcp);
+    struct udp4_bindpoint *bp = opaque;
+    struct udp4_resolution *res = NULL;
     struct sockaddr_in remote_addr;
     socklen_t addrlen = sizeof(remote_addr);
     struct udp4_tmpq_packet *tpkt;
@@ -305,58 +683,35 @@ udp4_recv_dgram(struct uipcp *uipcp, int bfd, void *opaque)
 
     ep = udp4_endpoint_lookup(shim, &remote_addr);
     if (!ep) {
-        /* First packet: this is an implicit flow allocation request. */
-        char *remote_appl, *local_appl;
-        struct sockaddr_in bpaddr;
-        struct rl_flow_config cfg;
-        int ret = 0;
-
-        addrlen = sizeof(bpaddr);
-        if (getsockname(bfd, (struct sockaddr *)&bpaddr, &addrlen)) {
-            UPE(uipcp, "getsockname() failed [%d]\n", errno);
+        /* First packet: this is an implicit flow allocation request.
+         * The local application is the one registered on this bound
+         * socket, while the remote application has to be looked up from
+         * the packet source IP address. The endpoint is created right
+         * away, so that packets arriving while the lookup is in progress
+         * are queued as well. */
+        res = udp4_resolution_alloc(shim, UDP4_RES_ADDR2NAME,
+                                    UDP4_CTX_INCOMING, NULL);
+        if (!res) {
             return;
         }
-
-        memset(&local_appl, 0, sizeof(local_appl));
-        memset(&remote_appl, 0, sizeof(remote_appl));
-        /* Lookup the local application from the packet destination IP
-         * address. */
-        if (ipaddr_to_rina_name(shim, &local_appl, &bpaddr)) {
-            goto skip;
-        }
-
-        /* Lookup the remote application from the packet source IP address. */
-        if (ipaddr_to_rina_name(shim, &remote_appl, &remote_addr)) {
-            goto skip;
+        res->local_appl = rl_strdup(bp->appl_name, RL_MT_SHIMDATA);
+        if (!res->local_appl) {
+            UPE(uipcp, "Out of memory\n");
+            udp4_resolution_free(res);
+            return;
         }
+        memcpy(&res->addr, &remote_addr, sizeof(remote_addr));
 
         /* Open an UDP socket associated to the remote address. */
         ep = udp4_endpoint_open(shim);
-        if (!ep) {
-            goto skip;
-        }
-        memcpy(&ep->remote_addr, &remote_addr, sizeof(remote_addr));
-
-        /* Generate a kevent_id, so that we can later match this flow
-         * allocation request in shim_udp4_fa_resp(). */
-        ep->kevent_id = shim->kevent_id_cnt++;
-
-        /* Push the file descriptor and source address down to kernelspace. */
-        udp4_flow_config_fill(ep, &cfg);
-        ret = uipcp_issue_fa_req_arrived(uipcp, ep->kevent_id, 0, 0, 0, 0,
-                                         local_appl, remote_appl, &cfg);
-    skip:
-        rl_free(local_appl, RL_MT_SHIMDATA);
-        rl_free(remote_appl, RL_MT_SHIMDATA);
-        if (ret) {
-            UPE(uipcp, "uipcp_fa_req_arrived() failed\n");
-            return;
-        }
-
         if (!ep) {
             UPE(uipcp, "Failed to create endpoint\n");
+            udp4_resolution_free(res);
             return;
         }
+        memcpy(&ep->remote_addr, &remote_addr, sizeof(remote_addr));
+        udp4_ep_table_insert(shim, ep);
+        res->kevent_id = ep->kevent_id;
     }
 
     /* Insert this packet in a temporary queue. Once the flow allocation
@@ -365,15 +720,48 @@ udp4_recv_dgram(struct uipcp *uipcp, int bfd, void *opaque)
     tpkt = rl_alloc(sizeof(*tpkt) + payload_len, RL_MT_SHIMDATA);
     if (tpkt == NULL) {
         UPE(uipcp, "Failed to allocate memory for tmpq packet\n");
+    } else {
+        tpkt->len = payload_len;
+        memcpy(tpkt->buf, payload, payload_len);
+        list_add_tail(&tpkt->node, &ep->tmpq);
+    }
+
+    if (res) {
+        udp4_resolve(shim, res);
+    }
+}
+
+static void
+udp4_incoming_complete(struct shim_udp4 *shim, struct udp4_resolution *res)
+{
+    struct uipcp *uipcp = shim->uipcp;
+    struct rl_flow_config cfg;
+    struct udp4_endpoint *ep;
+
+    ep = get_endpoint_by_kevent_id(shim, res->kevent_id);
+    if (!ep) {
+        return;
+    }
+
+    if (res->result) {
+        UPE(uipcp, "Failed to get the remote application name\n");
+        udp4_endpoint_close(shim, ep);
         return;
     }
-    tpkt->len = payload_len;
-    memcpy(tpkt->buf, payload, payload_len);
-    list_add_tail(&tpkt->node, &ep->tmpq);
+
+    /* Push the file descriptor and source address down to kernelspace.
+     * The kevent_id will match this flow allocation request in
+     * shim_udp4_fa_resp(). */
+    udp4_flow_config_fill(ep, &cfg);
+    if (uipcp_issue_fa_req_arrived(uipcp, ep->kevent_id, 0, 0, 0, 0,
+                                   res->local_appl, res->name, &cfg)) {
+        UPE(uipcp, "uipcp_fa_req_arrived() failed\n");
+    }
 }
 
 static struct udp4_bindpoint *
-udp4_bindpoint_open(struct shim_udp4 *shim, char *local_name)
+udp4_bindpoint_open(struct shim_udp4 *shim, const char *local_name,
+                    const struct sockaddr_in *addr)
 {
     struct uipcp *uipcp = shim->uipcp;
     struct sockaddr_in bpaddr;
@@ -382,10 +770,9 @@ udp4_bindpoint_open(struct shim_udp4 *shim, char *local_name)
     /* TODO We should update the DDNS here. For now we rely on
      *      static /etc/hosts configuration. */
 
-    /* Look-up the IP address corresponding to the application name. */
-    if (rina_name_to_ipaddr(shim, local_name, &bpaddr)) {
-        return NULL;
-    }
+    /* The IP address corresponding to the application name has already
+     * been looked up. */
+    memcpy(&bpaddr, addr, sizeof(bpaddr));
 
     bp = rl_alloc(sizeof(*bp), RL_MT_SHIMDATA);
     if (!bp) {
@@ -419,7 +806,7 @@ udp4_bindpoint_open(struct shim_udp4 *shim, char *local_name)
 
     /* The udp4_recv_dgram() callback will be invoked to receive UDP packets
      * for port 0x0d1f. */
-    if (uipcp_loop_fdh_add(uipcp, bp->fd, udp4_recv_dgram, NULL)) {
+    if (uipcp_loop_fdh_add(uipcp, bp->fd, udp4_recv_dgram, bp)) {
         UPE(uipcp, "uipcp_loop_fdh_add() failed\n");
         goto err;
     }
@@ -447,31 +834,26 @@ udp4_bindpoint_close(struct udp4_bindpoint *bp)
     rl_free(bp, RL_MT_SHIMDATA);
 }
 
-static struct udp4_endpoint *
-get_endpoint_by_kevent_id(struct shim_udp4 *shim, uint32_t kevent_id)
-{
-    struct udp4_endpoint *ep;
-
-    list_for_each_entry (ep, &shim->endpoints, node) {
-        if (kevent_id == ep->kevent_id) {
-            return ep;
-        }
-    }
-
-    return NULL;
-}
-
 static int
 shim_udp4_appl_register(struct uipcp *uipcp, const struct rl_msg_base *msg)
 {
     struct rl_kmsg_appl_register *req = (struct rl_kmsg_appl_register *)msg;
     struct shim_udp4 *shim            = SHIM(uipcp);
+    struct udp4_resolution *res;
     struct udp4_bindpoint *bp;
 
     if (req->reg) {
-        bp = udp4_bindpoint_open(shim, req->appl_name);
-        return uipcp_appl_register_resp(uipcp, bp ? RLITE_SUCC : RLITE_ERR,
-                                        req->hdr.event_id, req->appl_name);
+        /* Look-up the IP address corresponding to the application name,
+         * the response is sent on completion. */
+        res = udp4_resolution_alloc(shim, UDP4_RES_NAME2ADDR,
+                                    UDP4_CTX_REGISTER, req->appl_name);
+        if (!res) {
+            return uipcp_appl_register_resp(uipcp, RLITE_ERR,
+                                            req->hdr.event_id, req->appl_name);
+        }
+        res->event_id = req->hdr.event_id;
+        udp4_resolve(shim, res);
+        return 0;
     }
 
     list_for_each_entry (bp, &shim->bindpoints, node) {
@@ -484,12 +866,24 @@ shim_udp4_appl_register(struct uipcp *uipcp, const struct rl_msg_base *msg)
     return -1;
 }
 
+static void
+udp4_register_complete(struct shim_udp4 *shim, struct udp4_resolution *res)
+{
+    struct udp4_bindpoint *bp = NULL;
+
+    if (res->result == 0) {
+        bp = udp4_bindpoint_open(shim, res->name, &res->addr);
+    }
+    uipcp_appl_register_resp(shim->uipcp, bp ? RLITE_SUCC : RLITE_ERR,
+                             res->event_id, res->name);
+}
+
 static int
 shim_udp4_fa_req(struct uipcp *uipcp, const struct rl_msg_base *msg)
 {
     struct rl_kmsg_fa_req *req = (struct rl_kmsg_fa_req *)msg;
     struct shim_udp4 *shim     = SHIM(uipcp);
-    struct rl_flow_config cfg;
+    struct udp4_resolution *res;
     struct udp4_endpoint *ep;
 
     UPV(uipcp, "[uipcp %u] Got reflected message\n", uipcp->id);
@@ -502,23 +896,67 @@ shim_udp4_fa_req(struct uipcp *uipcp, const struct rl_msg_base *msg)
 
     ep->port_id = req->local_port;
 
-    /* Resolve the destination name into an IP address. */
-    if (rina_name_to_ipaddr(shim, req->remote_appl, &ep->remote_addr)) {
-        udp4_endpoint_close(ep);
+    /* Resolve the destination name into an IP address. The flow allocation
+     * response is issued on completion. */
+    res = udp4_resolution_alloc(shim, UDP4_RES_NAME2ADDR, UDP4_CTX_FA_REQ,
+                                req->remote_appl);
+    if (!res) {
+        udp4_endpoint_close(shim, ep);
         return -1;
     }
+    res->kevent_id = ep->kevent_id;
+    udp4_resolve(shim, res);
+
+    return 0;
+}
+
+static void
+udp4_fa_req_complete(struct shim_udp4 *shim, struct udp4_resolution *res)
+{
+    struct uipcp *uipcp = shim->uipcp;
+    struct rl_flow_config cfg;
+    struct udp4_endpoint *ep;
+
+    ep = get_endpoint_by_kevent_id(shim, res->kevent_id);
+    if (!ep) {
+        /* Flow deallocated in the meanwhile. */
+        return;
+    }
+
+    if (res->result) {
+        uipcp_issue_fa_resp_arrived(uipcp, ep->port_id, 0, 0, 0, 0, 1, NULL);
+        udp4_endpoint_close(shim, ep);
+        return;
+    }
 
     /* We don't know the remote UDP port right now, so we specify the known
      * port for flow allocation. The kernel will learn the remote port
      * when the first packet is received from the other side. */
+    memcpy(&ep->remote_addr, &res->addr, sizeof(ep->remote_addr));
     ep->remote_addr.sin_port = htons(RL_SHIM_UDP_PORT);
+    udp4_ep_table_insert(shim, ep);
 
     /* Issue a positive flow allocation response, pushing to the kernel
      * the socket file descriptor and the remote address. */
     udp4_flow_config_fill(ep, &cfg);
     uipcp_issue_fa_resp_arrived(uipcp, ep->port_id, 0, 0, 0, 0, 0, &cfg);
+}
 
-    return 0;
+static void
+udp4_resolution_complete(struct shim_udp4 *shim, struct udp4_resolution *res)
+{
+    switch (res->ctx) {
+    case UDP4_CTX_REGISTER:
+        udp4_register_complete(shim, res);
+        break;
+    case UDP4_CTX_FA_REQ:
+        udp4_fa_req_complete(shim, res);
+        break;
+    case UDP4_CTX_INCOMING:
+        udp4_incoming_complete(shim, res);
+        break;
+    }
+    udp4_resolution_free(res);
 }
 
 static int
@@ -544,7 +982,8 @@ shim_udp4_fa_resp(struct uipcp *uipcp, const struct rl_msg_base *msg)
         /* Negative response, we have to close the endpoint. */
         UPD(uipcp, "Removing endpoint [port_id=%u,kevent_id=%u,sfd=%d]\n",
             ep->port_id, ep->kevent_id, ep->fd);
-        udp4_endpoint_close(ep);
+        udp4_endpoint_close(shim, ep);
+        return 0;
     }
 
     /* Inject the UDP packets from the temporary queue into the kernel. */
@@ -572,7 +1011,7 @@ shim_udp4_flow_deallocated(struct uipcp *uipcp, const struct rl_msg_base *msg)
                 "Removing endpoint [port_id=%u,kevent_id=%u,"
                 "sfd=%d]\n",
                 ep->port_id, ep->kevent_id, ep->fd);
-            udp4_endpoint_close(ep);
+            udp4_endpoint_close(shim, ep);
             return 0;
         }
     }
@@ -586,28 +1025,73 @@ static int
 shim_udp4_init(struct uipcp *uipcp)
 {
     struct shim_udp4 *shim;
+    unsigned int i;
+    int ret;
 
     shim = rl_alloc(sizeof(*shim), RL_MT_SHIM);
     if (!shim) {
         UPE(uipcp, "Out of memory\n");
         return -1;
     }
+    memset(shim, 0, sizeof(*shim));
 
     uipcp->priv = shim;
     shim->uipcp = uipcp;
     list_init(&shim->endpoints);
     list_init(&shim->bindpoints);
     shim->kevent_id_cnt = 1;
+    shim->res_efd       = -1;
 
     shim->fwdfd = socket(AF_INET, SOCK_DGRAM, 0);
     if (shim->fwdfd < 0) {
         UPE(shim->uipcp, "socket(SOCK_RAW failed [%d]\n)", errno);
-        goto err;
+        goto err0;
+    }
+
+    shim->ep_table_buckets = UDP4_EP_MIN_BUCKETS;
+    shim->ep_table         = rl_alloc(
+        shim->ep_table_buckets * sizeof(*shim->ep_table), RL_MT_SHIMDATA);
+    if (!shim->ep_table) {
+        UPE(uipcp, "Out of memory\n");
+        goto err1;
+    }
+    for (i = 0; i < shim->ep_table_buckets; i++) {
+        list_init(&shim->ep_table[i]);
+    }
+
+    for (i = 0; i < UDP4_CACHE_BUCKETS; i++) {
+        list_init(&shim->cache_table[i]);
+    }
+    list_init(&shim->cache_age);
+
+    /* Start the resolver thread. */
+    pthread_mutex_init(&shim->res_lock, NULL);
+    pthread_cond_init(&shim->res_cond, NULL);
+    list_init(&shim->res_pending);
+    list_init(&shim->res_done);
+    shim->res_efd = eventfd(0, 0);
+    if (shim->res_efd < 0) {
+        UPE(uipcp, "eventfd() failed [%s]\n", strerror(errno));
+        goto err2;
+    }
+    ret = pthread_create(&shim->resolver_th, NULL, udp4_resolver_worker, shim);
+    if (ret) {
+        UPE(uipcp, "pthread_create() failed [%s]\n", strerror(ret));
+        goto err3;
     }
+    uipcp_loop_fdh_add(uipcp, shim->res_efd, udp4_resolver_completions, NULL);
 
     return 0;
-err:
+err3:
+    close(shim->res_efd);
+err2:
+    pthread_cond_destroy(&shim->res_cond);
+    pthread_mutex_destroy(&shim->res_lock);
+    rl_free(shim->ep_table, RL_MT_SHIMDATA);
+err1:
     close(shim->fwdfd);
+err0:
+    rl_free(shim, RL_MT_SHIM);
     return -1;
 }
 
@@ -616,13 +1100,37 @@ shim_udp4_fini(struct uipcp *uipcp)
 {
     struct shim_udp4 *shim = SHIM(uipcp);
 
+    /* Stop the resolver thread and drop pending resolutions. */
+    pthread_mutex_lock(&shim->res_lock);
+    shim->res_stop = 1;
+    pthread_cond_signal(&shim->res_cond);
+    pthread_mutex_unlock(&shim->res_lock);
+    pthread_join(shim->resolver_th, NULL);
+    uipcp_loop_fdh_del(uipcp, shim->res_efd);
+    close(shim->res_efd);
+
+    {
+        struct udp4_resolution *res, *tmp;
+
+        list_for_each_entry_safe (res, tmp, &shim->res_pending, node) {
+            list_del(&res->node);
+            udp4_resolution_free(res);
+        }
+        list_for_each_entry_safe (res, tmp, &shim->res_done, node) {
+            list_del(&res->node);
+            udp4_resolution_free(res);
+        }
+    }
+    pthread_cond_destroy(&shim->res_cond);
+    pthread_mutex_destroy(&shim->res_lock);
+
     close(shim->fwdfd);
 
     {
         struct udp4_endpoint *ep, *tmp;
 
         list_for_each_entry_safe (ep, tmp, &shim->endpoints, node) {
-            udp4_endpoint_close(ep);
+            udp4_endpoint_close(shim, ep);
         }
     }
 
@@ -634,6 +1142,15 @@ shim_udp4_fini(struct uipcp *uipcp)
         }
     }
 
+    {
+        struct udp4_cache_entry *ce, *tmp;
+
+        list_for_each_entry_safe (ce, tmp, &shim->cache_age, lnode) {
+            udp4_cache_entry_free(shim, ce);
+        }
+    }
+
+    rl_free(shim->ep_table, RL_MT_SHIMDATA);
     rl_free(shim, RL_MT_SHIM);
 
     return 0;
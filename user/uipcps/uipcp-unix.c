@@ -42,6 +42,8 @@
 #include <poll.h>
 #include <sys/ioctl.h>
 #include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include <time.h>
 #include <sys/file.h>
 
 #include "rlite/kernel-msg.h"
@@ -500,6 +502,105 @@ rl_u_memtrack_dump(struct uipcps *uipcps, int sfd,
 }
 #endif /* RL_MEMTRACK */
 
+static int
+rl_u_memtrack_stats(struct uipcps *uipcps, int sfd,
+                    const struct rl_msg_base *b_req)
+{
+    struct rl_cmsg_memtrack_stats_resp resp;
+
+    memset(&resp, 0, sizeof(resp));
+    resp.hdr.msg_type = RLITE_U_MEMTRACK_STATS_RESP;
+    resp.hdr.event_id = b_req->hdr.event_id;
+    resp.result       = RLITE_SUCC;
+#ifdef RL_MEMTRACK
+    resp.num = rl_memtrack_get_stats(resp.stats, RL_MEMTRACK_MAX_TYPES);
+#endif /* RL_MEMTRACK */
+
+    return rl_msg_write_fd(sfd, RLITE_MB(&resp));
+}
+
+/* Latency of the management requests, from the time the connection is
+ * accepted to the time the response is written. Bucket i counts the
+ * requests that took between 2^i and 2^(i+1) microseconds. */
+#define RL_REQ_LAT_BUCKETS 24
+
+static struct {
+    pthread_mutex_t lock;
+    uint64_t buckets[RL_REQ_LAT_BUCKETS];
+    uint64_t count[RLITE_U_MSG_MAX];
+    uint64_t usecs[RLITE_U_MSG_MAX];
+    uint64_t usecs_max[RLITE_U_MSG_MAX];
+    uint64_t errors;
+} req_stats = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void
+req_stats_update(unsigned int msg_type, const struct timespec *t_start)
+{
+    struct timespec now;
+    uint64_t usecs;
+    int b = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    usecs = (now.tv_sec - t_start->tv_sec) * 1000000ULL +
+            (now.tv_nsec - t_start->tv_nsec) / 1000;
+    while (b < RL_REQ_LAT_BUCKETS - 1 && (usecs >> (b + 1))) {
+        b++;
+    }
+
+    pthread_mutex_lock(&req_stats.lock);
+    req_stats.buckets[b]++;
+    if (msg_type < RLITE_U_MSG_MAX) {
+        req_stats.count[msg_type]++;
+        req_stats.usecs[msg_type] += usecs;
+        if (usecs > req_stats.usecs_max[msg_type]) {
+            req_stats.usecs_max[msg_type] = usecs;
+        }
+    } else {
+        req_stats.errors++;
+    }
+    pthread_mutex_unlock(&req_stats.lock);
+}
+
+static int
+rl_u_server_stats_dump(struct uipcps *uipcps, int sfd,
+                       const struct rl_msg_base *b_req)
+{
+    struct rl_msg_base_resp resp;
+    uint64_t total = 0;
+    int i;
+
+    pthread_mutex_lock(&req_stats.lock);
+    for (i = 0; i < RL_REQ_LAT_BUCKETS; i++) {
+        total += req_stats.buckets[i];
+    }
+    PI("Management requests: %llu served, %llu malformed\n",
+       (long long unsigned)total, (long long unsigned)req_stats.errors);
+    PI("    Latency histogram:\n");
+    for (i = 0; i < RL_REQ_LAT_BUCKETS; i++) {
+        if (req_stats.buckets[i]) {
+            PI("    %10llu us - %10llu us: %10llu\n",
+               i ? (1ULL << i) : 0ULL, (1ULL << (i + 1)) - 1,
+               (long long unsigned)req_stats.buckets[i]);
+        }
+    }
+    PI("    Per message type:\n");
+    for (i = 0; i < RLITE_U_MSG_MAX; i++) {
+        if (req_stats.count[i]) {
+            PI("    type %2d: %8llu requests, avg %8llu us, max %8llu us\n", i,
+               (long long unsigned)req_stats.count[i],
+               (long long unsigned)(req_stats.usecs[i] / req_stats.count[i]),
+               (long long unsigned)req_stats.usecs_max[i]);
+        }
+    }
+    pthread_mutex_unlock(&req_stats.lock);
+
+    resp.result = 0; /* ok */
+
+    return rl_u_response(sfd, b_req, &resp);
+}
+
 typedef int (*rl_req_handler_t)(struct uipcps *uipcps, int sfd,
                                 const struct rl_msg_base *b_req);
 
@@ -526,157 +627,348 @@ static rl_req_handler_t rl_config_handlers[] = {
 #ifdef RL_MEMTRACK
     [RLITE_U_MEMTRACK_DUMP] = rl_u_memtrack_dump,
 #endif /* RL_MEMTRACK */
-    [RLITE_U_MSG_MAX] = NULL,
+    [RLITE_U_SERVER_STATS_DUMP]  = rl_u_server_stats_dump,
+    [RLITE_U_MEMTRACK_STATS_REQ] = rl_u_memtrack_stats,
+    [RLITE_U_MSG_MAX]            = NULL,
 };
 
-struct worker_info {
-    pthread_t th;
-    struct uipcps *uipcps;
+/* A connection from a management client. The request is read and parsed
+ * by the server loop, and then handed over to a worker thread, which
+ * handles it, writes the response and closes the connection. */
+struct mgmt_conn {
     int cfd;
+    struct timespec t_accept;
+    unsigned int len;
+    char serbuf[4096];
+    char msgbuf[4096];
     struct list_head node;
 };
 
+/* Queue of parsed requests waiting for a worker. */
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct list_head reqs;
+} req_queue = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+/* Number of worker threads. Requests that block until a network operation
+ * completes (enrollment and lower flow allocation) are not served by the
+ * workers, but by a dedicated thread each (see mgmt_req_blocking()), so
+ * that they cannot starve the other requests. */
+#define RL_SERVER_WORKERS 8
+
+static void
+mgmt_conn_close(struct mgmt_conn *conn)
+{
+    close(conn->cfd);
+    rl_free(conn, RL_MT_MISC);
+}
+
+/* Handle a parsed request, write the response and close the connection. */
+static void
+mgmt_conn_serve(struct uipcps *uipcps, struct mgmt_conn *conn)
+{
+    struct rl_msg_base *req = RLITE_MB(conn->msgbuf);
+    int ret;
+
+    /* Valid message type: handle the request. */
+    ret = rl_config_handlers[req->hdr.msg_type](uipcps, conn->cfd, req);
+    if (ret) {
+        struct rl_msg_base_resp resp;
+
+        PE("Error while handling message type [%d]\n", req->hdr.msg_type);
+        resp.hdr.msg_type = RLITE_U_BASE_RESP;
+        resp.hdr.event_id = req->hdr.event_id;
+        resp.result       = RLITE_ERR;
+        rl_msg_write_fd(conn->cfd, RLITE_MB(&resp));
+    }
+    req_stats_update(req->hdr.msg_type, &conn->t_accept);
+    rl_msg_free(rl_uipcps_numtables, RLITE_U_MSG_MAX, req);
+    mgmt_conn_close(conn);
+
+    if (uipcps->terminate) {
+        PD("terminate command received, daemon is going to exit ...\n");
+        unlink_and_exit(EXIT_SUCCESS);
+    }
+}
+
 static void *
 worker_fn(void *opaque)
 {
-    struct worker_info *wi  = opaque;
-    struct rl_msg_base *req = NULL;
-    char serbuf[4096];
-    char msgbuf[4096];
-    int ret;
+    struct uipcps *uipcps = opaque;
 
-    PV("Worker %p started\n", wi);
+    for (;;) {
+        struct mgmt_conn *conn;
 
-    /* Read the request message in serialized form. */
-    ret = read(wi->cfd, serbuf, sizeof(serbuf));
-    if (ret < 0) {
-        PE("read() error [%d]\n", ret);
-        goto out;
+        pthread_mutex_lock(&req_queue.lock);
+        while (list_empty(&req_queue.reqs)) {
+            pthread_cond_wait(&req_queue.cond, &req_queue.lock);
+        }
+        conn = list_first_entry(&req_queue.reqs, struct mgmt_conn, node);
+        list_del(&conn->node);
+        pthread_mutex_unlock(&req_queue.lock);
+
+        mgmt_conn_serve(uipcps, conn);
+    }
+
+    return NULL;
+}
+
+struct mgmt_blocking_req {
+    struct uipcps *uipcps;
+    struct mgmt_conn *conn;
+};
+
+static void *
+blocking_req_fn(void *opaque)
+{
+    struct mgmt_blocking_req *breq = opaque;
+
+    mgmt_conn_serve(breq->uipcps, breq->conn);
+    rl_free(breq, RL_MT_MISC);
+
+    return NULL;
+}
+
+/* Returns nonzero for the requests whose handler may block for a long
+ * time, waiting for other IPCPs. */
+static int
+mgmt_req_blocking(const struct rl_msg_base *req)
+{
+    return req->hdr.msg_type == RLITE_U_IPCP_ENROLL ||
+           req->hdr.msg_type == RLITE_U_IPCP_LOWER_FLOW_ALLOC;
+}
+
+/* Hand a parsed request over to a worker, or to a dedicated thread if
+ * the request may block. */
+static void
+mgmt_conn_dispatch(struct uipcps *uipcps, struct mgmt_conn *conn)
+{
+    if (mgmt_req_blocking(RLITE_MB(conn->msgbuf))) {
+        struct mgmt_blocking_req *breq;
+        pthread_attr_t attr;
+        pthread_t th;
+        int ret = -1;
+
+        breq = rl_alloc(sizeof(*breq), RL_MT_MISC);
+        if (breq && pthread_attr_init(&attr) == 0) {
+            breq->uipcps = uipcps;
+            breq->conn   = conn;
+            pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+            ret = pthread_create(&th, &attr, blocking_req_fn, breq);
+            pthread_attr_destroy(&attr);
+        }
+        if (ret == 0) {
+            return;
+        }
+        /* Fall back on the workers. */
+        PW("Cannot start a thread for a blocking request\n");
+        if (breq) {
+            rl_free(breq, RL_MT_MISC);
+        }
+    }
+
+    pthread_mutex_lock(&req_queue.lock);
+    list_add_tail(&conn->node, &req_queue.reqs);
+    pthread_cond_signal(&req_queue.cond);
+    pthread_mutex_unlock(&req_queue.lock);
+}
+
+/* Read (part of) the request from a client. Returns 1 if more data is
+ * needed, 0 if the request was parsed and queued, -1 on error (in which
+ * case the connection must be closed). */
+static int
+mgmt_conn_input(struct uipcps *uipcps, struct mgmt_conn *conn)
+{
+    struct rl_msg_base *req;
+    int serlen;
+    int n;
+
+    n = read(conn->cfd, conn->serbuf + conn->len,
+             sizeof(conn->serbuf) - conn->len);
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EINTR) {
+            return 1;
+        }
+        PE("read() error [%s]\n", strerror(errno));
+        return -1;
+    }
+    if (n == 0) {
+        PV("Client closed the connection before sending a request\n");
+        return -1;
+    }
+    conn->len += n;
+
+    /* Wait until the whole message has been received, including the
+     * variable-length fields. */
+    serlen = rl_msg_serbuf_len(rl_uipcps_numtables, RLITE_U_MSG_MAX,
+                               conn->serbuf, conn->len);
+    if (serlen < 0) {
+        return -1;
+    }
+    if (serlen > (int)sizeof(conn->serbuf)) {
+        PE("Request too long\n");
+        return -1;
+    }
+    if (serlen == 0 || conn->len < (unsigned int)serlen) {
+        return 1;
     }
 
     /* Deserialize into a formatted message. */
-    ret = deserialize_rlite_msg(rl_uipcps_numtables, RLITE_U_MSG_MAX, serbuf,
-                                ret, msgbuf, sizeof(msgbuf));
-    if (ret) {
+    if (deserialize_rlite_msg(rl_uipcps_numtables, RLITE_U_MSG_MAX,
+                              conn->serbuf, conn->len, conn->msgbuf,
+                              sizeof(conn->msgbuf))) {
         errno = EPROTO;
         PE("deserialization error [%s]\n", strerror(errno));
-        goto out;
+        return -1;
     }
 
     /* Lookup the message type. */
-    req = RLITE_MB(msgbuf);
+    req = RLITE_MB(conn->msgbuf);
     if (rl_config_handlers[req->hdr.msg_type] == NULL) {
         PE("No handler for message of type [%d]\n", req->hdr.msg_type);
-        ret = -1;
-        goto out;
-    }
-
-    /* Valid message type: handle the request. */
-    ret = rl_config_handlers[req->hdr.msg_type](wi->uipcps, wi->cfd, req);
-    if (ret) {
-        PE("Error while handling message type [%d]\n", req->hdr.msg_type);
-    }
-out:
-    if (ret) {
-        struct rl_msg_base_resp resp;
-
-        resp.hdr.msg_type = RLITE_U_BASE_RESP;
-        resp.hdr.event_id = req ? req->hdr.event_id : 0;
-        resp.result       = RLITE_ERR;
-        rl_msg_write_fd(wi->cfd, RLITE_MB(&resp));
+        rl_msg_free(rl_uipcps_numtables, RLITE_U_MSG_MAX, req);
+        return -1;
     }
 
-    if (req) {
+    /* Workers write the response with blocking writes. */
+    if (fcntl(conn->cfd, F_SETFL, 0)) {
+        PE("fcntl(F_SETFL) failed [%s]\n", strerror(errno));
         rl_msg_free(rl_uipcps_numtables, RLITE_U_MSG_MAX, req);
+        return -1;
     }
 
-    /* Close the connection. */
-    close(wi->cfd);
+    mgmt_conn_dispatch(uipcps, conn);
 
-    PV("Worker %p stopped\n", wi);
+    return 0;
+}
 
-    if (wi->uipcps->terminate) {
-        PD("terminate command received, daemon is going to exit ...\n");
-        unlink_and_exit(EXIT_SUCCESS);
-    }
+/* Reply with an error to a request that could not be parsed. */
+static void
+mgmt_conn_reject(struct mgmt_conn *conn)
+{
+    struct rl_msg_base_resp resp;
 
-    return NULL;
+    resp.hdr.msg_type = RLITE_U_BASE_RESP;
+    resp.hdr.event_id = 0;
+    resp.result       = RLITE_ERR;
+    if (fcntl(conn->cfd, F_SETFL, 0) == 0) {
+        rl_msg_write_fd(conn->cfd, RLITE_MB(&resp));
+    }
+    req_stats_update(RLITE_U_MSG_MAX, &conn->t_accept);
+    mgmt_conn_close(conn);
 }
 
-/* Unix server thread to manage configuration requests. */
+/* Unix server loop to manage configuration requests. A single thread
+ * accepts the connections and reads the requests without blocking, so that
+ * many clients can be served concurrently; requests are then handled by a
+ * fixed pool of workers. */
 static int
 socket_server(struct uipcps *uipcps)
 {
-    struct list_head threads;
-    int threads_cnt = 0;
-#define RL_MAX_THREADS 16
+#define RL_MAX_EVENTS 64
+    struct epoll_event events[RL_MAX_EVENTS];
+    struct epoll_event ev;
+    pthread_t workers[RL_SERVER_WORKERS];
+    int efd;
+    int ret;
+    int i;
 
-    list_init(&threads);
+    list_init(&req_queue.reqs);
 
-    for (;;) {
-        struct sockaddr_un client_address;
-        socklen_t client_address_len = sizeof(client_address);
-        struct worker_info *wi, *tmp;
-        int ret;
-
-        for (;;) {
-            /* Try to clean up previously terminated worker threads. */
-            if (!list_empty(&threads)) {
-                list_for_each_entry_safe (wi, tmp, &threads, node) {
-                    ret = pthread_tryjoin_np(wi->th, NULL);
-                    if (ret == EBUSY) {
-                        /* Skip this since it has not finished yet. */
-                        continue;
-                    } else if (ret) {
-                        PE("pthread_tryjoin_np() failed: %d\n", ret);
-                    }
+    for (i = 0; i < RL_SERVER_WORKERS; i++) {
+        ret = pthread_create(&workers[i], NULL, worker_fn, uipcps);
+        if (ret) {
+            PE("pthread_create() failed [%s]\n", strerror(ret));
+            exit(EXIT_FAILURE);
+        }
+    }
 
-                    PV("Worker %p cleaned-up\n", wi);
-                    list_del(&wi->node);
-                    rl_free(wi, RL_MT_MISC);
-                    threads_cnt--;
-                }
-            }
+    efd = epoll_create1(EPOLL_CLOEXEC);
+    if (efd < 0) {
+        PE("epoll_create1() failed [%s]\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
 
-            if (threads_cnt < RL_MAX_THREADS) {
-                /* We have not reached the maximum, let's go ahead. */
-                break;
-            }
+    if (fcntl(uipcps->lfd, F_SETFL, O_NONBLOCK)) {
+        PE("fcntl(lfd, F_SETFL, O_NONBLOCK) failed [%s]\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
 
-            /* Too many threads, let's wait a bit and try again to free up
-             * resources. */
-            PD("Too many active threads, wait to free up some\n");
-            usleep(50000);
+    ev.events   = EPOLLIN;
+    ev.data.ptr = NULL; /* the listening socket */
+    if (epoll_ctl(efd, EPOLL_CTL_ADD, uipcps->lfd, &ev)) {
+        PE("epoll_ctl() failed [%s]\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    for (;;) {
+        int n = epoll_wait(efd, events, RL_MAX_EVENTS, -1);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            PE("epoll_wait() failed [%s]\n", strerror(errno));
+            exit(EXIT_FAILURE);
         }
 
-        wi         = rl_alloc(sizeof(*wi), RL_MT_MISC);
-        wi->uipcps = uipcps;
+        for (i = 0; i < n; i++) {
+            struct mgmt_conn *conn = events[i].data.ptr;
 
-        /* Accept a new client and create a thread to serve it. */
-        wi->cfd = accept(uipcps->lfd, (struct sockaddr *)&client_address,
-                         &client_address_len);
+            if (conn) {
+                /* Request data from a client. */
+                ret = mgmt_conn_input(uipcps, conn);
+                if (ret <= 0) {
+                    epoll_ctl(efd, EPOLL_CTL_DEL, conn->cfd, NULL);
+                }
+                if (ret < 0) {
+                    mgmt_conn_reject(conn);
+                }
+                continue;
+            }
 
-        ret = pthread_create(&wi->th, NULL, worker_fn, wi);
-        if (ret) {
-            PE("pthread_create() failed [%s]\n", strerror(ret));
-            if (ret != EAGAIN) {
-                /* Unrecoverable error. */
-                exit(EXIT_FAILURE);
+            /* Accept all the pending clients. */
+            for (;;) {
+                int cfd = accept4(uipcps->lfd, NULL, NULL,
+                                  SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+                if (cfd < 0) {
+                    if (errno != EAGAIN && errno != EINTR) {
+                        PE("accept() failed [%s]\n", strerror(errno));
+                        if (errno == EMFILE || errno == ENFILE) {
+                            /* Give some time to the workers. */
+                            usleep(50000);
+                        }
+                    }
+                    break;
+                }
+
+                conn = rl_alloc(sizeof(*conn), RL_MT_MISC);
+                if (!conn) {
+                    PE("Out of memory\n");
+                    close(cfd);
+                    break;
+                }
+                conn->cfd = cfd;
+                conn->len = 0;
+                clock_gettime(CLOCK_MONOTONIC, &conn->t_accept);
+
+                ev.events   = EPOLLIN;
+                ev.data.ptr = conn;
+                if (epoll_ctl(efd, EPOLL_CTL_ADD, cfd, &ev)) {
+                    PE("epoll_ctl() failed [%s]\n", strerror(errno));
+                    mgmt_conn_close(conn);
+                }
             }
-            /* Temporary failure due to lack of system resources. Wait a bit
-             * and retry. */
-            close(wi->cfd);
-            rl_free(wi, RL_MT_MISC);
-            sleep(3);
-            continue;
         }
-
-        list_add_tail(&wi->node, &threads);
-        threads_cnt++;
     }
 
     return 0;
-#undef RL_MAX_THREADS
+#undef RL_MAX_EVENTS
 }
 
 int